@@ -3,6 +3,30 @@
 #include <stdint.h>
 #include <float.h>
 #include <math.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+// gcc 12's _mm512_undefined_* initialize a variable from itself and trip -Wuninitialized
+// wherever the packet kernels inline them
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 typedef int32_t s32;
 typedef int64_t s64;
@@ -17,8 +41,20 @@ typedef uint8_t u8;
 typedef float r32;
 typedef double r64;
 
-const r64 INF_NEG = -DBL_MAX;
-const r64 INF_POS = DBL_MAX;
+// scalar of the geometry and shading pipeline. the math types and the per ray kernels
+// are templates on it, the scene, the bvh and the renderer use real. build with
+// -DRT_FLOAT for single precision, which halves the geometry's memory traffic and
+// doubles the simd width
+#if defined(RT_FLOAT)
+typedef r32 real;
+const real REAL_MAX = FLT_MAX;
+#else
+typedef r64 real;
+const real REAL_MAX = DBL_MAX;
+#endif
+
+const real INF_NEG = -REAL_MAX;
+const real INF_POS = REAL_MAX;
 
 const r64 PI = 3.1415926535897932385;
 
@@ -31,6 +67,22 @@ inline r64 radians_to_degree(r64 radians) {
     return radians * 180.0 / PI;
 }
 
+inline r64 get_time_seconds(){
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// integer finalizer with full avalanche, for samplers and procedural geometry
+inline u32 hash_u32(u32 x){
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
 template<typename T> 
 inline T clamp(const T & min, const T & max, const T & value){
     if (value > max) return max;
@@ -38,6 +90,17 @@ inline T clamp(const T & min, const T & max, const T & value){
     return value;
 }
 
+// fmin/fmax are library calls unless nans are ruled out, these compile to minsd/maxsd
+template<typename T>
+inline T minimum(const T & a, const T & b){
+    return a < b ? a : b;
+}
+
+template<typename T>
+inline T maximum(const T & a, const T & b){
+    return a > b ? a : b;
+}
+
 template<typename T>
 inline bool inrange(const T & min, const T & max, const T & value){
     return (value > min && value < max);
@@ -49,35 +112,44 @@ T abs(T x) {
     return x;
 }
 
+// scalar arguments of the vector operators take their type from the vector, so a double
+// literal can scale a float vector
+template<typename T>
+struct non_deduced {
+    typedef T type;
+};
 
-struct vec3 {
+template<typename T>
+struct basic_vec3_t {
     union {
-        struct {r64 x, y, z;};
-        struct {r64 r, g, b;};
-        r64 data[3];
+        struct {T x, y, z;};
+        struct {T r, g, b;};
+        T data[3];
     };
-    vec3() = default;
-    vec3(r64 v1, r64 v2, r64 v3);
+    basic_vec3_t() = default;
+    basic_vec3_t(T v1, T v2, T v3);
 };
 
-bool near_zero(vec3 a) {
-    const r64 epsilon = 10e-5;
+template<typename T>
+bool near_zero(basic_vec3_t<T> a) {
+    const T epsilon = 10e-5;
     return (abs(a.x) < epsilon && abs(a.y) < epsilon && abs(a.z) < epsilon);
 }
-vec3 operator - (const vec3 & a);
-vec3 operator - (const vec3 & a, const vec3 & b);
-vec3 operator + (const vec3 & a, const vec3 & b);
-vec3 operator * (const vec3  & a, r64 scale);
-vec3 operator * (const vec3  & a, const vec3 & b);
-vec3 operator * (const r64 & scale, vec3 a);
-vec3 operator / (const vec3  & a, r64 scale);
-
-vec3 cross(const vec3 & a, const vec3 & b);
-r64  lengthsq(const vec3 & v);
-r64  length(const vec3 & v);
-vec3 normalize(const vec3 & val);
-r64  dot(const vec3 & a, const vec3 & b);
-
+template<typename T> basic_vec3_t<T> operator - (const basic_vec3_t<T> & a);
+template<typename T> basic_vec3_t<T> operator - (const basic_vec3_t<T> & a, const basic_vec3_t<T> & b);
+template<typename T> basic_vec3_t<T> operator + (const basic_vec3_t<T> & a, const basic_vec3_t<T> & b);
+template<typename T> basic_vec3_t<T> operator * (const basic_vec3_t<T>  & a, typename non_deduced<T>::type scale);
+template<typename T> basic_vec3_t<T> operator * (const basic_vec3_t<T>  & a, const basic_vec3_t<T> & b);
+template<typename T> basic_vec3_t<T> operator * (const typename non_deduced<T>::type & scale, basic_vec3_t<T> a);
+template<typename T> basic_vec3_t<T> operator / (const basic_vec3_t<T>  & a, typename non_deduced<T>::type scale);
+
+template<typename T> basic_vec3_t<T> cross(const basic_vec3_t<T> & a, const basic_vec3_t<T> & b);
+template<typename T> T lengthsq(const basic_vec3_t<T> & v);
+template<typename T> T length(const basic_vec3_t<T> & v);
+template<typename T> basic_vec3_t<T> normalize(const basic_vec3_t<T> & val);
+template<typename T> T dot(const basic_vec3_t<T> & a, const basic_vec3_t<T> & b);
+
+typedef basic_vec3_t<real> vec3;
 typedef vec3 color3; // for storing color information
 typedef vec3 point3; // for distinction between a direction and a point in space;
 
@@ -90,18 +162,20 @@ color3 get_color_from_hex(u32 hexcolor){
     return result;
 }
 
-struct interval_t  {
-    r64 min, max;
-    interval_t () = default;
-    interval_t (r64 min, r64 max) : min(min), max(max) {}
+template<typename T>
+struct basic_interval_t  {
+    T min, max;
+    basic_interval_t () = default;
+    basic_interval_t (T min, T max) : min(min), max(max) {}
 };
+typedef basic_interval_t<real> interval_t;
 const static interval_t universe(INF_NEG, INF_POS);
 const static interval_t empty(INF_POS, INF_NEG);
 
-inline r64 size(interval_t inv);
-inline bool contains(interval_t inv, r64 value);
-inline bool surrounds(interval_t inv, r64 value);
-inline r64 clamp(interval_t inv, r64 x);
+template<typename T> inline T size(basic_interval_t<T> inv);
+template<typename T> inline bool contains(basic_interval_t<T> inv, T value);
+template<typename T> inline bool surrounds(basic_interval_t<T> inv, T value);
+template<typename T> inline T clamp(basic_interval_t<T> inv, T x);
 
 struct pixel_t {
     u8 r, g, b;
@@ -116,14 +190,14 @@ pixel_t color_to_pixel(const color3 & color, bool gamma = false){
     gamma_color.b = color.b > 0.0 ? sqrt(color.b) : color.b;
 
     if (gamma){
-        result.r = clamp(0.0, 1.0, gamma_color.r) * 255;
-        result.g = clamp(0.0, 1.0, gamma_color.g) * 255;
-        result.b = clamp(0.0, 1.0, gamma_color.b) * 255;
+        result.r = clamp<real>(0.0, 1.0, gamma_color.r) * 255;
+        result.g = clamp<real>(0.0, 1.0, gamma_color.g) * 255;
+        result.b = clamp<real>(0.0, 1.0, gamma_color.b) * 255;
     }
     else {
-        result.r = clamp(-1.0, 1.0, color.r) * 255;
-        result.g = clamp(-1.0, 1.0, color.g) * 255;
-        result.b = clamp(-1.0, 1.0, color.b) * 255;
+        result.r = clamp<real>(-1.0, 1.0, color.r) * 255;
+        result.g = clamp<real>(-1.0, 1.0, color.g) * 255;
+        result.b = clamp<real>(-1.0, 1.0, color.b) * 255;
     }
 
     return result;
@@ -132,16 +206,20 @@ pixel_t color_to_pixel(const color3 & color, bool gamma = false){
 struct image_t {
     s32 width, height;
     pixel_t * pixels;
+    r32 * hdr;  // optional linear rgb, 3 floats per pixel
 };
 
-struct ray_t {
-    point3 point;
-    vec3 dir;
-    ray_t() = default;
-    ray_t(point3 point, vec3 dir): point(point), dir(dir) {}
+template<typename T>
+struct basic_ray_t {
+    basic_vec3_t<T> point;
+    basic_vec3_t<T> dir;
+    basic_ray_t() = default;
+    basic_ray_t(basic_vec3_t<T> point, basic_vec3_t<T> dir): point(point), dir(dir) {}
 };
+typedef basic_ray_t<real> ray_t;
 
-point3 at(const  ray_t & ray, r64 delta) {
+template<typename T>
+basic_vec3_t<T> at(const basic_ray_t<T> & ray, T delta) {
     return (ray.point + (ray.dir * delta));
 }
 
@@ -149,6 +227,8 @@ enum material_type {
     Lambertian,
     Metallic,
     Dielectric,
+    Emissive,
+    MaterialTypeCount,
 };
 
 struct lambertian_t {
@@ -157,12 +237,17 @@ struct lambertian_t {
 
 struct metallic_t {
     color3 albedo;
-    r64 fuzziness;
+    real fuzziness;
 };
 
 struct dielectric_t {
     color3 albedo;
-    r64 refractive;
+    real refractive;
+};
+
+// a light: emits from its front face and ends the path, nothing is scattered
+struct emissive_t {
+    color3 radiance;
 };
 
 struct material_t {
@@ -171,9 +256,89 @@ struct material_t {
         lambertian_t lambertian;
         metallic_t metallic;
         dielectric_t dielectric;
+        emissive_t emissive;
     };
 };
 
+// @note: material table
+// spheres and hits refer to materials by a 32 bit index into one shared table. equal
+// materials share an entry, so the demo scene keeps a single glass material however
+// many glass spheres it has
+
+struct material_table_t {
+    material_t * materials;
+    s32 count;
+    s32 capacity;
+    s32 * buckets;       // open addressing over material indices, -1 is empty
+    s32 bucket_count;    // power of two, at least twice count
+};
+
+// a copy with the bytes the type does not use zeroed, so equal materials are equal bytes
+inline material_t canonical_material(const material_t & mat){
+    material_t result;
+    memset(&result, 0, sizeof(result));
+    result.type = mat.type;
+    switch(mat.type){
+        case Lambertian: result.lambertian = mat.lambertian; break;
+        case Metallic: result.metallic = mat.metallic; break;
+        case Dielectric: result.dielectric = mat.dielectric; break;
+        case Emissive: result.emissive = mat.emissive; break;
+        default: break;
+    }
+    return result;
+}
+
+// fnv-1a over the canonical bytes
+inline u32 material_hash(const material_t & mat){
+    const u8 * bytes = (const u8 *) &mat;
+    u32 hash = 2166136261u;
+    for(u64 i = 0 ; i < sizeof(material_t) ; i++) hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+void material_table_rehash(material_table_t * table, s32 bucket_count){
+    free(table->buckets);
+    table->buckets = (s32 *) malloc(sizeof(s32) * bucket_count);
+    table->bucket_count = bucket_count;
+    for(s32 b = 0 ; b < bucket_count ; b++) table->buckets[b] = -1;
+
+    u32 mask = bucket_count - 1;
+    for(s32 i = 0 ; i < table->count ; i++){
+        u32 b = material_hash(table->materials[i]) & mask;
+        while (table->buckets[b] >= 0) b = (b + 1) & mask;
+        table->buckets[b] = i;
+    }
+}
+
+// index of mat in the table, added when no equal material is there yet
+u32 material_table_add(material_table_t * table, const material_t & mat){
+    if (2 * (table->count + 1) > table->bucket_count) {
+        material_table_rehash(table, table->bucket_count > 0 ? table->bucket_count * 2 : 64);
+    }
+
+    material_t key = canonical_material(mat);
+    u32 mask = table->bucket_count - 1;
+    u32 b = material_hash(key) & mask;
+    for(; table->buckets[b] >= 0 ; b = (b + 1) & mask){
+        s32 index = table->buckets[b];
+        if (memcmp(&table->materials[index], &key, sizeof(material_t)) == 0) return index;
+    }
+
+    if (table->count == table->capacity) {
+        table->capacity = table->capacity > 0 ? table->capacity * 2 : 32;
+        table->materials = (material_t *) realloc(table->materials, sizeof(material_t) * table->capacity);
+    }
+    table->materials[table->count] = key;
+    table->buckets[b] = table->count;
+    return table->count++;
+}
+
+void destroy_material_table(material_table_t * table){
+    free(table->materials);
+    free(table->buckets);
+    *table = {};
+}
+
 enum entity_type {
     Sphere,
     Cube,
@@ -181,8 +346,8 @@ enum entity_type {
 
 struct sphere_t {
     vec3 center;
-    material_t mat;
-    r64 radius;
+    real radius;
+    u32 material;    // index into the material table
 };
 
 
@@ -193,578 +358,9000 @@ struct entity_t {
     };
 };
 
-struct hit_t {
-    point3 point;
-    vec3   normal;
-    r64    delta;
-
-    material_t mat;
-
-    bool front_face;
+template<typename T>
+struct basic_hit_t {
+    basic_vec3_t<T> point;
+    basic_vec3_t<T> normal;
+    T               delta;
+    u32             material;
+    s32             slot;          // sphere slot in the scene arrays, set by scene queries
+    bool            front_face;
 };
+typedef basic_hit_t<real> hit_t;
 
-inline hit_t create_hit_info_for_sphere(const ray_t & r, const r64 & t, const sphere_t & sphere){
-    hit_t hit = {};
+template<typename T>
+inline basic_hit_t<T> create_hit_info_for_sphere(const basic_ray_t<T> & r, const T & t, const basic_vec3_t<T> & center, T radius, u32 material){
+    basic_hit_t<T> hit = {};
 
     // normal point out of the surface of the shape
-    const vec3 outward_normal = (at(r, t) - sphere.center) / sphere.radius;
+    const basic_vec3_t<T> outward_normal = (at(r, t) - center) / radius;
 
     hit.delta = t;
     hit.point = at(r, t);
     hit.front_face = dot(r.dir, outward_normal) <= 0.0;
     hit.normal = hit.front_face ? outward_normal : -outward_normal;
-    hit.mat = sphere.mat;
+    hit.material = material;
     // we are storing normal opposite to the ray direction : just a design choice
     
     return hit;
 }
 
+inline hit_t create_hit_info_for_sphere(const ray_t & r, const real & t, const sphere_t & sphere){
+    return create_hit_info_for_sphere(r, t, sphere.center, sphere.radius, sphere.material);
+}
+
 
-bool sphere_hit(const ray_t & r, r64 tmin, r64 tmax, const sphere_t &sphere, hit_t * hit){
+template<typename T>
+bool sphere_hit(const basic_ray_t<T> & r, T tmin, T tmax, const basic_vec3_t<T> & center, T radius, u32 material, basic_hit_t<T> * hit){
 
-    vec3 oc = sphere.center - r.point;
+    basic_vec3_t<T> oc = center - r.point;
 
     auto a = dot(r.dir, r.dir);
     auto h = dot(r.dir, oc);
-    auto c = dot(oc, oc) - sphere.radius* sphere.radius;
+    auto c = dot(oc, oc) - radius * radius;
 
     auto discriminant = h*h - a*c;
 
     if (discriminant < 0) return false;
 
-    r64 dsqrt = sqrt(discriminant);
+    T dsqrt = sqrt(discriminant);
 
 
-    r64 t1 = (h + dsqrt) / a;
-    r64 t2 = (h - dsqrt) / a;
+    T t2 = (h - dsqrt) / a;
 
     if (inrange(tmin, tmax, t2)) {
-        *hit = create_hit_info_for_sphere(r, t2, sphere);
+        *hit = create_hit_info_for_sphere(r, t2, center, radius, material);
         return true;
     } 
 
     return false;
 }
 
-inline r32 random_double(){
-    return double(rand()) / double(RAND_MAX + 1.0);
+bool sphere_hit(const ray_t & r, real tmin, real tmax, const sphere_t &sphere, hit_t * hit){
+    return sphere_hit(r, tmin, tmax, sphere.center, sphere.radius, sphere.material, hit);
 }
 
-inline r32 random_double(r64 min, r64 max){
-    return min + (max - min) * random_double();
-}
+// @note: structure of arrays sphere storage
+// the intersection loop only needs the center and the radius, so they live in separate
+// 64 byte aligned arrays and the materials are kept in a table next to them. the arrays
+// are padded to a multiple of the widest simd batch with nan radii, which never hit
+
+// a 64 byte vector of floats, the widest batch the kernels take
+const s32 SPHERE_SOA_PADDING = 16;
+const s32 SPHERE_SOA_ALIGN = 64;
+
+struct sphere_soa_t {
+    real * center_x;
+    real * center_y;
+    real * center_z;
+    real * radius;
+    s32 count;
+    s32 capacity;
+};
 
-inline point3 random_in_unit_disk(){
-    while(1){
-        point3 p = point3(random_double(-1, 1), random_double(-1, 1), 0);
-        if (lengthsq(p) <= 1){
-            return p;
-        }
-    }
+void * aligned_malloc(u64 size){
+    size = (size + SPHERE_SOA_ALIGN - 1) / SPHERE_SOA_ALIGN * SPHERE_SOA_ALIGN;
+    return aligned_alloc(SPHERE_SOA_ALIGN, size > 0 ? size : SPHERE_SOA_ALIGN);
 }
 
+void create_sphere_soa(sphere_soa_t * soa, s32 count){
+    soa->count = count;
+    soa->capacity = (count + SPHERE_SOA_PADDING - 1) / SPHERE_SOA_PADDING * SPHERE_SOA_PADDING;
 
-inline vec3 random_unit_vector() {
-    while (true) {
-        vec3 p = vec3(
-                r64(rand() % 2000) / 1000.0, 
-                r64(rand() % 2000) / 1000.0, 
-                r64(rand() % 2000) / 1000.0) - vec3(1.0, 1.0, 1.0);
-        r64 lsq = lengthsq(p);
-        if (lsq > 10e-60 && lsq <= 1){
-            return p / sqrt(lsq);
-        }
+    u64 size = sizeof(real) * soa->capacity;
+    soa->center_x = (real *) aligned_malloc(size);
+    soa->center_y = (real *) aligned_malloc(size);
+    soa->center_z = (real *) aligned_malloc(size);
+    soa->radius = (real *) aligned_malloc(size);
+
+    for(s32 i = count ; i < soa->capacity ; i++){
+        soa->center_x[i] = soa->center_y[i] = soa->center_z[i] = 0.0;
+        soa->radius[i] = NAN;
     }
 }
 
-inline vec3 random_unit_in_hemisphere(const vec3 & normal) {
-        vec3 result = {};
-        while(true){
-            result= random_unit_vector();
-            r64 dotc = dot(result, normal);
-            if (dotc == 0) continue;
-            if (dotc < 0.0) {
-                result= -result;
-            }
-            break;
-        }
-        return result;
+void destroy_sphere_soa(sphere_soa_t * soa){
+    free(soa->center_x);
+    free(soa->center_y);
+    free(soa->center_z);
+    free(soa->radius);
+    *soa = {};
 }
 
-inline vec3 reflect(const vec3 & inc, const vec3 & normal){
-    vec3 result = inc - 2 * dot(inc, normal) * normal;
-    return result;
+// @note: render statistics
+// per thread counters bumped on the hot paths through STAT(), merged by render_image when
+// the workers finish. building with -DRT_NO_STATS compiles every STAT() away
+
+#ifndef RT_NO_STATS
+#define STAT(expression) (expression)
+#else
+#define STAT(expression) ((void)0)
+#endif
+
+#define STATS_MAX_DEPTH 64
+
+struct render_stats_t {
+    u64 primary_rays;
+    u64 secondary_rays;
+    u64 sphere_tests;                    // ray-sphere tests, packet tests count every lane
+    u64 triangle_tests;                  // ray-triangle tests
+    u64 shadow_rays;                     // next event estimation
+    u64 shaded[MaterialTypeCount];       // hits by material_type
+    u64 ended_sky;
+    u64 ended_light;                     // hit an emissive surface
+    u64 ended_roulette;
+    u64 ended_depth;                     // ran into max_bounce
+    u64 depth_histogram[STATS_MAX_DEPTH]; // scattering events per finished path, last bin is open ended
+};
+
+thread_local render_stats_t thread_stats = {};
+
+inline void stats_path_ended(u64 * reason, s32 depth){
+    (*reason)++;
+    thread_stats.depth_histogram[depth < STATS_MAX_DEPTH ? depth : STATS_MAX_DEPTH - 1]++;
 }
 
-inline vec3 refract(const vec3 & normalized_inc, const vec3 & normalized_normal, r64 n1overn2){
-    r32 dotp = dot(-normalized_inc, normalized_normal);
-    r64 cos_theta = dotp > 1.0 ? 1.0 : dotp;
-    vec3 out_prep = n1overn2 * (normalized_inc  + cos_theta * normalized_normal);
-    vec3 out_parallel = -sqrt(abs(1.0 - lengthsq(out_prep))) * normalized_normal;
-    return out_prep + out_parallel;
+void merge_stats(render_stats_t * into, const render_stats_t * from){
+    u64 * a = (u64 *) into;
+    const u64 * b = (const u64 *) from;
+    for(u64 i = 0 ; i < sizeof(render_stats_t) / sizeof(u64) ; i++){
+        a[i] += b[i];
+    }
 }
 
-color3 cast_ray(const ray_t & ray, entity_t entities[], u32 entityCount, u32 bounces_left){
-    if (bounces_left == 0){
-        return color3(0.0, 0.0, 0.0);
+// tests the spheres in [begin, end) against the ray, returns the index of the closest one
+// with t in (tmin, *tmax) or -1. *tmax is lowered to the closest t on a hit. only the
+// near root is considered, same as sphere_hit. doubles go 8 (avx-512) or 4 (avx2) to a
+// vector, floats twice as many
+template<typename T>
+s32 sphere_soa_nearest(const T * center_x, const T * center_y, const T * center_z, const T * radius, s32 begin, s32 end, const basic_ray_t<T> & r, T tmin, T * tmax){
+    s32 nearest = -1;
+    T best = *tmax;
+    T a = dot(r.dir, r.dir);
+    STAT(thread_stats.sphere_tests += end - begin);
+
+    s32 i = begin;
+
+#if defined(__AVX512F__)
+    if constexpr (sizeof(T) == sizeof(r64)) {
+        __m512d ox = _mm512_set1_pd(r.point.x), oy = _mm512_set1_pd(r.point.y), oz = _mm512_set1_pd(r.point.z);
+        __m512d dx = _mm512_set1_pd(r.dir.x), dy = _mm512_set1_pd(r.dir.y), dz = _mm512_set1_pd(r.dir.z);
+        __m512d va = _mm512_set1_pd(a);
+        __m512d vtmin = _mm512_set1_pd(tmin);
+        __m512d vbest = _mm512_set1_pd(best);
+        __m512d zero = _mm512_setzero_pd();
+
+        for(; i < end ; i += 8){
+            __mmask8 lanes = end - i >= 8 ? 0xff : (__mmask8)((1u << (end - i)) - 1);
+
+            __m512d ocx = _mm512_sub_pd(_mm512_maskz_loadu_pd(lanes, center_x + i), ox);
+            __m512d ocy = _mm512_sub_pd(_mm512_maskz_loadu_pd(lanes, center_y + i), oy);
+            __m512d ocz = _mm512_sub_pd(_mm512_maskz_loadu_pd(lanes, center_z + i), oz);
+            __m512d rad = _mm512_maskz_loadu_pd(lanes, radius + i);
+
+            __m512d h = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx, ocx), _mm512_mul_pd(dy, ocy)), _mm512_mul_pd(dz, ocz));
+            __m512d c = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, ocx), _mm512_mul_pd(ocy, ocy)), _mm512_mul_pd(ocz, ocz));
+            c = _mm512_sub_pd(c, _mm512_mul_pd(rad, rad));
+            __m512d disc = _mm512_sub_pd(_mm512_mul_pd(h, h), _mm512_mul_pd(va, c));
+
+            __mmask8 mask = _mm512_mask_cmp_pd_mask(lanes, disc, zero, _CMP_GE_OQ);
+            if (!mask) continue;
+
+            __m512d t = _mm512_div_pd(_mm512_sub_pd(h, _mm512_sqrt_pd(disc)), va);
+            mask = _mm512_mask_cmp_pd_mask(mask, t, vtmin, _CMP_GT_OQ);
+            mask = _mm512_mask_cmp_pd_mask(mask, t, vbest, _CMP_LT_OQ);
+            if (!mask) continue;
+
+            alignas(64) r64 ts[8];
+            _mm512_store_pd(ts, t);
+            for(u32 m = mask ; m ; m &= m - 1){
+                s32 lane = __builtin_ctz(m);
+                if (ts[lane] < best) {
+                    best = ts[lane];
+                    nearest = i + lane;
+                }
+            }
+            vbest = _mm512_set1_pd(best);
+        }
+    }
+    else {
+        __m512 ox = _mm512_set1_ps(r.point.x), oy = _mm512_set1_ps(r.point.y), oz = _mm512_set1_ps(r.point.z);
+        __m512 dx = _mm512_set1_ps(r.dir.x), dy = _mm512_set1_ps(r.dir.y), dz = _mm512_set1_ps(r.dir.z);
+        __m512 va = _mm512_set1_ps(a);
+        __m512 vtmin = _mm512_set1_ps(tmin);
+        __m512 vbest = _mm512_set1_ps(best);
+        __m512 zero = _mm512_setzero_ps();
+
+        for(; i < end ; i += 16){
+            __mmask16 lanes = end - i >= 16 ? 0xffff : (__mmask16)((1u << (end - i)) - 1);
+
+            __m512 ocx = _mm512_sub_ps(_mm512_maskz_loadu_ps(lanes, center_x + i), ox);
+            __m512 ocy = _mm512_sub_ps(_mm512_maskz_loadu_ps(lanes, center_y + i), oy);
+            __m512 ocz = _mm512_sub_ps(_mm512_maskz_loadu_ps(lanes, center_z + i), oz);
+            __m512 rad = _mm512_maskz_loadu_ps(lanes, radius + i);
+
+            __m512 h = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, ocx), _mm512_mul_ps(dy, ocy)), _mm512_mul_ps(dz, ocz));
+            __m512 c = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ocx, ocx), _mm512_mul_ps(ocy, ocy)), _mm512_mul_ps(ocz, ocz));
+            c = _mm512_sub_ps(c, _mm512_mul_ps(rad, rad));
+            __m512 disc = _mm512_sub_ps(_mm512_mul_ps(h, h), _mm512_mul_ps(va, c));
+
+            __mmask16 mask = _mm512_mask_cmp_ps_mask(lanes, disc, zero, _CMP_GE_OQ);
+            if (!mask) continue;
+
+            __m512 t = _mm512_div_ps(_mm512_sub_ps(h, _mm512_sqrt_ps(disc)), va);
+            mask = _mm512_mask_cmp_ps_mask(mask, t, vtmin, _CMP_GT_OQ);
+            mask = _mm512_mask_cmp_ps_mask(mask, t, vbest, _CMP_LT_OQ);
+            if (!mask) continue;
+
+            alignas(64) r32 ts[16];
+            _mm512_store_ps(ts, t);
+            for(u32 m = mask ; m ; m &= m - 1){
+                s32 lane = __builtin_ctz(m);
+                if (ts[lane] < best) {
+                    best = ts[lane];
+                    nearest = i + lane;
+                }
+            }
+            vbest = _mm512_set1_ps(best);
+        }
+    }
+#elif defined(__AVX2__)
+    if constexpr (sizeof(T) == sizeof(r64)) {
+        __m256d ox = _mm256_set1_pd(r.point.x), oy = _mm256_set1_pd(r.point.y), oz = _mm256_set1_pd(r.point.z);
+        __m256d dx = _mm256_set1_pd(r.dir.x), dy = _mm256_set1_pd(r.dir.y), dz = _mm256_set1_pd(r.dir.z);
+        __m256d va = _mm256_set1_pd(a);
+        __m256d vtmin = _mm256_set1_pd(tmin);
+        __m256d vbest = _mm256_set1_pd(best);
+        __m256d zero = _mm256_setzero_pd();
+        __m256i lane_index = _mm256_set_epi64x(3, 2, 1, 0);
+
+        for(; i < end ; i += 4){
+            __m256i lanes = _mm256_cmpgt_epi64(_mm256_set1_epi64x(end - i), lane_index);
+
+            __m256d ocx = _mm256_sub_pd(_mm256_maskload_pd(center_x + i, lanes), ox);
+            __m256d ocy = _mm256_sub_pd(_mm256_maskload_pd(center_y + i, lanes), oy);
+            __m256d ocz = _mm256_sub_pd(_mm256_maskload_pd(center_z + i, lanes), oz);
+            __m256d rad = _mm256_maskload_pd(radius + i, lanes);
+
+            __m256d h = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, ocx), _mm256_mul_pd(dy, ocy)), _mm256_mul_pd(dz, ocz));
+            __m256d c = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz));
+            c = _mm256_sub_pd(c, _mm256_mul_pd(rad, rad));
+            __m256d disc = _mm256_sub_pd(_mm256_mul_pd(h, h), _mm256_mul_pd(va, c));
+
+            __m256d valid = _mm256_and_pd(_mm256_castsi256_pd(lanes), _mm256_cmp_pd(disc, zero, _CMP_GE_OQ));
+            if (!_mm256_movemask_pd(valid)) continue;
+
+            __m256d t = _mm256_div_pd(_mm256_sub_pd(h, _mm256_sqrt_pd(disc)), va);
+            valid = _mm256_and_pd(valid, _mm256_cmp_pd(t, vtmin, _CMP_GT_OQ));
+            valid = _mm256_and_pd(valid, _mm256_cmp_pd(t, vbest, _CMP_LT_OQ));
+            s32 mask = _mm256_movemask_pd(valid);
+            if (!mask) continue;
+
+            alignas(32) r64 ts[4];
+            _mm256_store_pd(ts, t);
+            for(u32 m = mask ; m ; m &= m - 1){
+                s32 lane = __builtin_ctz(m);
+                if (ts[lane] < best) {
+                    best = ts[lane];
+                    nearest = i + lane;
+                }
+            }
+            vbest = _mm256_set1_pd(best);
+        }
+    }
+    else {
+        __m256 ox = _mm256_set1_ps(r.point.x), oy = _mm256_set1_ps(r.point.y), oz = _mm256_set1_ps(r.point.z);
+        __m256 dx = _mm256_set1_ps(r.dir.x), dy = _mm256_set1_ps(r.dir.y), dz = _mm256_set1_ps(r.dir.z);
+        __m256 va = _mm256_set1_ps(a);
+        __m256 vtmin = _mm256_set1_ps(tmin);
+        __m256 vbest = _mm256_set1_ps(best);
+        __m256 zero = _mm256_setzero_ps();
+        __m256i lane_index = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+
+        for(; i < end ; i += 8){
+            __m256i lanes = _mm256_cmpgt_epi32(_mm256_set1_epi32(end - i), lane_index);
+
+            __m256 ocx = _mm256_sub_ps(_mm256_maskload_ps(center_x + i, lanes), ox);
+            __m256 ocy = _mm256_sub_ps(_mm256_maskload_ps(center_y + i, lanes), oy);
+            __m256 ocz = _mm256_sub_ps(_mm256_maskload_ps(center_z + i, lanes), oz);
+            __m256 rad = _mm256_maskload_ps(radius + i, lanes);
+
+            __m256 h = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, ocx), _mm256_mul_ps(dy, ocy)), _mm256_mul_ps(dz, ocz));
+            __m256 c = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz));
+            c = _mm256_sub_ps(c, _mm256_mul_ps(rad, rad));
+            __m256 disc = _mm256_sub_ps(_mm256_mul_ps(h, h), _mm256_mul_ps(va, c));
+
+            __m256 valid = _mm256_and_ps(_mm256_castsi256_ps(lanes), _mm256_cmp_ps(disc, zero, _CMP_GE_OQ));
+            if (!_mm256_movemask_ps(valid)) continue;
+
+            __m256 t = _mm256_div_ps(_mm256_sub_ps(h, _mm256_sqrt_ps(disc)), va);
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, vtmin, _CMP_GT_OQ));
+            valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, vbest, _CMP_LT_OQ));
+            s32 mask = _mm256_movemask_ps(valid);
+            if (!mask) continue;
+
+            alignas(32) r32 ts[8];
+            _mm256_store_ps(ts, t);
+            for(u32 m = mask ; m ; m &= m - 1){
+                s32 lane = __builtin_ctz(m);
+                if (ts[lane] < best) {
+                    best = ts[lane];
+                    nearest = i + lane;
+                }
+            }
+            vbest = _mm256_set1_ps(best);
+        }
+    }
+#endif
+
+    for(; i < end ; i++){
+        basic_vec3_t<T> oc = basic_vec3_t<T>(center_x[i], center_y[i], center_z[i]) - r.point;
+        T h = dot(r.dir, oc);
+        T c = dot(oc, oc) - radius[i] * radius[i];
+        T discriminant = h*h - a*c;
+        if (!(discriminant >= 0)) continue;
+
+        T t = (h - sqrt(discriminant)) / a;
+        if (inrange(tmin, best, t)) {
+            best = t;
+            nearest = i;
+        }
     }
 
-    color3 color;
+    *tmax = best;
+    return nearest;
+}
 
-    vec3 direction = ray.dir;
-    r64 delta = 0.0;
+inline s32 sphere_soa_nearest(const sphere_soa_t * soa, s32 begin, s32 end, const ray_t & r, real tmin, real * tmax){
+    return sphere_soa_nearest(soa->center_x, soa->center_y, soa->center_z, soa->radius, begin, end, r, tmin, tmax);
+}
 
-    //hit_t hits[5];
-    //s32 hitCount = 0;
+// @note: bounding volume hierarchy
+// nodes are flattened in depth first order, so the left child of an interior node is
+// always the next node in the array and only the right child's index is stored
 
-    bool hitted = false;
-    hit_t minhit = {};
+struct aabb_t {
+    vec3 min, max;
+};
 
-    for(s32 idx = 0 ; idx < entityCount ; idx++) {
-        delta = 0.0;
-        hit_t hit = {};
-        if (entities[idx].type == Sphere && sphere_hit(ray, 0.001, INF_POS, entities[idx].sphere, &hit)){
-            //hits[hitCount] = hit;
-            //hitCount += 1;
+inline aabb_t aabb_empty(){
+    aabb_t result = {vec3(INF_POS, INF_POS, INF_POS), vec3(INF_NEG, INF_NEG, INF_NEG)};
+    return result;
+}
 
-            if (hitted == false || minhit.delta > hit.delta) {
-                minhit = hit;
-                hitted = true;
-            }
-        }
+inline aabb_t aabb_union(const aabb_t & a, const aabb_t & b){
+    aabb_t result = {};
+    for(s32 i = 0 ; i < 3 ; i++){
+        result.min.data[i] = a.min.data[i] < b.min.data[i] ? a.min.data[i] : b.min.data[i];
+        result.max.data[i] = a.max.data[i] > b.max.data[i] ? a.max.data[i] : b.max.data[i];
     }
+    return result;
+}
 
-    //if (hitCount > 0 != hitted) {
-    //    printf("failed to execute\n");
-    //    exit(-1);
-    //}
+inline aabb_t aabb_grow(const aabb_t & a, const point3 & p){
+    aabb_t point = {p, p};
+    return aabb_union(a, point);
+}
 
-    if (hitted){
+inline r64 aabb_area(const aabb_t & a){
+    vec3 e = a.max - a.min;
+    if (e.x < 0 || e.y < 0 || e.z < 0) return 0.0;
+    return 2.0 * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
 
-        //r64 minDelta = INF_POS;
-        //s32 minDeltaIndex = -1;
+inline aabb_t sphere_bounds(const sphere_t & sphere){
+    vec3 r = vec3(sphere.radius, sphere.radius, sphere.radius);
+    aabb_t result = {sphere.center - r, sphere.center + r};
+    return result;
+}
 
-        //for (s32 idx = 0 ; idx < hitCount ; idx++) {
-        //    if (minDelta > hits[idx].delta) {
-        //        minDeltaIndex = idx;
-        //        minDelta = hits[idx].delta;
-        //    }
-        //}
-        //// @note: this was for checking if the normals are being displayed correctly or not
-        //// color = 0.5 * (hits[minDeltaIndex].normal + color3(1.0, 1.0, 1.0));
+// slab test, returns true if the ray enters the box before tmax
+inline bool aabb_hit(const aabb_t & box, const point3 & origin, const vec3 & inv_dir, real tmin, real tmax){
+    for(s32 i = 0 ; i < 3 ; i++){
+        real t0 = (box.min.data[i] - origin.data[i]) * inv_dir.data[i];
+        real t1 = (box.max.data[i] - origin.data[i]) * inv_dir.data[i];
+        if (t0 > t1) {
+            real temp = t0; t0 = t1; t1 = temp;
+        }
+        tmin = t0 > tmin ? t0 : tmin;
+        tmax = t1 < tmax ? t1 : tmax;
+        if (tmax < tmin) return false;
+    }
+    return true;
+}
 
-        //hit_t hit = hits[minDeltaIndex];
+struct bvh_node_t {
+    aabb_t bounds;
+    s32 offset;   // leaf: first slot in bvh_t::indices, interior: index of the right child
+    u16 count;    // number of primitives in a leaf, 0 for interior nodes
+    u16 axis;     // split axis, used to visit the nearer child first
+    u8 pad[8];
+};
 
-        hit_t hit = minhit;
-        //if (hit.delta != minhit.delta) {
-        //    printf("failewd to execute\n");
-        //    exit(-1);
-        //}
-        color3 attenuation = vec3(0.5, 0.5, 0.5);
+struct bvh_t {
+    bvh_node_t * nodes;
+    s32 node_count;
+    s32 * indices;  // primitive order, leaves reference contiguous runs of this
+    s32 index_count;
+};
 
-        vec3 newdirection = {};
-        // lambertian approximation 
-        // light is scattered proportional to cos(phi) where phi is the angle the incident ray 
-        // makes with the reflected one 
+const s32 BVH_BIN_COUNT = 16;
+const s32 BVH_MAX_LEAF_SIZE = 4;
+const s32 BVH_STACK_SIZE = 64;
 
-        // this gives a more sharper circle but make the lighting seems to be vrom above
-        // newdirection = random_unit_in_hemisphere(hits[minDeltaIndex].normal)+ hits[minDeltaIndex].normal;
+struct bvh_build_t {
+    bvh_t * bvh;
+    const aabb_t * bounds;     // per primitive
+    const point3 * centroids;  // per primitive
+    s32 max_leaf_size;
+    s32 max_depth;             // deeper nodes become leaves
+};
 
-        // this gives a less sharp image but is more accurate to the scattering
+s32 bvh_build_node(bvh_build_t * build, s32 begin, s32 end, s32 depth){
+    bvh_t * bvh = build->bvh;
+    s32 * indices = bvh->indices;
 
+    s32 node_index = bvh->node_count++;
+    bvh_node_t * node = &bvh->nodes[node_index];
+    *node = {};
 
-        if (hit.mat.type == Lambertian) {
-            newdirection = random_unit_vector() + hit.normal;
-            if (near_zero(newdirection)){
-                newdirection = hit.normal;
+    aabb_t bounds = aabb_empty();
+    aabb_t centroid_bounds = aabb_empty();
+    for(s32 i = begin ; i < end ; i++){
+        bounds = aabb_union(bounds, build->bounds[indices[i]]);
+        centroid_bounds = aabb_grow(centroid_bounds, build->centroids[indices[i]]);
+    }
+    node->bounds = bounds;
+
+    s32 count = end - begin;
+
+    // binned sah: bucket the centroids along every axis and sweep the bins to find the
+    // cheapest split plane. cost of a leaf is the number of entities in it
+    r64 best_cost = INF_POS;
+    s32 best_axis = -1;
+    s32 best_bin = 0;
+
+    if (count > build->max_leaf_size / 2 && depth < build->max_depth) {
+        for(s32 axis = 0 ; axis < 3 ; axis++){
+            r64 cmin = centroid_bounds.min.data[axis];
+            r64 cmax = centroid_bounds.max.data[axis];
+            if (cmax - cmin <= 0.0) continue;
+
+            aabb_t bin_bounds[BVH_BIN_COUNT];
+            s32 bin_count[BVH_BIN_COUNT] = {};
+            for(s32 b = 0 ; b < BVH_BIN_COUNT ; b++) bin_bounds[b] = aabb_empty();
+
+            r64 scale = BVH_BIN_COUNT / (cmax - cmin);
+            for(s32 i = begin ; i < end ; i++){
+                s32 b = (s32)((build->centroids[indices[i]].data[axis] - cmin) * scale);
+                b = clamp(0, BVH_BIN_COUNT - 1, b);
+                bin_count[b]++;
+                bin_bounds[b] = aabb_union(bin_bounds[b], build->bounds[indices[i]]);
             }
-            attenuation = hit.mat.lambertian.albedo;
-        }
-        else if (hit.mat.type == Metallic) {
-            vec3 reflected = normalize(reflect(ray.dir, hit.normal));
-            newdirection = reflected + random_unit_vector() * hit.mat.metallic.fuzziness;
-            if(near_zero(newdirection)) {
-                newdirection = reflected;
+
+            r64 right_area[BVH_BIN_COUNT];
+            s32 right_count[BVH_BIN_COUNT];
+            aabb_t acc = aabb_empty();
+            s32 acc_count = 0;
+            for(s32 b = BVH_BIN_COUNT - 1 ; b > 0 ; b--){
+                acc = aabb_union(acc, bin_bounds[b]);
+                acc_count += bin_count[b];
+                right_area[b] = aabb_area(acc);
+                right_count[b] = acc_count;
             }
-            attenuation = hit.mat.metallic.albedo;
-            
-        }
-        else if (hit.mat.type == Dielectric) {
-            attenuation  = color3(1.0, 1.0, 1.0);
-            auto n1overn2 = hit.front_face ? (1.0/hit.mat.dielectric.refractive) : hit.mat.dielectric.refractive;
 
-            vec3 unit_direction = normalize(ray.dir);
-            vec3 unit_normal = normalize(hit.normal);
-            
-            r64 cost = 0, sint = 0;
-            {
-                r64 d = dot(-unit_direction, unit_normal);
-                cost = d > 1.0 ? 1.0 : d;
-                sint = sqrt(1 - cost * cost);
+            acc = aabb_empty();
+            acc_count = 0;
+            for(s32 b = 0 ; b < BVH_BIN_COUNT - 1 ; b++){
+                acc = aabb_union(acc, bin_bounds[b]);
+                acc_count += bin_count[b];
+                if (acc_count == 0 || right_count[b + 1] == 0) continue;
+                r64 cost = aabb_area(acc) * acc_count + right_area[b + 1] * right_count[b + 1];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = b;
+                }
             }
+        }
+    }
 
-            r32 reflectance = 0;
-            {
-                auto r0 = (1 - n1overn2) / (1 + n1overn2);
-                r0 = r0 * r0;
-                reflectance = r0 + ( 1 - r0) * pow((1 - cost), 5);
+    r64 parent_area = aabb_area(bounds);
+    r64 leaf_cost = count;
+    // traversal step is costed at about one intersection test
+    r64 split_cost = best_axis < 0 ? INF_POS : 1.0 + (parent_area > 0.0 ? best_cost / parent_area : 0.0);
 
-            }
+    bool make_leaf = best_axis < 0 || (count <= build->max_leaf_size && split_cost >= leaf_cost);
+    if (make_leaf && count <= 0xffff) {
+        node->offset = begin;
+        node->count = (u16) count;
+        return node_index;
+    }
 
-            if (n1overn2 * sint > 1.0 || reflectance > random_double()) {
-                newdirection = reflect(unit_direction, unit_normal);
-            } else { 
-                newdirection = refract(unit_direction, unit_normal, n1overn2);
+    s32 mid = begin;
+    if (best_axis >= 0) {
+        r64 cmin = centroid_bounds.min.data[best_axis];
+        r64 scale = BVH_BIN_COUNT / (centroid_bounds.max.data[best_axis] - cmin);
+        s32 i = begin, j = end - 1;
+        while (i <= j) {
+            s32 b = (s32)((build->centroids[indices[i]].data[best_axis] - cmin) * scale);
+            b = clamp(0, BVH_BIN_COUNT - 1, b);
+            if (b <= best_bin) {
+                i++;
+            } else {
+                s32 temp = indices[i]; indices[i] = indices[j]; indices[j] = temp;
+                j--;
             }
         }
-        
-        color = attenuation * cast_ray(ray_t(hit.point, newdirection), entities, entityCount, bounces_left - 1);
+        mid = i;
     }
-    else {
-        r64 a = 0.5 * (direction.y + 1.0);
-        color = (1.0 - a) * color3(1.0, 1.0, 1.0) + a * color3(0.5, 0.7, 1.0);
+    if (mid == begin || mid == end) {
+        // all centroids coincide, split down the middle
+        mid = begin + count / 2;
+        best_axis = 0;
     }
 
-    return color;
-}
-
-s32 write_image(const char * file, image_t * image);
-s32 create_image(image_t * image, s32 width, s32 height, u32 color);
-
-entity_t * create_entities(s32 * count){
-    *count = 22 * 22 + 4;
-    entity_t * entities = (entity_t *) malloc(sizeof(entity_t) * (*count));
-
-    s32 offset = 0;
-
-    entities[offset].type = Sphere;
-    entities[offset].sphere.mat.type = Lambertian;
-    entities[offset].sphere.mat.lambertian.albedo = get_color_from_hex(0x888888);
-    entities[offset].sphere.center = point3(0, -1000, 0);
-    entities[offset].sphere.radius = 1000;
-
-    offset++;
+    node->axis = (u16) best_axis;
+    bvh_build_node(build, begin, mid, depth + 1);
+    s32 right = bvh_build_node(build, mid, end, depth + 1);
+    bvh->nodes[node_index].offset = right;
+    bvh->nodes[node_index].count = 0;
 
-    entities[offset].type = Sphere;
-    entities[offset].sphere.mat.type = Dielectric;
-    entities[offset].sphere.mat.dielectric.albedo = get_color_from_hex(0xffffff);
-    entities[offset].sphere.mat.dielectric.refractive = 1.5;
-    entities[offset].sphere.center = point3(0, 1, 0);
-    entities[offset].sphere.radius = 1;
-    
-    offset++;
+    return node_index;
+}
 
-    entities[offset].type = Sphere;
-    entities[offset].sphere.mat.type = Metallic;
-    entities[offset].sphere.mat.metallic.albedo = color3(0.7, 0.6, 0.5);
-    entities[offset].sphere.mat.metallic.fuzziness = 0.0;
-    entities[offset].sphere.center = point3(4, 1, 0);
-    entities[offset].sphere.radius = 1;
-    
+// builds over count primitives given their bounds, bvh->indices ends up holding the
+// primitive order the leaves expect. max_depth leaves room below the tree for a caller
+// that hangs subtrees off its leaves
+void build_bvh(bvh_t * bvh, const aabb_t * bounds, const point3 * centroids, s32 count, s32 max_leaf_size = BVH_MAX_LEAF_SIZE, s32 max_depth = BVH_STACK_SIZE - 2){
+    *bvh = {};
+    if (count == 0) return;
+
+    bvh->index_count = count;
+    bvh->indices = (s32 *) malloc(sizeof(s32) * count);
+    for(s32 i = 0 ; i < count ; i++){
+        bvh->indices[i] = i;
+    }
 
-    offset++;
+    bvh->nodes = (bvh_node_t *) malloc(sizeof(bvh_node_t) * (2 * count));
 
-    entities[offset].type = Sphere;
-    entities[offset].sphere.mat.type = Lambertian;
-    entities[offset].sphere.mat.lambertian.albedo = color3(0.4, 0.2, 0.1);
-    entities[offset].sphere.center = point3(-4, 1, 0);
-    entities[offset].sphere.radius = 1;
+    bvh_build_t build = {};
+    build.bvh = bvh;
+    build.bounds = bounds;
+    build.centroids = centroids;
+    build.max_leaf_size = max_leaf_size;
+    build.max_depth = max_depth;
 
-    offset++;
-    
-    for(s32 i = -11 ; i < 11 ; i++){
-        for(s32 j = -11 ; j < 11 ;  j++){
-            r64 choose_mat = random_double();
-            point3 center(i + 0.9 * random_double(), 0.2,  j + 0.9 * random_double());
+    bvh_build_node(&build, 0, count, 0);
+}
 
+void destroy_bvh(bvh_t * bvh){
+    free(bvh->nodes);
+    free(bvh->indices);
+    *bvh = {};
+}
 
-            if (length(center - point3(4, 0.2, 9)) > 0.9) {
+// fits the node bounds to spheres that moved while keeping the tree as it is. children
+// always come after their parent, so one backwards sweep sees them before the parent
+void refit_bvh(bvh_t * bvh, const sphere_soa_t * spheres){
+    for(s32 n = bvh->node_count - 1 ; n >= 0 ; n--){
+        bvh_node_t * node = &bvh->nodes[n];
+        if (node->count > 0) {
+            aabb_t bounds = aabb_empty();
+            for(s32 slot = node->offset ; slot < node->offset + node->count ; slot++){
+                real r = spheres->radius[slot];
+                point3 center = point3(spheres->center_x[slot], spheres->center_y[slot], spheres->center_z[slot]);
+                aabb_t sphere = {center - vec3(r, r, r), center + vec3(r, r, r)};
+                bounds = aabb_union(bounds, sphere);
+            }
+            node->bounds = bounds;
+        }
+        else {
+            node->bounds = aabb_union(bvh->nodes[n + 1].bounds, bvh->nodes[node->offset].bounds);
+        }
+    }
+}
 
-                if (choose_mat < 0.8 ){
-                    entity_t entity = {};
-                    entity.type = Sphere;
-                    entity.sphere.mat.type = Lambertian;
-                    entity.sphere.mat.lambertian.albedo = color3(random_double(), random_double(), random_double()) * color3(random_double(), random_double(), random_double());
-                    entity.sphere.radius = 0.2;
-                    entity.sphere.center = center;
-
-                    entities[offset] = entity;
-                    offset++;
-                }
+// sah cost of the whole tree: expected node visits and sphere tests of a random ray
+// that hits the root. refitting keeps the topology, so this grows as things move apart
+r64 bvh_sah_cost(const bvh_t * bvh){
+    if (bvh->node_count == 0) return 0.0;
+    r64 root_area = aabb_area(bvh->nodes[0].bounds);
+    if (root_area <= 0.0) return 0.0;
+
+    r64 cost = 0.0;
+    for(s32 n = 0 ; n < bvh->node_count ; n++){
+        const bvh_node_t & node = bvh->nodes[n];
+        cost += aabb_area(node.bounds) / root_area * (node.count > 0 ? node.count : 1);
+    }
+    return cost;
+}
 
-                else if (choose_mat < 0.95){
-                    entity_t entity = {};
-                    entity.type = Sphere;
-                    entity.sphere.mat.type = Metallic;
-                    entity.sphere.mat.metallic.albedo = color3(random_double(0.5, 1), random_double(0.5, 1), random_double(0.5, 1));
-                    entity.sphere.mat.metallic.fuzziness = random_double(0, 0.5);
-                    entity.sphere.radius = 0.2;
-                    entity.sphere.center = center;
-
-                    entities[offset] = entity;
-                    offset++;
+// walks the nodes the ray enters front to back, leaf(node, tmax) tests a leaf's primitives
+// and returns the slot of the closest hit below *tmax or -1. returns the closest slot
+template<typename leaf_t>
+s32 bvh_traverse(const bvh_t * bvh, const ray_t & ray, real tmin, real * tmax, leaf_t leaf){
+    if (bvh->node_count == 0) return -1;
+
+    vec3 inv_dir = vec3(1.0 / ray.dir.x, 1.0 / ray.dir.y, 1.0 / ray.dir.z);
+    s32 dir_negative[3] = {ray.dir.x < 0, ray.dir.y < 0, ray.dir.z < 0};
+
+    s32 nearest = -1;
+    s32 stack[BVH_STACK_SIZE];
+    s32 stack_size = 0;
+    s32 node_index = 0;
+
+    while(true){
+        const bvh_node_t * node = &bvh->nodes[node_index];
+
+        if (aabb_hit(node->bounds, ray.point, inv_dir, tmin, *tmax)) {
+            if (node->count > 0) {
+                // tmax shrinks with every hit, so later nodes only pass if they can be closer
+                s32 slot = leaf(node, tmax);
+                if (slot >= 0) {
+                    nearest = slot;
                 }
-
-                else {
-                    entity_t entity = {};
-                    entity.type = Sphere;
-                    entity.sphere.mat.type = Dielectric;
-                    entity.sphere.mat.dielectric.albedo = get_color_from_hex(0xffffff);
-                    entity.sphere.mat.dielectric.refractive= 1.5;
-                    entity.sphere.radius = 0.2;
-                    entity.sphere.center = center;
-
-                    entities[offset] = entity;
-                    offset++;
+            }
+            else {
+                // push the far child, descend into the near one
+                if (dir_negative[node->axis]) {
+                    stack[stack_size++] = node_index + 1;
+                    node_index = node->offset;
+                } else {
+                    stack[stack_size++] = node->offset;
+                    node_index = node_index + 1;
                 }
+                continue;
             }
         }
+
+        if (stack_size == 0) break;
+        node_index = stack[--stack_size];
     }
 
-    *count = offset;
-   
-    return entities;
+    return nearest;
 }
 
-int main(int argc, char ** argv) {
-
-    srand(3000);
+// returns the slot of the closest sphere or -1, the scene keeps its spheres in leaf order
+s32 bvh_hit(const bvh_t * bvh, const sphere_soa_t * spheres, const ray_t & ray, real tmin, real * tmax){
+    return bvh_traverse(bvh, ray, tmin, tmax, [&](const bvh_node_t * node, real * t){
+        return sphere_soa_nearest(spheres, node->offset, node->offset + node->count, ray, tmin, t);
+    });
+}
 
-    const s32 MAX_RAY_BOUNCE = 50;
-    const s32 RAYS_PER_PIXEL = 500;
+enum accel_type {
+    AccelNone,
+    AccelBVH,
+    AccelCompact,   // bvh over compressed clusters of spheres
+};
 
-    r64 aspect_ratio = 16.0/ 9.0;
-    int image_width = 800;
-    int image_height = (int)(image_width / aspect_ratio);
+// where the camera sits and how it sees, kept with the scene so scene files carry it
+struct camera_desc_t {
+    point3 lookfrom;
+    point3 look_at;
+    vec3 up;
+    r64 vfov;
+    r64 aspect_ratio;
+    r64 defocus_angle;
+    r64 focus_dist;
+};
 
+camera_desc_t default_camera_desc(){
+    camera_desc_t desc = {};
+    desc.lookfrom = point3(13, 2, 3);
+    desc.look_at = point3(0, 0, 0);
+    desc.up = vec3(0, 1, 0);
+    desc.vfov = 20;
+    desc.aspect_ratio = 16.0 / 9.0;
+    desc.defocus_angle = 0.6;
+    desc.focus_dist = 10.0;
+    return desc;
+}
 
-    // @note: camera properties
+// flat sphere record a scene is assembled from, the material is an index into the
+// scene's material table
+struct sphere_desc_t {
+    point3 center;
+    r64 radius;
+    u32 material;
+};
 
-    // distance between the camera and view port
-    r64 vfov = 20;
-    vec3 camera_up = vec3(0, 1, 0);
-    vec3 lookfrom = point3(13, 2, 3);
-    vec3 look_at = point3(0, 0, 0);
+// @note: compact sphere storage
+// --accel compact keeps big scenes small. the spheres are sorted along a morton curve and
+// cut into clusters of up to 16 neighbours. a cluster stores the smallest of its centers
+// and a step per axis, and every center is three 16 bit step counts from there. the
+// radius is a 16 bit index into a palette of the distinct radii, the material an index
+// into the scene's table, which already holds every distinct material once. spheres wider
+// than 1/64 of the scene get a cluster of their own, so they keep their exact center and
+// don't stretch the clusters around them. the bvh is built over the clusters with one
+// cluster per leaf, and a leaf is decoded into a simd batch right before it is tested.
+// the spheres rendered are the decoded ones, centers move by at most half a step
+
+const s32 COMPACT_CLUSTER_SIZE = 16;
+const s32 COMPACT_PALETTE_SIZE = 65536;
+const r64 COMPACT_LARGE_SPHERE = 1.0 / 64.0;    // of the largest extent of the centers
+const s32 COMPACT_MORTON_BITS = 21;             // per axis
+
+struct compact_cluster_t {
+    real origin[3];    // smallest center per axis
+    real step[3];      // center = origin + offset * step
+    s32 first;         // slot of its first sphere
+    s32 count;
+};
 
-    r64 defocus_angle = 0.6;
-    r64 focus_dist = 10.0;
+struct compact_spheres_t {
+    compact_cluster_t * clusters;   // in bvh leaf order, their spheres in slot order
+    s32 cluster_count;
+    u16 * offsets;                  // x, y, z per slot
+    u16 * radius_index;             // per slot, into radii
+    u32 * material_index;           // per slot
+    real * radii;
+    s32 radius_count;
+};
 
-    vec3 u, v, w;
-    w = normalize(lookfrom - look_at);
-    u = normalize(cross (camera_up, w));
-    v = normalize(cross(w, u));
+// a decoded cluster, laid out for sphere_soa_nearest
+struct compact_batch_t {
+    alignas(SPHERE_SOA_ALIGN) real center_x[COMPACT_CLUSTER_SIZE];
+    alignas(SPHERE_SOA_ALIGN) real center_y[COMPACT_CLUSTER_SIZE];
+    alignas(SPHERE_SOA_ALIGN) real center_z[COMPACT_CLUSTER_SIZE];
+    alignas(SPHERE_SOA_ALIGN) real radius[COMPACT_CLUSTER_SIZE];
+};
 
-    point3 camera_center = lookfrom;
+inline point3 compact_center(const compact_cluster_t & cluster, const u16 * offset){
+    return point3(
+        cluster.origin[0] + (real) offset[0] * cluster.step[0], 
+        cluster.origin[1] + (real) offset[1] * cluster.step[1], 
+        cluster.origin[2] + (real) offset[2] * cluster.step[2]);
+}
 
+inline void compact_decode(const compact_spheres_t * compact, const compact_cluster_t & cluster, compact_batch_t * batch){
+    for(s32 i = 0 ; i < cluster.count ; i++){
+        s32 slot = cluster.first + i;
+        point3 center = compact_center(cluster, &compact->offsets[3 * slot]);
+        batch->center_x[i] = center.x;
+        batch->center_y[i] = center.y;
+        batch->center_z[i] = center.z;
+        batch->radius[i] = compact->radii[compact->radius_index[slot]];
+    }
+}
 
-    r64 viewport_height = 2 * tan(degrees_to_radians(vfov) / 2) * focus_dist;
-    r64 viewport_width = viewport_height * ((r64)(image_width) / (r64)(image_height));
+// the cluster holding slot, clusters cover the slots in order
+inline const compact_cluster_t & compact_cluster_of(const compact_spheres_t * compact, s32 slot){
+    s32 low = 0, high = compact->cluster_count - 1;
+    while (low < high) {
+        s32 mid = (low + high + 1) / 2;
+        if (compact->clusters[mid].first <= slot) low = mid;
+        else high = mid - 1;
+    }
+    return compact->clusters[low];
+}
 
-    vec3 viewport_u = viewport_width * u;
-    vec3 viewport_v = viewport_height * -v;
-    
-    vec3 delta_u = viewport_u / image_width;
-    vec3 delta_v = viewport_v / image_height;
+// the 3 * bits low bits of x, y and z interleaved
+inline u64 morton_code(u32 x, u32 y, u32 z){
+    u64 code = 0;
+    for(s32 bit = 0 ; bit < COMPACT_MORTON_BITS ; bit++){
+        code |= (u64)((x >> bit) & 1) << (3 * bit + 0);
+        code |= (u64)((y >> bit) & 1) << (3 * bit + 1);
+        code |= (u64)((z >> bit) & 1) << (3 * bit + 2);
+    }
+    return code;
+}
 
-    point3 viewport_top_left = camera_center - (focus_dist * w) - (viewport_u / 2) - (viewport_v / 2);
-    auto defocus_radius = focus_dist * tan(degrees_to_radians(defocus_angle / 2.0));
+struct compact_order_t {
+    u64 key;
+    s32 index;
+};
 
-    vec3 defocus_disk_u = u * defocus_radius;
-    vec3 defocus_disk_v = v * defocus_radius;
+static int compare_compact_order(const void * a, const void * b){
+    const compact_order_t * x = (const compact_order_t *) a;
+    const compact_order_t * y = (const compact_order_t *) b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return x->index - y->index;
+}
 
-    point3 pixel00_loc = viewport_top_left + (delta_u + delta_v) * 0.5;
+// encodes the spheres, whose materials go through remap, and builds the bvh over the
+// clusters. returns false when there are more distinct radii than the palette holds
+bool build_compact_spheres(compact_spheres_t * compact, bvh_t * bvh, const sphere_desc_t * spheres, s32 count, const u32 * remap){
+    *compact = {};
+    *bvh = {};
+
+    // radius palette, through an open addressed table of palette indices
+    const s32 TABLE_SIZE = 2 * COMPACT_PALETTE_SIZE;
+    s32 * table = (s32 *) malloc(sizeof(s32) * TABLE_SIZE);
+    for(s32 i = 0 ; i < TABLE_SIZE ; i++) table[i] = -1;
+    compact->radii = (real *) malloc(sizeof(real) * COMPACT_PALETTE_SIZE);
+    u16 * radius_index = (u16 *) malloc(sizeof(u16) * (count > 0 ? count : 1));
+
+    bool fits = true;
+    for(s32 i = 0 ; i < count && fits ; i++){
+        real radius = spheres[i].radius;
+        u64 bits = 0;
+        memcpy(&bits, &radius, sizeof(radius));
+
+        s32 entry = (s32)((bits * 0x9e3779b97f4a7c15ull) >> 40) & (TABLE_SIZE - 1);
+        while (table[entry] >= 0 && compact->radii[table[entry]] != radius) {
+            entry = (entry + 1) & (TABLE_SIZE - 1);
+        }
+        if (table[entry] < 0) {
+            if (compact->radius_count == COMPACT_PALETTE_SIZE) {
+                fits = false;
+                break;
+            }
+            table[entry] = compact->radius_count;
+            compact->radii[compact->radius_count++] = radius;
+        }
+        radius_index[i] = (u16) table[entry];
+    }
+    free(table);
+    if (!fits) {
+        free(radius_index);
+        free(compact->radii);
+        *compact = {};
+        return false;
+    }
 
-    image_t image;
-    create_image(&image, image_width, image_height, 0xffffff);
+    // morton order inside the box of the centers, large spheres at the end
+    aabb_t centers = aabb_empty();
+    for(s32 i = 0 ; i < count ; i++) centers = aabb_grow(centers, spheres[i].center);
+    vec3 extent = centers.max - centers.min;
+    r64 largest = maximum(extent.x, maximum(extent.y, extent.z));
+    r64 cells = (r64)((1 << COMPACT_MORTON_BITS) - 1);
+
+    compact_order_t * order = (compact_order_t *) malloc(sizeof(compact_order_t) * (count > 0 ? count : 1));
+    for(s32 i = 0 ; i < count ; i++){
+        u32 cell[3] = {};
+        for(s32 axis = 0 ; axis < 3 ; axis++){
+            r64 t = extent.data[axis] > 0.0 ? (spheres[i].center.data[axis] - centers.min.data[axis]) / extent.data[axis] : 0.0;
+            cell[axis] = (u32)(t * cells);
+        }
+        bool large = spheres[i].radius > COMPACT_LARGE_SPHERE * largest;
+        order[i].key = large ? 1ull << 63 : morton_code(cell[0], cell[1], cell[2]);
+        order[i].index = i;
+    }
+    qsort(order, count, sizeof(compact_order_t), compare_compact_order);
+
+    // clusters over runs of the sorted spheres, quantized in sorted order for now
+    s32 max_clusters = count > 0 ? count : 1;
+    compact_cluster_t * clusters = (compact_cluster_t *) malloc(sizeof(compact_cluster_t) * max_clusters);
+    aabb_t * bounds = (aabb_t *) malloc(sizeof(aabb_t) * max_clusters);
+    point3 * centroids = (point3 *) malloc(sizeof(point3) * max_clusters);
+    u16 * offsets = (u16 *) malloc(sizeof(u16) * 3 * (count > 0 ? count : 1));
+
+    s32 cluster_count = 0;
+    for(s32 begin = 0 ; begin < count ; ){
+        bool large = order[begin].key >> 63;
+        s32 end = begin + 1;
+        while (!large && end < count && end - begin < COMPACT_CLUSTER_SIZE && !(order[end].key >> 63)) end++;
+
+        compact_cluster_t & cluster = clusters[cluster_count];
+        aabb_t box = aabb_empty();
+        for(s32 i = begin ; i < end ; i++) box = aabb_grow(box, spheres[order[i].index].center);
+        for(s32 axis = 0 ; axis < 3 ; axis++){
+            cluster.origin[axis] = box.min.data[axis];
+            cluster.step[axis] = (box.max.data[axis] - box.min.data[axis]) / 65535.0;
+        }
+        cluster.first = begin;
+        cluster.count = end - begin;
+
+        // bounds of the spheres as they decode, not as they came in
+        aabb_t decoded = aabb_empty();
+        for(s32 i = begin ; i < end ; i++){
+            const sphere_desc_t & sphere = spheres[order[i].index];
+            for(s32 axis = 0 ; axis < 3 ; axis++){
+                r64 steps = cluster.step[axis] > 0.0 ? (sphere.center.data[axis] - cluster.origin[axis]) / cluster.step[axis] : 0.0;
+                offsets[3 * i + axis] = (u16) clamp(0.0, 65535.0, floor(steps + 0.5));
+            }
+            point3 center = compact_center(cluster, &offsets[3 * i]);
+            real r = compact->radii[radius_index[order[i].index]];
+            aabb_t sphere_box = {center - vec3(r, r, r), center + vec3(r, r, r)};
+            decoded = aabb_union(decoded, sphere_box);
+        }
+        bounds[cluster_count] = decoded;
+        centroids[cluster_count] = (decoded.min + decoded.max) * 0.5;
+        cluster_count++;
+        begin = end;
+    }
 
-    s32 entityCount = 0;
-    entity_t * entities = create_entities(&entityCount);
+    build_bvh(bvh, bounds, centroids, cluster_count, 1);
+
+    // clusters and their spheres into leaf order
+    compact->cluster_count = cluster_count;
+    compact->clusters = (compact_cluster_t *) malloc(sizeof(compact_cluster_t) * (cluster_count > 0 ? cluster_count : 1));
+    compact->offsets = (u16 *) malloc(sizeof(u16) * 3 * (count > 0 ? count : 1));
+    compact->radius_index = (u16 *) malloc(sizeof(u16) * (count > 0 ? count : 1));
+    compact->material_index = (u32 *) malloc(sizeof(u32) * (count > 0 ? count : 1));
+    s32 slot = 0;
+    for(s32 c = 0 ; c < cluster_count ; c++){
+        compact_cluster_t cluster = clusters[bvh->indices[c]];
+        for(s32 i = 0 ; i < cluster.count ; i++){
+            s32 sorted = cluster.first + i;
+            memcpy(&compact->offsets[3 * (slot + i)], &offsets[3 * sorted], sizeof(u16) * 3);
+            compact->radius_index[slot + i] = radius_index[order[sorted].index];
+            compact->material_index[slot + i] = remap[spheres[order[sorted].index].material];
+        }
+        cluster.first = slot;
+        compact->clusters[c] = cluster;
+        slot += cluster.count;
+    }
 
-    for(s32 i = 0 ; i < image_height ; i++){
-        for(s32 ii =0 ; ii < image_width ; ii++){
+    // the leaves reference clusters by position, the order is no longer needed
+    free(bvh->indices);
+    bvh->indices = NULL;
+    bvh->index_count = 0;
 
-            color3 colors[RAYS_PER_PIXEL] = {};
+    compact->radii = (real *) realloc(compact->radii, sizeof(real) * (compact->radius_count > 0 ? compact->radius_count : 1));
 
-            for(s32 iii = 0 ; iii < RAYS_PER_PIXEL ; iii++){
+    free(order);
+    free(clusters);
+    free(bounds);
+    free(centroids);
+    free(offsets);
+    free(radius_index);
+    return true;
+}
 
-                point3 pixel_center = pixel00_loc + (delta_v * i)  + (delta_u * ii);
+void destroy_compact_spheres(compact_spheres_t * compact){
+    free(compact->clusters);
+    free(compact->offsets);
+    free(compact->radius_index);
+    free(compact->material_index);
+    free(compact->radii);
+    *compact = {};
+}
 
-                point3 ray_point = pixel_center + delta_u * 0.5 * (r64(rand() % 2000) / 1000.0 - 0.5) + delta_v * 0.5 * (r64(rand() % 2000) / 1000.0 - 0.5);
+// returns the slot of the closest sphere or -1
+s32 compact_hit(const bvh_t * bvh, const compact_spheres_t * compact, const ray_t & ray, real tmin, real * tmax){
+    return bvh_traverse(bvh, ray, tmin, tmax, [&](const bvh_node_t * node, real * t){
+        s32 nearest = -1;
+        for(s32 c = node->offset ; c < node->offset + node->count ; c++){
+            const compact_cluster_t & cluster = compact->clusters[c];
+            compact_batch_t batch;
+            compact_decode(compact, cluster, &batch);
+            s32 i = sphere_soa_nearest(batch.center_x, batch.center_y, batch.center_z, batch.radius, 0, cluster.count, ray, tmin, t);
+            if (i >= 0) nearest = cluster.first + i;
+        }
+        return nearest;
+    });
+}
 
-                point3 ray_origin = camera_center;
-                {
-                    if (defocus_angle > 0 ){
-                        auto temp = random_in_unit_disk();
-                        ray_origin = camera_center + (temp.data[0] * defocus_disk_u) + (temp.data[1]  * defocus_disk_v );
-                    }
-                }
+// @note: triangle meshes
+// an indexed mesh keeps float positions and three u32 vertex indices per triangle, in
+// bvh leaf order so a leaf is a contiguous run of triangles. rays are tested with the
+// watertight algorithm of woop, benthin and wald: the ray is sheared so it points down
+// z from the origin, and the edge functions are evaluated in that 2d space. a ray
+// through a shared edge or vertex hits at least one of the triangles around it, so
+// meshes don't leak light through their seams. meshes are flat shaded
+
+const s32 MESH_LEAF_SIZE = 4;
+const s32 MESH_TREELET_SIZE = 64;          // triangles per primitive of the sah build
+const s32 MESH_TREELET_DEPTH = 24;         // levels kept free below the sah build for the treelets
+
+struct mesh_t {
+    r32 * positions;         // x, y, z per vertex
+    u32 * triangles;         // three vertex indices per triangle
+    s32 vertex_count;
+    s32 triangle_count;
+    u32 material;
+    bvh_t bvh;               // over the triangles, no index array
+
+    // what the scene file said, to write it back
+    char * file;             // absolute
+    point3 offset;
+    r64 scale;
+};
 
-                
+// the shear that takes a ray direction to +z, computed once per ray and mesh
+struct watertight_ray_t {
+    s32 kx, ky, kz;
+    real sx, sy, sz;
+};
 
-                ray_t ray = {ray_origin, ray_point - ray_origin};
+inline watertight_ray_t watertight_setup(const vec3 & dir){
+    watertight_ray_t w = {};
+    real ax = abs(dir.x), ay = abs(dir.y), az = abs(dir.z);
+    w.kz = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+    w.kx = (w.kz + 1) % 3;
+    w.ky = (w.kx + 1) % 3;
+    // keep the winding when z flips
+    if (dir.data[w.kz] < 0) {
+        s32 temp = w.kx; w.kx = w.ky; w.ky = temp;
+    }
+    w.sx = dir.data[w.kx] / dir.data[w.kz];
+    w.sy = dir.data[w.ky] / dir.data[w.kz];
+    w.sz = 1.0 / dir.data[w.kz];
+    return w;
+}
 
-                color3 color = cast_ray(ray, entities, entityCount, MAX_RAY_BOUNCE);
+// lowers *tmax to the hit when the triangle is hit in (tmin, *tmax)
+inline bool triangle_hit(const watertight_ray_t & w, const point3 & origin, const r32 * a, const r32 * b, const r32 * c, real tmin, real * tmax){
+    vec3 pa = vec3(a[0], a[1], a[2]) - origin;
+    vec3 pb = vec3(b[0], b[1], b[2]) - origin;
+    vec3 pc = vec3(c[0], c[1], c[2]) - origin;
+
+    real ax = pa.data[w.kx] - w.sx * pa.data[w.kz], ay = pa.data[w.ky] - w.sy * pa.data[w.kz];
+    real bx = pb.data[w.kx] - w.sx * pb.data[w.kz], by = pb.data[w.ky] - w.sy * pb.data[w.kz];
+    real cx = pc.data[w.kx] - w.sx * pc.data[w.kz], cy = pc.data[w.ky] - w.sy * pc.data[w.kz];
+
+    real u = cx * by - cy * bx;
+    real v = ax * cy - ay * cx;
+    real e = bx * ay - by * ax;
+    // an edge function of exactly 0 in floats is redone in doubles, so rays through an
+    // edge still come out on one side of it
+    if (sizeof(real) < sizeof(r64) && (u == 0.0 || v == 0.0 || e == 0.0)) {
+        u = (real)((r64)cx * by - (r64)cy * bx);
+        v = (real)((r64)ax * cy - (r64)ay * cx);
+        e = (real)((r64)bx * ay - (r64)by * ax);
+    }
+    if ((u < 0.0 || v < 0.0 || e < 0.0) && (u > 0.0 || v > 0.0 || e > 0.0)) return false;
 
-                colors[iii] = color;
-            }
+    real det = u + v + e;
+    if (det == 0.0) return false;
 
-            color3 avg(0.0, 0.0, 0.0);
+    real t = (u * w.sz * pa.data[w.kz] + v * w.sz * pb.data[w.kz] + e * w.sz * pc.data[w.kz]) / det;
+    if (!(t > tmin && t < *tmax)) return false;
+    *tmax = t;
+    return true;
+}
 
-            for(s32 iii =0 ; iii < RAYS_PER_PIXEL ; iii ++){
-                avg = avg + colors[iii] * 1.0 / RAYS_PER_PIXEL;
+// returns the closest triangle hit in (tmin, *tmax) or -1, lowering *tmax to it
+s32 mesh_hit(const mesh_t * mesh, const ray_t & ray, real tmin, real * tmax){
+    watertight_ray_t w = watertight_setup(ray.dir);
+    return bvh_traverse(&mesh->bvh, ray, tmin, tmax, [&](const bvh_node_t * node, real * t){
+        STAT(thread_stats.triangle_tests += node->count);
+        s32 nearest = -1;
+        for(s32 i = node->offset ; i < node->offset + node->count ; i++){
+            const u32 * tri = &mesh->triangles[3 * i];
+            if (triangle_hit(w, ray.point, &mesh->positions[3 * tri[0]], &mesh->positions[3 * tri[1]], &mesh->positions[3 * tri[2]], tmin, t)) {
+                nearest = i;
             }
-
-            image.pixels[image_width * i + ii] = color_to_pixel(avg, true);
         }
-    }
-
-    write_image("output.ppm", &image);
-    return 0;
+        return nearest;
+    });
 }
 
-inline r64 size(interval_t inv) {
-    return inv.max - inv.min;
+inline hit_t mesh_hit_record(const mesh_t * mesh, const ray_t & ray, s32 triangle, real t){
+    const u32 * tri = &mesh->triangles[3 * triangle];
+    const r32 * a = &mesh->positions[3 * tri[0]];
+    const r32 * b = &mesh->positions[3 * tri[1]];
+    const r32 * c = &mesh->positions[3 * tri[2]];
+    vec3 outward = normalize(cross(vec3(b[0] - a[0], b[1] - a[1], b[2] - a[2]), vec3(c[0] - a[0], c[1] - a[1], c[2] - a[2])));
+
+    hit_t hit = {};
+    hit.delta = t;
+    hit.point = at(ray, t);
+    hit.front_face = dot(ray.dir, outward) <= 0.0;
+    hit.normal = hit.front_face ? outward : -outward;
+    hit.material = mesh->material;
+    hit.slot = -1;
+    return hit;
 }
 
-inline bool contains(interval_t inv, r64 value) {
-    return inv.max >= value && inv.min <= value;
+struct mesh_build_t {
+    const mesh_t * mesh;
+    const compact_order_t * order;  // morton codes, mesh->triangles is sorted by them
+    const s32 * treelet_begin;      // into order, and one past the last treelet
+    const bvh_t * top;              // sah build over the treelets
+    bvh_node_t * nodes;
+    s32 node_count;
+    u32 * triangles;                // in leaf order, as the leaves are written
+    s32 slot;
+};
+
+static aabb_t mesh_triangle_bounds(const mesh_t * mesh, s32 triangle){
+    aabb_t box = aabb_empty();
+    for(s32 k = 0 ; k < 3 ; k++){
+        const r32 * p = &mesh->positions[3 * mesh->triangles[3 * triangle + k]];
+        box = aabb_grow(box, point3(p[0], p[1], p[2]));
+    }
+    return box;
 }
 
-inline bool surrounds(interval_t inv, r64 value)  {
-    return inv.max > value && inv.min < value;
+// where the highest bit the codes of [begin, end) differ in turns on, the spatial middle
+// of the range along that bit's axis. ranges of one code are split at their middle
+static s32 mesh_morton_split(const compact_order_t * order, s32 begin, s32 end, s32 * axis){
+    u64 differ = order[begin].key ^ order[end - 1].key;
+    if (differ == 0) {
+        *axis = 0;
+        return begin + (end - begin) / 2;
+    }
+    s32 bit = 63 - __builtin_clzll(differ);
+    *axis = bit % 3;
+
+    s32 low = begin + 1, high = end - 1;
+    while (low < high) {
+        s32 mid = (low + high) / 2;
+        if ((order[mid].key >> bit) & 1) high = mid;
+        else low = mid + 1;
+    }
+    return low;
 }
 
-inline r64 clamp(interval_t inv, r64 x) {
-    return clamp(inv.min, inv.max, x);
+// the morton ordered triangles cut into treelets of at most MESH_TREELET_SIZE
+static void mesh_treelets(const compact_order_t * order, s32 begin, s32 end, s32 * treelet_begin, s32 * treelet_count){
+    if (end - begin <= MESH_TREELET_SIZE) {
+        treelet_begin[(*treelet_count)++] = begin;
+        return;
+    }
+    s32 axis = 0;
+    s32 mid = mesh_morton_split(order, begin, end, &axis);
+    mesh_treelets(order, begin, mid, treelet_begin, treelet_count);
+    mesh_treelets(order, mid, end, treelet_begin, treelet_count);
 }
 
+static s32 mesh_interior_node(mesh_build_t * build, s32 node_index, s32 right, s32 axis){
+    bvh_node_t * node = &build->nodes[node_index];
+    node->bounds = aabb_union(build->nodes[node_index + 1].bounds, build->nodes[right].bounds);
+    node->offset = right;
+    node->count = 0;
+    node->axis = (u16) axis;
+    return node_index;
+}
 
-vec3::vec3(r64 x1, r64 x2, r64 x3){
+// the nodes of one treelet, split at morton bits down to MESH_LEAF_SIZE
+static s32 mesh_emit_range(mesh_build_t * build, s32 begin, s32 end, s32 depth){
+    s32 node_index = build->node_count++;
+    build->nodes[node_index] = {};
+
+    if (end - begin <= MESH_LEAF_SIZE || depth >= BVH_STACK_SIZE - 2) {
+        bvh_node_t * node = &build->nodes[node_index];
+        node->bounds = aabb_empty();
+        node->offset = build->slot;
+        node->count = (u16)(end - begin);
+        for(s32 i = begin ; i < end ; i++){
+            node->bounds = aabb_union(node->bounds, mesh_triangle_bounds(build->mesh, i));
+            memcpy(&build->triangles[3 * build->slot++], &build->mesh->triangles[3 * i], sizeof(u32) * 3);
+        }
+        return node_index;
+    }
+
+    // past the treelet budget only halving splits, they reach the leaves in a few levels
+    s32 axis = 0;
+    s32 mid = depth < BVH_STACK_SIZE - 8 ? mesh_morton_split(build->order, begin, end, &axis) : begin + (end - begin) / 2;
+    mesh_emit_range(build, begin, mid, depth + 1);
+    s32 right = mesh_emit_range(build, mid, end, depth + 1);
+    return mesh_interior_node(build, node_index, right, axis);
+}
+
+// a leaf of the sah build holds more than one treelet only when their centroids coincide
+static s32 mesh_emit_treelets(mesh_build_t * build, s32 first, s32 count, s32 depth){
+    if (count == 1) {
+        s32 treelet = build->top->indices[first];
+        return mesh_emit_range(build, build->treelet_begin[treelet], build->treelet_begin[treelet + 1], depth);
+    }
+    s32 node_index = build->node_count++;
+    build->nodes[node_index] = {};
+    mesh_emit_treelets(build, first, count / 2, depth + 1);
+    s32 right = mesh_emit_treelets(build, first + count / 2, count - count / 2, depth + 1);
+    return mesh_interior_node(build, node_index, right, 0);
+}
+
+// the sah build with the treelets expanded in place of its leaves
+static s32 mesh_emit_top(mesh_build_t * build, s32 top_node, s32 depth){
+    const bvh_node_t & node = build->top->nodes[top_node];
+    if (node.count > 0) return mesh_emit_treelets(build, node.offset, node.count, depth);
+
+    s32 node_index = build->node_count++;
+    build->nodes[node_index] = {};
+    mesh_emit_top(build, top_node + 1, depth + 1);
+    s32 right = mesh_emit_top(build, node.offset, depth + 1);
+    return mesh_interior_node(build, node_index, right, node.axis);
+}
+
+// the bvh over the triangles, which are reordered to its leaves. a binned sah build over
+// millions of triangles takes tens of seconds, so as in hlbvh the sah only places treelets
+// of up to MESH_TREELET_SIZE triangles that are runs of the morton order, and the levels
+// inside a treelet split at morton bits, which is a binary search each
+void build_mesh_bvh(mesh_t * mesh){
+    s32 count = mesh->triangle_count;
+    mesh->bvh = {};
+    if (count == 0) return;
+
+    aabb_t extent_box = aabb_empty();
+    for(s32 v = 0 ; v < mesh->vertex_count ; v++){
+        const r32 * p = &mesh->positions[3 * v];
+        extent_box = aabb_grow(extent_box, point3(p[0], p[1], p[2]));
+    }
+    // cubic cells, a flat mesh stretched to a cube would be split along its thin side
+    vec3 extent = extent_box.max - extent_box.min;
+    r64 largest = maximum(extent.x, maximum(extent.y, extent.z));
+    r64 cells = (r64)((1 << COMPACT_MORTON_BITS) - 1);
+
+    compact_order_t * order = (compact_order_t *) malloc(sizeof(compact_order_t) * count);
+    for(s32 i = 0 ; i < count ; i++){
+        u32 cell[3] = {};
+        for(s32 axis = 0 ; axis < 3 ; axis++){
+            r64 sum = 0.0;
+            for(s32 k = 0 ; k < 3 ; k++) sum += mesh->positions[3 * mesh->triangles[3 * i + k] + axis];
+            r64 t = largest > 0.0 ? (sum / 3.0 - extent_box.min.data[axis]) / largest : 0.0;
+            cell[axis] = (u32)(clamp(0.0, 1.0, t) * cells);
+        }
+        order[i].key = morton_code(cell[0], cell[1], cell[2]);
+        order[i].index = i;
+    }
+    qsort(order, count, sizeof(compact_order_t), compare_compact_order);
+
+    // the triangles in morton order too, so the passes below read them in order
+    u32 * sorted = (u32 *) malloc(sizeof(u32) * 3 * count);
+    for(s32 i = 0 ; i < count ; i++){
+        memcpy(&sorted[3 * i], &mesh->triangles[3 * order[i].index], sizeof(u32) * 3);
+    }
+    free(mesh->triangles);
+    mesh->triangles = sorted;
+
+    s32 treelet_count = 0;
+    s32 * treelet_begin = (s32 *) malloc(sizeof(s32) * (count + 1));
+    mesh_treelets(order, 0, count, treelet_begin, &treelet_count);
+    treelet_begin[treelet_count] = count;
+
+    aabb_t * bounds = (aabb_t *) malloc(sizeof(aabb_t) * treelet_count);
+    point3 * centroids = (point3 *) malloc(sizeof(point3) * treelet_count);
+    for(s32 t = 0 ; t < treelet_count ; t++){
+        aabb_t box = aabb_empty();
+        for(s32 i = treelet_begin[t] ; i < treelet_begin[t + 1] ; i++){
+            box = aabb_union(box, mesh_triangle_bounds(mesh, i));
+        }
+        bounds[t] = box;
+        centroids[t] = (box.min + box.max) * 0.5;
+    }
+
+    bvh_t top = {};
+    build_bvh(&top, bounds, centroids, treelet_count, 1, BVH_STACK_SIZE - 2 - MESH_TREELET_DEPTH);
+    free(bounds);
+    free(centroids);
+
+    // leaves hold at least a triangle, so there are fewer than 2 * count nodes
+    mesh_build_t build = {};
+    build.mesh = mesh;
+    build.order = order;
+    build.treelet_begin = treelet_begin;
+    build.top = &top;
+    build.nodes = (bvh_node_t *) malloc(sizeof(bvh_node_t) * 2 * count);
+    build.triangles = (u32 *) malloc(sizeof(u32) * 3 * count);
+    mesh_emit_top(&build, 0, 0);
+
+    destroy_bvh(&top);
+    free(treelet_begin);
+    free(order);
+
+    free(mesh->triangles);
+    mesh->triangles = build.triangles;
+    mesh->bvh.nodes = (bvh_node_t *) realloc(build.nodes, sizeof(bvh_node_t) * build.node_count);
+    mesh->bvh.node_count = build.node_count;
+}
+
+void destroy_mesh(mesh_t * mesh){
+    free(mesh->positions);
+    free(mesh->triangles);
+    destroy_bvh(&mesh->bvh);
+    free(mesh->file);
+    *mesh = {};
+}
+
+// @note: procedural sphere grids
+// a grid stores no spheres. every cell of an nx by nz field holds one sphere whose size,
+// place and material come from a hash of the cell index, worked out again whenever a ray
+// passes the cell, so a field of any size takes the same few hundred bytes. the sphere
+// stays inside its cell, which lets a 2d dda over the cells stop at the first sphere hit.
+// materials are drawn from a palette of GRID_PALETTE_SIZE made from the seed, with the
+// mix of the demo scene's field
+
+const s32 GRID_PALETTE_SIZE = 64;
+const r64 GRID_MIN_RADIUS = 0.1;     // in cells
+const r64 GRID_MAX_RADIUS = 0.25;
+
+struct sphere_grid_t {
+    point3 origin;       // corner of cell (0, 0), the spheres stand on its y
+    real cell;           // edge of a cell
+    s32 nx, nz;
+    u32 seed;
+    u32 palette[GRID_PALETTE_SIZE];    // scene material indices
+    aabb_t bounds;
+};
+
+struct grid_sphere_t {
+    point3 center;
+    real radius;
+    u32 palette_entry;
+};
+
+// uniform in [0, 1) from the high bits of a hash
+inline real hash_unit(u32 h){
+    return (real)((h >> 8) * (1.0 / 16777216.0));
+}
+
+inline grid_sphere_t grid_cell_sphere(const sphere_grid_t * grid, s32 i, s32 j){
+    u32 h = hash_u32(grid->seed ^ hash_u32((u32) i ^ hash_u32((u32) j)));
+    real size = GRID_MIN_RADIUS + (GRID_MAX_RADIUS - GRID_MIN_RADIUS) * hash_unit(hash_u32(h + 1));
+
+    grid_sphere_t sphere;
+    sphere.radius = size * grid->cell;
+    sphere.center = point3(
+        grid->origin.x + (i + size + (1.0 - 2.0 * size) * hash_unit(hash_u32(h + 2))) * grid->cell, 
+        grid->origin.y + sphere.radius, 
+        grid->origin.z + (j + size + (1.0 - 2.0 * size) * hash_unit(hash_u32(h + 3))) * grid->cell);
+    sphere.palette_entry = hash_u32(h + 4) % GRID_PALETTE_SIZE;
+    return sphere;
+}
+
+// the materials of a grid's palette, made from its seed
+void grid_palette(u32 seed, material_t * palette){
+    for(s32 k = 0 ; k < GRID_PALETTE_SIZE ; k++){
+        u32 h = hash_u32(seed ^ hash_u32(0x9e3779b9u + k));
+        real u[7];
+        for(s32 n = 0 ; n < 7 ; n++) u[n] = hash_unit(hash_u32(h + n));
+
+        material_t mat = {};
+        if (u[0] < 0.8) {
+            mat.type = Lambertian;
+            mat.lambertian.albedo = color3(u[1] * u[4], u[2] * u[5], u[3] * u[6]);
+        }
+        else if (u[0] < 0.95) {
+            mat.type = Metallic;
+            mat.metallic.albedo = color3(0.5 + 0.5 * u[1], 0.5 + 0.5 * u[2], 0.5 + 0.5 * u[3]);
+            mat.metallic.fuzziness = 0.5 * u[4];
+        }
+        else {
+            mat.type = Dielectric;
+            mat.dielectric.albedo = color3(1.0, 1.0, 1.0);
+            mat.dielectric.refractive = 1.5;
+        }
+        palette[k] = mat;
+    }
+}
+
+void create_sphere_grid(sphere_grid_t * grid, const point3 & origin, real cell, s32 nx, s32 nz, u32 seed){
+    *grid = {};
+    grid->origin = origin;
+    grid->cell = cell;
+    grid->nx = nx;
+    grid->nz = nz;
+    grid->seed = seed;
+    grid->bounds = {origin, origin + vec3(nx * cell, 2.0 * GRID_MAX_RADIUS * cell, nz * cell)};
+}
+
+// returns the cell, j * nx + i, whose sphere is hit first in (tmin, *tmax) or -1,
+// lowering *tmax to the hit
+s64 grid_hit(const sphere_grid_t * grid, const ray_t & ray, real tmin, real * tmax){
+    // the part of the ray inside the slab of the spheres
+    real t0 = tmin, t1 = *tmax;
+    for(s32 axis = 0 ; axis < 3 ; axis++){
+        real o = ray.point.data[axis], d = ray.dir.data[axis];
+        real lo = grid->bounds.min.data[axis], hi = grid->bounds.max.data[axis];
+        if (d == 0.0) {
+            if (o < lo || o > hi) return -1;
+            continue;
+        }
+        real ta = (lo - o) / d, tb = (hi - o) / d;
+        if (ta > tb) {
+            real temp = ta; ta = tb; tb = temp;
+        }
+        t0 = maximum(t0, ta);
+        t1 = minimum(t1, tb);
+        if (t0 > t1) return -1;
+    }
+
+    point3 entry = at(ray, t0);
+    s32 i = clamp(0, grid->nx - 1, (s32) floor((entry.x - grid->origin.x) / grid->cell));
+    s32 j = clamp(0, grid->nz - 1, (s32) floor((entry.z - grid->origin.z) / grid->cell));
+    s32 step_i = ray.dir.x > 0.0 ? 1 : -1;
+    s32 step_j = ray.dir.z > 0.0 ? 1 : -1;
+    real delta_x = ray.dir.x != 0.0 ? grid->cell / abs(ray.dir.x) : INF_POS;
+    real delta_z = ray.dir.z != 0.0 ? grid->cell / abs(ray.dir.z) : INF_POS;
+    real next_x = ray.dir.x != 0.0 ? (grid->origin.x + (i + (step_i > 0)) * grid->cell - ray.point.x) / ray.dir.x : INF_POS;
+    real next_z = ray.dir.z != 0.0 ? (grid->origin.z + (j + (step_j > 0)) * grid->cell - ray.point.z) / ray.dir.z : INF_POS;
+
+    real a = dot(ray.dir, ray.dir);
+    while (true) {
+        // near root only, as in sphere_soa_nearest
+        STAT(thread_stats.sphere_tests++);
+        grid_sphere_t sphere = grid_cell_sphere(grid, i, j);
+        vec3 oc = sphere.center - ray.point;
+        real h = dot(ray.dir, oc);
+        real discriminant = h * h - a * (dot(oc, oc) - sphere.radius * sphere.radius);
+        if (discriminant >= 0.0) {
+            real t = (h - sqrt(discriminant)) / a;
+            if (inrange(tmin, *tmax, t)) {
+                *tmax = t;
+                return (s64) j * grid->nx + i;
+            }
+        }
+
+        if (next_x < next_z) {
+            if (next_x > t1) break;
+            i += step_i;
+            if (i < 0 || i >= grid->nx) break;
+            next_x += delta_x;
+        }
+        else {
+            if (next_z > t1) break;
+            j += step_j;
+            if (j < 0 || j >= grid->nz) break;
+            next_z += delta_z;
+        }
+    }
+    return -1;
+}
+
+inline hit_t grid_hit_record(const sphere_grid_t * grid, const ray_t & ray, s64 cell, real t){
+    grid_sphere_t sphere = grid_cell_sphere(grid, (s32)(cell % grid->nx), (s32)(cell / grid->nx));
+    hit_t hit = create_hit_info_for_sphere(ray, t, sphere.center, sphere.radius, grid->palette[sphere.palette_entry]);
+    hit.slot = -1;
+    return hit;
+}
+
+// @note: instances
+// an object is a scene of its own, loaded once with its own acceleration structure, and
+// an instance places it with a translation, a uniform scale and a turn about y. rays are
+// taken into the object's space instead of the object into the world's, so any number of
+// instances share the object's memory. the direction is not renormalized, which keeps t
+// the same in both spaces. instances have a bvh of their own over their world bounds,
+// and objects may hold instances of other objects in turn
+
+struct scene_t;
+
+const s32 OBJECT_MAX_DEPTH = 8;
+
+struct object_t {
+    char name[64];
+    char * file;             // absolute, to write the scene back
+    scene_t * scene;
+    u32 * material_remap;    // from the object's material table to the scene's
+};
+
+struct instance_t {
+    point3 offset;
+    real scale;
+    real yaw;                // degrees
+    real cos_yaw, sin_yaw;
+    s32 object;
+};
+
+inline instance_t create_instance(s32 object, const point3 & offset, real scale, real yaw){
+    instance_t instance = {};
+    instance.object = object;
+    instance.offset = offset;
+    instance.scale = scale;
+    instance.yaw = yaw;
+    instance.cos_yaw = cos(degrees_to_radians(yaw));
+    instance.sin_yaw = sin(degrees_to_radians(yaw));
+    return instance;
+}
+
+// world = offset + scale * turn(object), the turn taking +x toward -z
+inline vec3 instance_turn(const instance_t & instance, const vec3 & v){
+    return vec3(instance.cos_yaw * v.x + instance.sin_yaw * v.z, v.y, -instance.sin_yaw * v.x + instance.cos_yaw * v.z);
+}
+
+inline vec3 instance_unturn(const instance_t & instance, const vec3 & v){
+    return vec3(instance.cos_yaw * v.x - instance.sin_yaw * v.z, v.y, instance.sin_yaw * v.x + instance.cos_yaw * v.z);
+}
+
+inline ray_t instance_ray(const instance_t & instance, const ray_t & ray){
+    real inverse = 1.0 / instance.scale;
+    return ray_t(instance_unturn(instance, ray.point - instance.offset) * inverse, instance_unturn(instance, ray.dir) * inverse);
+}
+
+// the world box around the object's box
+inline aabb_t instance_bounds(const instance_t & instance, const aabb_t & object_bounds){
+    aabb_t box = aabb_empty();
+    for(s32 corner = 0 ; corner < 8 ; corner++){
+        vec3 p = vec3(
+            corner & 1 ? object_bounds.max.x : object_bounds.min.x, 
+            corner & 2 ? object_bounds.max.y : object_bounds.min.y, 
+            corner & 4 ? object_bounds.max.z : object_bounds.min.z);
+        box = aabb_grow(box, instance.offset + instance_turn(instance, p) * instance.scale);
+    }
+    return box;
+}
+
+struct scene_t {
+    entity_t * entities;
+    s32 entity_count;
+    material_table_t entity_materials;    // the table entity spheres index
+
+    camera_desc_t camera;
+
+    // render side copy of the spheres, in bvh leaf order when a bvh is built. a compact
+    // scene keeps only spheres.count and holds the spheres in compact instead
+    sphere_soa_t spheres;
+    u32 * material_index;    // one per sphere slot
+    compact_spheres_t compact;
+
+    mesh_t * meshes;         // material indices into the same table
+    s32 mesh_count;
+    sphere_grid_t * grids;
+    s32 grid_count;
+    object_t * objects;
+    s32 object_count;
+    instance_t * instances;  // in leaf order of instance_bvh
+    s32 instance_count;
+    bvh_t instance_bvh;
+    material_t * materials;
+    s32 material_count;
+
+    // slots of the emissive spheres, rebuilt whenever the slots are. always on the heap
+    s32 * lights;
+    s32 light_count;
+
+    accel_type accel;
+    bvh_t bvh;
+
+    // set when the arrays above point into a mapped scene file instead of the heap
+    void * mapping;
+    u64 mapping_size;
+};
+
+// a sphere slot of either storage, for the code off the intersection path
+inline point3 scene_sphere_center(const scene_t * scene, s32 slot){
+    if (scene->accel == AccelCompact) {
+        return compact_center(compact_cluster_of(&scene->compact, slot), &scene->compact.offsets[3 * slot]);
+    }
+    return point3(scene->spheres.center_x[slot], scene->spheres.center_y[slot], scene->spheres.center_z[slot]);
+}
+
+inline real scene_sphere_radius(const scene_t * scene, s32 slot){
+    if (scene->accel == AccelCompact) return scene->compact.radii[scene->compact.radius_index[slot]];
+    return scene->spheres.radius[slot];
+}
+
+inline u32 scene_sphere_material(const scene_t * scene, s32 slot){
+    if (scene->accel == AccelCompact) return scene->compact.material_index[slot];
+    return scene->material_index[slot];
+}
+
+// the spheres in slot order, malloc'ed
+sphere_desc_t * scene_sphere_descs(const scene_t * scene){
+    s32 count = scene->spheres.count;
+    sphere_desc_t * spheres = (sphere_desc_t *) malloc(sizeof(sphere_desc_t) * (count > 0 ? count : 1));
+    for(s32 slot = 0 ; slot < count ; slot++){
+        spheres[slot].center = scene_sphere_center(scene, slot);
+        spheres[slot].radius = scene_sphere_radius(scene, slot);
+        spheres[slot].material = scene_sphere_material(scene, slot);
+    }
+    return spheres;
+}
+
+// bytes the renderer's copy of the geometry takes: sphere arrays or their compact
+// encoding, and the bvh
+u64 scene_geometry_bytes(const scene_t * scene){
+    u64 bytes = (u64) scene->bvh.node_count * sizeof(bvh_node_t) + (u64) scene->bvh.index_count * sizeof(s32);
+    if (scene->accel == AccelCompact) {
+        const compact_spheres_t & compact = scene->compact;
+        bytes += (u64) compact.cluster_count * sizeof(compact_cluster_t);
+        bytes += (u64) scene->spheres.count * (3 * sizeof(u16) + sizeof(u16) + sizeof(u32));
+        bytes += (u64) compact.radius_count * sizeof(real);
+    }
+    else {
+        bytes += (u64) scene->spheres.capacity * (4 * sizeof(real) + sizeof(u32));
+    }
+    return bytes;
+}
+
+// what the scene holds in memory beyond the spheres: meshes, grids, instances, and
+// every object once however often it is placed
+u64 scene_memory_bytes(const scene_t * scene){
+    u64 bytes = scene_geometry_bytes(scene);
+    for(s32 m = 0 ; m < scene->mesh_count ; m++){
+        const mesh_t & mesh = scene->meshes[m];
+        bytes += (u64) mesh.vertex_count * 3 * sizeof(r32) + (u64) mesh.triangle_count * 3 * sizeof(u32) + 
+            (u64) mesh.bvh.node_count * sizeof(bvh_node_t);
+    }
+    bytes += (u64) scene->grid_count * sizeof(sphere_grid_t);
+    bytes += (u64) scene->instance_count * sizeof(instance_t) + (u64) scene->instance_bvh.node_count * sizeof(bvh_node_t);
+    for(s32 o = 0 ; o < scene->object_count ; o++){
+        bytes += sizeof(object_t) + scene_memory_bytes(scene->objects[o].scene);
+    }
+    return bytes;
+}
+
+// the spheres and triangles the scene stands for, every instance counting its object's
+r64 scene_primitive_count(const scene_t * scene){
+    r64 count = scene->spheres.count;
+    for(s32 m = 0 ; m < scene->mesh_count ; m++){
+        count += scene->meshes[m].triangle_count;
+    }
+    for(s32 g = 0 ; g < scene->grid_count ; g++){
+        count += (r64) scene->grids[g].nx * scene->grids[g].nz;
+    }
+    for(s32 i = 0 ; i < scene->instance_count ; i++){
+        count += scene_primitive_count(scene->objects[scene->instances[i].object].scene);
+    }
+    return count;
+}
+
+void build_light_list(scene_t * scene){
+    s32 count = 0;
+    for(s32 slot = 0 ; slot < scene->spheres.count ; slot++){
+        if (scene->materials[scene_sphere_material(scene, slot)].type == Emissive) count++;
+    }
+
+    free(scene->lights);
+    scene->lights = (s32 *) malloc(sizeof(s32) * (count > 0 ? count : 1));
+    scene->light_count = 0;
+    for(s32 slot = 0 ; slot < scene->spheres.count ; slot++){
+        if (scene->materials[scene_sphere_material(scene, slot)].type == Emissive) scene->lights[scene->light_count++] = slot;
+    }
+}
+
+void build_scene(scene_t * scene, const sphere_desc_t * spheres, s32 sphere_count, const material_t * materials, s32 material_count, accel_type accel){
+    s32 * order = NULL;
+
+    // duplicates in the incoming table collapse into one entry, remap[] follows them
+    material_table_t table = {};
+    u32 * remap = (u32 *) malloc(sizeof(u32) * (material_count > 0 ? material_count : 1));
+    for(s32 i = 0 ; i < material_count ; i++){
+        remap[i] = material_table_add(&table, materials[i]);
+    }
+
+    if (accel == AccelCompact && !build_compact_spheres(&scene->compact, &scene->bvh, spheres, sphere_count, remap)) {
+        fprintf(stderr, "compact: more than %d distinct radii, using the plain bvh\n", COMPACT_PALETTE_SIZE);
+        accel = AccelBVH;
+    }
+
+    scene->accel = accel;
+    if (accel == AccelBVH) {
+        aabb_t * bounds = (aabb_t *) malloc(sizeof(aabb_t) * (sphere_count > 0 ? sphere_count : 1));
+        point3 * centroids = (point3 *) malloc(sizeof(point3) * (sphere_count > 0 ? sphere_count : 1));
+        for(s32 i = 0 ; i < sphere_count ; i++){
+            vec3 r = vec3(spheres[i].radius, spheres[i].radius, spheres[i].radius);
+            bounds[i] = {spheres[i].center - r, spheres[i].center + r};
+            centroids[i] = spheres[i].center;
+        }
+
+        build_bvh(&scene->bvh, bounds, centroids, sphere_count);
+        order = scene->bvh.indices;
+
+        free(bounds);
+        free(centroids);
+    }
+
+    if (accel == AccelCompact) {
+        scene->spheres.count = sphere_count;
+    }
+    else {
+        create_sphere_soa(&scene->spheres, sphere_count);
+        scene->material_index = (u32 *) aligned_malloc(sizeof(u32) * scene->spheres.capacity);
+        for(s32 i = 0 ; i < sphere_count ; i++){
+            const sphere_desc_t & sphere = spheres[order ? order[i] : i];
+            scene->spheres.center_x[i] = sphere.center.x;
+            scene->spheres.center_y[i] = sphere.center.y;
+            scene->spheres.center_z[i] = sphere.center.z;
+            scene->spheres.radius[i] = sphere.radius;
+            scene->material_index[i] = remap[sphere.material];
+        }
+        for(s32 i = sphere_count ; i < scene->spheres.capacity ; i++){
+            scene->material_index[i] = 0;
+        }
+    }
+
+    scene->material_count = table.count;
+    scene->materials = (material_t *) aligned_malloc(sizeof(material_t) * (table.count > 0 ? table.count : 1));
+    memcpy(scene->materials, table.materials, sizeof(material_t) * table.count);
+
+    free(remap);
+    destroy_material_table(&table);
+
+    build_light_list(scene);
+}
+
+// the spheres of scene->entities over the table they index
+void build_scene_from_entities(scene_t * scene, accel_type accel){
+    s32 count = scene->entity_count > 0 ? scene->entity_count : 1;
+    sphere_desc_t * spheres = (sphere_desc_t *) malloc(sizeof(sphere_desc_t) * count);
+
+    s32 sphere_count = 0;
+    for(s32 i = 0 ; i < scene->entity_count ; i++){
+        if (scene->entities[i].type != Sphere) continue;
+        const sphere_t & sphere = scene->entities[i].sphere;
+        spheres[sphere_count].center = sphere.center;
+        spheres[sphere_count].radius = sphere.radius;
+        spheres[sphere_count].material = sphere.material;
+        sphere_count++;
+    }
+
+    build_scene(scene, spheres, sphere_count, scene->entity_materials.materials, scene->entity_materials.count, accel);
+
+    free(spheres);
+}
+
+void destroy_scene(scene_t * scene){
+    if (scene->mapping) {
+        // arrays live in the mapping, only a bvh built after loading is on the heap
+        if (scene->bvh.indices) destroy_bvh(&scene->bvh);
+        munmap(scene->mapping, scene->mapping_size);
+    }
+    else {
+        destroy_bvh(&scene->bvh);
+        destroy_sphere_soa(&scene->spheres);
+        destroy_compact_spheres(&scene->compact);
+        free(scene->material_index);
+        free(scene->materials);
+    }
+    for(s32 m = 0 ; m < scene->mesh_count ; m++){
+        destroy_mesh(&scene->meshes[m]);
+    }
+    free(scene->meshes);
+    free(scene->grids);
+    for(s32 o = 0 ; o < scene->object_count ; o++){
+        destroy_scene(scene->objects[o].scene);
+        free(scene->objects[o].scene);
+        free(scene->objects[o].material_remap);
+        free(scene->objects[o].file);
+    }
+    free(scene->objects);
+    free(scene->instances);
+    destroy_bvh(&scene->instance_bvh);
+    free(scene->lights);
+    free(scene->entities);
+    destroy_material_table(&scene->entity_materials);
+    *scene = {};
+}
+
+// the box around everything the scene holds, from the roots of its trees
+aabb_t scene_bounds(const scene_t * scene){
+    aabb_t bounds = aabb_empty();
+    if (scene->accel != AccelNone && scene->bvh.node_count > 0) {
+        bounds = scene->bvh.nodes[0].bounds;
+    }
+    else {
+        for(s32 i = 0 ; i < scene->spheres.count ; i++){
+            vec3 r = vec3(scene->spheres.radius[i], scene->spheres.radius[i], scene->spheres.radius[i]);
+            point3 center = point3(scene->spheres.center_x[i], scene->spheres.center_y[i], scene->spheres.center_z[i]);
+            bounds = aabb_union(bounds, {center - r, center + r});
+        }
+    }
+    for(s32 m = 0 ; m < scene->mesh_count ; m++){
+        if (scene->meshes[m].bvh.node_count > 0) bounds = aabb_union(bounds, scene->meshes[m].bvh.nodes[0].bounds);
+    }
+    for(s32 g = 0 ; g < scene->grid_count ; g++){
+        bounds = aabb_union(bounds, scene->grids[g].bounds);
+    }
+    if (scene->instance_bvh.node_count > 0) {
+        bounds = aabb_union(bounds, scene->instance_bvh.nodes[0].bounds);
+    }
+    return bounds;
+}
+
+// builds the bvh over scene->instances and puts them in its leaf order. instances of an
+// empty object are dropped, their box would swallow the tree
+void build_instance_bvh(scene_t * scene){
+    destroy_bvh(&scene->instance_bvh);
+
+    s32 count = scene->instance_count > 0 ? scene->instance_count : 1;
+    aabb_t * bounds = (aabb_t *) malloc(sizeof(aabb_t) * count);
+    point3 * centroids = (point3 *) malloc(sizeof(point3) * count);
+    s32 kept = 0;
+    for(s32 i = 0 ; i < scene->instance_count ; i++){
+        aabb_t object_bounds = scene_bounds(scene->objects[scene->instances[i].object].scene);
+        if (object_bounds.min.x > object_bounds.max.x) continue;
+        scene->instances[kept] = scene->instances[i];
+        bounds[kept] = instance_bounds(scene->instances[i], object_bounds);
+        centroids[kept] = (bounds[kept].min + bounds[kept].max) * 0.5;
+        kept++;
+    }
+    scene->instance_count = kept;
+
+    if (kept > 0) {
+        build_bvh(&scene->instance_bvh, bounds, centroids, kept);
+        instance_t * ordered = (instance_t *) malloc(sizeof(instance_t) * kept);
+        for(s32 i = 0 ; i < kept ; i++){
+            ordered[i] = scene->instances[scene->instance_bvh.indices[i]];
+        }
+        free(scene->instances);
+        scene->instances = ordered;
+    }
+
+    free(bounds);
+    free(centroids);
+}
+
+inline hit_t scene_hit_record(const scene_t * scene, const ray_t & ray, s32 slot, real t){
+    hit_t hit = create_hit_info_for_sphere(ray, t, scene_sphere_center(scene, slot), scene_sphere_radius(scene, slot), scene_sphere_material(scene, slot));
+    hit.slot = slot;
+    return hit;
+}
+
+// scene queries made by the calling thread, workers hand theirs to the job for rays/s
+thread_local u64 rays_traced = 0;
+
+bool scene_query(const scene_t * scene, const ray_t & ray, real tmin, real tmax, hit_t * minhit);
+
+// the shapes other than the scene's own spheres: meshes, grids and instances. each only
+// passes where it is closer than *tmax, which is lowered to the hit
+bool scene_hit_shapes(const scene_t * scene, const ray_t & ray, real tmin, real * tmax, hit_t * minhit){
+    s32 mesh = -1, triangle = -1;
+    for(s32 m = 0 ; m < scene->mesh_count ; m++){
+        s32 t = mesh_hit(&scene->meshes[m], ray, tmin, tmax);
+        if (t >= 0) {
+            mesh = m;
+            triangle = t;
+        }
+    }
+
+    s32 grid = -1;
+    s64 cell = -1;
+    for(s32 g = 0 ; g < scene->grid_count ; g++){
+        s64 c = grid_hit(&scene->grids[g], ray, tmin, tmax);
+        if (c >= 0) {
+            grid = g;
+            cell = c;
+        }
+    }
+
+    // an instance's record is made inside its object while the ray is in object space, so
+    // it is kept from the traversal rather than made again after it
+    if (scene->instance_count > 0) {
+        hit_t record;
+        s32 instance = bvh_traverse(&scene->instance_bvh, ray, tmin, tmax, [&](const bvh_node_t * node, real * t){
+            s32 nearest = -1;
+            for(s32 i = node->offset ; i < node->offset + node->count ; i++){
+                const instance_t & instance = scene->instances[i];
+                hit_t hit;
+                if (!scene_query(scene->objects[instance.object].scene, instance_ray(instance, ray), tmin, *t, &hit)) continue;
+                *t = hit.delta;
+                record = hit;
+                nearest = i;
+            }
+            return nearest;
+        });
+        if (instance >= 0) {
+            const instance_t & placed = scene->instances[instance];
+            record.point = at(ray, record.delta);
+            record.normal = instance_turn(placed, record.normal);
+            record.material = scene->objects[placed.object].material_remap[record.material];
+            record.slot = -1;
+            *minhit = record;
+            return true;
+        }
+    }
+
+    if (grid >= 0) {
+        *minhit = grid_hit_record(&scene->grids[grid], ray, cell, *tmax);
+        return true;
+    }
+    if (mesh >= 0) {
+        *minhit = mesh_hit_record(&scene->meshes[mesh], ray, triangle, *tmax);
+        return true;
+    }
+    return false;
+}
+
+inline bool scene_has_shapes(const scene_t * scene){
+    return scene->mesh_count > 0 || scene->grid_count > 0 || scene->instance_count > 0;
+}
+
+// scene_hit without the count, for the objects of instances
+bool scene_query(const scene_t * scene, const ray_t & ray, real tmin, real tmax, hit_t * minhit){
+    s32 slot = -1;
+    if (scene->accel == AccelBVH) {
+        slot = bvh_hit(&scene->bvh, &scene->spheres, ray, tmin, &tmax);
+    } else if (scene->accel == AccelCompact) {
+        slot = compact_hit(&scene->bvh, &scene->compact, ray, tmin, &tmax);
+    } else {
+        slot = sphere_soa_nearest(&scene->spheres, 0, scene->spheres.count, ray, tmin, &tmax);
+    }
+
+    if (scene_has_shapes(scene) && scene_hit_shapes(scene, ray, tmin, &tmax, minhit)) return true;
+    if (slot < 0) return false;
+
+    // only the winning sphere pays for the hit record
+    *minhit = scene_hit_record(scene, ray, slot, tmax);
+    return true;
+}
+
+bool scene_hit(const scene_t * scene, const ray_t & ray, real tmin, real tmax, hit_t * minhit){
+    rays_traced++;
+    return scene_query(scene, ray, tmin, tmax, minhit);
+}
+
+// @note: coherent ray packets
+// the camera samples of one pixel leave from nearly the same point in nearly the same
+// direction, so they walk the bvh together: every per ray quantity is an array over the
+// packet and the kernels step through it one simd vector of rays at a time. a node is
+// first tested with interval arithmetic against the whole packet (one test culls it for
+// every ray) and only then lane by lane
+
+// thin wrappers over the widest vector of real the target has, so the packet kernels
+// below are written once. a lane mask is whatever the compare of that width returns.
+// sphere slots ride along as integers as wide as real, a float could not hold them
+#ifdef RT_FLOAT
+typedef s32 lane_index_t;
+#else
+typedef s64 lane_index_t;
+#endif
+
+#if defined(__AVX512F__) && defined(RT_FLOAT)
+const s32 PACKET_LANES = 16;
+typedef __m512 lanes_t;
+typedef __mmask16 lane_mask_t;
+inline lanes_t lanes_load(const real * p){ return _mm512_loadu_ps(p); }
+inline void lanes_store(real * p, lanes_t v){ _mm512_storeu_ps(p, v); }
+inline lanes_t lanes_set(real v){ return _mm512_set1_ps(v); }
+inline lanes_t lanes_add(lanes_t a, lanes_t b){ return _mm512_add_ps(a, b); }
+inline lanes_t lanes_sub(lanes_t a, lanes_t b){ return _mm512_sub_ps(a, b); }
+inline lanes_t lanes_mul(lanes_t a, lanes_t b){ return _mm512_mul_ps(a, b); }
+inline lanes_t lanes_div(lanes_t a, lanes_t b){ return _mm512_div_ps(a, b); }
+inline lanes_t lanes_sqrt(lanes_t a){ return _mm512_sqrt_ps(a); }
+inline lanes_t lanes_min(lanes_t a, lanes_t b){ return _mm512_min_ps(a, b); }
+inline lanes_t lanes_max(lanes_t a, lanes_t b){ return _mm512_max_ps(a, b); }
+inline lane_mask_t lanes_lt(lanes_t a, lanes_t b){ return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+inline lane_mask_t lanes_le(lanes_t a, lanes_t b){ return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+inline lane_mask_t mask_and(lane_mask_t a, lane_mask_t b){ return a & b; }
+inline bool mask_any(lane_mask_t m){ return m != 0; }
+inline lanes_t lanes_select(lane_mask_t m, lanes_t a, lanes_t b){ return _mm512_mask_blend_ps(m, b, a); }
+inline void lanes_store_index(lane_index_t * p, lane_mask_t m, lane_index_t v){ _mm512_mask_storeu_epi32(p, m, _mm512_set1_epi32(v)); }
+#elif defined(__AVX512F__)
+const s32 PACKET_LANES = 8;
+typedef __m512d lanes_t;
+typedef __mmask8 lane_mask_t;
+inline lanes_t lanes_load(const real * p){ return _mm512_loadu_pd(p); }
+inline void lanes_store(real * p, lanes_t v){ _mm512_storeu_pd(p, v); }
+inline lanes_t lanes_set(real v){ return _mm512_set1_pd(v); }
+inline lanes_t lanes_add(lanes_t a, lanes_t b){ return _mm512_add_pd(a, b); }
+inline lanes_t lanes_sub(lanes_t a, lanes_t b){ return _mm512_sub_pd(a, b); }
+inline lanes_t lanes_mul(lanes_t a, lanes_t b){ return _mm512_mul_pd(a, b); }
+inline lanes_t lanes_div(lanes_t a, lanes_t b){ return _mm512_div_pd(a, b); }
+inline lanes_t lanes_sqrt(lanes_t a){ return _mm512_sqrt_pd(a); }
+inline lanes_t lanes_min(lanes_t a, lanes_t b){ return _mm512_min_pd(a, b); }
+inline lanes_t lanes_max(lanes_t a, lanes_t b){ return _mm512_max_pd(a, b); }
+inline lane_mask_t lanes_lt(lanes_t a, lanes_t b){ return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+inline lane_mask_t lanes_le(lanes_t a, lanes_t b){ return _mm512_cmp_pd_mask(a, b, _CMP_LE_OQ); }
+inline lane_mask_t mask_and(lane_mask_t a, lane_mask_t b){ return a & b; }
+inline bool mask_any(lane_mask_t m){ return m != 0; }
+inline lanes_t lanes_select(lane_mask_t m, lanes_t a, lanes_t b){ return _mm512_mask_blend_pd(m, b, a); }
+inline void lanes_store_index(lane_index_t * p, lane_mask_t m, lane_index_t v){ _mm512_mask_storeu_epi64(p, m, _mm512_set1_epi64(v)); }
+#elif defined(__AVX2__) && defined(RT_FLOAT)
+const s32 PACKET_LANES = 8;
+typedef __m256 lanes_t;
+typedef __m256 lane_mask_t;
+inline lanes_t lanes_load(const real * p){ return _mm256_loadu_ps(p); }
+inline void lanes_store(real * p, lanes_t v){ _mm256_storeu_ps(p, v); }
+inline lanes_t lanes_set(real v){ return _mm256_set1_ps(v); }
+inline lanes_t lanes_add(lanes_t a, lanes_t b){ return _mm256_add_ps(a, b); }
+inline lanes_t lanes_sub(lanes_t a, lanes_t b){ return _mm256_sub_ps(a, b); }
+inline lanes_t lanes_mul(lanes_t a, lanes_t b){ return _mm256_mul_ps(a, b); }
+inline lanes_t lanes_div(lanes_t a, lanes_t b){ return _mm256_div_ps(a, b); }
+inline lanes_t lanes_sqrt(lanes_t a){ return _mm256_sqrt_ps(a); }
+inline lanes_t lanes_min(lanes_t a, lanes_t b){ return _mm256_min_ps(a, b); }
+inline lanes_t lanes_max(lanes_t a, lanes_t b){ return _mm256_max_ps(a, b); }
+inline lane_mask_t lanes_lt(lanes_t a, lanes_t b){ return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline lane_mask_t lanes_le(lanes_t a, lanes_t b){ return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline lane_mask_t mask_and(lane_mask_t a, lane_mask_t b){ return _mm256_and_ps(a, b); }
+inline bool mask_any(lane_mask_t m){ return _mm256_movemask_ps(m) != 0; }
+inline lanes_t lanes_select(lane_mask_t m, lanes_t a, lanes_t b){ return _mm256_blendv_ps(b, a, m); }
+inline void lanes_store_index(lane_index_t * p, lane_mask_t m, lane_index_t v){ _mm256_maskstore_epi32((int *) p, _mm256_castps_si256(m), _mm256_set1_epi32(v)); }
+#elif defined(__AVX2__)
+const s32 PACKET_LANES = 4;
+typedef __m256d lanes_t;
+typedef __m256d lane_mask_t;
+inline lanes_t lanes_load(const real * p){ return _mm256_loadu_pd(p); }
+inline void lanes_store(real * p, lanes_t v){ _mm256_storeu_pd(p, v); }
+inline lanes_t lanes_set(real v){ return _mm256_set1_pd(v); }
+inline lanes_t lanes_add(lanes_t a, lanes_t b){ return _mm256_add_pd(a, b); }
+inline lanes_t lanes_sub(lanes_t a, lanes_t b){ return _mm256_sub_pd(a, b); }
+inline lanes_t lanes_mul(lanes_t a, lanes_t b){ return _mm256_mul_pd(a, b); }
+inline lanes_t lanes_div(lanes_t a, lanes_t b){ return _mm256_div_pd(a, b); }
+inline lanes_t lanes_sqrt(lanes_t a){ return _mm256_sqrt_pd(a); }
+inline lanes_t lanes_min(lanes_t a, lanes_t b){ return _mm256_min_pd(a, b); }
+inline lanes_t lanes_max(lanes_t a, lanes_t b){ return _mm256_max_pd(a, b); }
+inline lane_mask_t lanes_lt(lanes_t a, lanes_t b){ return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+inline lane_mask_t lanes_le(lanes_t a, lanes_t b){ return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+inline lane_mask_t mask_and(lane_mask_t a, lane_mask_t b){ return _mm256_and_pd(a, b); }
+inline bool mask_any(lane_mask_t m){ return _mm256_movemask_pd(m) != 0; }
+inline lanes_t lanes_select(lane_mask_t m, lanes_t a, lanes_t b){ return _mm256_blendv_pd(b, a, m); }
+inline void lanes_store_index(lane_index_t * p, lane_mask_t m, lane_index_t v){ _mm256_maskstore_epi64((long long *) p, _mm256_castpd_si256(m), _mm256_set1_epi64x(v)); }
+#else
+const s32 PACKET_LANES = 1;
+typedef real lanes_t;
+typedef bool lane_mask_t;
+inline lanes_t lanes_load(const real * p){ return *p; }
+inline void lanes_store(real * p, lanes_t v){ *p = v; }
+inline lanes_t lanes_set(real v){ return v; }
+inline lanes_t lanes_add(lanes_t a, lanes_t b){ return a + b; }
+inline lanes_t lanes_sub(lanes_t a, lanes_t b){ return a - b; }
+inline lanes_t lanes_mul(lanes_t a, lanes_t b){ return a * b; }
+inline lanes_t lanes_div(lanes_t a, lanes_t b){ return a / b; }
+inline lanes_t lanes_sqrt(lanes_t a){ return sqrt(a); }
+inline lanes_t lanes_min(lanes_t a, lanes_t b){ return a < b ? a : b; }
+inline lanes_t lanes_max(lanes_t a, lanes_t b){ return a > b ? a : b; }
+inline lane_mask_t lanes_lt(lanes_t a, lanes_t b){ return a < b; }
+inline lane_mask_t lanes_le(lanes_t a, lanes_t b){ return a <= b; }
+inline lane_mask_t mask_and(lane_mask_t a, lane_mask_t b){ return a && b; }
+inline bool mask_any(lane_mask_t m){ return m; }
+inline lanes_t lanes_select(lane_mask_t m, lanes_t a, lanes_t b){ return m ? a : b; }
+inline void lanes_store_index(lane_index_t * p, lane_mask_t m, lane_index_t v){ if (m) *p = v; }
+#endif
+
+const s32 MAX_PACKET_SIZE = 16;
+
+// the lane arrays hold at least one full simd vector, the kernels always step a whole
+// vector at a time even when the packet is narrower
+template<s32 N>
+struct ray_packet_t {
+    static const s32 WIDTH = N < PACKET_LANES ? PACKET_LANES : N;
+
+    real ox[WIDTH], oy[WIDTH], oz[WIDTH];
+    real dx[WIDTH], dy[WIDTH], dz[WIDTH];
+    real ix[WIDTH], iy[WIDTH], iz[WIDTH];  // inverse directions
+    real a[WIDTH];                         // dot(dir, dir)
+    real tmax[WIDTH];
+    lane_index_t slot[WIDTH];              // sphere slot per lane, -1 while nothing was hit
+
+    // bounds of the origins and inverse directions over the packet, valid on the axes
+    // where all directions share a sign
+    real origin_min[3], origin_max[3];
+    real inv_min[3], inv_max[3];
+    bool same_sign[3];
+    s32 negative[3];
+};
+
+// fills the first count lanes with rays and repeats the first ray into the rest
+template<s32 N>
+void create_ray_packet(ray_packet_t<N> * packet, const ray_t * rays, s32 count){
+    for(s32 l = 0 ; l < ray_packet_t<N>::WIDTH ; l++){
+        const ray_t & ray = rays[l < count ? l : 0];
+        packet->ox[l] = ray.point.x; packet->oy[l] = ray.point.y; packet->oz[l] = ray.point.z;
+        packet->dx[l] = ray.dir.x; packet->dy[l] = ray.dir.y; packet->dz[l] = ray.dir.z;
+        packet->ix[l] = 1.0 / ray.dir.x; packet->iy[l] = 1.0 / ray.dir.y; packet->iz[l] = 1.0 / ray.dir.z;
+        packet->a[l] = dot(ray.dir, ray.dir);
+        packet->tmax[l] = INF_POS;
+        packet->slot[l] = -1;
+    }
+
+    const real * origins[3] = {packet->ox, packet->oy, packet->oz};
+    const real * inverses[3] = {packet->ix, packet->iy, packet->iz};
+    for(s32 axis = 0 ; axis < 3 ; axis++){
+        real omin = INF_POS, omax = INF_NEG, imin = INF_POS, imax = INF_NEG;
+        for(s32 l = 0 ; l < N ; l++){
+            omin = minimum(omin, origins[axis][l]);
+            omax = maximum(omax, origins[axis][l]);
+            imin = minimum(imin, inverses[axis][l]);
+            imax = maximum(imax, inverses[axis][l]);
+        }
+        packet->origin_min[axis] = omin;
+        packet->origin_max[axis] = omax;
+        packet->inv_min[axis] = imin;
+        packet->inv_max[axis] = imax;
+        packet->same_sign[axis] = (imin > 0.0) == (imax > 0.0) && isfinite(imin) && isfinite(imax);
+        packet->negative[axis] = imax < 0.0;
+    }
+}
+
+inline void interval_mul(real a0, real a1, real b0, real b1, real * lo, real * hi){
+    real p0 = a0 * b0, p1 = a0 * b1, p2 = a1 * b0, p3 = a1 * b1;
+    *lo = minimum(minimum(p0, p1), minimum(p2, p3));
+    *hi = maximum(maximum(p0, p1), maximum(p2, p3));
+}
+
+// conservative: false only if no ray of the packet can enter the box in (tmin, tmax_bound)
+template<s32 N>
+bool packet_interval_hit(const ray_packet_t<N> * packet, const aabb_t & box, real tmin, real tmax_bound){
+    real entry = tmin, exit = tmax_bound;
+    for(s32 axis = 0 ; axis < 3 ; axis++){
+        if (!packet->same_sign[axis]) return true;
+
+        real near_plane = packet->negative[axis] ? box.max.data[axis] : box.min.data[axis];
+        real far_plane = packet->negative[axis] ? box.min.data[axis] : box.max.data[axis];
+
+        real lo, hi, temp;
+        interval_mul(near_plane - packet->origin_max[axis], near_plane - packet->origin_min[axis], packet->inv_min[axis], packet->inv_max[axis], &lo, &temp);
+        interval_mul(far_plane - packet->origin_max[axis], far_plane - packet->origin_min[axis], packet->inv_min[axis], packet->inv_max[axis], &temp, &hi);
+        entry = maximum(entry, lo);
+        exit = minimum(exit, hi);
+    }
+    return entry <= exit;
+}
+
+// per lane slab test, returns true if any lane enters the box before its tmax
+template<s32 N>
+bool packet_lanes_hit(const ray_packet_t<N> * packet, const aabb_t & box, r64 tmin){
+    lanes_t min_x = lanes_set(box.min.x), min_y = lanes_set(box.min.y), min_z = lanes_set(box.min.z);
+    lanes_t max_x = lanes_set(box.max.x), max_y = lanes_set(box.max.y), max_z = lanes_set(box.max.z);
+    lanes_t vtmin = lanes_set(tmin);
+
+    for(s32 l = 0 ; l < N ; l += PACKET_LANES){
+        lanes_t ox = lanes_load(packet->ox + l), oy = lanes_load(packet->oy + l), oz = lanes_load(packet->oz + l);
+        lanes_t ix = lanes_load(packet->ix + l), iy = lanes_load(packet->iy + l), iz = lanes_load(packet->iz + l);
+
+        lanes_t tx0 = lanes_mul(lanes_sub(min_x, ox), ix), tx1 = lanes_mul(lanes_sub(max_x, ox), ix);
+        lanes_t ty0 = lanes_mul(lanes_sub(min_y, oy), iy), ty1 = lanes_mul(lanes_sub(max_y, oy), iy);
+        lanes_t tz0 = lanes_mul(lanes_sub(min_z, oz), iz), tz1 = lanes_mul(lanes_sub(max_z, oz), iz);
+
+        lanes_t entry = lanes_max(lanes_max(lanes_min(tx0, tx1), lanes_min(ty0, ty1)), lanes_max(lanes_min(tz0, tz1), vtmin));
+        lanes_t exit = lanes_min(lanes_min(lanes_max(tx0, tx1), lanes_max(ty0, ty1)), lanes_min(lanes_max(tz0, tz1), lanes_load(packet->tmax + l)));
+        if (mask_any(lanes_le(entry, exit))) return true;
+    }
+    return false;
+}
+
+// same math as sphere_soa_nearest, one sphere against every lane. sphere i is slot
+// first_slot + i
+template<s32 N>
+void packet_test_spheres(ray_packet_t<N> * packet, const real * center_x, const real * center_y, const real * center_z, const real * radius, s32 begin, s32 end, s32 first_slot, real tmin){
+    lanes_t vtmin = lanes_set(tmin);
+    lanes_t zero = lanes_set(0.0);
+    STAT(thread_stats.sphere_tests += (u64)(end - begin) * N);
+
+    for(s32 i = begin ; i < end ; i++){
+        lanes_t cx = lanes_set(center_x[i]), cy = lanes_set(center_y[i]), cz = lanes_set(center_z[i]);
+        lanes_t rr = lanes_set(radius[i] * radius[i]);
+        lane_index_t slot = first_slot + i;
+
+        for(s32 l = 0 ; l < N ; l += PACKET_LANES){
+            lanes_t ocx = lanes_sub(cx, lanes_load(packet->ox + l));
+            lanes_t ocy = lanes_sub(cy, lanes_load(packet->oy + l));
+            lanes_t ocz = lanes_sub(cz, lanes_load(packet->oz + l));
+            lanes_t a = lanes_load(packet->a + l);
+
+            lanes_t h = lanes_add(lanes_add(lanes_mul(lanes_load(packet->dx + l), ocx), lanes_mul(lanes_load(packet->dy + l), ocy)), lanes_mul(lanes_load(packet->dz + l), ocz));
+            lanes_t c = lanes_sub(lanes_add(lanes_add(lanes_mul(ocx, ocx), lanes_mul(ocy, ocy)), lanes_mul(ocz, ocz)), rr);
+            lanes_t discriminant = lanes_sub(lanes_mul(h, h), lanes_mul(a, c));
+
+            lane_mask_t valid = lanes_le(zero, discriminant);
+            if (!mask_any(valid)) continue;
+
+            lanes_t tmax = lanes_load(packet->tmax + l);
+            lanes_t t = lanes_div(lanes_sub(h, lanes_sqrt(lanes_max(discriminant, zero))), a);
+            valid = mask_and(valid, mask_and(lanes_lt(vtmin, t), lanes_lt(t, tmax)));
+
+            lanes_store(packet->tmax + l, lanes_select(valid, t, tmax));
+            lanes_store_index(packet->slot + l, valid, slot);
+        }
+    }
+}
+
+template<s32 N>
+inline void packet_test_spheres(ray_packet_t<N> * packet, const sphere_soa_t * soa, s32 begin, s32 end, real tmin){
+    packet_test_spheres(packet, soa->center_x, soa->center_y, soa->center_z, soa->radius, begin, end, 0, tmin);
+}
+
+template<s32 N>
+void packet_nearest(const scene_t * scene, ray_packet_t<N> * packet, real tmin){
+    if (scene->accel == AccelNone) {
+        packet_test_spheres(packet, &scene->spheres, 0, scene->spheres.count, tmin);
+        return;
+    }
+
+    const bvh_t * bvh = &scene->bvh;
+    if (bvh->node_count == 0) return;
+
+    s32 stack[BVH_STACK_SIZE];
+    s32 stack_size = 0;
+    s32 node_index = 0;
+
+    while(true){
+        const bvh_node_t * node = &bvh->nodes[node_index];
+
+        real tmax_bound = INF_NEG;
+        for(s32 l = 0 ; l < N ; l++) tmax_bound = maximum(tmax_bound, packet->tmax[l]);
+
+        if (packet_interval_hit(packet, node->bounds, tmin, tmax_bound) && packet_lanes_hit(packet, node->bounds, tmin)) {
+            if (node->count > 0 && scene->accel == AccelCompact) {
+                for(s32 c = node->offset ; c < node->offset + node->count ; c++){
+                    const compact_cluster_t & cluster = scene->compact.clusters[c];
+                    compact_batch_t batch;
+                    compact_decode(&scene->compact, cluster, &batch);
+                    packet_test_spheres(packet, batch.center_x, batch.center_y, batch.center_z, batch.radius, 0, cluster.count, cluster.first, tmin);
+                }
+            }
+            else if (node->count > 0) {
+                packet_test_spheres(packet, &scene->spheres, node->offset, node->offset + node->count, tmin);
+            }
+            else {
+                // the lanes agree on direction signs often enough that the first one decides
+                if (packet->dx[0] * (node->axis == 0) + packet->dy[0] * (node->axis == 1) + packet->dz[0] * (node->axis == 2) < 0) {
+                    stack[stack_size++] = node_index + 1;
+                    node_index = node->offset;
+                } else {
+                    stack[stack_size++] = node->offset;
+                    node_index = node_index + 1;
+                }
+                continue;
+            }
+        }
+
+        if (stack_size == 0) break;
+        node_index = stack[--stack_size];
+    }
+}
+
+// finds the first hit of count rays at once, hitted[i] tells whether rays[i] hit anything
+template<s32 N>
+void packet_hit(const scene_t * scene, const ray_t * rays, s32 count, real tmin, hit_t * hits, bool * hitted){
+    ray_packet_t<N> packet;
+    create_ray_packet(&packet, rays, count);
+    packet_nearest(scene, &packet, tmin);
+
+    for(s32 l = 0 ; l < count ; l++){
+        hitted[l] = packet.slot[l] >= 0;
+        if (hitted[l]) {
+            hits[l] = scene_hit_record(scene, rays[l], (s32) packet.slot[l], packet.tmax[l]);
+        }
+    }
+
+    // the other shapes go one ray at a time behind the spheres, as in scene_hit
+    for(s32 l = 0 ; l < count && scene_has_shapes(scene) ; l++){
+        real tmax = packet.tmax[l];
+        if (scene_hit_shapes(scene, rays[l], tmin, &tmax, &hits[l])) hitted[l] = true;
+    }
+}
+
+void scene_hit_packet(const scene_t * scene, const ray_t * rays, s32 count, real tmin, hit_t * hits, bool * hitted){
+    rays_traced += count;
+    if (count <= 4) packet_hit<4>(scene, rays, count, tmin, hits, hitted);
+    else if (count <= 8) packet_hit<8>(scene, rays, count, tmin, hits, hitted);
+    else packet_hit<16>(scene, rays, count, tmin, hits, hitted);
+}
+
+
+// @note: pcg32 (O'Neill), 16 bytes of state and one multiply per number. every camera
+// sample seeds its own generator from the pixel index and picks the stream from the
+// sample index, so a sample renders the same no matter which thread runs it or when.
+// the generator a sample carries is also its sampler, see the samplers section below
+struct rng_t {
+    u64 state;
+    u64 inc;
+
+    // low discrepancy samplers only
+    u32 sampler;      // sampler_type
+    u32 index;        // sample index in the pixel's sequence
+    u32 seed;         // hash of the pixel
+    u32 group_seed;   // hash of the pixel and the current dimension group
+    u32 shuffled;     // index shuffled for the current group, bits reversed
+    u32 dimension;    // next dimension in the current group
+};
+
+inline u32 rng_next(rng_t * rng){
+    u64 old = rng->state;
+    rng->state = old * 6364136223846793005ull + rng->inc;
+    u32 xorshifted = (u32)(((old >> 18u) ^ old) >> 27u);
+    u32 rot = (u32)(old >> 59u);
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+inline void rng_seed(rng_t * rng, u64 seed, u64 sequence = 0){
+    *rng = {};
+    rng->state = 0u;
+    rng->inc = (sequence << 1u) | 1u;
+    rng_next(rng);
+    rng->state += seed;
+    rng_next(rng);
+}
+
+// @note: samplers
+// random is the pcg32 stream above. sobol and rank1 are low discrepancy sequences over a
+// pixel's samples. a sample's numbers come in groups of four dimensions: the camera takes
+// group 0 (pixel jitter, lens), bounce n takes group n + 1 (two for the scatter
+// direction, one for the fresnel choice, the last for roulette), and every group is a 4d
+// point of the sequence at the sample index. to keep groups and pixels from correlating,
+// each group shuffles the sample index with an owen scramble seeded by the pixel and the
+// group, which maps power of two runs of samples onto aligned runs of the sequence and
+// keeps them stratified (burley, practical hash-based owen scrambling, 2020). sobol
+// points are owen scrambled per dimension too, rank1 points are a rank-1 lattice
+// sequence with a random shift per dimension. numbers past a group's four dimensions
+// come from the pcg stream
+
+enum sampler_type {
+    SamplerRandom,
+    SamplerSobol,
+    SamplerRank1,
+    SamplerCount,
+};
+
+static const char * SAMPLER_NAMES[SamplerCount] = {"random", "sobol", "rank1"};
+
+const u32 SAMPLER_GROUP_DIMENSIONS = 4;
+const u32 SAMPLER_FRESNEL_DIMENSION = 2;
+const u32 SAMPLER_ROULETTE_DIMENSION = 3;
+
+// generator matrices of the first four sobol dimensions (joe and kuo), column per bit
+static constexpr u32 SOBOL_DIRECTIONS[4][32] = {
+    {0x80000000, 0x40000000, 0x20000000, 0x10000000, 0x08000000, 0x04000000, 0x02000000, 0x01000000,
+     0x00800000, 0x00400000, 0x00200000, 0x00100000, 0x00080000, 0x00040000, 0x00020000, 0x00010000,
+     0x00008000, 0x00004000, 0x00002000, 0x00001000, 0x00000800, 0x00000400, 0x00000200, 0x00000100,
+     0x00000080, 0x00000040, 0x00000020, 0x00000010, 0x00000008, 0x00000004, 0x00000002, 0x00000001},
+    {0x80000000, 0xc0000000, 0xa0000000, 0xf0000000, 0x88000000, 0xcc000000, 0xaa000000, 0xff000000,
+     0x80800000, 0xc0c00000, 0xa0a00000, 0xf0f00000, 0x88880000, 0xcccc0000, 0xaaaa0000, 0xffff0000,
+     0x80008000, 0xc000c000, 0xa000a000, 0xf000f000, 0x88008800, 0xcc00cc00, 0xaa00aa00, 0xff00ff00,
+     0x80808080, 0xc0c0c0c0, 0xa0a0a0a0, 0xf0f0f0f0, 0x88888888, 0xcccccccc, 0xaaaaaaaa, 0xffffffff},
+    {0x80000000, 0xc0000000, 0x60000000, 0x90000000, 0xe8000000, 0x5c000000, 0x8e000000, 0xc5000000,
+     0x68800000, 0x9cc00000, 0xee600000, 0x55900000, 0x80680000, 0xc09c0000, 0x60ee0000, 0x90550000,
+     0xe8808000, 0x5cc0c000, 0x8e606000, 0xc5909000, 0x6868e800, 0x9c9c5c00, 0xeeee8e00, 0x5555c500,
+     0x8000e880, 0xc0005cc0, 0x60008e60, 0x9000c590, 0xe8006868, 0x5c009c9c, 0x8e00eeee, 0xc5005555},
+    {0x80000000, 0xc0000000, 0x20000000, 0x50000000, 0xf8000000, 0x74000000, 0xa2000000, 0x93000000,
+     0xd8800000, 0x25400000, 0x59e00000, 0xe6d00000, 0x78080000, 0xb40c0000, 0x82020000, 0xc3050000,
+     0x208f8000, 0x51474000, 0xfbea2000, 0x75d93000, 0xa0858800, 0x914e5400, 0xdbe79e00, 0x25db6d00,
+     0x58800080, 0xe54000c0, 0x79e00020, 0xb6d00050, 0x800800f8, 0xc00c0074, 0x200200a2, 0x50050093},
+};
+
+// korobov generator (1, a, a^2, a^3) mod 2^20, a = 533157 picked by a search for the
+// largest minimum distance in the 2d projections of the first 4 to 1024 points
+static const u32 RANK1_GENERATOR[4] = {1, 533157, 15961, 524637};
+
+constexpr u32 reverse_bits(u32 x){
+    x = __builtin_bswap32(x);
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    return ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+}
+
+// every bit is flipped by a hash of the bits below it (laine and karras). on reversed
+// bits that is a base 2 owen scramble of the fraction they stand for
+inline u32 laine_karras_permutation(u32 x, u32 seed){
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+// the sobol matrices applied a byte of the reversed index at a time, with the result
+// reversed as well since the owen scramble works on reversed bits. built at compile time
+struct sobol_tables_t {
+    u32 bytes[4][4][256];
+
+    constexpr sobol_tables_t() : bytes() {
+        for(s32 d = 0 ; d < 4 ; d++){
+            for(s32 c = 0 ; c < 4 ; c++){
+                for(s32 v = 0 ; v < 256 ; v++){
+                    u32 x = 0;
+                    for(s32 b = 0 ; b < 8 ; b++){
+                        if ((v >> b) & 1) x ^= SOBOL_DIRECTIONS[d][31 - (c * 8 + b)];
+                    }
+                    bytes[d][c][v] = reverse_bits(x);
+                }
+            }
+        }
+    }
+};
+
+static constexpr sobol_tables_t SOBOL_TABLES;
+
+// sobol point of the index, both with their bits reversed
+inline u32 sobol_sample_reversed(u32 reversed_index, u32 dimension){
+    const u32 (*table)[256] = SOBOL_TABLES.bytes[dimension];
+    return table[0][reversed_index & 0xff] ^ table[1][(reversed_index >> 8) & 0xff] ^
+        table[2][(reversed_index >> 16) & 0xff] ^ table[3][reversed_index >> 24];
+}
+
+// the sample's numbers from the camera (group 0) or a bounce on. a no-op for random
+inline void sampler_start_group(rng_t * rng, u32 group){
+    if (rng->sampler == SamplerRandom) return;
+    rng->group_seed = hash_u32(rng->seed ^ hash_u32(group));
+    rng->shuffled = laine_karras_permutation(reverse_bits(rng->index), rng->group_seed);
+    rng->dimension = 0;
+}
+
+inline void sampler_start_bounce(rng_t * rng, u32 depth){
+    sampler_start_group(rng, depth + 1);
+}
+
+// seeds the sampler of one camera sample
+inline void sampler_seed(rng_t * rng, sampler_type sampler, u64 seed, u32 sample){
+    rng_seed(rng, seed, sample);
+    rng->sampler = sampler;
+    rng->index = sample;
+    rng->seed = hash_u32((u32)seed ^ hash_u32((u32)(seed >> 32)));
+    sampler_start_group(rng, 0);
+}
+
+inline u32 sampler_next(rng_t * rng){
+    if (rng->sampler == SamplerRandom || rng->dimension >= SAMPLER_GROUP_DIMENSIONS) return rng_next(rng);
+
+    u32 dimension = rng->dimension++;
+    u32 dimension_seed = hash_u32(rng->group_seed ^ (0x9e3779b9u * (dimension + 1)));
+    if (rng->sampler == SamplerSobol) {
+        return reverse_bits(laine_karras_permutation(sobol_sample_reversed(rng->shuffled, dimension), dimension_seed));
+    }
+    // the reversed index is its radical inverse, which makes the lattice extensible
+    return rng->shuffled * RANK1_GENERATOR[dimension] + dimension_seed;
+}
+
+// top 24 bits so the value is exact in a float and never rounds up to 1.0
+inline r32 random_double(rng_t * rng){
+    return (sampler_next(rng) >> 8) * (1.0f / 16777216.0f);
+}
+
+inline r32 random_double(rng_t * rng, r64 min, r64 max){
+    return min + (max - min) * random_double(rng);
+}
+
+// direct mappings from uniform numbers in [0, 1) to the sampled domains, no rejection
+// loops and no branches, so loops over batches of samples vectorize
+
+inline point3 sample_unit_disk(real u1, real u2){
+    real r = sqrt(u1);
+    real phi = 2.0 * PI * u2;
+    return point3(r * cos(phi), r * sin(phi), 0);
+}
+
+inline vec3 sample_unit_vector(real u1, real u2){
+    real z = 1.0 - 2.0 * u1;
+    real r = sqrt(maximum(0.0, 1.0 - z * z));
+    real phi = 2.0 * PI * u2;
+    return vec3(r * cos(phi), r * sin(phi), z);
+}
+
+inline vec3 sample_unit_in_hemisphere(real u1, real u2, const vec3 & normal){
+    vec3 result = sample_unit_vector(u1, u2);
+    return result * copysign(1.0, dot(result, normal));
+}
+
+inline point3 random_in_unit_disk(rng_t * rng){
+    real u1 = random_double(rng);
+    real u2 = random_double(rng);
+    return sample_unit_disk(u1, u2);
+}
+
+inline vec3 random_unit_vector(rng_t * rng) {
+    real u1 = random_double(rng);
+    real u2 = random_double(rng);
+    return sample_unit_vector(u1, u2);
+}
+
+inline vec3 random_unit_in_hemisphere(rng_t * rng, const vec3 & normal) {
+    real u1 = random_double(rng);
+    real u2 = random_double(rng);
+    return sample_unit_in_hemisphere(u1, u2, normal);
+}
+
+inline vec3 reflect(const vec3 & inc, const vec3 & normal){
+    vec3 result = inc - 2 * dot(inc, normal) * normal;
+    return result;
+}
+
+inline vec3 refract(const vec3 & normalized_inc, const vec3 & normalized_normal, real n1overn2){
+    real dotp = dot(-normalized_inc, normalized_normal);
+    real cos_theta = dotp > 1.0 ? 1.0 : dotp;
+    vec3 out_prep = n1overn2 * (normalized_inc  + cos_theta * normalized_normal);
+    vec3 out_parallel = -sqrt(abs(1.0 - lengthsq(out_prep))) * normalized_normal;
+    return out_prep + out_parallel;
+}
+
+// picks the next direction for a ray that hit a surface, returns the color it is
+// attenuated by. one kernel per material type, chosen at compile time: the wavefront
+// shading queues instantiate one each and the megakernel reaches them through a single
+// switch
+template<material_type M>
+color3 scatter(const ray_t & ray, const hit_t & hit, const material_t & mat, rng_t * rng, vec3 * newdirection);
+
+// lambertian approximation 
+// light is scattered proportional to cos(phi) where phi is the angle the incident ray 
+// makes with the reflected one 
+
+// this gives a more sharper circle but make the lighting seems to be vrom above
+// newdirection = random_unit_in_hemisphere(hit.normal)+ hit.normal;
+
+// this gives a less sharp image but is more accurate to the scattering
+template<>
+inline color3 scatter<Lambertian>(const ray_t &, const hit_t & hit, const material_t & mat, rng_t * rng, vec3 * newdirection){
+    *newdirection = random_unit_vector(rng) + hit.normal;
+    if (near_zero(*newdirection)){
+        *newdirection = hit.normal;
+    }
+    return mat.lambertian.albedo;
+}
+
+template<>
+inline color3 scatter<Metallic>(const ray_t & ray, const hit_t & hit, const material_t & mat, rng_t * rng, vec3 * newdirection){
+    vec3 reflected = normalize(reflect(ray.dir, hit.normal));
+    *newdirection = reflected + random_unit_vector(rng) * mat.metallic.fuzziness;
+    if(near_zero(*newdirection)) {
+        *newdirection = reflected;
+    }
+    return mat.metallic.albedo;
+}
+
+template<>
+inline color3 scatter<Dielectric>(const ray_t & ray, const hit_t & hit, const material_t & mat, rng_t * rng, vec3 * newdirection){
+    auto n1overn2 = hit.front_face ? (1.0/mat.dielectric.refractive) : mat.dielectric.refractive;
+
+    vec3 unit_direction = normalize(ray.dir);
+    vec3 unit_normal = normalize(hit.normal);
+    
+    real cost = 0, sint = 0;
+    {
+        real d = dot(-unit_direction, unit_normal);
+        cost = d > 1.0 ? 1.0 : d;
+        sint = sqrt(1 - cost * cost);
+    }
+
+    real reflectance = 0;
+    {
+        auto r0 = (1 - n1overn2) / (1 + n1overn2);
+        r0 = r0 * r0;
+        reflectance = r0 + ( 1 - r0) * pow((1 - cost), 5);
+
+    }
+
+    rng->dimension = SAMPLER_FRESNEL_DIMENSION;
+    if (n1overn2 * sint > 1.0 || reflectance > random_double(rng)) {
+        *newdirection = reflect(unit_direction, unit_normal);
+    } else { 
+        *newdirection = refract(unit_direction, unit_normal, n1overn2);
+    }
+
+    return color3(1.0, 1.0, 1.0);
+}
+
+inline color3 scatter(const ray_t & ray, const hit_t & hit, const material_t & mat, rng_t * rng, vec3 * newdirection){
+    switch(mat.type){
+        case Lambertian: return scatter<Lambertian>(ray, hit, mat, rng, newdirection);
+        case Metallic: return scatter<Metallic>(ray, hit, mat, rng, newdirection);
+        case Dielectric: return scatter<Dielectric>(ray, hit, mat, rng, newdirection);
+        default: break;
+    }
+    return vec3(0.5, 0.5, 0.5);
+}
+
+inline color3 sky_color(const ray_t & ray){
+    real a = 0.5 * (ray.dir.y + 1.0);
+    return (1.0 - a) * color3(1.0, 1.0, 1.0) + a * color3(0.5, 0.7, 1.0);
+}
+
+// russian roulette: once a path is rr_depth bounces deep it survives with a probability
+// equal to its brightest throughput channel (capped so bright paths still terminate) and
+// the survivors are scaled up by 1/p, which keeps the estimate unbiased
+inline bool russian_roulette(color3 * throughput, rng_t * rng){
+    rng->dimension = SAMPLER_ROULETTE_DIMENSION;
+    real p = maximum(throughput->r, maximum(throughput->g, throughput->b));
+    if (p > 0.95) p = 0.95;
+    if (p <= 0.0 || random_double(rng) >= p) return false;
+    *throughput = *throughput / p;
+    return true;
+}
+
+// @note: light sampling
+// emissive spheres are lit two ways: paths that run into them by scattering, and next
+// event estimation, which at every diffuse or glossy vertex picks one light uniformly,
+// samples a direction in the cone the sphere subtends (uniform in solid angle) and traces
+// a shadow ray towards it. both see the same lights, so each is weighted by the power
+// heuristic over the two densities of the direction (veach, 1997). lambertian and fuzzy
+// metallic scatter in a way whose density is known: their direction is a point uniform on
+// a sphere (radius 1 around the normal, fuzz around the mirror direction), normalized.
+// their attenuation is the albedo whatever direction they pick, so f cos = albedo * pdf.
+// the sky is only reached by scattering. the light's numbers come from the pcg stream,
+// past the low discrepancy dimensions of the bounce
+
+inline bool samples_lights(const material_t & mat){
+    return mat.type == Lambertian || (mat.type == Metallic && mat.metallic.fuzziness > 0.0);
+}
+
+// density of normalize(center + radius * u) for u uniform on the unit sphere, |center| = 1.
+// a direction gathers t^2 / |cos| of every point on the line the sphere is cut at
+inline real projected_sphere_pdf(const vec3 & center, real radius, const vec3 & dir){
+    real b = dot(dir, center);
+    real disc = b * b - (1.0 - radius * radius);
+    if (disc <= 0.0) return 0.0;
+    real root = sqrt(disc);
+    real t_far = b + root, t_near = b - root;
+    real sum = 0.0;
+    if (t_far > 0.0) sum += t_far * t_far;
+    if (t_near > 0.0) sum += t_near * t_near;
+    return sum / (4.0 * PI * radius * root);
+}
+
+// solid angle density of scattering towards dir, which is unit length. 0 for specular
+// materials, which no light sample can hit
+inline real scatter_pdf(const ray_t & ray, const hit_t & hit, const material_t & mat, const vec3 & dir){
+    switch(mat.type){
+        case Lambertian: return maximum(dot(dir, hit.normal), (real)0.0) / PI;
+        case Metallic: {
+            if (mat.metallic.fuzziness <= 0.0) return 0.0;
+            vec3 reflected = normalize(reflect(ray.dir, hit.normal));
+            return projected_sphere_pdf(reflected, mat.metallic.fuzziness, dir);
+        }
+        default: return 0.0;
+    }
+}
+
+inline color3 scatter_albedo(const material_t & mat){
+    return mat.type == Lambertian ? mat.lambertian.albedo : mat.metallic.albedo;
+}
+
+inline real power_heuristic(real pdf, real other){
+    return pdf * pdf / (pdf * pdf + other * other);
+}
+
+// 1 - cos of the half angle of the cone a sphere subtends from point, 0 from inside
+inline real sphere_cone_size(const point3 & point, const point3 & center, real radius){
+    real distance_sq = lengthsq(center - point);
+    real sin_sq = radius * radius / distance_sq;
+    if (sin_sq >= 1.0) return 0.0;
+    // 1 - sqrt(1 - x) without the cancellation for small spheres far away
+    return sin_sq / (1.0 + sqrt(1.0 - sin_sq));
+}
+
+// density with which next event estimation from point picks a direction that lands on
+// the light in slot
+inline real light_pdf(const scene_t * scene, s32 slot, const point3 & point){
+    real cone = sphere_cone_size(point, scene_sphere_center(scene, slot), scene_sphere_radius(scene, slot));
+    if (cone <= 0.0) return 0.0;
+    return 1.0 / (2.0 * PI * cone * scene->light_count);
+}
+
+// what a path that scattered with density pdf into a light gets from it. pdf is 0 for
+// camera rays and specular bounces, which light sampling can't produce
+inline color3 emitted(const scene_t * scene, const ray_t & ray, const hit_t & hit, real pdf){
+    if (!hit.front_face) return color3(0.0, 0.0, 0.0);
+    const color3 & radiance = scene->materials[hit.material].emissive.radiance;
+    // emissive meshes, grids and instances are not sampled as lights, only found by scattering
+    if (pdf <= 0.0 || hit.slot < 0) return radiance;
+    return radiance * power_heuristic(pdf, light_pdf(scene, hit.slot, ray.point));
+}
+
+// next event estimation at a hit whose material samples_lights
+color3 sample_light(const scene_t * scene, const ray_t & ray, const hit_t & hit, const material_t & mat, rng_t * rng){
+    rng->dimension = SAMPLER_GROUP_DIMENSIONS;
+    real u_light = random_double(rng);
+    real u1 = random_double(rng);
+    real u2 = random_double(rng);
+
+    s32 pick = (s32)(u_light * scene->light_count);
+    s32 slot = scene->lights[pick < scene->light_count ? pick : scene->light_count - 1];
+    point3 center = scene_sphere_center(scene, slot);
+    real cone = sphere_cone_size(hit.point, center, scene_sphere_radius(scene, slot));
+    if (cone <= 0.0) return color3(0.0, 0.0, 0.0);
+
+    // uniform in the cone around the direction to the center
+    vec3 axis = normalize(center - hit.point);
+    vec3 tangent = normalize(cross(abs(axis.x) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0), axis));
+    vec3 bitangent = cross(axis, tangent);
+    real cos_theta = 1.0 - u1 * cone;
+    real sin_theta = sqrt(maximum(0.0, 1.0 - cos_theta * cos_theta));
+    real phi = 2.0 * PI * u2;
+    vec3 dir = axis * cos_theta + (tangent * cos(phi) + bitangent * sin(phi)) * sin_theta;
+    if (dot(dir, hit.normal) <= 0.0) return color3(0.0, 0.0, 0.0);
+
+    real bsdf = scatter_pdf(ray, hit, mat, dir);
+    if (bsdf <= 0.0) return color3(0.0, 0.0, 0.0);
+
+    hit_t shadow = {};
+    STAT(thread_stats.shadow_rays++);
+    if (!scene_hit(scene, ray_t(hit.point, dir), 0.001, INF_POS, &shadow) || shadow.slot != slot || !shadow.front_face) {
+        return color3(0.0, 0.0, 0.0);
+    }
+
+    real pdf = 1.0 / (2.0 * PI * cone * scene->light_count);
+    const color3 & radiance = scene->materials[shadow.material].emissive.radiance;
+    return scatter_albedo(mat) * radiance * (bsdf / pdf * power_heuristic(pdf, bsdf));
+}
+
+// what a camera sample's first hit tells the denoiser. a miss records the sky color as
+// albedo, the reversed ray as normal and depth 0
+struct feature_t {
+    color3 albedo;
+    vec3 normal;
+    real depth;
+};
+
+inline feature_t hit_feature(const ray_t & ray, bool hitted, const hit_t & hit, const material_t * materials){
+    feature_t feature = {};
+    if (!hitted) {
+        feature.albedo = sky_color(ray);
+        feature.normal = -normalize(ray.dir);
+        feature.depth = 0.0;
+        return feature;
+    }
+    const material_t & mat = materials[hit.material];
+    switch(mat.type){
+        case Lambertian: feature.albedo = mat.lambertian.albedo; break;
+        case Metallic: feature.albedo = mat.metallic.albedo; break;
+        case Dielectric: feature.albedo = color3(1.0, 1.0, 1.0); break;
+        case Emissive: feature.albedo = color3(1.0, 1.0, 1.0); break;
+        default: break;
+    }
+    feature.normal = normalize(hit.normal);
+    feature.depth = length(hit.point - ray.point);
+    return feature;
+}
+
+// iterative path tracer: the throughput of the path is carried forward and multiplied
+// by every attenuation on the way out instead of on the way back up the recursion, and
+// light picked up on the way is added to the radiance as it is found.
+// starts from an intersection that is already known, so packets can hand over their
+// first hits. feature is optional
+color3 trace_path(const scene_t * scene, ray_t ray, bool hitted, hit_t hit, u32 max_bounce, u32 rr_depth, rng_t * rng, feature_t * feature = NULL){
+    color3 throughput = color3(1.0, 1.0, 1.0);
+    color3 radiance = color3(0.0, 0.0, 0.0);
+    real pdf = 0.0;    // of the bounce that made the ray, for weighting the light it hits
+
+    for(u32 depth = 0 ; depth < max_bounce ; depth++){
+        if (depth > 0) {
+            hitted = scene_hit(scene, ray, 0.001, INF_POS, &hit);
+            STAT(thread_stats.secondary_rays++);
+        }
+        else {
+            STAT(thread_stats.primary_rays++);
+            if (feature) *feature = hit_feature(ray, hitted, hit, scene->materials);
+        }
+        if (!hitted) {
+            STAT(stats_path_ended(&thread_stats.ended_sky, depth));
+            return radiance + throughput * sky_color(ray);
+        }
+        const material_t & mat = scene->materials[hit.material];
+        STAT(thread_stats.shaded[mat.type]++);
+        if (mat.type == Emissive) {
+            STAT(stats_path_ended(&thread_stats.ended_light, depth));
+            return radiance + throughput * emitted(scene, ray, hit, pdf);
+        }
+
+        vec3 newdirection = {};
+        sampler_start_bounce(rng, depth);
+        color3 attenuation = scatter(ray, hit, mat, rng, &newdirection);
+        if (scene->light_count > 0 && samples_lights(mat)) {
+            radiance = radiance + throughput * sample_light(scene, ray, hit, mat, rng);
+            pdf = scatter_pdf(ray, hit, mat, normalize(newdirection));
+        }
+        else {
+            pdf = 0.0;
+        }
+        throughput = throughput * attenuation;
+
+        if (depth + 1 >= rr_depth && !russian_roulette(&throughput, rng)) {
+            STAT(stats_path_ended(&thread_stats.ended_roulette, depth + 1));
+            return radiance;
+        }
+
+        ray = ray_t(hit.point, newdirection);
+    }
+
+    STAT(stats_path_ended(&thread_stats.ended_depth, max_bounce));
+    return radiance;
+}
+
+color3 cast_ray(const ray_t & primary, const scene_t * scene, u32 max_bounce, u32 rr_depth, rng_t * rng, feature_t * feature = NULL){
+    hit_t hit = {};
+    bool hitted = max_bounce > 0 && scene_hit(scene, primary, 0.001, INF_POS, &hit);
+    return trace_path(scene, primary, hitted, hit, max_bounce, rr_depth, rng, feature);
+}
+
+s32 write_image(const char * file, image_t * image);
+s32 create_image(image_t * image, s32 width, s32 height, u32 color);
+
+// @note: output stage
+// images are written row by row through an image_writer_t. a writer can stream: render
+// workers report finished tiles, and a writer thread flushes every run of completed rows
+// at the top of the image while the rest of the frame is still rendering
+
+enum image_format {
+    ImageFormatPPMAscii,  // P3, one text line per pixel
+    ImageFormatPPM,       // P6, binary
+    ImageFormatPNG,
+    ImageFormatPFM,       // linear float rgb, needs image_t::hdr
+};
+
+struct image_writer_t {
+    FILE * fp;
+    image_t * image;
+    image_format format;
+    s64 data_offset;      // pfm: where the rows start
+
+    // png: deflate state carried between batches of rows
+    bool zlib_started;
+    u64 bit_buffer;
+    s32 bit_count;
+    u32 adler;
+    u8 * window;          // last 32k of filtered bytes, matches may reach back into it
+    s32 window_size;
+    u8 * previous_row;    // unfiltered, for the up and paeth filters
+
+    // streaming
+    bool streaming;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    s32 * pending_tiles;  // tiles of each row that are still rendering
+    s32 rows_ready;       // rows [0, rows_ready) are final
+    s32 rows_written;
+    bool finished;
+};
+
+image_format image_format_from_file(const char * file);
+bool parse_image_format(const char * name, image_format * format);
+
+s32 image_writer_open(image_writer_t * writer, const char * file, image_t * image, image_format format);
+s32 image_writer_open_stream(image_writer_t * writer, FILE * fp, image_t * image, image_format format);
+s32 image_writer_write_rows(image_writer_t * writer, s32 y0, s32 y1);
+s32 image_writer_close(image_writer_t * writer);
+s32 encode_image(image_t * image, image_format format, u8 ** data, u64 * size);
+
+void image_writer_start_stream(image_writer_t * writer, s32 tiles_per_row);
+void image_writer_tile_done(image_writer_t * writer, s32 y0, s32 y1);
+s32 image_writer_finish_stream(image_writer_t * writer);
+
+
+// blue at 0 through green to red at 1
+inline color3 heat_color(r64 t){
+    t = clamp(0.0, 1.0, t);
+    return t < 0.5 ? 
+        color3(0.0, 2.0 * t, 1.0 - 2.0 * t) : 
+        color3(2.0 * t - 1.0, 2.0 - 2.0 * t, 0.0);
+}
+
+// blue for pixels that stopped at min_samples through green to red for max_samples
+s32 write_sample_heatmap(const char * file, const s32 * counts, s32 width, s32 height, s32 min_samples, s32 max_samples){
+    image_t heatmap;
+    create_image(&heatmap, width, height, 0x000000);
+
+    r64 range = max_samples > min_samples ? max_samples - min_samples : 1;
+    for(s64 i = 0 ; i < (s64)width * height ; i++){
+        heatmap.pixels[i] = color_to_pixel(heat_color((counts[i] - min_samples) / range));
+    }
+
+    s32 result = write_image(file, &heatmap);
+    free(heatmap.pixels);
+    return result;
+}
+
+// @note: scene files
+//
+// binary scenes are laid out so a load is an mmap plus validation: every array the
+// renderer reads sits 64 byte aligned in the file, spheres already in bvh leaf order
+// with the flattened nodes stored alongside. text scenes are the editable form and
+// get converted with --convert
+
+#define SCENE_FILE_MAGIC "RTSCENE"
+#define SCENE_FILE_VERSION 2
+#define SCENE_FILE_ALIGN 64
+
+enum scene_file_flags {
+    SceneFileHasBVH = 1 << 0,
+};
+
+struct scene_file_header_t {
+    char magic[8];
+    u32 version;
+    u32 flags;
+    s32 sphere_count;
+    s32 sphere_capacity;     // sphere arrays are padded to SPHERE_SOA_PADDING with NaN radii
+    s32 material_count;
+    s32 node_count;
+    u32 material_size;       // sizeof(material_t) and sizeof(bvh_node_t) of the writer,
+    u32 node_size;           // a mismatch means the layout changed without a version bump
+    u32 real_size;           // sizeof(real), float and double builds can't share files
+    u32 reserved;
+    u64 center_x_offset;
+    u64 center_y_offset;
+    u64 center_z_offset;
+    u64 radius_offset;
+    u64 material_index_offset;
+    u64 materials_offset;
+    u64 camera_offset;
+    u64 nodes_offset;
+    u64 file_size;
+};
+
+s32 load_scene(scene_t * scene, const char * file, accel_type accel);
+s32 load_scene_binary(scene_t * scene, const char * file, accel_type accel);
+s32 load_scene_mapping(scene_t * scene, void * mapping, u64 mapping_size, accel_type accel, const char * name);
+s32 load_scene_text(scene_t * scene, const char * file, accel_type accel);
+s32 save_scene_binary(const scene_t * scene, const char * file);
+bool write_scene_binary(const scene_t * scene, FILE * fp);
+s32 save_scene_text(const scene_t * scene, const char * file);
+const char * load_mesh(mesh_t * mesh, const char * file, const point3 & offset, r64 scale, u32 material);
+const char * parse_camera_keys(const char * rest, camera_desc_t * camera);
+
+// the three large spheres over a grid x grid field of small random ones, 22 is the
+// classic cover scene. their materials go into the given table
+entity_t * create_entities(s32 * count, rng_t * rng, material_table_t * materials, s32 grid = 22){
+    *count = grid * grid + 4;
+    entity_t * entities = (entity_t *) malloc(sizeof(entity_t) * (*count));
+
+    s32 offset = 0;
+    material_t mat = {};
+
+    mat.type = Lambertian;
+    mat.lambertian.albedo = get_color_from_hex(0x888888);
+    entities[offset].type = Sphere;
+    entities[offset].sphere.material = material_table_add(materials, mat);
+    entities[offset].sphere.center = point3(0, -1000, 0);
+    entities[offset].sphere.radius = 1000;
+
+    offset++;
+
+    mat.type = Dielectric;
+    mat.dielectric.albedo = get_color_from_hex(0xffffff);
+    mat.dielectric.refractive = 1.5;
+    entities[offset].type = Sphere;
+    entities[offset].sphere.material = material_table_add(materials, mat);
+    entities[offset].sphere.center = point3(0, 1, 0);
+    entities[offset].sphere.radius = 1;
+    
+    offset++;
+
+    mat.type = Metallic;
+    mat.metallic.albedo = color3(0.7, 0.6, 0.5);
+    mat.metallic.fuzziness = 0.0;
+    entities[offset].type = Sphere;
+    entities[offset].sphere.material = material_table_add(materials, mat);
+    entities[offset].sphere.center = point3(4, 1, 0);
+    entities[offset].sphere.radius = 1;
+    
+
+    offset++;
+
+    mat.type = Lambertian;
+    mat.lambertian.albedo = color3(0.4, 0.2, 0.1);
+    entities[offset].type = Sphere;
+    entities[offset].sphere.material = material_table_add(materials, mat);
+    entities[offset].sphere.center = point3(-4, 1, 0);
+    entities[offset].sphere.radius = 1;
+
+    offset++;
+    
+    for(s32 i = -grid / 2 ; i < grid - grid / 2 ; i++){
+        for(s32 j = -grid / 2 ; j < grid - grid / 2 ;  j++){
+            r64 choose_mat = random_double(rng);
+            point3 center(i + 0.9 * random_double(rng), 0.2,  j + 0.9 * random_double(rng));
+
+
+            if (length(center - point3(4, 0.2, 9)) > 0.9) {
+
+                if (choose_mat < 0.8 ){
+                    mat.type = Lambertian;
+                    mat.lambertian.albedo = color3(random_double(rng), random_double(rng), random_double(rng)) * color3(random_double(rng), random_double(rng), random_double(rng));
+                }
+
+                else if (choose_mat < 0.95){
+                    mat.type = Metallic;
+                    mat.metallic.albedo = color3(random_double(rng, 0.5, 1), random_double(rng, 0.5, 1), random_double(rng, 0.5, 1));
+                    mat.metallic.fuzziness = random_double(rng, 0, 0.5);
+                }
+
+                else {
+                    mat.type = Dielectric;
+                    mat.dielectric.albedo = get_color_from_hex(0xffffff);
+                    mat.dielectric.refractive= 1.5;
+                }
+
+                entity_t entity = {};
+                entity.type = Sphere;
+                entity.sphere.material = material_table_add(materials, mat);
+                entity.sphere.radius = 0.2;
+                entity.sphere.center = center;
+
+                entities[offset] = entity;
+                offset++;
+            }
+        }
+    }
+
+    *count = offset;
+   
+    return entities;
+}
+
+struct camera_t {
+    point3 center;
+    point3 pixel00_loc;
+    vec3 delta_u, delta_v;
+    r64 defocus_angle;
+    vec3 defocus_disk_u, defocus_disk_v;
+};
+
+camera_t create_camera(const camera_desc_t * desc, s32 image_width, s32 image_height){
+    camera_t camera = {};
+
+    point3 lookfrom = desc->lookfrom;
+    point3 look_at = desc->look_at;
+    vec3 camera_up = desc->up;
+    r64 vfov = desc->vfov;
+    r64 defocus_angle = desc->defocus_angle;
+    r64 focus_dist = desc->focus_dist;
+
+    vec3 u, v, w;
+    w = normalize(lookfrom - look_at);
+    u = normalize(cross (camera_up, w));
+    v = normalize(cross(w, u));
+
+    camera.center = lookfrom;
+
+    r64 viewport_height = 2 * tan(degrees_to_radians(vfov) / 2) * focus_dist;
+    r64 viewport_width = viewport_height * ((r64)(image_width) / (r64)(image_height));
+
+    vec3 viewport_u = viewport_width * u;
+    vec3 viewport_v = viewport_height * -v;
+    
+    camera.delta_u = viewport_u / image_width;
+    camera.delta_v = viewport_v / image_height;
+
+    point3 viewport_top_left = camera.center - (focus_dist * w) - (viewport_u / 2) - (viewport_v / 2);
+    auto defocus_radius = focus_dist * tan(degrees_to_radians(defocus_angle / 2.0));
+
+    camera.defocus_angle = defocus_angle;
+    camera.defocus_disk_u = u * defocus_radius;
+    camera.defocus_disk_v = v * defocus_radius;
+
+    camera.pixel00_loc = viewport_top_left + (camera.delta_u + camera.delta_v) * 0.5;
+
+    return camera;
+}
+
+// jittered ray through pixel (x, y), starting on the defocus disk
+ray_t get_camera_ray(const camera_t * camera, s32 x, s32 y, rng_t * rng){
+    point3 pixel_center = camera->pixel00_loc + (camera->delta_v * y)  + (camera->delta_u * x);
+
+    point3 ray_point = pixel_center + camera->delta_u * 0.5 * random_double(rng, -1.0, 1.0) + camera->delta_v * 0.5 * random_double(rng, -1.0, 1.0);
+
+    point3 ray_origin = camera->center;
+    {
+        if (camera->defocus_angle > 0 ){
+            auto temp = random_in_unit_disk(rng);
+            ray_origin = camera->center + (temp.data[0] * camera->defocus_disk_u) + (temp.data[1]  * camera->defocus_disk_v );
+        }
+    }
+
+    ray_t ray = {ray_origin, ray_point - ray_origin};
+    return ray;
+}
+
+// @note: tile based parallel renderer
+// the frame is cut into square tiles, every worker owns a deque of tiles, pops its own
+// work from the back and steals from the front of the other workers' deques once it
+// runs dry. each sample seeds its own rng so the output does not depend on the schedule
+
+struct tile_queue_t {
+    pthread_mutex_t lock;
+    s32 * tiles;
+    s32 head, tail;
+};
+
+// stages of the wavefront renderer, see render_tile_wavefront
+enum wavefront_stage {
+    StageGenerate,
+    StageIntersect,
+    StageSort,
+    StageShadeLambertian,
+    StageShadeMetallic,
+    StageShadeDielectric,
+    StageAccumulate,
+    StageCount,
+};
+
+static const char * WAVEFRONT_STAGE_NAMES[StageCount] = {
+    "generate", "intersect", "sort", "shade lambertian", "shade metallic", "shade dielectric", "accumulate",
+};
+
+struct wavefront_timings_t {
+    r64 seconds[StageCount];
+    u64 items[StageCount];
+};
+
+struct coordinator_t;
+struct checkpoint_t;
+struct pixel_estimate_t;
+struct feature_buffers_t;
+
+struct render_job_t {
+    image_t * image;
+    const camera_t * camera;
+    const scene_t * scene;
+
+    s32 samples_per_pixel;  // upper bound when sampling adaptively
+    s32 min_samples_per_pixel;
+    r64 max_error;          // 0 disables adaptive sampling
+    s32 max_bounce;
+    s32 rr_depth;
+    sampler_type sampler;
+    s32 packet_size;        // camera samples traced together, 1 for single rays
+    bool wavefront;
+    s32 frame;              // animation frame, decorrelates the noise of consecutive frames
+
+    s32 * sample_counts;    // optional, samples taken per pixel
+    image_writer_t * writer;  // optional, streams finished rows to disk
+
+    s32 tile_size;
+    s32 tiles_x, tiles_y;
+
+    tile_queue_t * queues;
+    s32 worker_count;
+
+    wavefront_timings_t timings;  // stage timings of the last wavefront render
+    u64 rays;                     // scene queries of the last render
+    render_stats_t stats;         // merged counters of the last render
+    r64 * tile_seconds;           // optional, wall time per tile
+
+    coordinator_t * coordinator;  // optional, renders the tiles on worker processes
+
+    // progressive renders keep every pixel's estimate and take the samples in passes,
+    // each pass continues the estimates up to pass_samples
+    pixel_estimate_t * estimates;
+    s32 pass_samples;
+    r64 time_limit;               // seconds the passes may take, 0 for no limit
+    const char * preview;         // optional, rewritten after every pass, - streams ppm frames to stdout
+    checkpoint_t * checkpoint;    // optional, saves the estimates while rendering
+
+    feature_buffers_t * features; // optional, first hit features and variance per pixel
+    bool denoise;                 // filter the image with the feature buffers after rendering
+    r64 denoise_seconds;
+};
+
+
+bool tile_queue_pop(tile_queue_t * queue, s32 * tile){
+    bool result = false;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail) {
+        queue->tail--;
+        *tile = queue->tiles[queue->tail];
+        result = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return result;
+}
+
+bool tile_queue_steal(tile_queue_t * queue, s32 * tile){
+    bool result = false;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail) {
+        *tile = queue->tiles[queue->head];
+        queue->head++;
+        result = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return result;
+}
+
+inline r64 luminance(const color3 & color){
+    return 0.2126 * color.r + 0.7152 * color.g + 0.0722 * color.b;
+}
+
+// running mean of the samples of one pixel plus welford's sum of squared luminance
+// deviations, enough to tell how far the mean can still be from the true value
+struct pixel_estimate_t {
+    color3 mean;
+    r64 m2;
+    s32 samples;
+    feature_t features;     // mean over the samples, only kept when the job has feature buffers
+};
+
+inline void add_sample(pixel_estimate_t * estimate, const color3 & sample){
+    r64 old_luminance = luminance(estimate->mean);
+    estimate->samples++;
+    estimate->mean = estimate->mean + (sample - estimate->mean) / estimate->samples;
+    estimate->m2 += (luminance(sample) - old_luminance) * (luminance(sample) - luminance(estimate->mean));
+}
+
+// after add_sample, which counted the sample
+inline void add_features(pixel_estimate_t * estimate, const feature_t & sample){
+    feature_t & mean = estimate->features;
+    mean.albedo = mean.albedo + (sample.albedo - mean.albedo) / estimate->samples;
+    mean.normal = mean.normal + (sample.normal - mean.normal) / estimate->samples;
+    mean.depth = mean.depth + (sample.depth - mean.depth) / estimate->samples;
+}
+
+// what the denoiser reads, one plane of floats per channel. variance is that of the
+// luminance of the pixel's mean, how far the denoiser may trust the pixel's own value
+enum feature_plane {
+    PlaneRed, PlaneGreen, PlaneBlue,
+    PlaneVariance,
+    PlaneAlbedoR, PlaneAlbedoG, PlaneAlbedoB,
+    PlaneNormalX, PlaneNormalY, PlaneNormalZ,
+    PlaneDepth,
+    PlaneCount
+};
+
+struct feature_buffers_t {
+    s32 width, height;
+    r32 * planes[PlaneCount];
+};
+
+void create_feature_buffers(feature_buffers_t * buffers, s32 width, s32 height){
+    s64 size = (s64)width * height;
+    buffers->width = width;
+    buffers->height = height;
+    buffers->planes[0] = (r32 *) calloc(size * PlaneCount, sizeof(r32));
+    for(s32 p = 1 ; p < PlaneCount ; p++){
+        buffers->planes[p] = buffers->planes[0] + size * p;
+    }
+}
+
+void destroy_feature_buffers(feature_buffers_t * buffers){
+    free(buffers->planes[0]);
+    memset(buffers, 0, sizeof(feature_buffers_t));
+}
+
+inline void store_features(feature_buffers_t * buffers, s64 index, const pixel_estimate_t * estimate){
+    const feature_t & features = estimate->features;
+    r32 ** planes = buffers->planes;
+    planes[PlaneRed][index] = estimate->mean.r;
+    planes[PlaneGreen][index] = estimate->mean.g;
+    planes[PlaneBlue][index] = estimate->mean.b;
+    // a single sample says nothing about its spread, it gets as much as a bright pixel could have
+    planes[PlaneVariance][index] = estimate->samples > 1 ? estimate->m2 / (estimate->samples - 1) / estimate->samples : 1.0;
+    planes[PlaneAlbedoR][index] = features.albedo.r;
+    planes[PlaneAlbedoG][index] = features.albedo.g;
+    planes[PlaneAlbedoB][index] = features.albedo.b;
+    planes[PlaneNormalX][index] = features.normal.x;
+    planes[PlaneNormalY][index] = features.normal.y;
+    planes[PlaneNormalZ][index] = features.normal.z;
+    planes[PlaneDepth][index] = features.depth;
+}
+
+// true once the 95% confidence interval of the mean luminance is within max_error of
+// the mean. dark pixels are held to a floor so they don't chase a relative error of ~0
+inline bool is_converged(const pixel_estimate_t * estimate, r64 max_error){
+    if (estimate->samples < 2) return false;
+    r64 variance = estimate->m2 / (estimate->samples - 1);
+    r64 half_width = 1.96 * sqrt(variance / estimate->samples);
+    return half_width <= max_error * maximum(luminance(estimate->mean), 0.05);
+}
+
+// every pixel of every frame gets its own stream, frame 0 is what a still image uses
+inline u64 pixel_seed(const render_job_t * job, s32 x, s32 y){
+    return ((u64)job->frame * job->image->height + y) * job->image->width + x;
+}
+
+color3 render_sample(const render_job_t * job, s32 x, s32 y, s32 sample, feature_t * feature = NULL){
+    rng_t rng;
+    sampler_seed(&rng, job->sampler, pixel_seed(job, x, y), sample);
+
+    ray_t ray = get_camera_ray(job->camera, x, y, &rng);
+    return cast_ray(ray, job->scene, job->max_bounce, job->rr_depth, &rng, feature);
+}
+
+// samples [first, first + count) of a pixel with their camera rays traced as one packet.
+// each sample keeps its own rng, so the result matches count calls to render_sample.
+// features is optional
+void render_samples(const render_job_t * job, s32 x, s32 y, s32 first, s32 count, color3 * colors, feature_t * features){
+    if (count <= 1 || job->max_bounce == 0) {
+        for(s32 i = 0 ; i < count ; i++){
+            colors[i] = render_sample(job, x, y, first + i, features ? &features[i] : NULL);
+        }
+        return;
+    }
+
+    rng_t rngs[MAX_PACKET_SIZE];
+    ray_t rays[MAX_PACKET_SIZE];
+    hit_t hits[MAX_PACKET_SIZE];
+    bool hitted[MAX_PACKET_SIZE];
+
+    for(s32 i = 0 ; i < count ; i++){
+        sampler_seed(&rngs[i], job->sampler, pixel_seed(job, x, y), first + i);
+        rays[i] = get_camera_ray(job->camera, x, y, &rngs[i]);
+    }
+
+    scene_hit_packet(job->scene, rays, count, 0.001, hits, hitted);
+
+    // the packet splits here, every lane scatters its own way from the first bounce on
+    for(s32 i = 0 ; i < count ; i++){
+        colors[i] = trace_path(job->scene, rays[i], hitted[i], hits[i], job->max_bounce, job->rr_depth, &rngs[i], features ? &features[i] : NULL);
+    }
+}
+
+const s32 CONVERGENCE_CHECK_INTERVAL = 8;
+
+// samples per pixel the current render stops at
+inline s32 sample_limit(const render_job_t * job){
+    return job->estimates ? job->pass_samples : job->samples_per_pixel;
+}
+
+// true once a pixel has max_samples, or converged at its last check. convergence is only
+// checked every few samples once min_samples are in, the check is not free
+inline bool pixel_done(const render_job_t * job, const pixel_estimate_t * estimate, s32 max_samples){
+    if (estimate->samples >= max_samples) return true;
+    bool adaptive = job->max_error > 0.0;
+    return adaptive && estimate->samples >= job->min_samples_per_pixel &&
+        (estimate->samples - job->min_samples_per_pixel) % CONVERGENCE_CHECK_INTERVAL == 0 &&
+        is_converged(estimate, job->max_error);
+}
+
+// takes samples until the pixel is done, continuing whatever the estimate already holds.
+// packets never reach past the next convergence check, so packet and single ray renders
+// take the same samples, and so does a render that stops and continues in between
+void render_pixel(const render_job_t * job, s32 x, s32 y, pixel_estimate_t * estimate, s32 max_samples){
+    bool adaptive = job->max_error > 0.0;
+    s32 min_samples = adaptive ? job->min_samples_per_pixel : job->samples_per_pixel;
+
+    while (!pixel_done(job, estimate, max_samples)) {
+        s32 count = 1;
+        if (job->packet_size > 1) {
+            count = job->packet_size;
+            if (count > max_samples - estimate->samples) count = max_samples - estimate->samples;
+            if (adaptive) {
+                s32 next_check = estimate->samples < min_samples ? min_samples : 
+                    min_samples + ((estimate->samples - min_samples) / CONVERGENCE_CHECK_INTERVAL + 1) * CONVERGENCE_CHECK_INTERVAL;
+                if (count > next_check - estimate->samples) count = next_check - estimate->samples;
+            }
+        }
+
+        color3 colors[MAX_PACKET_SIZE];
+        feature_t features[MAX_PACKET_SIZE];
+        render_samples(job, x, y, estimate->samples, count, colors, job->features ? features : NULL);
+
+        for(s32 i = 0 ; i < count ; i++){
+            add_sample(estimate, colors[i]);
+            if (job->features) add_features(estimate, features[i]);
+        }
+    }
+}
+
+// @note: wavefront path tracing
+// instead of following one path to its end, a tile's samples for a round are generated
+// up front and advanced one bounce at a time in stages: intersect every ray in the queue,
+// bin the hits by material, then run one shading kernel per material over its bin, which
+// emits the queue for the next bounce. each path carries its own rng, and the rounds take
+// the same samples render_pixel would, so the image matches the megakernel output
+
+struct path_state_t {
+    ray_t ray;
+    color3 throughput;
+    real pdf;    // of the bounce that made the ray, see trace_path
+    rng_t rng;
+    s32 sample;  // slot of the result in the round's color buffer
+    s32 depth;
+};
+
+// grow-only buffers a worker reuses from tile to tile
+struct wavefront_scratch_t {
+    path_state_t * paths;
+    path_state_t * next;
+    hit_t * hits;
+    s32 * order;
+    color3 * colors;
+    feature_t * features;   // first hit of every sample, by result slot
+    s32 capacity;
+
+    // per pixel of the tile
+    pixel_estimate_t * estimates;
+    bool * done;
+    s32 * round_first;      // first color slot of the pixel's round
+    s32 * round_count;
+    s32 pixel_capacity;
+};
+
+void reserve_wavefront(wavefront_scratch_t * scratch, s32 count, s32 pixel_count){
+    if (count > scratch->capacity) {
+        scratch->paths = (path_state_t *) realloc(scratch->paths, sizeof(path_state_t) * count);
+        scratch->next = (path_state_t *) realloc(scratch->next, sizeof(path_state_t) * count);
+        scratch->hits = (hit_t *) realloc(scratch->hits, sizeof(hit_t) * count);
+        scratch->order = (s32 *) realloc(scratch->order, sizeof(s32) * count);
+        scratch->colors = (color3 *) realloc(scratch->colors, sizeof(color3) * count);
+        scratch->features = (feature_t *) realloc(scratch->features, sizeof(feature_t) * count);
+        scratch->capacity = count;
+    }
+    if (pixel_count > scratch->pixel_capacity) {
+        scratch->estimates = (pixel_estimate_t *) realloc(scratch->estimates, sizeof(pixel_estimate_t) * pixel_count);
+        scratch->done = (bool *) realloc(scratch->done, sizeof(bool) * pixel_count);
+        scratch->round_first = (s32 *) realloc(scratch->round_first, sizeof(s32) * pixel_count);
+        scratch->round_count = (s32 *) realloc(scratch->round_count, sizeof(s32) * pixel_count);
+        scratch->pixel_capacity = pixel_count;
+    }
+}
+
+void destroy_wavefront(wavefront_scratch_t * scratch){
+    free(scratch->paths);
+    free(scratch->next);
+    free(scratch->hits);
+    free(scratch->order);
+    free(scratch->colors);
+    free(scratch->features);
+    free(scratch->estimates);
+    free(scratch->done);
+    free(scratch->round_first);
+    free(scratch->round_count);
+    *scratch = {};
+}
+
+// one material's bin: scatter, sample a light, roulette, and queue the survivors for the
+// next bounce. light found on the way goes straight into the sample's color
+template<material_type M>
+s32 shade_queue(const render_job_t * job, wavefront_scratch_t * scratch, const s32 * bin, s32 count, s32 next_count){
+    const scene_t * scene = job->scene;
+    const material_t * materials = scene->materials;
+    for(s32 k = 0 ; k < count ; k++){
+        s32 i = bin[k];
+        path_state_t path = scratch->paths[i];
+        const hit_t & hit = scratch->hits[i];
+        const material_t & mat = materials[hit.material];
+
+        vec3 newdirection = {};
+        sampler_start_bounce(&path.rng, path.depth);
+        color3 attenuation = scatter<M>(path.ray, hit, mat, &path.rng, &newdirection);
+        if (M != Dielectric && scene->light_count > 0 && samples_lights(mat)) {
+            color3 & color = scratch->colors[path.sample];
+            color = color + path.throughput * sample_light(scene, path.ray, hit, mat, &path.rng);
+            path.pdf = scatter_pdf(path.ray, hit, mat, normalize(newdirection));
+        }
+        else {
+            path.pdf = 0.0;
+        }
+        path.throughput = path.throughput * attenuation;
+
+        if (path.depth + 1 >= job->rr_depth && !russian_roulette(&path.throughput, &path.rng)) {
+            STAT(stats_path_ended(&thread_stats.ended_roulette, path.depth + 1));
+            continue;
+        }
+
+        path.depth++;
+        if (path.depth >= job->max_bounce) {
+            STAT(stats_path_ended(&thread_stats.ended_depth, path.depth));
+            continue;
+        }
+
+        path.ray = ray_t(hit.point, newdirection);
+        scratch->next[next_count++] = path;
+    }
+    return next_count;
+}
+
+// advances count paths until all of them terminated, colors[path.sample] gets the result
+void run_wavefront(const render_job_t * job, wavefront_scratch_t * scratch, s32 count, wavefront_timings_t * timings){
+    const scene_t * scene = job->scene;
+
+    while (count > 0) {
+        r64 start = get_time_seconds();
+
+        bool * hitted = (bool *) scratch->order;  // reused before the sort overwrites it
+        for(s32 i = 0 ; i < count ; i++){
+            const path_state_t & path = scratch->paths[i];
+            hitted[i] = scene_hit(scene, path.ray, 0.001, INF_POS, &scratch->hits[i]);
+            STAT(path.depth == 0 ? thread_stats.primary_rays++ : thread_stats.secondary_rays++);
+            if (job->features && path.depth == 0) {
+                scratch->features[path.sample] = hit_feature(path.ray, hitted[i], scratch->hits[i], scene->materials);
+            }
+        }
+
+        r64 intersected = get_time_seconds();
+        timings->seconds[StageIntersect] += intersected - start;
+        timings->items[StageIntersect] += count;
+
+        // counting sort of the hits by material, misses pick up the sky right here and
+        // paths that hit a light its emission, neither goes on
+        s32 bin_count[MaterialTypeCount] = {};
+        s32 hit_count = 0;
+        for(s32 i = 0 ; i < count ; i++){
+            const path_state_t & path = scratch->paths[i];
+            color3 & color = scratch->colors[path.sample];
+            if (!hitted[i]) {
+                color = color + path.throughput * sky_color(path.ray);
+                STAT(stats_path_ended(&thread_stats.ended_sky, path.depth));
+            }
+            else if (scene->materials[scratch->hits[i].material].type == Emissive) {
+                color = color + path.throughput * emitted(scene, path.ray, scratch->hits[i], path.pdf);
+                STAT(thread_stats.shaded[Emissive]++);
+                STAT(stats_path_ended(&thread_stats.ended_light, path.depth));
+                hitted[i] = false;
+            }
+            else {
+                bin_count[scene->materials[scratch->hits[i].material].type]++;
+                hit_count++;
+            }
+        }
+        STAT(thread_stats.shaded[Lambertian] += bin_count[Lambertian]);
+        STAT(thread_stats.shaded[Metallic] += bin_count[Metallic]);
+        STAT(thread_stats.shaded[Dielectric] += bin_count[Dielectric]);
+        s32 bin_start[3] = {0, bin_count[0], bin_count[0] + bin_count[1]};
+        s32 bin_fill[3] = {bin_start[0], bin_start[1], bin_start[2]};
+        s32 * sorted = (s32 *) scratch->next;  // next is empty until shading starts
+        for(s32 i = 0 ; i < count ; i++){
+            if (hitted[i]) sorted[bin_fill[scene->materials[scratch->hits[i].material].type]++] = i;
+        }
+        memcpy(scratch->order, sorted, sizeof(s32) * hit_count);
+
+        r64 sorted_time = get_time_seconds();
+        timings->seconds[StageSort] += sorted_time - intersected;
+        timings->items[StageSort] += count;
+
+        s32 next_count = 0;
+        r64 stage_start = sorted_time;
+
+        next_count = shade_queue<Lambertian>(job, scratch, scratch->order + bin_start[Lambertian], bin_count[Lambertian], next_count);
+        r64 stage_end = get_time_seconds();
+        timings->seconds[StageShadeLambertian] += stage_end - stage_start;
+        timings->items[StageShadeLambertian] += bin_count[Lambertian];
+        stage_start = stage_end;
+
+        next_count = shade_queue<Metallic>(job, scratch, scratch->order + bin_start[Metallic], bin_count[Metallic], next_count);
+        stage_end = get_time_seconds();
+        timings->seconds[StageShadeMetallic] += stage_end - stage_start;
+        timings->items[StageShadeMetallic] += bin_count[Metallic];
+        stage_start = stage_end;
+
+        next_count = shade_queue<Dielectric>(job, scratch, scratch->order + bin_start[Dielectric], bin_count[Dielectric], next_count);
+        stage_end = get_time_seconds();
+        timings->seconds[StageShadeDielectric] += stage_end - stage_start;
+        timings->items[StageShadeDielectric] += bin_count[Dielectric];
+
+        path_state_t * temp = scratch->paths;
+        scratch->paths = scratch->next;
+        scratch->next = temp;
+        count = next_count;
+    }
+}
+
+void store_pixel(const render_job_t * job, s32 x, s32 y, const pixel_estimate_t * estimate){
+    image_t * image = job->image;
+    s64 index = (s64)image->width * y + x;
+    image->pixels[index] = color_to_pixel(estimate->mean, true);
+    if (image->hdr) {
+        image->hdr[index * 3 + 0] = estimate->mean.r;
+        image->hdr[index * 3 + 1] = estimate->mean.g;
+        image->hdr[index * 3 + 2] = estimate->mean.b;
+    }
+    if (job->sample_counts) {
+        job->sample_counts[index] = estimate->samples;
+    }
+    if (job->features) {
+        store_features(job->features, index, estimate);
+    }
+}
+
+void render_tile_wavefront(const render_job_t * job, wavefront_scratch_t * scratch, wavefront_timings_t * timings, s32 x0, s32 y0, s32 x1, s32 y1){
+    // fixed spp renders go in rounds of this many samples to bound the queue size
+    const s32 FIXED_ROUND_SAMPLES = 32;
+
+    s32 width = x1 - x0;
+    s32 pixel_count = width * (y1 - y0);
+
+    bool adaptive = job->max_error > 0.0;
+    s32 min_samples = adaptive ? job->min_samples_per_pixel : job->samples_per_pixel;
+    s32 max_samples = sample_limit(job);
+
+    reserve_wavefront(scratch, 0, pixel_count);
+    pixel_estimate_t * estimates = scratch->estimates;
+    bool * done = scratch->done;
+    s32 * round_first = scratch->round_first;
+    s32 * round_count = scratch->round_count;
+    for(s32 p = 0 ; p < pixel_count ; p++){
+        estimates[p] = {};
+        estimates[p].mean = color3(0.0, 0.0, 0.0);
+        done[p] = false;
+        if (job->estimates) {
+            estimates[p] = job->estimates[(s64)job->image->width * (y0 + p / width) + x0 + p % width];
+            done[p] = pixel_done(job, &estimates[p], max_samples);
+        }
+    }
+
+    bool any_left = true;
+
+    while (any_left) {
+        r64 start = get_time_seconds();
+
+        s32 total = 0;
+        for(s32 p = 0 ; p < pixel_count ; p++){
+            // adaptive rounds end at the pixel's next convergence check
+            s32 samples = estimates[p].samples;
+            s32 round_samples = !adaptive ? FIXED_ROUND_SAMPLES : samples < min_samples ? min_samples - samples :
+                CONVERGENCE_CHECK_INTERVAL - (samples - min_samples) % CONVERGENCE_CHECK_INTERVAL;
+            s32 left = max_samples - samples;
+            round_first[p] = total;
+            round_count[p] = done[p] ? 0 : (left < round_samples ? left : round_samples);
+            total += round_count[p];
+        }
+        reserve_wavefront(scratch, total, pixel_count);
+
+        s32 count = 0;
+        for(s32 p = 0 ; p < pixel_count ; p++){
+            s32 x = x0 + p % width, y = y0 + p / width;
+            for(s32 s = 0 ; s < round_count[p] ; s++){
+                path_state_t * path = &scratch->paths[count];
+                sampler_seed(&path->rng, job->sampler, pixel_seed(job, x, y), estimates[p].samples + s);
+                path->ray = get_camera_ray(job->camera, x, y, &path->rng);
+                path->throughput = color3(1.0, 1.0, 1.0);
+                path->pdf = 0.0;
+                path->sample = round_first[p] + s;
+                path->depth = 0;
+                scratch->colors[count] = color3(0.0, 0.0, 0.0);
+                count++;
+            }
+        }
+
+        r64 generated = get_time_seconds();
+        timings->seconds[StageGenerate] += generated - start;
+        timings->items[StageGenerate] += count;
+
+        if (job->max_bounce > 0) {
+            run_wavefront(job, scratch, count, timings);
+        }
+
+        r64 accumulate_start = get_time_seconds();
+
+        // samples go into the estimates in sample order, as render_pixel adds them
+        any_left = false;
+        for(s32 p = 0 ; p < pixel_count ; p++){
+            if (done[p]) continue;
+            for(s32 s = 0 ; s < round_count[p] ; s++){
+                add_sample(&estimates[p], scratch->colors[round_first[p] + s]);
+                if (job->features) add_features(&estimates[p], scratch->features[round_first[p] + s]);
+            }
+
+            done[p] = pixel_done(job, &estimates[p], max_samples);
+            any_left = any_left || !done[p];
+        }
+
+        timings->seconds[StageAccumulate] += get_time_seconds() - accumulate_start;
+        timings->items[StageAccumulate] += count;
+    }
+
+    // the job's estimates carry the samples to later passes and checkpoints
+    for(s32 p = 0 ; p < pixel_count ; p++){
+        store_pixel(job, x0 + p % width, y0 + p / width, &estimates[p]);
+        if (job->estimates) job->estimates[(s64)job->image->width * (y0 + p / width) + x0 + p % width] = estimates[p];
+    }
+}
+
+void print_wavefront_timings(const wavefront_timings_t * timings){
+    r64 total = 0.0;
+    for(s32 s = 0 ; s < StageCount ; s++) total += timings->seconds[s];
+
+    fprintf(stderr, "wavefront stages (cpu time summed over threads):\n");
+    for(s32 s = 0 ; s < StageCount ; s++){
+        fprintf(stderr, "  %-18s %9.3f s %5.1f%% %12llu items %8.1f ns/item\n", 
+                WAVEFRONT_STAGE_NAMES[s], timings->seconds[s], 
+                total > 0.0 ? 100.0 * timings->seconds[s] / total : 0.0,
+                (unsigned long long) timings->items[s],
+                timings->items[s] ? 1e9 * timings->seconds[s] / timings->items[s] : 0.0);
+    }
+}
+
+struct render_worker_t {
+    render_job_t * job;
+    s32 id;
+    pthread_t thread;
+
+    wavefront_scratch_t scratch;
+    wavefront_timings_t timings;
+    u64 rays;
+    render_stats_t stats;
+};
+
+// pixel bounds of a tile, x1 and y1 exclusive
+inline void tile_rect(const render_job_t * job, s32 tile, s32 * x0, s32 * y0, s32 * x1, s32 * y1){
+    *x0 = (tile % job->tiles_x) * job->tile_size;
+    *y0 = (tile / job->tiles_x) * job->tile_size;
+    *x1 = *x0 + job->tile_size < job->image->width ? *x0 + job->tile_size : job->image->width;
+    *y1 = *y0 + job->tile_size < job->image->height ? *y0 + job->tile_size : job->image->height;
+}
+
+void render_tile(const render_job_t * job, render_worker_t * worker, s32 tile){
+    r64 start = job->tile_seconds ? get_time_seconds() : 0.0;
+
+    s32 x0, y0, x1, y1;
+    tile_rect(job, tile, &x0, &y0, &x1, &y1);
+
+    if (job->wavefront) {
+        render_tile_wavefront(job, &worker->scratch, &worker->timings, x0, y0, x1, y1);
+    }
+    else {
+        for(s32 y = y0 ; y < y1 ; y++){
+            for(s32 x = x0 ; x < x1 ; x++){
+                pixel_estimate_t fresh = {};
+                fresh.mean = color3(0.0, 0.0, 0.0);
+                pixel_estimate_t * estimate = job->estimates ? &job->estimates[(s64)job->image->width * y + x] : &fresh;
+                render_pixel(job, x, y, estimate, sample_limit(job));
+                store_pixel(job, x, y, estimate);
+            }
+        }
+    }
+
+    if (job->tile_seconds) {
+        job->tile_seconds[tile] = get_time_seconds() - start;
+    }
+    image_writer_tile_done(job->writer, y0, y1);
+}
+
+void * render_worker(void * arg){
+    render_worker_t * worker = (render_worker_t *) arg;
+    render_job_t * job = worker->job;
+    u64 rays_start = rays_traced;
+    thread_stats = {};
+
+    s32 tile = 0;
+    while(true){
+        if (tile_queue_pop(&job->queues[worker->id], &tile)) {
+            render_tile(job, worker, tile);
+            continue;
+        }
+
+        bool stolen = false;
+        for(s32 i = 1 ; i < job->worker_count && !stolen ; i++){
+            stolen = tile_queue_steal(&job->queues[(worker->id + i) % job->worker_count], &tile);
+        }
+        if (!stolen) break;
+
+        render_tile(job, worker, tile);
+    }
+
+    destroy_wavefront(&worker->scratch);
+    worker->rays = rays_traced - rays_start;
+    worker->stats = thread_stats;
+    return NULL;
+}
+
+void render_image(render_job_t * job, s32 worker_count){
+    job->tiles_x = (job->image->width + job->tile_size - 1) / job->tile_size;
+    job->tiles_y = (job->image->height + job->tile_size - 1) / job->tile_size;
+    job->worker_count = worker_count;
+
+    s32 tile_count = job->tiles_x * job->tiles_y;
+
+    // contiguous runs of tiles per worker so a worker's own tiles stay neighbours
+    job->queues = (tile_queue_t *) malloc(sizeof(tile_queue_t) * worker_count);
+    for(s32 i = 0 ; i < worker_count ; i++){
+        tile_queue_t * queue = &job->queues[i];
+        s32 begin = (s32)((s64)tile_count * i / worker_count);
+        s32 end = (s32)((s64)tile_count * (i + 1) / worker_count);
+
+        pthread_mutex_init(&queue->lock, NULL);
+        queue->tiles = (s32 *) malloc(sizeof(s32) * (end - begin + 1));
+        queue->head = 0;
+        queue->tail = end - begin;
+        // reversed so the owner's pops from the back walk the run front to back
+        for(s32 t = begin ; t < end ; t++){
+            queue->tiles[end - 1 - t] = t;
+        }
+    }
+
+    render_worker_t * workers = (render_worker_t *) calloc(worker_count, sizeof(render_worker_t));
+    for(s32 i = 0 ; i < worker_count ; i++){
+        workers[i].job = job;
+        workers[i].id = i;
+        pthread_create(&workers[i].thread, NULL, render_worker, &workers[i]);
+    }
+    job->timings = {};
+    job->rays = 0;
+    job->stats = {};
+    for(s32 i = 0 ; i < worker_count ; i++){
+        pthread_join(workers[i].thread, NULL);
+        job->rays += workers[i].rays;
+        merge_stats(&job->stats, &workers[i].stats);
+        for(s32 s = 0 ; s < StageCount ; s++){
+            job->timings.seconds[s] += workers[i].timings.seconds[s];
+            job->timings.items[s] += workers[i].timings.items[s];
+        }
+    }
+
+    for(s32 i = 0 ; i < worker_count ; i++){
+        pthread_mutex_destroy(&job->queues[i].lock);
+        free(job->queues[i].tiles);
+    }
+    free(job->queues);
+    free(workers);
+    job->queues = NULL;
+}
+
+// @note: denoiser
+// an edge avoiding a-trous wavelet filter along the lines of svgf: five passes of a 5x5
+// b3 spline kernel whose taps lie 1, 2, 4, 8 and 16 pixels apart, so the fifth pass
+// averages over 129 pixels with 25 taps. a tap loses weight where the first hit features
+// say it sees another surface (normal, depth, albedo) and where its color is further from
+// the center than the center's variance explains. the albedo is divided out before
+// filtering so only the noisy lighting is blurred and textures stay sharp, and the
+// variance is filtered along so later passes see how much the earlier ones smoothed.
+// the planes are padded by the widest tap offset and carry a valid mask, so a whole simd
+// vector of pixels runs through the kernel at a time without bounds checks
+
+const s32 DENOISE_PASSES = 5;
+const s32 DENOISE_PAD = 2 << (DENOISE_PASSES - 1);  // outer tap offset of the last pass
+const real DENOISE_SIGMA_LUMINANCE = 4.0;
+const real DENOISE_SIGMA_DEPTH = 0.05;    // relative depth change per pixel of tap offset
+const real DENOISE_SIGMA_ALBEDO = 0.02;   // squared albedo distance
+const s32 DENOISE_NORMAL_SQUARINGS = 7;   // the normal weight is dot(n, n')^128
+const real DENOISE_MIN_ALBEDO = 0.01;
+
+enum denoise_guide {
+    GuideValid,
+    GuideAlbedoR, GuideAlbedoG, GuideAlbedoB,
+    GuideNormalX, GuideNormalY, GuideNormalZ,
+    GuideDepth,
+    GuideCount
+};
+
+// color and variance of the lighting, read by one pass and written by the next
+enum denoise_channel {
+    ChannelRed, ChannelGreen, ChannelBlue, ChannelVariance,
+    ChannelCount
+};
+
+struct denoiser_t {
+    s32 width, height;
+    s32 stride;               // padded row length, a multiple of the vector width plus the pads
+    real * guides[GuideCount];
+    real * input[ChannelCount];
+    real * output[ChannelCount];
+    s32 step;                 // tap spacing of the running pass
+};
+
+struct denoise_band_t {
+    const denoiser_t * denoiser;
+    s32 y0, y1;
+    pthread_t thread;
+};
+
+inline s64 denoise_index(const denoiser_t * denoiser, s32 x, s32 y){
+    return (s64)(y + DENOISE_PAD) * denoiser->stride + x + DENOISE_PAD;
+}
+
+inline lanes_t lanes_abs_diff(lanes_t a, lanes_t b){
+    return lanes_max(lanes_sub(a, b), lanes_sub(b, a));
+}
+
+inline lanes_t lanes_luminance(lanes_t r, lanes_t g, lanes_t b){
+    return lanes_add(lanes_add(lanes_mul(lanes_set(0.2126), r), lanes_mul(lanes_set(0.7152), g)), lanes_mul(lanes_set(0.0722), b));
+}
+
+// (1 - x/16)^16 for exp(-x), close enough for a weight and no transcendental per tap
+inline lanes_t lanes_exp_neg(lanes_t x){
+    lanes_t result = lanes_max(lanes_sub(lanes_set(1.0), lanes_mul(x, lanes_set(1.0 / 16.0))), lanes_set(0.0));
+    result = lanes_mul(result, result);
+    result = lanes_mul(result, result);
+    result = lanes_mul(result, result);
+    return lanes_mul(result, result);
+}
+
+void * denoise_band(void * arg){
+    const denoise_band_t * band = (const denoise_band_t *) arg;
+    const denoiser_t * denoiser = band->denoiser;
+    const real KERNEL[5] = {1.0 / 16.0, 1.0 / 4.0, 3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0};
+    real * const * guides = denoiser->guides;
+    real * const * input = denoiser->input;
+    lanes_t zero = lanes_set(0.0);
+    lanes_t depth_scale = lanes_set(DENOISE_SIGMA_DEPTH * denoiser->step);
+    lanes_t albedo_scale = lanes_set(1.0 / DENOISE_SIGMA_ALBEDO);
+
+    for(s32 y = band->y0 ; y < band->y1 ; y++){
+        for(s32 x = 0 ; x < denoiser->width ; x += PACKET_LANES){
+            s64 p = denoise_index(denoiser, x, y);
+            lanes_t valid = lanes_load(guides[GuideValid] + p);
+            lanes_t albedo_r = lanes_load(guides[GuideAlbedoR] + p);
+            lanes_t albedo_g = lanes_load(guides[GuideAlbedoG] + p);
+            lanes_t albedo_b = lanes_load(guides[GuideAlbedoB] + p);
+            lanes_t normal_x = lanes_load(guides[GuideNormalX] + p);
+            lanes_t normal_y = lanes_load(guides[GuideNormalY] + p);
+            lanes_t normal_z = lanes_load(guides[GuideNormalZ] + p);
+            lanes_t depth = lanes_load(guides[GuideDepth] + p);
+            lanes_t lum_scale = lanes_div(lanes_set(1.0), lanes_add(lanes_mul(lanes_set(DENOISE_SIGMA_LUMINANCE), lanes_sqrt(lanes_max(lanes_load(input[ChannelVariance] + p), zero))), lanes_set(1e-4)));
+
+            // the center tap counts in full whatever its features say, so no pixel is left
+            // without weight
+            lanes_t center_r = lanes_load(input[ChannelRed] + p);
+            lanes_t center_g = lanes_load(input[ChannelGreen] + p);
+            lanes_t center_b = lanes_load(input[ChannelBlue] + p);
+            lanes_t lum = lanes_luminance(center_r, center_g, center_b);
+            lanes_t sum_weight = lanes_set(KERNEL[2] * KERNEL[2]);
+            lanes_t sum_r = lanes_mul(sum_weight, center_r);
+            lanes_t sum_g = lanes_mul(sum_weight, center_g);
+            lanes_t sum_b = lanes_mul(sum_weight, center_b);
+            lanes_t sum_variance = lanes_mul(lanes_mul(sum_weight, sum_weight), lanes_load(input[ChannelVariance] + p));
+            for(s32 j = 0 ; j < 5 ; j++){
+                for(s32 i = 0 ; i < 5 ; i++){
+                    if (i == 2 && j == 2) continue;
+                    s64 q = p + ((s64)(j - 2) * denoiser->stride + (i - 2)) * denoiser->step;
+
+                    lanes_t cosine = lanes_add(lanes_add(
+                        lanes_mul(normal_x, lanes_load(guides[GuideNormalX] + q)),
+                        lanes_mul(normal_y, lanes_load(guides[GuideNormalY] + q))),
+                        lanes_mul(normal_z, lanes_load(guides[GuideNormalZ] + q)));
+                    lanes_t normal_weight = lanes_max(cosine, zero);
+                    for(s32 s = 0 ; s < DENOISE_NORMAL_SQUARINGS ; s++){
+                        normal_weight = lanes_mul(normal_weight, normal_weight);
+                    }
+
+                    lanes_t depth_q = lanes_load(guides[GuideDepth] + q);
+                    lanes_t depth_term = lanes_div(lanes_abs_diff(depth, depth_q), lanes_add(lanes_mul(depth_scale, lanes_max(depth, depth_q)), lanes_set(1e-4)));
+
+                    lanes_t dr = lanes_sub(albedo_r, lanes_load(guides[GuideAlbedoR] + q));
+                    lanes_t dg = lanes_sub(albedo_g, lanes_load(guides[GuideAlbedoG] + q));
+                    lanes_t db = lanes_sub(albedo_b, lanes_load(guides[GuideAlbedoB] + q));
+                    lanes_t albedo_term = lanes_mul(lanes_add(lanes_add(lanes_mul(dr, dr), lanes_mul(dg, dg)), lanes_mul(db, db)), albedo_scale);
+
+                    lanes_t r = lanes_load(input[ChannelRed] + q);
+                    lanes_t g = lanes_load(input[ChannelGreen] + q);
+                    lanes_t b = lanes_load(input[ChannelBlue] + q);
+                    lanes_t lum_term = lanes_mul(lanes_abs_diff(lum, lanes_luminance(r, g, b)), lum_scale);
+
+                    lanes_t weight = lanes_mul(lanes_mul(lanes_set(KERNEL[i] * KERNEL[j]), lanes_load(guides[GuideValid] + q)),
+                        lanes_mul(normal_weight, lanes_exp_neg(lanes_add(lanes_add(depth_term, albedo_term), lum_term))));
+
+                    sum_weight = lanes_add(sum_weight, weight);
+                    sum_r = lanes_add(sum_r, lanes_mul(weight, r));
+                    sum_g = lanes_add(sum_g, lanes_mul(weight, g));
+                    sum_b = lanes_add(sum_b, lanes_mul(weight, b));
+                    sum_variance = lanes_add(sum_variance, lanes_mul(lanes_mul(weight, weight), lanes_load(input[ChannelVariance] + q)));
+                }
+            }
+
+            // padding stays zero
+            lanes_t scale = lanes_div(valid, sum_weight);
+            lanes_store(denoiser->output[ChannelRed] + p, lanes_mul(sum_r, scale));
+            lanes_store(denoiser->output[ChannelGreen] + p, lanes_mul(sum_g, scale));
+            lanes_store(denoiser->output[ChannelBlue] + p, lanes_mul(sum_b, scale));
+            lanes_store(denoiser->output[ChannelVariance] + p, lanes_mul(sum_variance, lanes_mul(scale, scale)));
+        }
+    }
+    return NULL;
+}
+
+// filters the image in place with the job's feature buffers
+void denoise_image(render_job_t * job, s32 threads){
+    const feature_buffers_t * buffers = job->features;
+    image_t * image = job->image;
+
+    denoiser_t denoiser = {};
+    denoiser.width = buffers->width;
+    denoiser.height = buffers->height;
+    denoiser.stride = (buffers->width + PACKET_LANES - 1) / PACKET_LANES * PACKET_LANES + 2 * DENOISE_PAD;
+    s64 plane_size = (s64)denoiser.stride * (buffers->height + 2 * DENOISE_PAD);
+
+    real * memory = (real *) calloc(plane_size * (GuideCount + 2 * ChannelCount), sizeof(real));
+    for(s32 g = 0 ; g < GuideCount ; g++){
+        denoiser.guides[g] = memory + plane_size * g;
+    }
+    for(s32 c = 0 ; c < ChannelCount ; c++){
+        denoiser.input[c] = memory + plane_size * (GuideCount + c);
+        denoiser.output[c] = memory + plane_size * (GuideCount + ChannelCount + c);
+    }
+
+    // demodulated: the lighting is the color over the albedo, its variance over the
+    // squared albedo luminance
+    r32 * const * planes = buffers->planes;
+    for(s32 y = 0 ; y < buffers->height ; y++){
+        for(s32 x = 0 ; x < buffers->width ; x++){
+            s64 i = (s64)y * buffers->width + x;
+            s64 p = denoise_index(&denoiser, x, y);
+            color3 albedo = {
+                maximum((real)planes[PlaneAlbedoR][i], DENOISE_MIN_ALBEDO),
+                maximum((real)planes[PlaneAlbedoG][i], DENOISE_MIN_ALBEDO),
+                maximum((real)planes[PlaneAlbedoB][i], DENOISE_MIN_ALBEDO)};
+            denoiser.guides[GuideValid][p] = 1.0;
+            denoiser.guides[GuideAlbedoR][p] = albedo.r;
+            denoiser.guides[GuideAlbedoG][p] = albedo.g;
+            denoiser.guides[GuideAlbedoB][p] = albedo.b;
+            // the mean normal of an edge pixel is short, renormalized it compares like the rest
+            vec3 normal = vec3(planes[PlaneNormalX][i], planes[PlaneNormalY][i], planes[PlaneNormalZ][i]);
+            if (length(normal) > 1e-6) normal = normalize(normal);
+            denoiser.guides[GuideNormalX][p] = normal.x;
+            denoiser.guides[GuideNormalY][p] = normal.y;
+            denoiser.guides[GuideNormalZ][p] = normal.z;
+            denoiser.guides[GuideDepth][p] = planes[PlaneDepth][i];
+            denoiser.input[ChannelRed][p] = planes[PlaneRed][i] / albedo.r;
+            denoiser.input[ChannelGreen][p] = planes[PlaneGreen][i] / albedo.g;
+            denoiser.input[ChannelBlue][p] = planes[PlaneBlue][i] / albedo.b;
+            real albedo_luminance = luminance(albedo);
+            denoiser.input[ChannelVariance][p] = planes[PlaneVariance][i] / (albedo_luminance * albedo_luminance);
+        }
+    }
+
+    if (threads > buffers->height) threads = buffers->height;
+    denoise_band_t * bands = (denoise_band_t *) calloc(threads, sizeof(denoise_band_t));
+    for(s32 pass = 0 ; pass < DENOISE_PASSES ; pass++){
+        denoiser.step = 1 << pass;
+        for(s32 t = 0 ; t < threads ; t++){
+            bands[t].denoiser = &denoiser;
+            bands[t].y0 = (s32)((s64)buffers->height * t / threads);
+            bands[t].y1 = (s32)((s64)buffers->height * (t + 1) / threads);
+            pthread_create(&bands[t].thread, NULL, denoise_band, &bands[t]);
+        }
+        for(s32 t = 0 ; t < threads ; t++){
+            pthread_join(bands[t].thread, NULL);
+        }
+        for(s32 c = 0 ; c < ChannelCount ; c++){
+            real * temp = denoiser.input[c];
+            denoiser.input[c] = denoiser.output[c];
+            denoiser.output[c] = temp;
+        }
+    }
+    free(bands);
+
+    for(s32 y = 0 ; y < buffers->height ; y++){
+        for(s32 x = 0 ; x < buffers->width ; x++){
+            s64 i = (s64)y * buffers->width + x;
+            s64 p = denoise_index(&denoiser, x, y);
+            color3 color = {
+                denoiser.input[ChannelRed][p] * denoiser.guides[GuideAlbedoR][p],
+                denoiser.input[ChannelGreen][p] * denoiser.guides[GuideAlbedoG][p],
+                denoiser.input[ChannelBlue][p] * denoiser.guides[GuideAlbedoB][p]};
+            image->pixels[i] = color_to_pixel(color, true);
+            if (image->hdr) {
+                image->hdr[i * 3 + 0] = color.r;
+                image->hdr[i * 3 + 1] = color.g;
+                image->hdr[i * 3 + 2] = color.b;
+            }
+        }
+    }
+    free(memory);
+}
+
+// @note: distributed rendering
+// a coordinator process owns the scene and the image and hands tiles to worker processes
+// over unix or tcp stream sockets. a worker is sent the scene once per job as a binary
+// scene file image, renders the tiles it is given one after the other and answers with
+// their pixels. a tile's pixels only depend on the per pixel seeds, so whichever worker
+// renders it, or two workers racing for it, produce the same bytes. this makes failures
+// cheap to handle: the tiles of a worker that disconnects or stops answering go back in
+// the queue, and once the queue is empty idle workers take copies of tiles that are
+// overdue, the first answer wins. tiles go out most expensive first, by the tile times of
+// an earlier --stats file or of the previous animation frame
+//
+// messages are a net_header_t and size bytes of payload. both ends are the same build on
+// the same architecture, so structs travel as they are
+
+const char NET_MAGIC[8] = {'R', 'T', 'W', 'O', 'R', 'K', 'E', 'R'};
+const u32 NET_VERSION = 3;
+const s32 NET_PIPELINE = 2;              // tiles a worker holds, covers the round trip
+const s32 NET_MAX_WORKERS = 256;
+const r64 NET_BACKUP_FACTOR = 4.0;       // a tile this many mean tile times late gets a copy
+const r64 NET_BACKUP_MIN_SECONDS = 0.25;
+
+enum net_message_type {
+    NetHello,     // worker to coordinator, net_hello_t
+    NetJob,       // coordinator to worker, net_job_t and the scene file image
+    NetTile,      // coordinator to worker, net_tile_t
+    NetResult,    // worker to coordinator, net_result_t and the tile's pixels
+    NetDone,      // coordinator to worker, no payload
+};
+
+struct net_header_t {
+    u32 type;
+    u32 pad;
+    u64 size;
+};
+
+struct net_hello_t {
+    char magic[8];
+    u32 version;
+    u32 real_size;
+};
+
+enum net_job_flags {
+    NetJobHDR = 1,            // results carry linear rgb after the pixels
+    NetJobSampleCounts = 2,   // and the samples taken per pixel after that
+};
+
+struct net_job_t {
+    u32 id;
+    u32 flags;
+    s32 width, height;
+    s32 tile_size;
+    s32 samples_per_pixel;
+    s32 min_samples_per_pixel;
+    s32 max_bounce;
+    s32 rr_depth;
+    s32 sampler;
+    s32 packet_size;
+    s32 wavefront;
+    s32 frame;
+    r64 max_error;
+    camera_t camera;
+    u64 scene_size;
+};
+
+struct net_tile_t {
+    u32 job;
+    s32 tile;
+};
+
+struct net_result_t {
+    u32 job;
+    s32 tile;
+    r64 seconds;
+    u64 rays;
+    render_stats_t stats;
+};
+
+static bool net_send_all(s32 fd, const void * data, u64 size){
+    const u8 * p = (const u8 *) data;
+    while (size > 0) {
+        ssize_t sent = send(fd, p, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+        p += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool net_recv_all(s32 fd, void * data, u64 size){
+    u8 * p = (u8 *) data;
+    while (size > 0) {
+        ssize_t got = recv(fd, p, size, 0);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        p += got;
+        size -= got;
+    }
+    return true;
+}
+
+// a header and a payload in up to two parts
+static bool net_send(s32 fd, u32 type, const void * a, u64 a_size, const void * b = NULL, u64 b_size = 0){
+    net_header_t header = {type, 0, a_size + b_size};
+    return net_send_all(fd, &header, sizeof(header)) && net_send_all(fd, a, a_size) && net_send_all(fd, b, b_size);
+}
+
+// "unix:PATH" or "HOST:PORT", a listening socket with an empty host takes every
+// interface. returns the socket or -1, only listening reports why
+s32 net_open(const char * address, bool listening){
+    if (!strncmp(address, "unix:", 5)) {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (strlen(address + 5) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "%s: path too long\n", address);
+            return -1;
+        }
+        strcpy(addr.sun_path, address + 5);
+
+        s32 fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (listening) {
+            unlink(addr.sun_path);
+            if (bind(fd, (sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+                fprintf(stderr, "%s: %s\n", address, strerror(errno));
+                close(fd);
+                return -1;
+            }
+        }
+        else if (connect(fd, (sockaddr *) &addr, sizeof(addr)) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    const char * colon = strrchr(address, ':');
+    if (!colon) {
+        fprintf(stderr, "%s: expected unix:PATH or HOST:PORT\n", address);
+        return -1;
+    }
+    char host[256];
+    snprintf(host, sizeof(host), "%.*s", (s32)(colon - address), address);
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    addrinfo * list = NULL;
+    s32 error = getaddrinfo(host[0] ? host : NULL, colon + 1, &hints, &list);
+    if (error != 0) {
+        fprintf(stderr, "%s: %s\n", address, gai_strerror(error));
+        return -1;
+    }
+
+    s32 fd = -1;
+    for(addrinfo * ai = list ; ai && fd < 0 ; ai = ai->ai_next){
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        s32 one = 1;
+        bool ok = false;
+        if (listening) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            ok = bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 64) == 0;
+        }
+        else {
+            ok = connect(fd, ai->ai_addr, ai->ai_addrlen) == 0;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        if (!ok) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(list);
+    if (fd < 0 && listening) fprintf(stderr, "%s: %s\n", address, strerror(errno));
+    return fd;
+}
+
+// bytes of a result's payload after the net_result_t
+inline u64 net_tile_payload_size(u32 flags, s32 pixel_count){
+    u64 size = sizeof(pixel_t) * (u64)pixel_count;
+    if (flags & NetJobHDR) size += sizeof(r32) * 3 * (u64)pixel_count;
+    if (flags & NetJobSampleCounts) size += sizeof(s32) * (u64)pixel_count;
+    return size;
+}
+
+// copies a tile of the image to or from a result payload, rows one after the other
+void net_tile_pixels(const render_job_t * job, s32 tile, u32 flags, u8 * payload, bool unpack){
+    image_t * image = job->image;
+    s32 x0, y0, x1, y1;
+    tile_rect(job, tile, &x0, &y0, &x1, &y1);
+    s32 width = x1 - x0, pixel_count = width * (y1 - y0);
+
+    pixel_t * pixels = (pixel_t *) payload;
+    r32 * hdr = (r32 *)(payload + sizeof(pixel_t) * pixel_count);
+    s32 * counts = (s32 *)(payload + sizeof(pixel_t) * pixel_count + ((flags & NetJobHDR) ? sizeof(r32) * 3 * pixel_count : 0));
+    for(s32 y = y0 ; y < y1 ; y++){
+        s64 row = (s64)image->width * y + x0;
+        s32 p = (y - y0) * width;
+        if (unpack) memcpy(&image->pixels[row], &pixels[p], sizeof(pixel_t) * width);
+        else memcpy(&pixels[p], &image->pixels[row], sizeof(pixel_t) * width);
+        if (flags & NetJobHDR) {
+            if (unpack) memcpy(&image->hdr[row * 3], &hdr[p * 3], sizeof(r32) * 3 * width);
+            else memcpy(&hdr[p * 3], &image->hdr[row * 3], sizeof(r32) * 3 * width);
+        }
+        if (flags & NetJobSampleCounts) {
+            if (unpack) memcpy(&job->sample_counts[row], &counts[p], sizeof(s32) * width);
+            else memcpy(&counts[p], &job->sample_counts[row], sizeof(s32) * width);
+        }
+    }
+}
+
+// a worker process: connects, renders the tiles of whatever job it is sent, and returns
+// once the coordinator is done or gone
+s32 run_worker(const char * address){
+    // the coordinator may still be coming up
+    s32 fd = -1;
+    for(s32 attempt = 0 ; attempt < 50 && fd < 0 ; attempt++){
+        fd = net_open(address, false);
+        if (fd < 0) usleep(100 * 1000);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "worker: cannot connect to %s\n", address);
+        return -1;
+    }
+
+    net_hello_t hello = {};
+    memcpy(hello.magic, NET_MAGIC, sizeof(hello.magic));
+    hello.version = NET_VERSION;
+    hello.real_size = sizeof(real);
+
+    scene_t scene = {};
+    image_t image = {};
+    camera_t camera = {};
+    render_job_t job = {};
+    render_worker_t worker = {};
+    net_job_t current = {};
+    u8 * message = NULL;
+    u64 message_capacity = 0;
+    bool has_job = false;
+    const char * error = net_send(fd, NetHello, &hello, sizeof(hello)) ? NULL : "coordinator went away";
+
+    while (!error) {
+        net_header_t header;
+        if (!net_recv_all(fd, &header, sizeof(header)) || header.type == NetDone) break;
+
+        if (header.type == NetJob && header.size >= sizeof(net_job_t)) {
+            if (!net_recv_all(fd, &current, sizeof(current)) || header.size != sizeof(current) + current.scene_size) {
+                error = "bad job";
+                break;
+            }
+            destroy_scene(&scene);
+            free(image.pixels);
+            free(image.hdr);
+            free(job.sample_counts);
+            has_job = false;
+
+            // an anonymous mapping, which the scene then owns like a mapped file
+            void * mapping = mmap(NULL, current.scene_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapping == MAP_FAILED) {
+                error = "out of memory";
+                break;
+            }
+            if (!net_recv_all(fd, mapping, current.scene_size)) {
+                munmap(mapping, current.scene_size);
+                break;
+            }
+            if (load_scene_mapping(&scene, mapping, current.scene_size, AccelBVH, "worker scene") != 0) {
+                error = "bad scene";
+                break;
+            }
+
+            create_image(&image, current.width, current.height, 0x000000);
+            image.hdr = (current.flags & NetJobHDR) ? (r32 *) malloc(sizeof(r32) * 3 * current.width * current.height) : NULL;
+            camera = current.camera;
+
+            job = {};
+            job.image = &image;
+            job.camera = &camera;
+            job.scene = &scene;
+            job.samples_per_pixel = current.samples_per_pixel;
+            job.min_samples_per_pixel = current.min_samples_per_pixel;
+            job.max_error = current.max_error;
+            job.max_bounce = current.max_bounce;
+            job.rr_depth = current.rr_depth;
+            job.sampler = (sampler_type) current.sampler;
+            job.packet_size = current.packet_size;
+            job.wavefront = current.wavefront != 0;
+            job.frame = current.frame;
+            job.tile_size = current.tile_size;
+            job.tiles_x = (current.width + current.tile_size - 1) / current.tile_size;
+            job.tiles_y = (current.height + current.tile_size - 1) / current.tile_size;
+            job.worker_count = 1;
+            job.sample_counts = (current.flags & NetJobSampleCounts) ? (s32 *) malloc(sizeof(s32) * current.width * current.height) : NULL;
+            has_job = true;
+        }
+        else if (header.type == NetTile && header.size == sizeof(net_tile_t)) {
+            net_tile_t tile;
+            if (!net_recv_all(fd, &tile, sizeof(tile))) break;
+            if (!has_job || tile.job != current.id || tile.tile < 0 || tile.tile >= job.tiles_x * job.tiles_y) {
+                error = "tile of an unknown job";
+                break;
+            }
+
+            thread_stats = {};
+            u64 rays_start = rays_traced;
+            r64 start = get_time_seconds();
+            render_tile(&job, &worker, tile.tile);
+
+            net_result_t result = {};
+            result.job = tile.job;
+            result.tile = tile.tile;
+            result.seconds = get_time_seconds() - start;
+            result.rays = rays_traced - rays_start;
+            result.stats = thread_stats;
+
+            s32 x0, y0, x1, y1;
+            tile_rect(&job, tile.tile, &x0, &y0, &x1, &y1);
+            u64 size = net_tile_payload_size(current.flags, (x1 - x0) * (y1 - y0));
+            if (size > message_capacity) {
+                message_capacity = size;
+                message = (u8 *) realloc(message, message_capacity);
+            }
+            net_tile_pixels(&job, tile.tile, current.flags, message, false);
+            if (!net_send(fd, NetResult, &result, sizeof(result), message, size)) break;
+        }
+        else {
+            error = "unexpected message";
+        }
+    }
+
+    if (error) fprintf(stderr, "worker: %s\n", error);
+    destroy_wavefront(&worker.scratch);
+    destroy_scene(&scene);
+    free(image.pixels);
+    free(image.hdr);
+    free(job.sample_counts);
+    free(message);
+    close(fd);
+    return error ? -1 : 0;
+}
+
+struct net_worker_t {
+    s32 fd;
+    bool ready;                   // said hello
+    u32 job;                      // last job it was sent
+    s32 tiles[NET_PIPELINE];      // in flight, the first one is being rendered
+    s32 tile_count;
+    r64 head_start;               // when the first tile in flight got to the front
+};
+
+struct coordinator_t {
+    const char * address;
+    s32 listen_fd;
+    net_worker_t workers[NET_MAX_WORKERS];
+    s32 worker_count;
+    pid_t * local_pids;
+    s32 local_count;
+    r64 timeout;          // a worker sitting on a tile this long is dropped
+    r64 * tile_costs;     // expected seconds per tile, most expensive tiles go out first
+    s32 tile_cost_count;
+    u32 job_id;
+};
+
+// the tile times of an earlier --stats file, NULL when there are none
+r64 * load_tile_costs(const char * file, s32 * count){
+    *count = 0;
+    FILE * fp = fopen(file, "r");
+    if (!fp) {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return NULL;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char * text = (char *) malloc(size + 1);
+    text[fread(text, 1, size, fp)] = 0;
+    fclose(fp);
+
+    r64 * costs = NULL;
+    const char * p = strstr(text, "\"seconds\": [");
+    if (p) {
+        p += strlen("\"seconds\": [");
+        s32 capacity = 256;
+        costs = (r64 *) malloc(sizeof(r64) * capacity);
+        while (true) {
+            char * end = NULL;
+            r64 value = strtod(p, &end);
+            if (end == p) break;
+            if (*count == capacity) {
+                capacity *= 2;
+                costs = (r64 *) realloc(costs, sizeof(r64) * capacity);
+            }
+            costs[(*count)++] = value;
+            p = end;
+            while (*p == ',' || *p == ' ' || *p == '\n') p++;
+        }
+    }
+    free(text);
+    if (*count == 0) {
+        fprintf(stderr, "%s: no tile times\n", file);
+        free(costs);
+        costs = NULL;
+    }
+    return costs;
+}
+
+// listens on address and starts local_workers worker processes on this machine
+s32 coordinator_open(coordinator_t * coordinator, const char * address, s32 local_workers, r64 timeout, const char * tile_costs){
+    *coordinator = {};
+    coordinator->address = address;
+    coordinator->timeout = timeout;
+    coordinator->listen_fd = net_open(address, true);
+    if (coordinator->listen_fd < 0) return -1;
+
+    if (tile_costs) {
+        coordinator->tile_costs = load_tile_costs(tile_costs, &coordinator->tile_cost_count);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    coordinator->local_pids = (pid_t *) malloc(sizeof(pid_t) * (local_workers > 0 ? local_workers : 1));
+    for(s32 i = 0 ; i < local_workers ; i++){
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(coordinator->listen_fd);
+            _exit(run_worker(address) == 0 ? 0 : 1);
+        }
+        if (pid > 0) coordinator->local_pids[coordinator->local_count++] = pid;
+    }
+    return 0;
+}
+
+void coordinator_drop_worker(coordinator_t * coordinator, s32 index){
+    close(coordinator->workers[index].fd);
+    coordinator->workers[index] = coordinator->workers[--coordinator->worker_count];
+}
+
+void coordinator_close(coordinator_t * coordinator){
+    for(s32 i = 0 ; i < coordinator->worker_count ; i++){
+        net_send(coordinator->workers[i].fd, NetDone, NULL, 0);
+        close(coordinator->workers[i].fd);
+    }
+    close(coordinator->listen_fd);
+    if (!strncmp(coordinator->address, "unix:", 5)) unlink(coordinator->address + 5);
+    for(s32 i = 0 ; i < coordinator->local_count ; i++){
+        waitpid(coordinator->local_pids[i], NULL, 0);
+    }
+    free(coordinator->local_pids);
+    free(coordinator->tile_costs);
+    *coordinator = {};
+}
+
+// per frame bookkeeping of render_distributed
+struct net_frame_t {
+    u8 * done;           // per tile
+    s32 * copies;        // per tile, how many workers hold it
+    s32 * order;         // tiles by expected cost, the next one to hand out at next
+    s32 next;
+    s32 * retry;         // tiles taken back from lost workers, handed out first
+    s32 retry_count;
+    r64 tile_seconds;    // sum over the finished tiles, for the mean
+    s32 tiles_done;
+};
+
+static const r64 * sort_costs;
+static int compare_tile_costs(const void * a, const void * b){
+    r64 ca = sort_costs[*(const s32 *) a], cb = sort_costs[*(const s32 *) b];
+    return ca < cb ? 1 : (ca > cb ? -1 : *(const s32 *) a - *(const s32 *) b);
+}
+
+// the next tile for worker w: a queued one, or for an idle worker a copy of a tile that
+// is overdue elsewhere. -1 when there is nothing to do
+s32 coordinator_next_tile(coordinator_t * coordinator, net_frame_t * frame, s32 tile_count, s32 w, r64 now){
+    while (frame->retry_count > 0) {
+        s32 tile = frame->retry[--frame->retry_count];
+        if (!frame->done[tile]) return tile;
+    }
+    while (frame->next < tile_count) {
+        s32 tile = frame->order[frame->next++];
+        if (!frame->done[tile]) return tile;
+    }
+    if (coordinator->workers[w].tile_count > 0) return -1;
+
+    r64 mean = frame->tiles_done > 0 ? frame->tile_seconds / frame->tiles_done : 0.0;
+    r64 overdue = maximum(NET_BACKUP_FACTOR * mean, NET_BACKUP_MIN_SECONDS);
+    s32 best = -1;
+    r64 best_late = overdue;
+    for(s32 i = 0 ; i < coordinator->worker_count ; i++){
+        const net_worker_t & other = coordinator->workers[i];
+        if (i == w || other.tile_count == 0 || now - other.head_start <= best_late) continue;
+        for(s32 k = 0 ; k < other.tile_count ; k++){
+            s32 tile = other.tiles[k];
+            if (!frame->done[tile] && frame->copies[tile] < 2) {
+                best = tile;
+                best_late = now - other.head_start;
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+// takes the tiles of worker w back and disconnects it
+void coordinator_lose_worker(coordinator_t * coordinator, net_frame_t * frame, s32 w, const char * reason){
+    net_worker_t & worker = coordinator->workers[w];
+    for(s32 k = 0 ; k < worker.tile_count ; k++){
+        s32 tile = worker.tiles[k];
+        if (--frame->copies[tile] == 0 && !frame->done[tile]) frame->retry[frame->retry_count++] = tile;
+    }
+    fprintf(stderr, "coordinator: lost a worker (%s), %d tiles back in the queue\n", reason, worker.tile_count);
+    coordinator_drop_worker(coordinator, w);
+}
+
+// renders job on the coordinator's workers instead of local threads. workers that join
+// in the middle of a frame get work straight away. fails when no worker has been
+// connected for the coordinator's timeout
+s32 render_distributed(render_job_t * job){
+    coordinator_t * coordinator = job->coordinator;
+    image_t * image = job->image;
+    job->tiles_x = (image->width + job->tile_size - 1) / job->tile_size;
+    job->tiles_y = (image->height + job->tile_size - 1) / job->tile_size;
+    job->rays = 0;
+    job->stats = {};
+    job->timings = {};
+    s32 tile_count = job->tiles_x * job->tiles_y;
+
+    net_job_t message = {};
+    message.id = ++coordinator->job_id;
+    message.flags = (image->hdr ? NetJobHDR : 0) | (job->sample_counts ? NetJobSampleCounts : 0);
+    message.width = image->width;
+    message.height = image->height;
+    message.tile_size = job->tile_size;
+    message.samples_per_pixel = job->samples_per_pixel;
+    message.min_samples_per_pixel = job->min_samples_per_pixel;
+    message.max_error = job->max_error;
+    message.max_bounce = job->max_bounce;
+    message.rr_depth = job->rr_depth;
+    message.sampler = job->sampler;
+    message.packet_size = job->packet_size;
+    message.wavefront = job->wavefront;
+    message.frame = job->frame;
+    message.camera = *job->camera;
+
+    // the scene goes out in the binary file format, workers load it like a mapped file
+    FILE * fp = tmpfile();
+    u8 * scene_image = NULL;
+    if (fp && write_scene_binary(job->scene, fp) && fseek(fp, 0, SEEK_END) == 0) {
+        message.scene_size = ftell(fp);
+        scene_image = (u8 *) malloc(message.scene_size);
+        fseek(fp, 0, SEEK_SET);
+        if (fread(scene_image, 1, message.scene_size, fp) != message.scene_size) {
+            free(scene_image);
+            scene_image = NULL;
+        }
+    }
+    if (fp) fclose(fp);
+    if (!scene_image) {
+        fprintf(stderr, "coordinator: cannot serialize the scene\n");
+        return -1;
+    }
+
+    net_frame_t frame = {};
+    frame.done = (u8 *) calloc(tile_count, sizeof(u8));
+    frame.copies = (s32 *) calloc(tile_count, sizeof(s32));
+    frame.order = (s32 *) malloc(sizeof(s32) * tile_count);
+    frame.retry = (s32 *) malloc(sizeof(s32) * tile_count);
+    for(s32 t = 0 ; t < tile_count ; t++) frame.order[t] = t;
+    if (coordinator->tile_cost_count == tile_count) {
+        sort_costs = coordinator->tile_costs;
+        qsort(frame.order, tile_count, sizeof(s32), compare_tile_costs);
+    }
+    else {
+        coordinator->tile_costs = (r64 *) realloc(coordinator->tile_costs, sizeof(r64) * tile_count);
+        coordinator->tile_cost_count = tile_count;
+    }
+
+    // tiles still out from an earlier frame answer with the old job id and are ignored
+    for(s32 i = 0 ; i < coordinator->worker_count ; i++){
+        coordinator->workers[i].tile_count = 0;
+    }
+
+    u8 * payload = NULL;
+    u64 payload_capacity = 0;
+    s32 remaining = tile_count;
+    s32 status = 0;
+    r64 last_connected = get_time_seconds();
+    pollfd fds[NET_MAX_WORKERS + 1];
+
+    while (remaining > 0) {
+        r64 now = get_time_seconds();
+
+        // hand out work, and drop workers that sat on a tile for too long
+        for(s32 w = 0 ; w < coordinator->worker_count ; w++){
+            net_worker_t & worker = coordinator->workers[w];
+            if (!worker.ready) continue;
+            if (worker.tile_count > 0 && now - worker.head_start > coordinator->timeout) {
+                coordinator_lose_worker(coordinator, &frame, w--, "timed out");
+                continue;
+            }
+            if (worker.job != message.id) {
+                worker.job = message.id;
+                if (!net_send(worker.fd, NetJob, &message, sizeof(message), scene_image, message.scene_size)) {
+                    coordinator_lose_worker(coordinator, &frame, w--, "send failed");
+                    continue;
+                }
+            }
+            bool lost = false;
+            while (worker.tile_count < NET_PIPELINE) {
+                s32 tile = coordinator_next_tile(coordinator, &frame, tile_count, w, now);
+                if (tile < 0) break;
+                net_tile_t request = {message.id, tile};
+                if (!net_send(worker.fd, NetTile, &request, sizeof(request))) {
+                    if (frame.copies[tile] == 0) frame.retry[frame.retry_count++] = tile;
+                    lost = true;
+                    break;
+                }
+                if (worker.tile_count == 0) worker.head_start = now;
+                worker.tiles[worker.tile_count++] = tile;
+                frame.copies[tile]++;
+            }
+            if (lost) coordinator_lose_worker(coordinator, &frame, w--, "send failed");
+        }
+
+        if (coordinator->worker_count > 0) {
+            last_connected = now;
+        }
+        else if (now - last_connected > coordinator->timeout) {
+            fprintf(stderr, "coordinator: no workers, %d tiles left\n", remaining);
+            status = -1;
+            break;
+        }
+
+        s32 fd_count = 0;
+        fds[fd_count++] = {coordinator->listen_fd, POLLIN, 0};
+        for(s32 w = 0 ; w < coordinator->worker_count ; w++){
+            fds[fd_count++] = {coordinator->workers[w].fd, POLLIN, 0};
+        }
+        if (poll(fds, fd_count, 100) <= 0) continue;
+
+        // workers are visited back to front so dropping one keeps the others' poll slots
+        for(s32 w = coordinator->worker_count - 1 ; w >= 0 ; w--){
+            if (!(fds[w + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            net_worker_t & worker = coordinator->workers[w];
+
+            net_header_t header;
+            if (!net_recv_all(worker.fd, &header, sizeof(header))) {
+                coordinator_lose_worker(coordinator, &frame, w, "disconnected");
+                continue;
+            }
+            if (header.type == NetHello && header.size == sizeof(net_hello_t) && !worker.ready) {
+                net_hello_t hello;
+                if (!net_recv_all(worker.fd, &hello, sizeof(hello)) || memcmp(hello.magic, NET_MAGIC, sizeof(hello.magic)) || 
+                    hello.version != NET_VERSION || hello.real_size != sizeof(real)) {
+                    coordinator_lose_worker(coordinator, &frame, w, "incompatible worker");
+                    continue;
+                }
+                worker.ready = true;
+                worker.job = 0;
+            }
+            else if (header.type == NetResult && header.size >= sizeof(net_result_t)) {
+                net_result_t result;
+                u64 size = header.size - sizeof(result);
+                // the size comes off the wire, no tile of this job is larger than a full one
+                if (size > net_tile_payload_size(message.flags, job->tile_size * job->tile_size)) {
+                    coordinator_lose_worker(coordinator, &frame, w, "bad result");
+                    continue;
+                }
+                if (size > payload_capacity) {
+                    u8 * grown = (u8 *) realloc(payload, size);
+                    if (!grown) {
+                        coordinator_lose_worker(coordinator, &frame, w, "out of memory");
+                        continue;
+                    }
+                    payload = grown;
+                    payload_capacity = size;
+                }
+                if (!net_recv_all(worker.fd, &result, sizeof(result)) || !net_recv_all(worker.fd, payload, size)) {
+                    coordinator_lose_worker(coordinator, &frame, w, "disconnected");
+                    continue;
+                }
+                if (result.job != message.id) continue;
+
+                s32 x0, y0, x1, y1;
+                bool valid = result.tile >= 0 && result.tile < tile_count;
+                if (valid) {
+                    tile_rect(job, result.tile, &x0, &y0, &x1, &y1);
+                    valid = size == net_tile_payload_size(message.flags, (x1 - x0) * (y1 - y0));
+                }
+                if (!valid) {
+                    coordinator_lose_worker(coordinator, &frame, w, "bad result");
+                    continue;
+                }
+
+                for(s32 k = 0 ; k < worker.tile_count ; k++){
+                    if (worker.tiles[k] != result.tile) continue;
+                    for(s32 j = k + 1 ; j < worker.tile_count ; j++) worker.tiles[j - 1] = worker.tiles[j];
+                    worker.tile_count--;
+                    frame.copies[result.tile]--;
+                    if (k == 0) worker.head_start = get_time_seconds();
+                    break;
+                }
+                if (frame.done[result.tile]) continue;
+
+                frame.done[result.tile] = 1;
+                frame.tile_seconds += result.seconds;
+                frame.tiles_done++;
+                remaining--;
+                net_tile_pixels(job, result.tile, message.flags, payload, true);
+                coordinator->tile_costs[result.tile] = result.seconds;
+                if (job->tile_seconds) job->tile_seconds[result.tile] = result.seconds;
+                job->rays += result.rays;
+                merge_stats(&job->stats, &result.stats);
+                image_writer_tile_done(job->writer, y0, y1);
+            }
+            else {
+                coordinator_lose_worker(coordinator, &frame, w, "unexpected message");
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            s32 fd = accept(coordinator->listen_fd, NULL, NULL);
+            if (fd >= 0 && coordinator->worker_count < NET_MAX_WORKERS) {
+                s32 one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                // a worker that stops mid message must not hang the coordinator
+                timeval receive_timeout = {(time_t) coordinator->timeout, 0};
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &receive_timeout, sizeof(receive_timeout));
+                net_worker_t worker = {};
+                worker.fd = fd;
+                coordinator->workers[coordinator->worker_count++] = worker;
+            }
+            else if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    job->worker_count = coordinator->worker_count;
+    free(frame.done);
+    free(frame.copies);
+    free(frame.order);
+    free(frame.retry);
+    free(payload);
+    free(scene_image);
+    return status;
+}
+
+// @note: checkpoints
+// a progressive render keeps every pixel's running estimate, the mean color, the
+// luminance deviation sum and the sample count, and takes its samples in passes. after a
+// pass, once the interval is up, the estimates go to FILE.tmp, which is synced and renamed
+// over FILE, so the checkpoint on disk is always a whole one. a sample's rng is seeded by
+// its pixel and sample index, so the sample counts are all the rng state there is: a
+// resumed render takes the samples the interrupted one would have taken, in the same
+// order, and writes the same bytes as a render that never stopped. the estimates are
+// stored as the build holds them, float and double builds can't share checkpoints
+
+const char CHECKPOINT_MAGIC[8] = {'R', 'T', 'C', 'H', 'E', 'C', 'K', 'P'};
+const u32 CHECKPOINT_VERSION = 2;
+const s32 PROGRESSIVE_PASS_SAMPLES = 16;  // a packet's worth, so full passes don't split packets
+
+struct checkpoint_header_t {
+    char magic[8];
+    u32 version;
+    u32 estimate_size;          // sizeof(pixel_estimate_t) of the writer
+    s32 width;
+    s32 height;
+    s32 samples_per_pixel;      // of the writer, a resume may change it
+    s32 min_samples_per_pixel;
+    r64 max_error;
+    s32 max_bounce;
+    s32 rr_depth;
+    s32 pass_samples;           // every pixel is done up to this many samples
+    u32 sampler;
+    u64 scene_hash;
+};
+
+struct checkpoint_t {
+    const char * file;
+    r64 interval;               // seconds between writes
+    r64 last_write;
+};
+
+inline u64 fnv1a_64(u64 hash, const void * data, u64 size){
+    const u8 * bytes = (const u8 *) data;
+    for(u64 i = 0 ; i < size ; i++) hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+// the geometry and materials of a scene, objects included
+u64 scene_hash(u64 hash, const scene_t * scene){
+    s32 count = scene->spheres.count;
+    if (scene->accel == AccelCompact) {
+        const compact_spheres_t & compact = scene->compact;
+        hash = fnv1a_64(hash, compact.clusters, sizeof(compact_cluster_t) * compact.cluster_count);
+        hash = fnv1a_64(hash, compact.offsets, sizeof(u16) * 3 * count);
+        hash = fnv1a_64(hash, compact.radius_index, sizeof(u16) * count);
+        hash = fnv1a_64(hash, compact.material_index, sizeof(u32) * count);
+        hash = fnv1a_64(hash, compact.radii, sizeof(real) * compact.radius_count);
+    }
+    else {
+        hash = fnv1a_64(hash, scene->spheres.center_x, sizeof(real) * count);
+        hash = fnv1a_64(hash, scene->spheres.center_y, sizeof(real) * count);
+        hash = fnv1a_64(hash, scene->spheres.center_z, sizeof(real) * count);
+        hash = fnv1a_64(hash, scene->spheres.radius, sizeof(real) * count);
+        hash = fnv1a_64(hash, scene->material_index, sizeof(u32) * count);
+    }
+    for(s32 i = 0 ; i < scene->material_count ; i++){
+        u32 material = material_hash(scene->materials[i]);
+        hash = fnv1a_64(hash, &material, sizeof(material));
+    }
+    for(s32 m = 0 ; m < scene->mesh_count ; m++){
+        const mesh_t & mesh = scene->meshes[m];
+        hash = fnv1a_64(hash, &mesh.material, sizeof(mesh.material));
+        hash = fnv1a_64(hash, mesh.positions, sizeof(r32) * 3 * mesh.vertex_count);
+        hash = fnv1a_64(hash, mesh.triangles, sizeof(u32) * 3 * mesh.triangle_count);
+    }
+    for(s32 g = 0 ; g < scene->grid_count ; g++){
+        const sphere_grid_t & grid = scene->grids[g];
+        hash = fnv1a_64(hash, &grid.origin, sizeof(grid.origin));
+        hash = fnv1a_64(hash, &grid.cell, sizeof(grid.cell));
+        hash = fnv1a_64(hash, &grid.nx, sizeof(grid.nx));
+        hash = fnv1a_64(hash, &grid.nz, sizeof(grid.nz));
+        hash = fnv1a_64(hash, &grid.seed, sizeof(grid.seed));
+        hash = fnv1a_64(hash, grid.palette, sizeof(grid.palette));
+    }
+    for(s32 o = 0 ; o < scene->object_count ; o++){
+        hash = scene_hash(hash, scene->objects[o].scene);
+        hash = fnv1a_64(hash, scene->objects[o].material_remap, sizeof(u32) * scene->objects[o].scene->material_count);
+    }
+    for(s32 i = 0 ; i < scene->instance_count ; i++){
+        const instance_t & instance = scene->instances[i];
+        hash = fnv1a_64(hash, &instance.offset, sizeof(instance.offset));
+        hash = fnv1a_64(hash, &instance.scale, sizeof(instance.scale));
+        hash = fnv1a_64(hash, &instance.yaw, sizeof(instance.yaw));
+        hash = fnv1a_64(hash, &instance.object, sizeof(instance.object));
+    }
+    return hash;
+}
+
+// the camera and the scene a checkpoint's estimates belong to
+u64 render_hash(const render_job_t * job){
+    const camera_t * camera = job->camera;
+
+    u64 hash = 14695981039346656037ull;
+    const vec3 * vectors[] = {&camera->center, &camera->pixel00_loc, &camera->delta_u, &camera->delta_v, &camera->defocus_disk_u, &camera->defocus_disk_v};
+    for(const vec3 * v : vectors) hash = fnv1a_64(hash, v, sizeof(vec3));
+    hash = fnv1a_64(hash, &camera->defocus_angle, sizeof(camera->defocus_angle));
+    return scene_hash(hash, job->scene);
+}
+
+checkpoint_header_t checkpoint_header(const render_job_t * job){
+    checkpoint_header_t header = {};
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.estimate_size = sizeof(pixel_estimate_t);
+    header.width = job->image->width;
+    header.height = job->image->height;
+    header.samples_per_pixel = job->samples_per_pixel;
+    header.min_samples_per_pixel = job->min_samples_per_pixel;
+    header.max_error = job->max_error;
+    header.max_bounce = job->max_bounce;
+    header.rr_depth = job->rr_depth;
+    header.sampler = job->sampler;
+    header.pass_samples = job->pass_samples;
+    header.scene_hash = render_hash(job);
+    return header;
+}
+
+s32 write_checkpoint(const render_job_t * job){
+    const char * file = job->checkpoint->file;
+    u64 count = (u64)job->image->width * job->image->height;
+
+    char * temp = (char *) malloc(strlen(file) + 5);
+    sprintf(temp, "%s.tmp", file);
+
+    FILE * fp = fopen(temp, "wb");
+    if (!fp) {
+        fprintf(stderr, "%s: %s\n", temp, strerror(errno));
+        free(temp);
+        return -1;
+    }
+
+    checkpoint_header_t header = checkpoint_header(job);
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+        fwrite(job->estimates, sizeof(pixel_estimate_t), count, fp) == count;
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) ok = false;
+    if (fclose(fp) != 0) ok = false;
+
+    // the old checkpoint stays until the new one is complete
+    if (!ok || rename(temp, file) != 0) {
+        fprintf(stderr, "%s: %s\n", file, ok ? strerror(errno) : "write failed");
+        unlink(temp);
+        free(temp);
+        return -1;
+    }
+    free(temp);
+    return 0;
+}
+
+// the estimates and the pass they reached, of a checkpoint written by the same render
+s32 read_checkpoint(render_job_t * job){
+    const char * file = job->checkpoint->file;
+    u64 count = (u64)job->image->width * job->image->height;
+
+    FILE * fp = fopen(file, "rb");
+    if (!fp) {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    checkpoint_header_t expected = checkpoint_header(job);
+    checkpoint_header_t header = {};
+    const char * error = NULL;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic))) error = "not a checkpoint";
+    else if (header.version != CHECKPOINT_VERSION) error = "unsupported version";
+    else if (header.estimate_size != expected.estimate_size) error = "written by a build of another precision";
+    else if (header.width != expected.width || header.height != expected.height) error = "written for another image size";
+    else if (header.min_samples_per_pixel != expected.min_samples_per_pixel || header.max_error != expected.max_error ||
+             header.max_bounce != expected.max_bounce || header.rr_depth != expected.rr_depth ||
+             header.sampler != expected.sampler) error = "written with other sampling settings";
+    else if (header.scene_hash != expected.scene_hash) error = "written for another scene or camera";
+    else if (header.pass_samples < 0 || header.pass_samples > header.samples_per_pixel) error = "bad pass";
+    else if (header.pass_samples > expected.samples_per_pixel) error = "has more samples per pixel than --spp";
+    else if (fread(job->estimates, sizeof(pixel_estimate_t), count, fp) != count) error = "truncated";
+    fclose(fp);
+
+    if (error) {
+        fprintf(stderr, "%s: %s\n", file, error);
+        return -1;
+    }
+    job->pass_samples = header.pass_samples;
+    return 0;
+}
+
+// passes start at one sample and double up to PROGRESSIVE_PASS_SAMPLES, so the first
+// previews come quickly and later passes trace full packets
+inline s32 next_pass_samples(s32 samples, s32 samples_per_pixel){
+    s32 step = samples < 1 ? 1 : samples < PROGRESSIVE_PASS_SAMPLES ? samples : PROGRESSIVE_PASS_SAMPLES;
+    return samples + step < samples_per_pixel ? samples + step : samples_per_pixel;
+}
+
+// the image so far, replacing the preview file with one rename so a viewer never sees
+// half of it, or as the next binary ppm frame of a stream on stdout
+s32 write_preview(const char * file, image_t * image){
+    if (!strcmp(file, "-")) {
+        u64 size = sizeof(pixel_t) * image->width * image->height;
+        fprintf(stdout, "P6\n%d %d\n255\n", image->width, image->height);
+        if (fwrite(image->pixels, 1, size, stdout) != size || fflush(stdout) != 0) {
+            fprintf(stderr, "preview: %s\n", strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+
+    char * temp = (char *) malloc(strlen(file) + 5);
+    sprintf(temp, "%s.tmp", file);
+
+    image_writer_t writer = {};
+    s32 result = image_writer_open(&writer, temp, image, image_format_from_file(file));
+    if (result == 0) result = image_writer_write_rows(&writer, 0, image->height);
+    if (image_writer_close(&writer) != 0) result = -1;
+    if (result == 0 && rename(temp, file) != 0) {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        result = -1;
+    }
+    if (result != 0) unlink(temp);
+    free(temp);
+    return result;
+}
+
+// passes over the whole image, continuing job->estimates from job->pass_samples until
+// every pixel is done or the next pass would run past the time limit. the image holds the
+// render so far after every pass, only a last pass known in advance streams to the writer
+s32 render_progressive(render_job_t * job, s32 threads){
+    s32 tile_count = ((job->image->width + job->tile_size - 1) / job->tile_size) * ((job->image->height + job->tile_size - 1) / job->tile_size);
+    r64 * tile_seconds = job->tile_seconds ? (r64 *) calloc(tile_count, sizeof(r64)) : NULL;
+    image_writer_t * writer = job->writer;
+    checkpoint_t * checkpoint = job->checkpoint;
+
+    wavefront_timings_t timings = {};
+    render_stats_t stats = {};
+    u64 rays = 0;
+    s32 result = 0;
+
+    r64 start = get_time_seconds();
+    if (checkpoint) checkpoint->last_write = start;
+
+    s32 passes = 0;
+    bool out_of_time = false;
+    bool last = false;
+    while (!last) {
+        s32 first = job->pass_samples;
+        job->pass_samples = next_pass_samples(first, job->samples_per_pixel);
+        last = job->pass_samples == job->samples_per_pixel;
+        job->writer = last ? writer : NULL;
+
+        r64 pass_start = get_time_seconds();
+        render_image(job, threads);
+        passes++;
+
+        rays += job->rays;
+        merge_stats(&stats, &job->stats);
+        for(s32 s = 0 ; s < StageCount ; s++){
+            timings.seconds[s] += job->timings.seconds[s];
+            timings.items[s] += job->timings.items[s];
+        }
+        for(s32 t = 0 ; tile_seconds && t < tile_count ; t++){
+            tile_seconds[t] += job->tile_seconds[t];
+        }
+
+        // the next pass is guessed to take as long per sample as this one
+        r64 now = get_time_seconds();
+        if (!last && job->time_limit > 0.0) {
+            s32 taken = job->pass_samples - first;
+            s32 next = next_pass_samples(job->pass_samples, job->samples_per_pixel) - job->pass_samples;
+            out_of_time = now + (now - pass_start) / (taken > 0 ? taken : 1) * next > start + job->time_limit;
+            last = out_of_time;
+        }
+
+        if (checkpoint && (last || now - checkpoint->last_write >= checkpoint->interval)) {
+            if (write_checkpoint(job) != 0) result = -1;
+            else fprintf(stderr, "checkpoint: %d spp in %s\n", job->pass_samples, checkpoint->file);
+            checkpoint->last_write = now;
+        }
+        if (job->preview && write_preview(job->preview, job->image) != 0) result = -1;
+    }
+    fprintf(stderr, "progressive: %d spp in %d pass%s%s\n", job->pass_samples, passes, passes == 1 ? "" : "es", out_of_time ? ", stopped by the time limit" : "");
+
+    job->writer = writer;
+    job->timings = timings;
+    job->stats = stats;
+    job->rays = rays;
+    if (tile_seconds) {
+        memcpy(job->tile_seconds, tile_seconds, sizeof(r64) * tile_count);
+        free(tile_seconds);
+    }
+    return result;
+}
+
+// renders the job into file, on local threads or on the job's coordinator, streaming
+// finished rows while the frame renders when stream is set. returns 0 once the image
+// is written, times the render and the tail of the write
+s32 render_to_file(render_job_t * job, const char * file, image_format format, bool stream, s32 threads, r64 * render_seconds, r64 * output_seconds){
+    image_t * image = job->image;
+    *render_seconds = 0.0;
+    *output_seconds = 0.0;
+
+    image_writer_t writer = {};
+    if (image_writer_open(&writer, file, image, format) != 0) {
+        return -1;
+    }
+    if (stream) {
+        image_writer_start_stream(&writer, (image->width + job->tile_size - 1) / job->tile_size);
+        job->writer = &writer;
+    }
+
+    r64 render_start = get_time_seconds();
+    s32 rendered = 0;
+    if (job->coordinator) {
+        rendered = render_distributed(job);
+    }
+    else if (job->estimates) {
+        rendered = render_progressive(job, threads);
+    }
+    else {
+        render_image(job, threads);
+    }
+    r64 render_end = get_time_seconds();
+    job->writer = NULL;
+
+    // streamed rows are already out, main only asks for a denoise without streaming.
+    // its time is reported on its own, not as part of the render
+    job->denoise_seconds = 0.0;
+    if (job->denoise) {
+        denoise_image(job, threads);
+        job->denoise_seconds = get_time_seconds() - render_end;
+    }
+    r64 output_start = get_time_seconds();
+
+    s32 result = stream ? 
+        image_writer_finish_stream(&writer) : 
+        image_writer_write_rows(&writer, 0, image->height);
+    if (image_writer_close(&writer) != 0 || rendered != 0) result = -1;
+
+    *render_seconds = render_end - render_start;
+    *output_seconds = get_time_seconds() - output_start;
+    return result;
+}
+
+// @note: statistics export
+
+enum feature_image { FeatureAlbedo, FeatureNormal, FeatureDepth };
+
+// pfm files get the features as they are, 8 bit ones what fits in [0, 1]: the albedo with
+// the image's gamma, normals as 0.5 + 0.5 n and depth over the farthest hit
+s32 write_feature_image(const char * file, const feature_buffers_t * buffers, feature_image kind){
+    s64 size = (s64)buffers->width * buffers->height;
+    r32 * const * planes = buffers->planes;
+    bool hdr = image_format_from_file(file) == ImageFormatPFM;
+
+    r32 farthest = 0.0f;
+    for(s64 i = 0 ; kind == FeatureDepth && i < size ; i++){
+        farthest = maximum(farthest, planes[PlaneDepth][i]);
+    }
+    if (farthest <= 0.0f) farthest = 1.0f;
+
+    image_t image;
+    create_image(&image, buffers->width, buffers->height, 0x000000);
+    if (hdr) image.hdr = (r32 *) malloc(sizeof(r32) * 3 * size);
+    for(s64 i = 0 ; i < size ; i++){
+        color3 value = {};
+        if (kind == FeatureAlbedo) value = color3(planes[PlaneAlbedoR][i], planes[PlaneAlbedoG][i], planes[PlaneAlbedoB][i]);
+        else if (kind == FeatureNormal) value = color3(planes[PlaneNormalX][i], planes[PlaneNormalY][i], planes[PlaneNormalZ][i]);
+        else value = color3(planes[PlaneDepth][i], planes[PlaneDepth][i], planes[PlaneDepth][i]);
+
+        if (hdr) {
+            image.hdr[i * 3 + 0] = value.r;
+            image.hdr[i * 3 + 1] = value.g;
+            image.hdr[i * 3 + 2] = value.b;
+        }
+        if (kind == FeatureAlbedo) image.pixels[i] = color_to_pixel(value, true);
+        else if (kind == FeatureNormal) image.pixels[i] = color_to_pixel(value * 0.5 + color3(0.5, 0.5, 0.5));
+        else image.pixels[i] = color_to_pixel(value / farthest);
+    }
+
+    s32 result = write_image(file, &image);
+    free(image.pixels);
+    free(image.hdr);
+    return result;
+}
+
+// every tile at the image's resolution, colored by its wall time relative to the slowest
+s32 write_tile_heatmap(const char * file, const render_job_t * job){
+    s32 width = job->image->width, height = job->image->height;
+    s32 tile_count = job->tiles_x * job->tiles_y;
+
+    r64 slowest = 0.0;
+    for(s32 t = 0 ; t < tile_count ; t++){
+        slowest = maximum(slowest, job->tile_seconds[t]);
+    }
+    if (slowest <= 0.0) slowest = 1.0;
+
+    image_t heatmap;
+    create_image(&heatmap, width, height, 0x000000);
+    for(s32 y = 0 ; y < height ; y++){
+        for(s32 x = 0 ; x < width ; x++){
+            s32 tile = (y / job->tile_size) * job->tiles_x + x / job->tile_size;
+            heatmap.pixels[(s64)y * width + x] = color_to_pixel(heat_color(job->tile_seconds[tile] / slowest));
+        }
+    }
+
+    s32 result = write_image(file, &heatmap);
+    free(heatmap.pixels);
+    return result;
+}
+
+s32 write_stats_json(const char * file, const render_job_t * job, r64 render_seconds){
+    FILE * fp = strcmp(file, "-") ? fopen(file, "w") : stdout;
+    if (!fp) {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    const render_stats_t & stats = job->stats;
+    u64 rays = stats.primary_rays + stats.secondary_rays + stats.shadow_rays;
+    u64 hits = stats.shaded[Lambertian] + stats.shaded[Metallic] + stats.shaded[Dielectric] + stats.shaded[Emissive];
+
+#ifndef RT_NO_STATS
+    fprintf(fp, "{\n  \"counters_enabled\": true,\n");
+#else
+    fprintf(fp, "{\n  \"counters_enabled\": false,\n");
+#endif
+    fprintf(fp, "  \"render_seconds\": %.6f,\n", render_seconds);
+    fprintf(fp, "  \"threads\": %d,\n", job->worker_count);
+    fprintf(fp, "  \"max_bounce\": %d,\n", job->max_bounce);
+    fprintf(fp, "  \"rays\": {\"primary\": %llu, \"secondary\": %llu, \"shadow\": %llu, \"total\": %llu, \"mrays_per_second\": %.3f},\n", 
+        (unsigned long long) stats.primary_rays, (unsigned long long) stats.secondary_rays, (unsigned long long) stats.shadow_rays, 
+        (unsigned long long) rays, render_seconds > 0.0 ? rays / render_seconds * 1e-6 : 0.0);
+    fprintf(fp, "  \"sphere_tests\": %llu,\n", (unsigned long long) stats.sphere_tests);
+    fprintf(fp, "  \"ray_hits\": %llu,\n", (unsigned long long) hits);
+    fprintf(fp, "  \"sphere_tests_per_ray\": %.3f,\n", rays ? (r64) stats.sphere_tests / rays : 0.0);
+    fprintf(fp, "  \"triangle_tests\": %llu,\n", (unsigned long long) stats.triangle_tests);
+    fprintf(fp, "  \"triangle_tests_per_ray\": %.3f,\n", rays ? (r64) stats.triangle_tests / rays : 0.0);
+    fprintf(fp, "  \"shaded\": {\"lambertian\": %llu, \"metallic\": %llu, \"dielectric\": %llu, \"emissive\": %llu},\n", 
+        (unsigned long long) stats.shaded[Lambertian], (unsigned long long) stats.shaded[Metallic], (unsigned long long) stats.shaded[Dielectric], 
+        (unsigned long long) stats.shaded[Emissive]);
+    fprintf(fp, "  \"paths_ended\": {\"sky\": %llu, \"light\": %llu, \"roulette\": %llu, \"max_bounce\": %llu},\n", 
+        (unsigned long long) stats.ended_sky, (unsigned long long) stats.ended_light, (unsigned long long) stats.ended_roulette, 
+        (unsigned long long) stats.ended_depth);
+
+    // trailing empty bins are left out
+    s32 depths = STATS_MAX_DEPTH;
+    while (depths > 1 && stats.depth_histogram[depths - 1] == 0) depths--;
+    fprintf(fp, "  \"depth_histogram\": [");
+    for(s32 d = 0 ; d < depths ; d++){
+        fprintf(fp, "%s%llu", d ? ", " : "", (unsigned long long) stats.depth_histogram[d]);
+    }
+    fprintf(fp, "],\n");
+
+    fprintf(fp, "  \"tiles\": {\"size\": %d, \"columns\": %d, \"rows\": %d", job->tile_size, job->tiles_x, job->tiles_y);
+    if (job->tile_seconds) {
+        s32 tile_count = job->tiles_x * job->tiles_y;
+        r64 total = 0.0, slowest = 0.0, fastest = INF_POS;
+        s32 slowest_tile = 0;
+        for(s32 t = 0 ; t < tile_count ; t++){
+            total += job->tile_seconds[t];
+            fastest = minimum(fastest, job->tile_seconds[t]);
+            if (job->tile_seconds[t] > slowest) {
+                slowest = job->tile_seconds[t];
+                slowest_tile = t;
+            }
+        }
+        fprintf(fp, ", \"mean_seconds\": %.6f, \"min_seconds\": %.6f, \"max_seconds\": %.6f, \"slowest\": [%d, %d],\n", 
+            total / tile_count, fastest, slowest, slowest_tile % job->tiles_x, slowest_tile / job->tiles_x);
+        fprintf(fp, "    \"seconds\": [");
+        for(s32 t = 0 ; t < tile_count ; t++){
+            fprintf(fp, "%s%.6f", t == 0 ? "" : (t % job->tiles_x == 0 ? ",\n      " : ", "), job->tile_seconds[t]);
+        }
+        fprintf(fp, "]");
+    }
+    fprintf(fp, "}\n}\n");
+
+    if (fp != stdout && fclose(fp) != 0) {
+        fprintf(stderr, "%s: write failed\n", file);
+        return -1;
+    }
+    return 0;
+}
+
+// @note: animation
+// a sequence of frames rendered in one process. keyframes give the camera and sphere
+// positions at some frames and everything in between is interpolated linearly. between
+// frames the moved spheres are written into the scene's arrays and the bvh is refit in
+// place, the image, the job and its buffers are reused. only when refitting has made
+// the tree much worse than a fresh build is it rebuilt
+//
+//     frames 48
+//     turntable 1                  # orbits of the camera around lookat over the sequence
+//     camera 0 vfov 20             # camera FRAME key values..., as in scene files
+//     camera 47 vfov 30
+//     sphere 3 0 -4 1 0            # sphere INDEX FRAME x y z [radius]
+//     sphere 3 47 -4 3 0 1.5
+//
+// sphere indices count spheres in the order the scene lists them
+
+// sah cost ratio over the last build at which a refit tree gets rebuilt
+const r64 ANIMATION_REBUILD_RATIO = 2.0;
+
+struct camera_key_t {
+    s32 frame;
+    camera_desc_t desc;
+};
+
+struct sphere_key_t {
+    s32 sphere;
+    s32 frame;
+    point3 center;
+    r64 radius;
+};
+
+struct animation_t {
+    s32 frame_count;
+    r64 turns;                   // full orbits of the camera around lookat, 0 for none
+    camera_key_t * camera_keys;  // by frame
+    s32 camera_key_count;
+    sphere_key_t * sphere_keys;  // by sphere, then by frame
+    s32 sphere_key_count;
+
+    s32 * slot_of;               // scene slot of every sphere index
+    s32 sphere_count;
+    r64 built_cost;              // sah cost right after the last bvh build
+};
+
+// slot_of from the bvh's primitive order, spheres of a mapped scene are in slot order
+void animation_map_slots(animation_t * animation, const scene_t * scene){
+    animation->sphere_count = scene->spheres.count;
+    animation->slot_of = (s32 *) realloc(animation->slot_of, sizeof(s32) * (scene->spheres.count > 0 ? scene->spheres.count : 1));
+    for(s32 slot = 0 ; slot < scene->spheres.count ; slot++){
+        animation->slot_of[scene->bvh.indices ? scene->bvh.indices[slot] : slot] = slot;
+    }
+    animation->built_cost = bvh_sah_cost(&scene->bvh);
+}
+
+void destroy_animation(animation_t * animation){
+    free(animation->camera_keys);
+    free(animation->sphere_keys);
+    free(animation->slot_of);
+    *animation = {};
+}
+
+void create_turntable(animation_t * animation, const scene_t * scene, s32 frame_count){
+    *animation = {};
+    animation->frame_count = frame_count;
+    animation->turns = 1.0;
+    animation_map_slots(animation, scene);
+}
+
+static int compare_camera_keys(const void * a, const void * b){
+    return ((const camera_key_t *) a)->frame - ((const camera_key_t *) b)->frame;
+}
+
+static int compare_sphere_keys(const void * a, const void * b){
+    const sphere_key_t * ka = (const sphere_key_t *) a;
+    const sphere_key_t * kb = (const sphere_key_t *) b;
+    return ka->sphere != kb->sphere ? ka->sphere - kb->sphere : ka->frame - kb->frame;
+}
+
+s32 load_animation(animation_t * animation, const char * file, const scene_t * scene){
+    *animation = {};
+    animation_map_slots(animation, scene);
+
+    FILE * fp = fopen(file, "r");
+    if (!fp) {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        destroy_animation(animation);
+        return -1;
+    }
+
+    s32 camera_capacity = 16, sphere_capacity = 64;
+    animation->camera_keys = (camera_key_t *) malloc(sizeof(camera_key_t) * camera_capacity);
+    animation->sphere_keys = (sphere_key_t *) malloc(sizeof(sphere_key_t) * sphere_capacity);
+    animation->frame_count = 1;
+    camera_desc_t camera = scene->camera;  // every camera key starts from the one before it
+
+    char line[1024];
+    s32 line_number = 0;
+    const char * error = NULL;
+    while (!error && fgets(line, sizeof(line), fp)) {
+        line_number++;
+        char * comment = strchr(line, '#');
+        if (comment) *comment = 0;
+
+        char keyword[32];
+        s32 used = 0;
+        if (sscanf(line, " %31s%n", keyword, &used) != 1) continue;
+        const char * rest = line + used;
+
+        if (!strcmp(keyword, "frames")) {
+            if (sscanf(rest, "%d", &animation->frame_count) != 1 || animation->frame_count < 1) error = "expected: frames count";
+        }
+        else if (!strcmp(keyword, "turntable")) {
+            if (sscanf(rest, "%lf", &animation->turns) != 1) error = "expected: turntable turns";
+        }
+        else if (!strcmp(keyword, "camera")) {
+            camera_key_t key = {};
+            s32 consumed = 0;
+            if (sscanf(rest, "%d%n", &key.frame, &consumed) != 1 || key.frame < 0) {
+                error = "expected: camera frame key values...";
+                break;
+            }
+            error = parse_camera_keys(rest + consumed, &camera);
+            if (error) break;
+            key.desc = camera;
+
+            if (animation->camera_key_count == camera_capacity) {
+                camera_capacity *= 2;
+                animation->camera_keys = (camera_key_t *) realloc(animation->camera_keys, sizeof(camera_key_t) * camera_capacity);
+            }
+            animation->camera_keys[animation->camera_key_count++] = key;
+        }
+        else if (!strcmp(keyword, "sphere")) {
+            sphere_key_t key = {};
+            r64 v[4];
+            s32 read = sscanf(rest, "%d %d %lf %lf %lf %lf", &key.sphere, &key.frame, &v[0], &v[1], &v[2], &v[3]);
+            if (read != 5 && read != 6) {
+                error = "expected: sphere index frame x y z [radius]";
+                break;
+            }
+            if (key.sphere < 0 || key.sphere >= animation->sphere_count) {
+                error = "sphere index out of range";
+                break;
+            }
+            if (key.frame < 0) {
+                error = "negative frame";
+                break;
+            }
+            key.center = point3(v[0], v[1], v[2]);
+            key.radius = read == 6 ? v[3] : scene->spheres.radius[animation->slot_of[key.sphere]];
+
+            if (animation->sphere_key_count == sphere_capacity) {
+                sphere_capacity *= 2;
+                animation->sphere_keys = (sphere_key_t *) realloc(animation->sphere_keys, sizeof(sphere_key_t) * sphere_capacity);
+            }
+            animation->sphere_keys[animation->sphere_key_count++] = key;
+        }
+        else {
+            error = "unknown keyword";
+        }
+    }
+    fclose(fp);
+
+    if (error) {
+        fprintf(stderr, "%s:%d: %s\n", file, line_number, error);
+        destroy_animation(animation);
+        return -1;
+    }
+
+    // of two keys at the same frame one wins, which one is unspecified
+    qsort(animation->camera_keys, animation->camera_key_count, sizeof(camera_key_t), compare_camera_keys);
+    qsort(animation->sphere_keys, animation->sphere_key_count, sizeof(sphere_key_t), compare_sphere_keys);
+    return 0;
+}
+
+// the camera at frame, base is used when there are no camera keys. the aspect ratio
+// stays the base one since the image size is fixed for the whole sequence
+camera_desc_t animation_camera(const animation_t * animation, const camera_desc_t & base, s32 frame){
+    camera_desc_t desc = base;
+    const camera_key_t * keys = animation->camera_keys;
+    s32 count = animation->camera_key_count;
+
+    if (count > 0) {
+        s32 next = 0;
+        while (next < count && keys[next].frame <= frame) next++;
+        if (next == 0) desc = keys[0].desc;
+        else if (next == count) desc = keys[count - 1].desc;
+        else {
+            const camera_desc_t & a = keys[next - 1].desc;
+            const camera_desc_t & b = keys[next].desc;
+            r64 t = (r64)(frame - keys[next - 1].frame) / (keys[next].frame - keys[next - 1].frame);
+            desc.lookfrom = a.lookfrom + (b.lookfrom - a.lookfrom) * t;
+            desc.look_at = a.look_at + (b.look_at - a.look_at) * t;
+            desc.up = a.up + (b.up - a.up) * t;
+            desc.vfov = a.vfov + (b.vfov - a.vfov) * t;
+            desc.defocus_angle = a.defocus_angle + (b.defocus_angle - a.defocus_angle) * t;
+            desc.focus_dist = a.focus_dist + (b.focus_dist - a.focus_dist) * t;
+        }
+        desc.aspect_ratio = base.aspect_ratio;
+    }
+
+    if (animation->turns != 0.0) {
+        // rodrigues rotation of lookfrom around the up axis through lookat
+        r64 angle = 2.0 * PI * animation->turns * frame / animation->frame_count;
+        vec3 k = normalize(desc.up);
+        vec3 v = desc.lookfrom - desc.look_at;
+        real c = cos(angle), s = sin(angle);
+        v = v * c + cross(k, v) * s + k * (dot(k, v) * (1.0 - c));
+        desc.lookfrom = desc.look_at + v;
+    }
+    return desc;
+}
+
+// writes the keyed spheres' positions at frame into the scene, returns how many moved
+s32 animation_move_spheres(const animation_t * animation, scene_t * scene, s32 frame){
+    const sphere_key_t * keys = animation->sphere_keys;
+    s32 moved = 0;
+    for(s32 begin = 0, end = 0 ; begin < animation->sphere_key_count ; begin = end){
+        while (end < animation->sphere_key_count && keys[end].sphere == keys[begin].sphere) end++;
+
+        s32 next = begin;
+        while (next < end && keys[next].frame <= frame) next++;
+        point3 center;
+        r64 radius;
+        if (next == begin || next == end) {
+            const sphere_key_t & key = keys[next == begin ? begin : end - 1];
+            center = key.center;
+            radius = key.radius;
+        }
+        else {
+            const sphere_key_t & a = keys[next - 1];
+            const sphere_key_t & b = keys[next];
+            r64 t = (r64)(frame - a.frame) / (b.frame - a.frame);
+            center = a.center + (b.center - a.center) * t;
+            radius = a.radius + (b.radius - a.radius) * t;
+        }
+
+        s32 slot = animation->slot_of[keys[begin].sphere];
+        scene->spheres.center_x[slot] = center.x;
+        scene->spheres.center_y[slot] = center.y;
+        scene->spheres.center_z[slot] = center.z;
+        scene->spheres.radius[slot] = radius;
+        moved++;
+    }
+    return moved;
+}
+
+// a fresh bvh over the spheres where they are now. the scene's arrays are reordered, so
+// the animation's slots follow them
+void animation_rebuild(animation_t * animation, scene_t * scene){
+    s32 count = scene->spheres.count;
+    sphere_desc_t * spheres = (sphere_desc_t *) malloc(sizeof(sphere_desc_t) * (count > 0 ? count : 1));
+    for(s32 slot = 0 ; slot < count ; slot++){
+        spheres[slot].center = point3(scene->spheres.center_x[slot], scene->spheres.center_y[slot], scene->spheres.center_z[slot]);
+        spheres[slot].radius = scene->spheres.radius[slot];
+        spheres[slot].material = scene->material_index[slot];
+    }
+
+    scene_t built = {};
+    built.camera = scene->camera;
+    build_scene(&built, spheres, count, scene->materials, scene->material_count, AccelBVH);
+    free(spheres);
+
+    // the entities still describe the scene as it was loaded, they move over untouched,
+    // as do the meshes, grids and instances, which index the same material table
+    built.entities = scene->entities;
+    built.entity_count = scene->entity_count;
+    built.entity_materials = scene->entity_materials;
+    built.meshes = scene->meshes;
+    built.mesh_count = scene->mesh_count;
+    built.grids = scene->grids;
+    built.grid_count = scene->grid_count;
+    built.objects = scene->objects;
+    built.object_count = scene->object_count;
+    built.instances = scene->instances;
+    built.instance_count = scene->instance_count;
+    built.instance_bvh = scene->instance_bvh;
+    scene->entities = NULL;
+    scene->entity_materials = {};
+    scene->meshes = NULL;
+    scene->mesh_count = 0;
+    scene->grids = NULL;
+    scene->grid_count = 0;
+    scene->objects = NULL;
+    scene->object_count = 0;
+    scene->instances = NULL;
+    scene->instance_count = 0;
+    scene->instance_bvh = {};
+    destroy_scene(scene);
+    *scene = built;
+
+    // bvh indices map new slots to old ones
+    s32 * new_slot = (s32 *) malloc(sizeof(s32) * (count > 0 ? count : 1));
+    for(s32 slot = 0 ; slot < count ; slot++) new_slot[scene->bvh.indices[slot]] = slot;
+    for(s32 i = 0 ; i < count ; i++) animation->slot_of[i] = new_slot[animation->slot_of[i]];
+    free(new_slot);
+    animation->built_cost = bvh_sah_cost(&scene->bvh);
+}
+
+// output names come from pattern's printf style %d (e.g. frame_%04d.png), a pattern
+// without one gets _NNNN in front of its extension
+void animation_frame_file(char * file, s32 size, const char * pattern, s32 frame){
+    const char * percent = strchr(pattern, '%');
+    if (percent) {
+        const char * p = percent + 1;
+        while (*p >= '0' && *p <= '9') p++;
+        if (*p == 'd' && !strchr(p, '%')) {
+            snprintf(file, size, pattern, frame);
+            return;
+        }
+    }
+    const char * extension = strrchr(pattern, '.');
+    if (!extension || strchr(extension, '/')) extension = pattern + strlen(pattern);
+    snprintf(file, size, "%.*s_%04d%s", (s32)(extension - pattern), pattern, frame, extension);
+}
+
+// renders every frame of the animation through job, the job's camera is replaced. the
+// job's statistics and buffers are left with the last frame's
+s32 render_animation(render_job_t * job, scene_t * scene, animation_t * animation, const char * output, image_format format, bool stream, s32 threads, r64 * last_render_seconds){
+    image_t * image = job->image;
+    camera_t camera = {};
+    job->camera = &camera;
+
+    r64 update_total = 0.0, render_total = 0.0;
+    s32 rebuilds = 0;
+    s32 result = 0;
+    for(s32 frame = 0 ; frame < animation->frame_count && result == 0 ; frame++){
+        r64 update_start = get_time_seconds();
+        camera_desc_t desc = animation_camera(animation, scene->camera, frame);
+        camera = create_camera(&desc, image->width, image->height);
+
+        s32 moved = animation_move_spheres(animation, scene, frame);
+        const char * update = "static";
+        if (moved > 0 && scene->accel == AccelBVH) {
+            refit_bvh(&scene->bvh, &scene->spheres);
+            update = "refit";
+            if (bvh_sah_cost(&scene->bvh) > ANIMATION_REBUILD_RATIO * animation->built_cost) {
+                animation_rebuild(animation, scene);
+                update = "rebuild";
+                rebuilds++;
+            }
+        }
+        job->scene = scene;
+        job->frame = frame;
+        r64 update_seconds = get_time_seconds() - update_start;
+
+        char file[1024];
+        animation_frame_file(file, sizeof(file), output, frame);
+        r64 render_seconds = 0.0, output_seconds = 0.0;
+        result = render_to_file(job, file, format, stream, threads, &render_seconds, &output_seconds);
+
+        update_total += update_seconds;
+        render_total += render_seconds;
+        *last_render_seconds = render_seconds;
+        fprintf(stderr, "frame %d/%d: %s, %d spheres moved, %s %.3f ms, render %.3f s", 
+            frame + 1, animation->frame_count, file, moved, update, update_seconds * 1000.0, render_seconds);
+        if (job->denoise) fprintf(stderr, ", denoise %.3f s", job->denoise_seconds);
+        fprintf(stderr, "\n");
+    }
+
+    fprintf(stderr, "animation: %d frames, render %.3f s, scene updates %.3f ms, %d rebuilds\n", 
+        animation->frame_count, render_total, update_total * 1000.0, rebuilds);
+    return result;
+}
+
+// @note: benchmarks
+// --bench runs a fixed suite and reports it as json: microbenchmarks of the inner
+// functions, full frames over growing scenes and bounce settings, thread scaling, and
+// a render compared against a stored reference image so a speedup that changes the
+// picture fails the run
+
+#define BENCH_REFERENCE_WIDTH 160
+#define BENCH_REFERENCE_SPP 128
+
+volatile r64 bench_sink;
+
+// repeats body until it has run for at least min_seconds, returns ns per operation
+template<typename body_t>
+r64 bench_ns_per_op(body_t body, s64 ops_per_call, r64 min_seconds = 0.2){
+    s64 calls = 0;
+    r64 start = get_time_seconds();
+    r64 elapsed = 0.0;
+    while (elapsed < min_seconds) {
+        for(s32 i = 0 ; i < 16 ; i++) body();
+        calls += 16;
+        elapsed = get_time_seconds() - start;
+    }
+    return elapsed * 1e9 / ((r64)calls * ops_per_call);
+}
+
+struct bench_frame_t {
+    r64 seconds;
+    u64 rays;
+    s64 cache_misses;    // -1 where the counter is not available
+};
+
+// counts the hardware cache misses of the calling thread and of the threads it starts
+// from now on. -1 where the kernel or the machine offers no such counter
+s32 open_cache_miss_counter(){
+    perf_event_attr attr = {};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (s32) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// the count once the threads it followed are done, closes the counter
+s64 close_cache_miss_counter(s32 fd){
+    if (fd < 0) return -1;
+    u64 count = 0;
+    bool ok = read(fd, &count, sizeof(count)) == sizeof(count);
+    close(fd);
+    return ok ? (s64) count : -1;
+}
+
+bench_frame_t bench_render(const scene_t * scene, image_t * image, s32 spp, s32 max_bounce, s32 threads, sampler_type sampler = SamplerRandom){
+    camera_t camera = create_camera(&scene->camera, image->width, image->height);
+
+    render_job_t job = {};
+    job.image = image;
+    job.camera = &camera;
+    job.scene = scene;
+    job.samples_per_pixel = spp;
+    job.min_samples_per_pixel = spp;
+    job.max_bounce = max_bounce;
+    job.rr_depth = 5;
+    job.sampler = sampler;
+    job.packet_size = 16;
+    job.tile_size = 16;
+
+    bench_frame_t frame = {};
+    s32 counter = open_cache_miss_counter();
+    r64 start = get_time_seconds();
+    render_image(&job, threads);
+    frame.seconds = get_time_seconds() - start;
+    frame.cache_misses = close_cache_miss_counter(counter);
+    frame.rays = job.rays;
+    return frame;
+}
+
+void bench_demo_scene(scene_t * scene, s32 grid, accel_type accel){
+    rng_t scene_rng;
+    rng_seed(&scene_rng, 3000, 0);
+
+    *scene = {};
+    scene->camera = default_camera_desc();
+    scene->entities = create_entities(&scene->entity_count, &scene_rng, &scene->entity_materials, grid);
+    build_scene_from_entities(scene, accel);
+}
+
+// binary ppm only, which is what --update-reference writes
+s32 read_ppm(const char * file, image_t * image){
+    FILE * fp = fopen(file, "rb");
+    if (!fp) return -1;
+
+    s32 width = 0, height = 0, max_value = 0;
+    bool ok = fscanf(fp, "P6 %d %d %d", &width, &height, &max_value) == 3 && fgetc(fp) != EOF && 
+        width > 0 && height > 0 && max_value == 255;
+    if (ok) {
+        create_image(image, width, height, 0x000000);
+        for(s64 i = 0 ; i < (s64)width * height && ok ; i++){
+            u8 rgb[3];
+            ok = fread(rgb, 1, 3, fp) == 3;
+            image->pixels[i].r = rgb[0];
+            image->pixels[i].g = rgb[1];
+            image->pixels[i].b = rgb[2];
+        }
+        if (!ok) free(image->pixels);
+    }
+    fclose(fp);
+    return ok ? 0 : -1;
+}
+
+r64 image_psnr(const image_t * a, const image_t * b){
+    r64 squared = 0.0;
+    for(s64 i = 0 ; i < (s64)a->width * a->height ; i++){
+        r64 dr = (r64)a->pixels[i].r - b->pixels[i].r;
+        r64 dg = (r64)a->pixels[i].g - b->pixels[i].g;
+        r64 db = (r64)a->pixels[i].b - b->pixels[i].b;
+        squared += dr * dr + dg * dg + db * db;
+    }
+    // identical images come back as INF_POS, reported as 999 dB
+    r64 mse = squared / (3.0 * a->width * a->height);
+    return mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : INF_POS;
+}
+
+void bench_micro(FILE * out){
+    const s32 N = 1024;
+    rng_t rng;
+    rng_seed(&rng, 42, 0);
+
+    ray_t * rays = (ray_t *) malloc(sizeof(ray_t) * N);
+    vec3 * a = (vec3 *) malloc(sizeof(vec3) * N);
+    vec3 * b = (vec3 *) malloc(sizeof(vec3) * N);
+    color3 * colors = (color3 *) malloc(sizeof(color3) * N);
+    for(s32 i = 0 ; i < N ; i++){
+        // about half of the rays hit the sphere
+        rays[i] = {point3(0, 0, 5), normalize(point3(random_double(&rng, -1.5, 1.5), random_double(&rng, -1.5, 1.5), 0) - point3(0, 0, 5))};
+        a[i] = vec3(random_double(&rng), random_double(&rng), random_double(&rng));
+        b[i] = vec3(random_double(&rng), random_double(&rng), random_double(&rng));
+        colors[i] = color3(random_double(&rng), random_double(&rng), random_double(&rng));
+    }
+
+    sphere_t sphere = {};
+    sphere.center = point3(0, 0, 0);
+    sphere.radius = 1.0;
+    sphere.material = 0;
+
+    r64 sphere_ns = bench_ns_per_op([&](){
+        s32 hits = 0;
+        for(s32 i = 0 ; i < N ; i++){
+            hit_t hit;
+            hits += sphere_hit(rays[i], 0.001, INF_POS, sphere, &hit);
+        }
+        bench_sink = hits;
+    }, N);
+
+    // the same test at both precisions regardless of how real is defined
+    basic_ray_t<r32> * rays32 = (basic_ray_t<r32> *) malloc(sizeof(basic_ray_t<r32>) * N);
+    basic_ray_t<r64> * rays64 = (basic_ray_t<r64> *) malloc(sizeof(basic_ray_t<r64>) * N);
+    for(s32 i = 0 ; i < N ; i++){
+        rays32[i] = {{(r32) rays[i].point.x, (r32) rays[i].point.y, (r32) rays[i].point.z}, {(r32) rays[i].dir.x, (r32) rays[i].dir.y, (r32) rays[i].dir.z}};
+        rays64[i] = {{(r64) rays[i].point.x, (r64) rays[i].point.y, (r64) rays[i].point.z}, {(r64) rays[i].dir.x, (r64) rays[i].dir.y, (r64) rays[i].dir.z}};
+    }
+
+    r64 sphere32_ns = bench_ns_per_op([&](){
+        s32 hits = 0;
+        for(s32 i = 0 ; i < N ; i++){
+            basic_hit_t<r32> hit;
+            hits += sphere_hit<r32>(rays32[i], 0.001f, FLT_MAX, {0, 0, 0}, 1.0f, sphere.material, &hit);
+        }
+        bench_sink = hits;
+    }, N);
+
+    r64 sphere64_ns = bench_ns_per_op([&](){
+        s32 hits = 0;
+        for(s32 i = 0 ; i < N ; i++){
+            basic_hit_t<r64> hit;
+            hits += sphere_hit<r64>(rays64[i], 0.001, DBL_MAX, {0, 0, 0}, 1.0, sphere.material, &hit);
+        }
+        bench_sink = hits;
+    }, N);
+
+    r64 vec3_ns = bench_ns_per_op([&](){
+        vec3 acc = vec3(0, 0, 0);
+        for(s32 i = 0 ; i < N ; i++){
+            acc = acc + cross(a[i], b[i]) * dot(a[i], b[i]) - a[i] / 3.0;
+        }
+        bench_sink = acc.x + acc.y + acc.z;
+    }, N);
+
+    r64 normalize_ns = bench_ns_per_op([&](){
+        r64 acc = 0.0;
+        for(s32 i = 0 ; i < N ; i++){
+            acc += normalize(a[i] + b[i]).x;
+        }
+        bench_sink = acc;
+    }, N);
+
+    r64 unit_vector_ns = bench_ns_per_op([&](){
+        vec3 acc = vec3(0, 0, 0);
+        for(s32 i = 0 ; i < N ; i++) acc = acc + random_unit_vector(&rng);
+        bench_sink = acc.x;
+    }, N);
+
+    r64 hemisphere_ns = bench_ns_per_op([&](){
+        vec3 acc = vec3(0, 0, 0);
+        for(s32 i = 0 ; i < N ; i++) acc = acc + random_unit_in_hemisphere(&rng, a[i]);
+        bench_sink = acc.x;
+    }, N);
+
+    r64 disk_ns = bench_ns_per_op([&](){
+        vec3 acc = vec3(0, 0, 0);
+        for(s32 i = 0 ; i < N ; i++) acc = acc + random_in_unit_disk(&rng);
+        bench_sink = acc.x;
+    }, N);
+
+    // the four numbers of a bounce, group setup included
+    r64 sampler_ns[SamplerCount];
+    for(s32 k = 0 ; k < SamplerCount ; k++){
+        rng_t sampler;
+        u32 sample = 0;
+        sampler_ns[k] = bench_ns_per_op([&](){
+            r64 acc = 0.0;
+            for(s32 i = 0 ; i < N ; i++){
+                sampler_seed(&sampler, (sampler_type) k, 42, sample++);
+                for(s32 d = 0 ; d < 4 ; d++) acc += random_double(&sampler);
+            }
+            bench_sink = acc;
+        }, N);
+    }
+
+    r64 pixel_ns = bench_ns_per_op([&](){
+        u32 acc = 0;
+        for(s32 i = 0 ; i < N ; i++){
+            pixel_t pixel = color_to_pixel(colors[i], true);
+            acc += pixel.r + pixel.g + pixel.b;
+        }
+        bench_sink = acc;
+    }, N);
+
+    fprintf(out, "  \"micro\": {\n");
+    fprintf(out, "    \"precision\": \"%s\",\n", sizeof(real) == sizeof(r32) ? "float" : "double");
+    fprintf(out, "    \"sphere_hit_ns\": %.3f,\n", sphere_ns);
+    fprintf(out, "    \"sphere_hit_r32_ns\": %.3f,\n", sphere32_ns);
+    fprintf(out, "    \"sphere_hit_r64_ns\": %.3f,\n", sphere64_ns);
+    fprintf(out, "    \"vec3_cross_dot_ns\": %.3f,\n", vec3_ns);
+    fprintf(out, "    \"vec3_normalize_ns\": %.3f,\n", normalize_ns);
+    fprintf(out, "    \"random_unit_vector_ns\": %.3f,\n", unit_vector_ns);
+    fprintf(out, "    \"random_unit_in_hemisphere_ns\": %.3f,\n", hemisphere_ns);
+    fprintf(out, "    \"random_in_unit_disk_ns\": %.3f,\n", disk_ns);
+    for(s32 k = 0 ; k < SamplerCount ; k++){
+        fprintf(out, "    \"sampler_%s_4d_ns\": %.3f,\n", SAMPLER_NAMES[k], sampler_ns[k]);
+    }
+    fprintf(out, "    \"color_to_pixel_ns\": %.3f\n", pixel_ns);
+    fprintf(out, "  },\n");
+    fprintf(stderr, "bench: micro done, sphere_hit %.2f ns\n", sphere_ns);
+
+    free(rays);
+    free(rays32);
+    free(rays64);
+    free(a);
+    free(b);
+    free(colors);
+}
+
+void bench_frames(FILE * out, s32 threads){
+    const s32 grids[] = {22, 100, 316, 1000};
+    struct { s32 spp, max_bounce; } settings[] = {{4, 1}, {4, 8}, {16, 50}};
+
+    image_t image;
+    create_image(&image, 320, 180, 0x000000);
+
+    fprintf(out, "  \"frames\": [\n");
+    bool first = true;
+    for(s32 g = 0 ; g < (s32)(sizeof(grids) / sizeof(grids[0])) ; g++){
+        scene_t scene;
+        r64 build_start = get_time_seconds();
+        bench_demo_scene(&scene, grids[g], AccelBVH);
+        r64 build_seconds = get_time_seconds() - build_start;
+
+        for(s32 s = 0 ; s < (s32)(sizeof(settings) / sizeof(settings[0])) ; s++){
+            bench_frame_t frame = bench_render(&scene, &image, settings[s].spp, settings[s].max_bounce, threads);
+            r64 mrays = frame.rays / frame.seconds * 1e-6;
+
+            fprintf(out, "%s    {\"grid\": %d, \"spheres\": %d, \"width\": %d, \"height\": %d, \"spp\": %d, \"max_bounce\": %d, \"threads\": %d, "
+                "\"build_ms\": %.3f, \"seconds\": %.6f, \"rays\": %llu, \"mrays_per_second\": %.3f, \"ns_per_ray\": %.3f}", 
+                first ? "" : ",\n", grids[g], scene.spheres.count, image.width, image.height, settings[s].spp, settings[s].max_bounce, threads, 
+                build_seconds * 1000.0, frame.seconds, (unsigned long long) frame.rays, mrays, frame.seconds * 1e9 / frame.rays);
+            first = false;
+            fprintf(stderr, "bench: grid %d spp %d bounces %d, %.3f s, %.2f Mrays/s\n", grids[g], settings[s].spp, settings[s].max_bounce, frame.seconds, mrays);
+        }
+        destroy_scene(&scene);
+    }
+    fprintf(out, "\n  ],\n");
+
+    free(image.pixels);
+}
+
+// the demo scene in plain and compact storage: memory per sphere, speed and cache misses
+// per ray, and how far the quantized spheres move the image
+void bench_geometry(FILE * out, s32 threads){
+    const s32 grids[] = {316, 1000};
+    const accel_type layouts[] = {AccelBVH, AccelCompact};
+    const char * names[] = {"bvh", "compact"};
+
+    image_t images[2];
+    for(s32 l = 0 ; l < 2 ; l++) create_image(&images[l], 320, 180, 0x000000);
+
+    fprintf(out, "  \"geometry\": [\n");
+    for(s32 g = 0 ; g < (s32)(sizeof(grids) / sizeof(grids[0])) ; g++){
+        for(s32 l = 0 ; l < 2 ; l++){
+            scene_t scene;
+            r64 build_start = get_time_seconds();
+            bench_demo_scene(&scene, grids[g], layouts[l]);
+            r64 build_seconds = get_time_seconds() - build_start;
+            r64 bytes = (r64) scene_geometry_bytes(&scene) / scene.spheres.count;
+
+            bench_frame_t frame = bench_render(&scene, &images[l], 4, 8, threads);
+            char misses[32] = "null";
+            if (frame.cache_misses >= 0) snprintf(misses, sizeof(misses), "%.3f", (r64) frame.cache_misses / frame.rays);
+
+            fprintf(out, "%s    {\"grid\": %d, \"spheres\": %d, \"layout\": \"%s\", \"build_ms\": %.3f, \"bytes_per_sphere\": %.2f, "
+                "\"seconds\": %.6f, \"mrays_per_second\": %.3f, \"ns_per_ray\": %.3f, \"cache_misses_per_ray\": %s",
+                g == 0 && l == 0 ? "" : ",\n", grids[g], scene.spheres.count, names[l], build_seconds * 1000.0, bytes,
+                frame.seconds, frame.rays / frame.seconds * 1e-6, frame.seconds * 1e9 / frame.rays, misses);
+            if (l == 1) fprintf(out, ", \"psnr_to_bvh\": %.2f", minimum(image_psnr(&images[0], &images[1]), 999.0));
+            fprintf(out, "}");
+            fprintf(stderr, "bench: grid %d %s, %.1f bytes per sphere, %.2f Mrays/s, %s cache misses per ray\n", 
+                grids[g], names[l], bytes, frame.rays / frame.seconds * 1e-6, misses);
+            destroy_scene(&scene);
+        }
+    }
+    fprintf(out, "\n  ],\n");
+
+    for(s32 l = 0 ; l < 2 ; l++) free(images[l].pixels);
+}
+
+void bench_scaling(FILE * out, s32 max_threads){
+    scene_t scene;
+    bench_demo_scene(&scene, 22, AccelBVH);
+
+    image_t image;
+    create_image(&image, 320, 180, 0x000000);
+
+    fprintf(out, "  \"scaling\": [\n");
+    r64 single = 0.0;
+    for(s32 threads = 1 ; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads){
+        bench_frame_t frame = bench_render(&scene, &image, 8, 50, threads);
+        if (threads == 1) single = frame.seconds;
+        r64 efficiency = single / (frame.seconds * threads);
+
+        fprintf(out, "%s    {\"threads\": %d, \"seconds\": %.6f, \"mrays_per_second\": %.3f, \"speedup\": %.3f, \"efficiency\": %.3f}", 
+            threads == 1 ? "" : ",\n", threads, frame.seconds, frame.rays / frame.seconds * 1e-6, single / frame.seconds, efficiency);
+        fprintf(stderr, "bench: %d threads, %.3f s, efficiency %.2f\n", threads, frame.seconds, efficiency);
+        if (threads >= max_threads) break;
+    }
+    fprintf(out, "\n  ],\n");
+
+    free(image.pixels);
+    destroy_scene(&scene);
+}
+
+// rms error of the linear pixel values against a converged render of the demo scene, for
+// every sampler at power of two spp. the reference is a sobol render at SAMPLER_REFERENCE_SPP,
+// far enough past the curves that its own noise stays below theirs
+void bench_samplers(FILE * out, s32 threads){
+    const s32 SAMPLER_REFERENCE_SPP = 4096;
+    const s32 SAMPLER_MAX_SPP = 256;
+
+    scene_t scene;
+    bench_demo_scene(&scene, 22, AccelBVH);
+
+    image_t image;
+    create_image(&image, 64, (s32)(64 / scene.camera.aspect_ratio), 0x000000);
+    s64 values = (s64)image.width * image.height * 3;
+    image.hdr = (r32 *) malloc(sizeof(r32) * values);
+
+    bench_render(&scene, &image, SAMPLER_REFERENCE_SPP, 50, threads, SamplerSobol);
+    r32 * reference = image.hdr;
+    image.hdr = (r32 *) malloc(sizeof(r32) * values);
+
+    fprintf(out, "  \"samplers\": {\"width\": %d, \"height\": %d, \"reference_spp\": %d, \"curves\": {\n", image.width, image.height, SAMPLER_REFERENCE_SPP);
+    for(s32 k = 0 ; k < SamplerCount ; k++){
+        fprintf(out, "    \"%s\": [", SAMPLER_NAMES[k]);
+        for(s32 spp = 1 ; spp <= SAMPLER_MAX_SPP ; spp *= 2){
+            bench_render(&scene, &image, spp, 50, threads, (sampler_type) k);
+            r64 squared = 0.0;
+            for(s64 i = 0 ; i < values ; i++){
+                r64 d = (r64)image.hdr[i] - reference[i];
+                squared += d * d;
+            }
+            r64 rmse = sqrt(squared / values);
+            fprintf(out, "%s{\"spp\": %d, \"rmse\": %.6f}", spp == 1 ? "" : ", ", spp, rmse);
+            if (spp == SAMPLER_MAX_SPP) fprintf(stderr, "bench: sampler %s, rmse %.5f at %d spp\n", SAMPLER_NAMES[k], rmse, spp);
+        }
+        fprintf(out, "]%s\n", k + 1 < SamplerCount ? "," : "");
+    }
+    fprintf(out, "  }},\n");
+
+    free(reference);
+    free(image.hdr);
+    free(image.pixels);
+    destroy_scene(&scene);
+}
+
+// renders the demo scene at a fixed size and compares it against the reference, or
+// replaces the reference when update is set. returns whether the check passed
+bool bench_golden(FILE * out, const char * reference, r64 min_psnr, bool update, s32 threads){
+    scene_t scene;
+    bench_demo_scene(&scene, 22, AccelBVH);
+
+    image_t image;
+    create_image(&image, BENCH_REFERENCE_WIDTH, (s32)(BENCH_REFERENCE_WIDTH / scene.camera.aspect_ratio), 0x000000);
+    bench_render(&scene, &image, BENCH_REFERENCE_SPP, 50, threads);
+    destroy_scene(&scene);
+
+    bool passed = false;
+    r64 psnr = 0.0;
+    const char * status = "";
+    if (update) {
+        passed = write_image(reference, &image) == 0;
+        status = passed ? "updated" : "write failed";
+    }
+    else {
+        image_t expected;
+        if (read_ppm(reference, &expected) != 0) {
+            status = "missing reference";
+        }
+        else if (expected.width != image.width || expected.height != image.height) {
+            status = "size mismatch";
+            free(expected.pixels);
+        }
+        else {
+            psnr = image_psnr(&image, &expected);
+            passed = psnr >= min_psnr;
+            status = passed ? "pass" : "fail";
+            free(expected.pixels);
+        }
+    }
+    free(image.pixels);
+
+    fprintf(out, "  \"golden\": {\"reference\": \"%s\", \"width\": %d, \"spp\": %d, \"psnr\": %.3f, \"min_psnr\": %.3f, \"status\": \"%s\"}\n", 
+        reference, BENCH_REFERENCE_WIDTH, BENCH_REFERENCE_SPP, psnr == INF_POS ? 999.0 : psnr, min_psnr, status);
+    fprintf(stderr, "bench: golden image %s, psnr %.2f dB\n", status, psnr == INF_POS ? 999.0 : psnr);
+    return passed;
+}
+
+s32 run_benchmarks(const char * file, const char * reference, r64 min_psnr, bool update_reference, s32 threads){
+    FILE * out = strcmp(file, "-") ? fopen(file, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    fprintf(out, "{\n");
+    bench_micro(out);
+    bench_frames(out, threads);
+    bench_geometry(out, threads);
+    bench_scaling(out, threads);
+    bench_samplers(out, threads);
+    bool passed = bench_golden(out, reference, min_psnr, update_reference, threads);
+    fprintf(out, "}\n");
+
+    if (out != stdout) fclose(out);
+    return passed ? 0 : 1;
+}
+
+// @note: render daemon
+// --serve keeps one process up that renders jobs sent to it over a local socket, so a
+// pipeline sending hundreds of small renders of the same few scenes pays for process
+// start, scene loading and bvh builds once. loaded scenes stay in an lru cache keyed by
+// their file (and its modification time, so an edited file is reloaded), a scene in use
+// by a job is never evicted. jobs share one pool of render threads: every thread takes
+// the next tile of the highest priority job, jobs of equal priority in arrival order, so
+// an urgent job overtakes the ones in flight at the next tile. every connection gets its
+// own thread which waits for its jobs and sends back the encoded image. the image is the
+// one a render of the same settings in its own process produces
+//
+// messages are a net_header_t and its payload, like the distributed renderer's. a client
+// sends a DaemonRender with a daemon_request_t and gets a DaemonImage with a
+// daemon_reply_t and the image file's bytes, or a DaemonError with a message
+
+const char DAEMON_MAGIC[8] = {'R', 'T', 'D', 'A', 'E', 'M', 'O', 'N'};
+const u32 DAEMON_VERSION = 1;
+const s32 DAEMON_SCENE_KEY = 512;
+const s32 DAEMON_CAMERA_KEYS = 512;
+const s32 DAEMON_MAX_WIDTH = 16384;
+
+enum daemon_message_type {
+    DaemonRender,   // client to daemon, daemon_request_t
+    DaemonImage,    // daemon to client, daemon_reply_t and the encoded image
+    DaemonError,    // daemon to client, the reason as text
+};
+
+struct daemon_request_t {
+    char magic[8];
+    u32 version;
+    s32 priority;                          // higher first, equal ones in arrival order
+    char scene[DAEMON_SCENE_KEY];          // absolute path of a scene file, empty for the demo scene
+    char camera[DAEMON_CAMERA_KEYS];       // "key values..." as in scene files, over the scene's camera
+    s32 width;
+    s32 samples_per_pixel;
+    s32 min_samples_per_pixel;
+    r64 max_error;
+    s32 max_bounce;
+    s32 rr_depth;
+    s32 sampler;
+    s32 packet_size;
+    s32 wavefront;
+    s32 tile_size;
+    s32 format;                            // image_format of the reply
+};
+
+struct daemon_reply_t {
+    s32 width, height;
+    s32 cached;              // the scene was already loaded
+    r64 load_seconds;        // scene load and bvh build, 0 when cached
+    r64 queue_seconds;       // until the pool started on the first tile
+    r64 render_seconds;
+    r64 encode_seconds;
+    u64 image_size;
+};
+
+struct scene_cache_entry_t {
+    char key[DAEMON_SCENE_KEY];
+    s64 modified_ns;         // of the file when it was loaded
+    s64 file_size;
+    scene_t scene;
+    s32 users;               // jobs rendering it
+    u64 last_used;
+    bool ready;              // false while its first user loads it
+    bool stale;              // the file changed, dropped once the last user is done
+};
+
+struct scene_cache_t {
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;
+    scene_cache_entry_t ** entries;
+    s32 count;
+    s32 capacity;            // scenes kept, exceeded only while all of them are in use
+    u64 clock;
+    accel_type accel;
+};
+
+void create_scene_cache(scene_cache_t * cache, s32 capacity, accel_type accel){
+    *cache = {};
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->loaded, NULL);
+    cache->capacity = capacity > 0 ? capacity : 1;
+    cache->entries = (scene_cache_entry_t **) malloc(sizeof(scene_cache_entry_t *) * (cache->capacity + 1));
+    cache->accel = accel;
+}
+
+// with the lock held
+static void scene_cache_remove(scene_cache_t * cache, s32 index){
+    scene_cache_entry_t * entry = cache->entries[index];
+    destroy_scene(&entry->scene);
+    free(entry);
+    cache->entries[index] = cache->entries[--cache->count];
+}
+
+static bool scene_file_version(const char * key, s64 * modified_ns, s64 * file_size){
+    *modified_ns = 0;
+    *file_size = 0;
+    if (!key[0]) return true;
+    struct stat st;
+    if (stat(key, &st) != 0) return false;
+    *modified_ns = (s64) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    *file_size = st.st_size;
+    return true;
+}
+
+// the scene of a file, empty key for the demo scene, loaded unless it is cached. the
+// entry stays in the cache until scene_cache_release. NULL when the scene doesn't load
+scene_cache_entry_t * scene_cache_acquire(scene_cache_t * cache, const char * key, bool * cached, r64 * load_seconds){
+    *cached = false;
+    *load_seconds = 0.0;
+
+    pthread_mutex_lock(&cache->lock);
+    while (true) {
+        s64 modified_ns = 0, file_size = 0;
+        bool exists = scene_file_version(key, &modified_ns, &file_size);
+
+        s32 found = -1;
+        for(s32 i = 0 ; i < cache->count && found < 0 ; i++){
+            if (!cache->entries[i]->stale && !strcmp(cache->entries[i]->key, key)) found = i;
+        }
+        if (found >= 0) {
+            scene_cache_entry_t * entry = cache->entries[found];
+            if (!entry->ready) {
+                // someone else is loading it, look again once they are done
+                pthread_cond_wait(&cache->loaded, &cache->lock);
+                continue;
+            }
+            if (exists && (entry->modified_ns != modified_ns || entry->file_size != file_size)) {
+                if (entry->users == 0) scene_cache_remove(cache, found);
+                else entry->stale = true;
+                continue;
+            }
+            entry->users++;
+            entry->last_used = ++cache->clock;
+            *cached = true;
+            pthread_mutex_unlock(&cache->lock);
+            return entry;
+        }
+
+        // make room: the least recently used scene nobody renders
+        while (cache->count >= cache->capacity) {
+            s32 oldest = -1;
+            for(s32 i = 0 ; i < cache->count ; i++){
+                const scene_cache_entry_t * entry = cache->entries[i];
+                if (entry->ready && entry->users == 0 && (oldest < 0 || entry->last_used < cache->entries[oldest]->last_used)) oldest = i;
+            }
+            if (oldest < 0) break;
+            fprintf(stderr, "daemon: evicting %s\n", cache->entries[oldest]->key[0] ? cache->entries[oldest]->key : "the demo scene");
+            scene_cache_remove(cache, oldest);
+        }
+        if (cache->count > cache->capacity) {
+            // every slot is in use, one more entry than the lru keeps
+            cache->entries = (scene_cache_entry_t **) realloc(cache->entries, sizeof(scene_cache_entry_t *) * (cache->count + 1));
+        }
+
+        scene_cache_entry_t * entry = (scene_cache_entry_t *) calloc(1, sizeof(scene_cache_entry_t));
+        snprintf(entry->key, sizeof(entry->key), "%s", key);
+        entry->modified_ns = modified_ns;
+        entry->file_size = file_size;
+        entry->users = 1;
+        entry->last_used = ++cache->clock;
+        cache->entries[cache->count++] = entry;
+        pthread_mutex_unlock(&cache->lock);
+
+        // loaded unlocked, jobs on other scenes go on meanwhile
+        r64 start = get_time_seconds();
+        s32 result = 0;
+        if (key[0]) result = load_scene(&entry->scene, key, cache->accel);
+        else bench_demo_scene(&entry->scene, 22, cache->accel);
+        *load_seconds = get_time_seconds() - start;
+
+        pthread_mutex_lock(&cache->lock);
+        if (result != 0) {
+            for(s32 i = 0 ; i < cache->count ; i++){
+                if (cache->entries[i] == entry) {
+                    scene_cache_remove(cache, i);
+                    break;
+                }
+            }
+            entry = NULL;
+        }
+        else {
+            entry->ready = true;
+        }
+        pthread_cond_broadcast(&cache->loaded);
+        pthread_mutex_unlock(&cache->lock);
+        return entry;
+    }
+}
+
+void scene_cache_release(scene_cache_t * cache, scene_cache_entry_t * entry){
+    pthread_mutex_lock(&cache->lock);
+    entry->users--;
+    if (entry->stale && entry->users == 0) {
+        for(s32 i = 0 ; i < cache->count ; i++){
+            if (cache->entries[i] == entry) {
+                scene_cache_remove(cache, i);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// a render job of the pool, the tiles are handed out in order
+struct pool_job_t {
+    render_job_t * render;
+    s32 priority;
+    u64 sequence;
+    s32 tile_count;
+    s32 next_tile;
+    s32 tiles_done;
+    r64 started;             // when its first tile was handed out
+    pthread_cond_t done;
+    pool_job_t * next;       // in the pool's list of jobs with tiles left
+};
+
+struct render_pool_t;
+
+struct pool_thread_t {
+    render_pool_t * pool;
+    render_worker_t worker;
+    pthread_t thread;
+};
+
+struct render_pool_t {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pool_job_t * jobs;       // jobs with tiles left to hand out
+    u64 sequence;
+    pool_thread_t * threads;
+    s32 thread_count;
+};
+
+void * pool_thread(void * arg){
+    pool_thread_t * self = (pool_thread_t *) arg;
+    render_pool_t * pool = self->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (!pool->jobs) pthread_cond_wait(&pool->work, &pool->lock);
+
+        pool_job_t ** best = &pool->jobs;
+        for(pool_job_t ** link = &pool->jobs ; *link ; link = &(*link)->next){
+            const pool_job_t * job = *link;
+            if (job->priority > (*best)->priority || (job->priority == (*best)->priority && job->sequence < (*best)->sequence)) best = link;
+        }
+        pool_job_t * job = *best;
+        s32 tile = job->next_tile++;
+        if (tile == 0) job->started = get_time_seconds();
+        if (job->next_tile == job->tile_count) *best = job->next;
+        pthread_mutex_unlock(&pool->lock);
+
+        render_tile(job->render, &self->worker, tile);
+
+        pthread_mutex_lock(&pool->lock);
+        if (++job->tiles_done == job->tile_count) pthread_cond_signal(&job->done);
+    }
+    return NULL;
+}
+
+void create_render_pool(render_pool_t * pool, s32 thread_count){
+    *pool = {};
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pool->thread_count = thread_count;
+    pool->threads = (pool_thread_t *) calloc(thread_count, sizeof(pool_thread_t));
+    for(s32 i = 0 ; i < thread_count ; i++){
+        pool->threads[i].pool = pool;
+        pool->threads[i].worker.id = i;
+        pthread_create(&pool->threads[i].thread, NULL, pool_thread, &pool->threads[i]);
+    }
+}
+
+// renders every tile of the job on the pool, returns once the last one is done
+void render_pool_run(render_pool_t * pool, render_job_t * render, s32 priority, r64 * queue_seconds){
+    render->tiles_x = (render->image->width + render->tile_size - 1) / render->tile_size;
+    render->tiles_y = (render->image->height + render->tile_size - 1) / render->tile_size;
+    render->worker_count = pool->thread_count;
+
+    pool_job_t job = {};
+    job.render = render;
+    job.priority = priority;
+    job.tile_count = render->tiles_x * render->tiles_y;
+    pthread_cond_init(&job.done, NULL);
+
+    r64 submitted = get_time_seconds();
+    pthread_mutex_lock(&pool->lock);
+    job.sequence = pool->sequence++;
+    job.next = pool->jobs;
+    pool->jobs = &job;
+    pthread_cond_broadcast(&pool->work);
+    while (job.tiles_done < job.tile_count) pthread_cond_wait(&job.done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_cond_destroy(&job.done);
+    *queue_seconds = job.started - submitted;
+}
+
+struct daemon_t {
+    scene_cache_t cache;
+    render_pool_t pool;
+    pthread_mutex_t log_lock;
+    u64 jobs;
+};
+
+struct daemon_connection_t {
+    daemon_t * daemon;
+    s32 fd;
+};
+
+// renders a request into an encoded image, returns an error message or NULL
+const char * daemon_render(daemon_t * daemon, const daemon_request_t * request, daemon_reply_t * reply, u8 ** encoded){
+    if (memcmp(request->magic, DAEMON_MAGIC, sizeof(request->magic)) || request->version != DAEMON_VERSION) return "unsupported client";
+    if (request->scene[DAEMON_SCENE_KEY - 1] || request->camera[DAEMON_CAMERA_KEYS - 1]) return "unterminated string";
+    if (request->width < 2 || request->width > DAEMON_MAX_WIDTH) return "bad width";
+    if (request->samples_per_pixel < 1 || request->min_samples_per_pixel < 1 || request->max_bounce < 0 ||
+        request->rr_depth < 1 || request->tile_size < 1 || request->max_error < 0.0) return "bad sampling settings";
+    // packets are traced in arrays of MAX_PACKET_SIZE on the stack
+    if (request->packet_size != 0 && request->packet_size != 1 && request->packet_size != 4 && 
+        request->packet_size != 8 && request->packet_size != 16) return "bad sampling settings";
+    if (request->sampler < 0 || request->sampler >= SamplerCount) return "unknown sampler";
+    if (request->format < ImageFormatPPMAscii || request->format > ImageFormatPFM) return "unknown format";
+
+    scene_cache_entry_t * entry = scene_cache_acquire(&daemon->cache, request->scene, (bool *) &reply->cached, &reply->load_seconds);
+    if (!entry) return "scene did not load";
+    const scene_t * scene = &entry->scene;
+
+    camera_desc_t desc = scene->camera;
+    const char * error = parse_camera_keys(request->camera, &desc);
+    if (!error && desc.aspect_ratio <= 0.0) error = "aspect must be positive";
+    if (error) {
+        scene_cache_release(&daemon->cache, entry);
+        return error;
+    }
+
+    s32 width = request->width;
+    s32 height = (s32)(width / desc.aspect_ratio);
+    if (height < 1) height = 1;
+    if (height > DAEMON_MAX_WIDTH) height = DAEMON_MAX_WIDTH;
+    camera_t camera = create_camera(&desc, width, height);
+
+    image_t image;
+    create_image(&image, width, height, 0xffffff);
+    image.hdr = request->format == ImageFormatPFM ? (r32 *) malloc(sizeof(r32) * 3 * width * height) : NULL;
+
+    render_job_t job = {};
+    job.image = &image;
+    job.camera = &camera;
+    job.scene = scene;
+    job.samples_per_pixel = request->samples_per_pixel;
+    job.min_samples_per_pixel = minimum(request->min_samples_per_pixel, request->samples_per_pixel);
+    job.max_error = request->max_error;
+    job.max_bounce = request->max_bounce;
+    job.rr_depth = request->rr_depth;
+    job.sampler = (sampler_type) request->sampler;
+    job.packet_size = request->packet_size > 1 ? request->packet_size : 1;
+    job.wavefront = request->wavefront != 0;
+    job.tile_size = request->tile_size;
+
+    r64 start = get_time_seconds();
+    render_pool_run(&daemon->pool, &job, request->priority, &reply->queue_seconds);
+    reply->render_seconds = get_time_seconds() - start - reply->queue_seconds;
+    scene_cache_release(&daemon->cache, entry);
+
+    r64 encode_start = get_time_seconds();
+    s32 result = encode_image(&image, (image_format) request->format, encoded, &reply->image_size);
+    reply->encode_seconds = get_time_seconds() - encode_start;
+    reply->width = width;
+    reply->height = height;
+    free(image.pixels);
+    free(image.hdr);
+    return result == 0 ? NULL : "encoding failed";
+}
+
+// one client, any number of requests one after the other
+void * daemon_connection(void * arg){
+    daemon_connection_t * connection = (daemon_connection_t *) arg;
+    daemon_t * daemon = connection->daemon;
+    s32 fd = connection->fd;
+    free(connection);
+
+    while (true) {
+        net_header_t header;
+        daemon_request_t request;
+        if (!net_recv_all(fd, &header, sizeof(header))) break;
+        if (header.type != DaemonRender || header.size != sizeof(request)) {
+            const char * error = "unexpected message";
+            net_send(fd, DaemonError, error, strlen(error));
+            break;
+        }
+        if (!net_recv_all(fd, &request, sizeof(request))) break;
+
+        daemon_reply_t reply = {};
+        u8 * encoded = NULL;
+        const char * error = daemon_render(daemon, &request, &reply, &encoded);
+
+        pthread_mutex_lock(&daemon->log_lock);
+        u64 id = ++daemon->jobs;
+        if (error) {
+            fprintf(stderr, "job %llu: %s: %s\n", (unsigned long long) id, request.scene[0] ? request.scene : "demo scene", error);
+        }
+        else {
+            fprintf(stderr, "job %llu: %s, %dx%d at %d spp, priority %d, scene %.2f ms%s, queued %.3f s, render %.3f s, encode %.3f s\n",
+                (unsigned long long) id, request.scene[0] ? request.scene : "demo scene", reply.width, reply.height, request.samples_per_pixel,
+                request.priority, reply.load_seconds * 1000.0, reply.cached ? " (cached)" : "",
+                reply.queue_seconds, reply.render_seconds, reply.encode_seconds);
+        }
+        pthread_mutex_unlock(&daemon->log_lock);
+
+        bool sent = error ?
+            net_send(fd, DaemonError, error, strlen(error)) :
+            net_send(fd, DaemonImage, &reply, sizeof(reply), encoded, reply.image_size);
+        free(encoded);
+        if (!sent) break;
+    }
+
+    close(fd);
+    return NULL;
+}
+
+// runs until the listening socket fails
+s32 run_daemon(const char * address, s32 threads, s32 cache_size, accel_type accel){
+    s32 listener = net_open(address, true);
+    if (listener < 0) return -1;
+
+    daemon_t daemon = {};
+    pthread_mutex_init(&daemon.log_lock, NULL);
+    create_scene_cache(&daemon.cache, cache_size, accel);
+    create_render_pool(&daemon.pool, threads);
+    fprintf(stderr, "daemon: listening on %s, %d render threads, %d cached scenes\n", address, threads, daemon.cache.capacity);
+
+    while (true) {
+        s32 fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            fprintf(stderr, "daemon: %s\n", strerror(errno));
+            break;
+        }
+
+        daemon_connection_t * connection = (daemon_connection_t *) malloc(sizeof(daemon_connection_t));
+        connection->daemon = &daemon;
+        connection->fd = fd;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, daemon_connection, connection) != 0) {
+            close(fd);
+            free(connection);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    // pool threads and connections still hold the daemon, the process ends with them
+    close(listener);
+    return -1;
+}
+
+// sends one request to a daemon and writes the image it answers with to file
+s32 submit_render(const char * address, const daemon_request_t * request, const char * file){
+    s32 fd = net_open(address, false);
+    if (fd < 0) {
+        fprintf(stderr, "%s: no daemon there\n", address);
+        return -1;
+    }
+
+    net_header_t header;
+    r64 start = get_time_seconds();
+    if (!net_send(fd, DaemonRender, request, sizeof(*request)) || !net_recv_all(fd, &header, sizeof(header))) {
+        fprintf(stderr, "%s: daemon went away\n", address);
+        close(fd);
+        return -1;
+    }
+
+    if (header.type == DaemonError) {
+        char error[256] = {};
+        u64 length = header.size < sizeof(error) - 1 ? header.size : sizeof(error) - 1;
+        net_recv_all(fd, error, length);
+        fprintf(stderr, "daemon: %s\n", error);
+        close(fd);
+        return -1;
+    }
+
+    daemon_reply_t reply = {};
+    if (header.type != DaemonImage || header.size < sizeof(reply) || !net_recv_all(fd, &reply, sizeof(reply)) ||
+        header.size != sizeof(reply) + reply.image_size) {
+        fprintf(stderr, "%s: bad reply\n", address);
+        close(fd);
+        return -1;
+    }
+    u8 * data = (u8 *) malloc(reply.image_size > 0 ? reply.image_size : 1);
+    bool received = net_recv_all(fd, data, reply.image_size);
+    close(fd);
+    r64 total = get_time_seconds() - start;
+
+    s32 result = -1;
+    FILE * fp = received ? fopen(file, "wb") : NULL;
+    if (fp) {
+        result = fwrite(data, 1, reply.image_size, fp) == reply.image_size ? 0 : -1;
+        if (fclose(fp) != 0) result = -1;
+    }
+    if (result != 0) fprintf(stderr, "%s: could not write\n", file);
+    free(data);
+
+    fprintf(stderr, "daemon: %dx%d, scene %.2f ms%s, queued %.3f s, render %.3f s, encode %.3f s, %.3f s round trip\n",
+        reply.width, reply.height, reply.load_seconds * 1000.0, reply.cached ? " (cached)" : "",
+        reply.queue_seconds, reply.render_seconds, reply.encode_seconds, total);
+    return result;
+}
+
+struct options_t {
+    accel_type accel;
+    s32 threads;
+    s32 tile_size;
+    s32 image_width;
+    s32 samples_per_pixel;
+    s32 min_samples_per_pixel;
+    r64 max_error;
+    s32 rr_depth;
+    s32 packet_size;
+    bool wavefront;
+    const char * output;
+    image_format format;
+    bool format_given;
+    bool stream_output;
+    const char * spp_heatmap;
+    const char * stats_file;
+    const char * tile_heatmap;
+    const char * scene_file;
+    const char * save_scene;
+    const char * convert_in;
+    const char * convert_out;
+    const char * bench;
+    const char * reference;
+    r64 min_psnr;
+    bool update_reference;
+    const char * animation;
+    s32 turntable;
+    s32 frames;
+    const char * coordinator;
+    const char * worker;
+    s32 local_workers;
+    r64 worker_timeout;
+    const char * tile_costs;
+    const char * checkpoint;
+    r64 checkpoint_interval;
+    bool resume;
+    r64 time_limit;
+    const char * preview;
+    sampler_type sampler;
+    bool denoise;
+    const char * albedo_file;
+    const char * normal_file;
+    const char * depth_file;
+    const char * serve;
+    const char * submit;
+    s32 scene_cache;
+    s32 priority;
+    const char * camera_keys;
+};
+
+void print_usage(const char * name){
+    fprintf(stderr, "usage: %s [options]\n", name);
+    fprintf(stderr, "  --accel none|bvh|compact\n");
+    fprintf(stderr, "                   linear entity scan, bvh traversal, or a bvh over quantized, morton\n");
+    fprintf(stderr, "                   ordered sphere clusters for big scenes (default: bvh)\n");
+    fprintf(stderr, "  --threads N      worker threads (default: number of cores)\n");
+    fprintf(stderr, "  --tile-size N    tile edge in pixels (default: 16)\n");
+    fprintf(stderr, "  --width N        image width in pixels (default: 800)\n");
+    fprintf(stderr, "  --spp N          samples per pixel, the upper bound with --error (default: 500)\n");
+    fprintf(stderr, "  --min-spp N      samples every pixel takes before it may stop (default: 16)\n");
+    fprintf(stderr, "  --error E        stop a pixel once its 95%% confidence interval is within E of\n");
+    fprintf(stderr, "                   its mean luminance, e.g. 0.02 (default: 0, fixed spp)\n");
+    fprintf(stderr, "  --spp-heatmap FILE  write the samples taken per pixel as an image\n");
+    fprintf(stderr, "  --stats FILE     write ray, hit, path depth and tile time statistics as json\n");
+    fprintf(stderr, "  --tile-heatmap FILE  write the wall time of every tile as an image\n");
+    fprintf(stderr, "  --rr-depth N     bounces before russian roulette starts (default: 5)\n");
+    fprintf(stderr, "  --sampler S      random|sobol|rank1, owen scrambled sobol and rank-1 lattice\n");
+    fprintf(stderr, "                   samples converge faster than random ones (default: random)\n");
+    fprintf(stderr, "  --packet N       trace camera rays in packets of 4, 8 or 16, 0 for single rays\n");
+    fprintf(stderr, "                   (default: 16)\n");
+    fprintf(stderr, "  --wavefront      advance all samples of a tile a bounce at a time, shading\n");
+    fprintf(stderr, "                   sorted by material, and report per stage timings\n");
+    fprintf(stderr, "  -o FILE          output image (default: output.ppm)\n");
+    fprintf(stderr, "  --format F       ppm|ppm-ascii|png|pfm, by default picked from the output\n");
+    fprintf(stderr, "                   extension (.png, .pfm, anything else is binary ppm)\n");
+    fprintf(stderr, "  --no-stream      write the image after rendering instead of streaming rows\n");
+    fprintf(stderr, "  --scene FILE     render a binary or text scene file instead of the demo scene\n");
+    fprintf(stderr, "  --save-scene FILE  write the scene being rendered, text for .txt, binary otherwise\n");
+    fprintf(stderr, "  --convert IN OUT write scene IN as a binary scene OUT and exit\n");
+    fprintf(stderr, "  --animate FILE   render the frames of an animation file, -o is the name pattern\n");
+    fprintf(stderr, "                   (frame_%%04d.png, or a frame number is added before the extension)\n");
+    fprintf(stderr, "  --turntable N    render N frames orbiting the camera once around its target\n");
+    fprintf(stderr, "  --frames N       frame count, overrides the animation file's\n");
+    fprintf(stderr, "  --coordinator ADDR  render on worker processes connecting to ADDR, unix:PATH or\n");
+    fprintf(stderr, "                   HOST:PORT (:PORT for every interface)\n");
+    fprintf(stderr, "  --local-workers N  start N worker processes on this machine for --coordinator\n");
+    fprintf(stderr, "  --worker ADDR    render tiles for the coordinator at ADDR, one tile at a time\n");
+    fprintf(stderr, "  --worker-timeout S  drop a worker that holds a tile for S seconds, and give up\n");
+    fprintf(stderr, "                   when no worker is connected for that long (default: 60)\n");
+    fprintf(stderr, "  --tile-costs FILE  hand out the slowest tiles of an earlier --stats file first\n");
+    fprintf(stderr, "  --checkpoint FILE  render progressively and save every pixel's estimate to FILE\n");
+    fprintf(stderr, "  --checkpoint-interval S  seconds between checkpoints (default: 60)\n");
+    fprintf(stderr, "  --resume         continue the render saved in the --checkpoint file\n");
+    fprintf(stderr, "  --time-limit S   render progressively and stop before a pass would end after S\n");
+    fprintf(stderr, "                   seconds, or at --spp\n");
+    fprintf(stderr, "  --preview FILE   render progressively and rewrite FILE after every pass, - writes\n");
+    fprintf(stderr, "                   a stream of binary ppm frames to stdout\n");
+    fprintf(stderr, "  --denoise        filter the noise out of the finished image, guided by the albedo,\n");
+    fprintf(stderr, "                   normal and depth of the first hits\n");
+    fprintf(stderr, "  --albedo FILE    write the first hit albedo as an image\n");
+    fprintf(stderr, "  --normal FILE    write the first hit normal as an image, 0.5 + 0.5 n unless .pfm\n");
+    fprintf(stderr, "  --depth FILE     write the first hit distance as an image, scaled to the farthest\n");
+    fprintf(stderr, "                   unless .pfm\n");
+    fprintf(stderr, "  --serve ADDR     run as a render daemon taking jobs on ADDR, unix:PATH, with --threads\n");
+    fprintf(stderr, "                   render threads shared by all jobs\n");
+    fprintf(stderr, "  --scene-cache N  scenes the daemon keeps loaded (default: 8)\n");
+    fprintf(stderr, "  --submit ADDR    have the daemon at ADDR render --scene (or the demo scene) and\n");
+    fprintf(stderr, "                   write its image to -o\n");
+    fprintf(stderr, "  --priority N     of a submitted job, higher ones get the render threads first\n");
+    fprintf(stderr, "                   (default: 0)\n");
+    fprintf(stderr, "  --camera KEYS    camera keys as in scene files (\"lookfrom 0 2 8 vfov 30\") over the\n");
+    fprintf(stderr, "                   submitted scene's camera\n");
+    fprintf(stderr, "  --bench FILE     run the benchmark suite and write json to FILE (- for stdout)\n");
+    fprintf(stderr, "  --reference FILE golden image for --bench (default: bench/reference.ppm)\n");
+    fprintf(stderr, "  --min-psnr DB    lowest psnr against the golden image that passes (default: 35)\n");
+    fprintf(stderr, "  --update-reference  rewrite the golden image instead of checking it\n");
+}
+
+bool parse_options(s32 argc, char ** argv, options_t * options){
+    options->accel = AccelBVH;
+    options->threads = (s32) sysconf(_SC_NPROCESSORS_ONLN);
+    options->tile_size = 16;
+    options->image_width = 800;
+    options->samples_per_pixel = 500;
+    options->min_samples_per_pixel = 16;
+    options->max_error = 0.0;
+    options->rr_depth = 5;
+    options->packet_size = 16;
+    options->output = "output.ppm";
+    options->format_given = false;
+    options->stream_output = true;
+    options->spp_heatmap = NULL;
+    options->stats_file = NULL;
+    options->tile_heatmap = NULL;
+    options->scene_file = NULL;
+    options->save_scene = NULL;
+    options->convert_in = NULL;
+    options->convert_out = NULL;
+    options->bench = NULL;
+    options->reference = "bench/reference.ppm";
+    options->min_psnr = 35.0;
+    options->update_reference = false;
+    options->animation = NULL;
+    options->turntable = 0;
+    options->frames = 0;
+    options->coordinator = NULL;
+    options->worker = NULL;
+    options->local_workers = 0;
+    options->worker_timeout = 60.0;
+    options->tile_costs = NULL;
+    options->checkpoint = NULL;
+    options->checkpoint_interval = 60.0;
+    options->resume = false;
+    options->time_limit = 0.0;
+    options->preview = NULL;
+    options->sampler = SamplerRandom;
+    options->denoise = false;
+    options->albedo_file = NULL;
+    options->normal_file = NULL;
+    options->depth_file = NULL;
+    options->serve = NULL;
+    options->submit = NULL;
+    options->scene_cache = 8;
+    options->priority = 0;
+    options->camera_keys = "";
+
+    for(s32 i = 1 ; i < argc ; i++){
+        const char * arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (!strcmp(arg, "--accel") && has_value) {
+            const char * value = argv[++i];
+            if (!strcmp(value, "none")) options->accel = AccelNone;
+            else if (!strcmp(value, "bvh")) options->accel = AccelBVH;
+            else if (!strcmp(value, "compact")) options->accel = AccelCompact;
+            else {
+                fprintf(stderr, "unknown acceleration structure: %s\n", value);
+                return false;
+            }
+        }
+        else if (!strcmp(arg, "--sampler") && has_value) {
+            const char * value = argv[++i];
+            s32 sampler = 0;
+            while (sampler < SamplerCount && strcmp(value, SAMPLER_NAMES[sampler])) sampler++;
+            if (sampler == SamplerCount) {
+                fprintf(stderr, "unknown sampler: %s\n", value);
+                return false;
+            }
+            options->sampler = (sampler_type) sampler;
+        }
+        else if (!strcmp(arg, "--threads") && has_value) {
+            options->threads = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "--tile-size") && has_value) {
+            options->tile_size = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "--width") && has_value) {
+            options->image_width = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "--spp") && has_value) {
+            options->samples_per_pixel = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "--min-spp") && has_value) {
+            options->min_samples_per_pixel = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "--error") && has_value) {
+            options->max_error = atof(argv[++i]);
+        }
+        else if (!strcmp(arg, "--spp-heatmap") && has_value) {
+            options->spp_heatmap = argv[++i];
+        }
+        else if (!strcmp(arg, "--stats") && has_value) {
+            options->stats_file = argv[++i];
+        }
+        else if (!strcmp(arg, "--tile-heatmap") && has_value) {
+            options->tile_heatmap = argv[++i];
+        }
+        else if (!strcmp(arg, "--rr-depth") && has_value) {
+            options->rr_depth = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "--packet") && has_value) {
+            options->packet_size = atoi(argv[++i]);
+            if (options->packet_size != 0 && options->packet_size != 4 && options->packet_size != 8 && options->packet_size != 16) {
+                fprintf(stderr, "packet size must be 0, 4, 8 or 16\n");
+                return false;
+            }
+        }
+        else if (!strcmp(arg, "--wavefront")) {
+            options->wavefront = true;
+        }
+        else if (!strcmp(arg, "-o") && has_value) {
+            options->output = argv[++i];
+        }
+        else if (!strcmp(arg, "--format") && has_value) {
+            const char * value = argv[++i];
+            if (!parse_image_format(value, &options->format)) {
+                fprintf(stderr, "unknown image format: %s\n", value);
+                return false;
+            }
+            options->format_given = true;
+        }
+        else if (!strcmp(arg, "--no-stream")) {
+            options->stream_output = false;
+        }
+        else if (!strcmp(arg, "--scene") && has_value) {
+            options->scene_file = argv[++i];
+        }
+        else if (!strcmp(arg, "--save-scene") && has_value) {
+            options->save_scene = argv[++i];
+        }
+        else if (!strcmp(arg, "--bench") && has_value) {
+            options->bench = argv[++i];
+        }
+        else if (!strcmp(arg, "--reference") && has_value) {
+            options->reference = argv[++i];
+        }
+        else if (!strcmp(arg, "--min-psnr") && has_value) {
+            options->min_psnr = atof(argv[++i]);
+        }
+        else if (!strcmp(arg, "--update-reference")) {
+            options->update_reference = true;
+        }
+        else if (!strcmp(arg, "--animate") && has_value) {
+            options->animation = argv[++i];
+        }
+        else if (!strcmp(arg, "--turntable") && has_value) {
+            options->turntable = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "--frames") && has_value) {
+            options->frames = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "--coordinator") && has_value) {
+            options->coordinator = argv[++i];
+        }
+        else if (!strcmp(arg, "--local-workers") && has_value) {
+            options->local_workers = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "--worker") && has_value) {
+            options->worker = argv[++i];
+        }
+        else if (!strcmp(arg, "--worker-timeout") && has_value) {
+            options->worker_timeout = atof(argv[++i]);
+        }
+        else if (!strcmp(arg, "--tile-costs") && has_value) {
+            options->tile_costs = argv[++i];
+        }
+        else if (!strcmp(arg, "--checkpoint") && has_value) {
+            options->checkpoint = argv[++i];
+        }
+        else if (!strcmp(arg, "--checkpoint-interval") && has_value) {
+            options->checkpoint_interval = atof(argv[++i]);
+        }
+        else if (!strcmp(arg, "--resume")) {
+            options->resume = true;
+        }
+        else if (!strcmp(arg, "--time-limit") && has_value) {
+            options->time_limit = atof(argv[++i]);
+        }
+        else if (!strcmp(arg, "--preview") && has_value) {
+            options->preview = argv[++i];
+        }
+        else if (!strcmp(arg, "--denoise")) {
+            options->denoise = true;
+        }
+        else if (!strcmp(arg, "--albedo") && has_value) {
+            options->albedo_file = argv[++i];
+        }
+        else if (!strcmp(arg, "--normal") && has_value) {
+            options->normal_file = argv[++i];
+        }
+        else if (!strcmp(arg, "--depth") && has_value) {
+            options->depth_file = argv[++i];
+        }
+        else if (!strcmp(arg, "--serve") && has_value) {
+            options->serve = argv[++i];
+        }
+        else if (!strcmp(arg, "--submit") && has_value) {
+            options->submit = argv[++i];
+        }
+        else if (!strcmp(arg, "--scene-cache") && has_value) {
+            options->scene_cache = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "--priority") && has_value) {
+            options->priority = atoi(argv[++i]);
+        }
+        else if (!strcmp(arg, "--camera") && has_value) {
+            options->camera_keys = argv[++i];
+        }
+        else if (!strcmp(arg, "--convert") && i + 2 < argc) {
+            options->convert_in = argv[++i];
+            options->convert_out = argv[++i];
+        }
+        else {
+            fprintf(stderr, "unknown or incomplete option: %s\n", arg);
+            return false;
+        }
+    }
+
+    if (!options->format_given) options->format = image_format_from_file(options->output);
+    if (options->threads < 1) options->threads = 1;
+    if (options->tile_size < 1) options->tile_size = 1;
+    if (options->image_width < 2) options->image_width = 2;
+    if (options->samples_per_pixel < 1) options->samples_per_pixel = 1;
+    if (options->min_samples_per_pixel < 2) options->min_samples_per_pixel = 2;
+    if (options->min_samples_per_pixel > options->samples_per_pixel) options->min_samples_per_pixel = options->samples_per_pixel;
+    if (options->max_error < 0.0) options->max_error = 0.0;
+    if (options->rr_depth < 1) options->rr_depth = 1;
+    if (options->worker_timeout < 1.0) options->worker_timeout = 1.0;
+    if (options->checkpoint_interval < 0.0) options->checkpoint_interval = 0.0;
+    if (options->time_limit < 0.0) options->time_limit = 0.0;
+    // the last pass of a timed render is only known once it is done, too late to stream it
+    if (options->time_limit > 0.0) options->stream_output = false;
+    // the denoiser needs the whole image before the first row is final
+    if (options->denoise) options->stream_output = false;
+
+    if (options->resume && !options->checkpoint) {
+        fprintf(stderr, "--resume needs --checkpoint\n");
+        return false;
+    }
+    bool progressive = options->checkpoint || options->time_limit > 0.0 || options->preview;
+    if (progressive && (options->animation || options->turntable > 0 || options->coordinator)) {
+        fprintf(stderr, "--checkpoint, --time-limit and --preview only work for still images rendered in this process\n");
+        return false;
+    }
+    // workers send back pixels only, the features stay on their side
+    bool features = options->denoise || options->albedo_file || options->normal_file || options->depth_file;
+    if (features && options->coordinator) {
+        fprintf(stderr, "--denoise, --albedo, --normal and --depth only work for images rendered in this process\n");
+        return false;
+    }
+    if ((options->albedo_file || options->normal_file || options->depth_file) && (options->animation || options->turntable > 0)) {
+        fprintf(stderr, "--albedo, --normal and --depth only work for still images\n");
+        return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char ** argv) {
+
+    options_t options = {};
+    if (!parse_options(argc, argv, &options)) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    const s32 MAX_RAY_BOUNCE = 50;
+
+    if (options.bench) {
+        return run_benchmarks(options.bench, options.reference, options.min_psnr, options.update_reference, options.threads);
+    }
+
+    if (options.worker) {
+        return run_worker(options.worker);
+    }
+
+    if (options.serve) {
+        return run_daemon(options.serve, options.threads, options.scene_cache, options.accel);
+    }
+
+    if (options.submit) {
+        daemon_request_t request = {};
+        memcpy(request.magic, DAEMON_MAGIC, sizeof(request.magic));
+        request.version = DAEMON_VERSION;
+        request.priority = options.priority;
+        // the daemon's working directory is not ours
+        if (options.scene_file) {
+            char * absolute = realpath(options.scene_file, NULL);
+            if (!absolute) {
+                fprintf(stderr, "%s: %s\n", options.scene_file, strerror(errno));
+                return -1;
+            }
+            if (strlen(absolute) >= sizeof(request.scene)) {
+                fprintf(stderr, "%s: path longer than %d bytes\n", absolute, DAEMON_SCENE_KEY - 1);
+                free(absolute);
+                return -1;
+            }
+            memcpy(request.scene, absolute, strlen(absolute) + 1);
+            free(absolute);
+        }
+        snprintf(request.camera, sizeof(request.camera), "%s", options.camera_keys);
+        request.width = options.image_width;
+        request.samples_per_pixel = options.samples_per_pixel;
+        request.min_samples_per_pixel = options.min_samples_per_pixel;
+        request.max_error = options.max_error;
+        request.max_bounce = MAX_RAY_BOUNCE;
+        request.rr_depth = options.rr_depth;
+        request.sampler = options.sampler;
+        request.packet_size = options.packet_size;
+        request.wavefront = options.wavefront;
+        request.tile_size = options.tile_size;
+        request.format = options.format;
+        return submit_render(options.submit, &request, options.output);
+    }
+
+    if (options.convert_in) {
+        scene_t scene = {};
+        r64 load_start = get_time_seconds();
+        if (load_scene(&scene, options.convert_in, options.accel) != 0) return -1;
+        fprintf(stderr, "scene: %d spheres, %d materials loaded in %.2f ms\n", scene.spheres.count, scene.material_count, (get_time_seconds() - load_start) * 1000.0);
+        s32 result = save_scene_binary(&scene, options.convert_out);
+        destroy_scene(&scene);
+        return result;
+    }
+
+    scene_t scene = {};
+    r64 load_start = get_time_seconds();
+    if (options.scene_file) {
+        if (load_scene(&scene, options.scene_file, options.accel) != 0) return -1;
+        fprintf(stderr, "scene: %d spheres, %d materials loaded in %.2f ms\n", scene.spheres.count, scene.material_count, (get_time_seconds() - load_start) * 1000.0);
+    }
+    else {
+        rng_t scene_rng;
+        rng_seed(&scene_rng, 3000, 0);
+
+        scene.camera = default_camera_desc();
+        scene.entities = create_entities(&scene.entity_count, &scene_rng, &scene.entity_materials);
+        build_scene_from_entities(&scene, options.accel);
+        if (scene.accel == AccelBVH) {
+            fprintf(stderr, "bvh: %d nodes over %d spheres in %.2f ms\n", scene.bvh.node_count, scene.bvh.index_count, (get_time_seconds() - load_start) * 1000.0);
+        }
+        else if (scene.accel == AccelCompact) {
+            fprintf(stderr, "compact: %d nodes over %d clusters, %d distinct radii in %.2f ms\n", 
+                scene.bvh.node_count, scene.compact.cluster_count, scene.compact.radius_count, (get_time_seconds() - load_start) * 1000.0);
+        }
+    }
+    fprintf(stderr, "geometry: %.1f bytes per sphere\n", scene.spheres.count > 0 ? (r64) scene_geometry_bytes(&scene) / scene.spheres.count : 0.0);
+    if (scene.grid_count > 0 || scene.instance_count > 0) {
+        fprintf(stderr, "geometry: %.4g primitives in %.2f MB\n", scene_primitive_count(&scene), scene_memory_bytes(&scene) / (1024.0 * 1024.0));
+    }
+
+    if (options.save_scene) {
+        const char * extension = strrchr(options.save_scene, '.');
+        bool text = extension && !strcmp(extension, ".txt");
+        if ((text ? save_scene_text(&scene, options.save_scene) : save_scene_binary(&scene, options.save_scene)) != 0) return -1;
+    }
+
+    int image_width = options.image_width;
+    int image_height = (int)(image_width / scene.camera.aspect_ratio);
+    if (image_height < 1) image_height = 1;
+
+    camera_t camera = create_camera(&scene.camera, image_width, image_height);
+
+    image_t image;
+    create_image(&image, image_width, image_height, 0xffffff);
+
+    render_job_t job = {};
+    job.image = &image;
+    job.camera = &camera;
+    job.scene = &scene;
+    job.samples_per_pixel = options.samples_per_pixel;
+    job.min_samples_per_pixel = options.min_samples_per_pixel;
+    job.max_error = options.max_error;
+    job.max_bounce = MAX_RAY_BOUNCE;
+    job.rr_depth = options.rr_depth;
+    job.sampler = options.sampler;
+    job.packet_size = options.packet_size > 1 ? options.packet_size : 1;
+    job.wavefront = options.wavefront;
+    job.tile_size = options.tile_size;
+
+    if (options.max_error > 0.0 || options.spp_heatmap) {
+        job.sample_counts = (s32 *) malloc(sizeof(s32) * image_width * image_height);
+    }
+    if (options.stats_file || options.tile_heatmap) {
+        s32 tiles = ((image_width + job.tile_size - 1) / job.tile_size) * ((image_height + job.tile_size - 1) / job.tile_size);
+        job.tile_seconds = (r64 *) calloc(tiles, sizeof(r64));
+    }
+
+    if (options.format == ImageFormatPFM || (options.preview && image_format_from_file(options.preview) == ImageFormatPFM)) {
+        image.hdr = (r32 *) malloc(sizeof(r32) * 3 * image_width * image_height);
+    }
+
+    feature_buffers_t features = {};
+    if (options.denoise || options.albedo_file || options.normal_file || options.depth_file) {
+        create_feature_buffers(&features, image_width, image_height);
+        job.features = &features;
+        job.denoise = options.denoise;
+    }
+
+    checkpoint_t checkpoint = {};
+    if (options.checkpoint || options.time_limit > 0.0 || options.preview) {
+        job.estimates = (pixel_estimate_t *) calloc((s64)image_width * image_height, sizeof(pixel_estimate_t));
+        job.time_limit = options.time_limit;
+        job.preview = options.preview;
+    }
+    if (options.checkpoint) {
+        checkpoint.file = options.checkpoint;
+        checkpoint.interval = options.checkpoint_interval;
+        job.checkpoint = &checkpoint;
+        if (options.resume) {
+            if (read_checkpoint(&job) != 0) return -1;
+            fprintf(stderr, "resume: %d spp from %s\n", job.pass_samples, options.checkpoint);
+        }
+    }
+
+    // before anything starts a thread, the local workers are forked from here
+    coordinator_t coordinator;
+    if (options.coordinator) {
+        if (coordinator_open(&coordinator, options.coordinator, options.local_workers, options.worker_timeout, options.tile_costs) != 0) return -1;
+        job.coordinator = &coordinator;
+    }
+
+    r64 render_seconds = 0.0, output_seconds = 0.0;
+    s32 write_result = 0;
+    if (options.animation || options.turntable > 0) {
+        if (scene.accel == AccelCompact) {
+            fprintf(stderr, "animations move spheres in place, render them with --accel bvh or none\n");
+            return -1;
+        }
+        animation_t animation = {};
+        if (options.animation) {
+            if (load_animation(&animation, options.animation, &scene) != 0) return -1;
+        }
+        else {
+            create_turntable(&animation, &scene, options.turntable);
+        }
+        if (options.frames > 0) animation.frame_count = options.frames;
+
+        write_result = render_animation(&job, &scene, &animation, options.output, options.format, options.stream_output, options.threads, &render_seconds);
+        destroy_animation(&animation);
+    }
+    else {
+        write_result = render_to_file(&job, options.output, options.format, options.stream_output, options.threads, &render_seconds, &output_seconds);
+        fprintf(stderr, "render: %.3f s\n", render_seconds);
+        if (job.denoise) {
+            fprintf(stderr, "denoise: %.3f s\n", job.denoise_seconds);
+        }
+        if (job.wavefront) {
+            print_wavefront_timings(&job.timings);
+        }
+        fprintf(stderr, "output: %.3f s after the last tile%s\n", output_seconds, write_result != 0 ? ", failed" : "");
+    }
+
+    if (job.sample_counts) {
+        s64 total = 0;
+        for(s64 i = 0 ; i < (s64)image_width * image_height ; i++){
+            total += job.sample_counts[i];
+        }
+        fprintf(stderr, "samples: %.1f spp average\n", (r64)total / ((s64)image_width * image_height));
+
+        if (options.spp_heatmap) {
+            write_sample_heatmap(options.spp_heatmap, job.sample_counts, image_width, image_height, options.min_samples_per_pixel, options.samples_per_pixel);
+        }
+        free(job.sample_counts);
+    }
+
+    if (job.tile_seconds) {
+        if (options.stats_file && write_stats_json(options.stats_file, &job, render_seconds) != 0) write_result = -1;
+        if (options.tile_heatmap && write_tile_heatmap(options.tile_heatmap, &job) != 0) write_result = -1;
+        free(job.tile_seconds);
+    }
+
+    if (job.features) {
+        if (options.albedo_file && write_feature_image(options.albedo_file, &features, FeatureAlbedo) != 0) write_result = -1;
+        if (options.normal_file && write_feature_image(options.normal_file, &features, FeatureNormal) != 0) write_result = -1;
+        if (options.depth_file && write_feature_image(options.depth_file, &features, FeatureDepth) != 0) write_result = -1;
+        destroy_feature_buffers(&features);
+    }
+
+    if (job.coordinator) coordinator_close(&coordinator);
+    free(job.estimates);
+    destroy_scene(&scene);
+    free(image.pixels);
+    free(image.hdr);
+    return write_result == 0 ? 0 : -1;
+}
+
+template<typename T>
+inline T size(basic_interval_t<T> inv) {
+    return inv.max - inv.min;
+}
+
+template<typename T>
+inline bool contains(basic_interval_t<T> inv, T value) {
+    return inv.max >= value && inv.min <= value;
+}
+
+template<typename T>
+inline bool surrounds(basic_interval_t<T> inv, T value)  {
+    return inv.max > value && inv.min < value;
+}
+
+template<typename T>
+inline T clamp(basic_interval_t<T> inv, T x) {
+    return clamp(inv.min, inv.max, x);
+}
+
+
+template<typename T>
+basic_vec3_t<T>::basic_vec3_t(T x1, T x2, T x3){
     x = x1;
     y = x2;
     z = x3;
 }
 
-vec3 operator - (const vec3 & a){
-    vec3 result = {
-        -a.x,
-        -a.y,
-        -a.z,
-    };
-    return result;
+template<typename T>
+basic_vec3_t<T> operator - (const basic_vec3_t<T> & a){
+    basic_vec3_t<T> result = {
+        -a.x,
+        -a.y,
+        -a.z,
+    };
+    return result;
+}
+
+template<typename T>
+basic_vec3_t<T> operator - (const basic_vec3_t<T> & a, const basic_vec3_t<T> & b){
+    basic_vec3_t<T> result = {
+        a.x - b.x,
+        a.y - b.y,
+        a.z - b.z,
+    };
+    return result;
+}
+
+template<typename T>
+basic_vec3_t<T> operator + (const basic_vec3_t<T> & a, const basic_vec3_t<T> & b) {
+    basic_vec3_t<T> result = {
+        a.x + b.x,
+        a.y + b.y,
+        a.z + b.z,
+    };
+    return result;
+}
+
+template<typename T>
+basic_vec3_t<T> operator * (const basic_vec3_t<T>  & a, typename non_deduced<T>::type scale){
+    basic_vec3_t<T> result = {
+        a.x * scale,
+        a.y * scale,
+        a.z * scale,
+    };
+    return result;
+}
+
+template<typename T>
+basic_vec3_t<T> operator * (const basic_vec3_t<T> & b, const basic_vec3_t<T> & a){
+    basic_vec3_t<T> result = {
+        a.x * b.x,
+        a.y * b.y,
+        a.z * b.z,
+    };
+    return result;
+}
+
+
+template<typename T>
+basic_vec3_t<T> operator * (const typename non_deduced<T>::type & scale, basic_vec3_t<T> a){
+    basic_vec3_t<T> result = {
+        a.x * scale,
+        a.y * scale,
+        a.z * scale,
+    };
+    return result;
+}
+
+template<typename T>
+basic_vec3_t<T> operator / (const basic_vec3_t<T>  & a, typename non_deduced<T>::type scale){
+    basic_vec3_t<T> result = {
+        a.x / scale,
+        a.y / scale,
+        a.z / scale,
+    };
+    return result;
+}
+
+template<typename T>
+basic_vec3_t<T> cross(const basic_vec3_t<T> & a, const basic_vec3_t<T> & b) {
+    basic_vec3_t<T> result = {};
+    result.x = a.y * b.z - a.z * b.y;
+    result.y = a.z * b.x - a.x * b.z;
+    result.z = a.x * b.y - a.y * b.x;
+    return result;
+}
+
+template<typename T>
+T lengthsq(const basic_vec3_t<T> & v) {
+    return (v.x * v.x + v.y * v.y + v.z * v.z);
+}
+
+template<typename T>
+T length(const basic_vec3_t<T> & v){
+    return sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+}
+
+template<typename T>
+basic_vec3_t<T> normalize(const basic_vec3_t<T> & val){
+    if (length(val) == 0) {
+        return basic_vec3_t<T>(0.0, 0.0, 0.0);
+    }
+    return val/ length(val);
+}
+
+
+template<typename T>
+T dot(const basic_vec3_t<T> & a, const basic_vec3_t<T> & b) {
+    return (a.x * b.x + a.y * b.y + a.z * b.z);
+}
+
+
+s32 create_image(image_t * image, s32 width, s32 height, u32 color){
+    const u64 MASK = 255;
+    s32 result = 0;
+    image->pixels = (pixel_t *) malloc(sizeof(pixel_t) * width * height);
+    for(s64 i = 0 ; i < width * height ; i++) {
+        image->pixels[i].r = (color >> 16) & MASK ;
+        image->pixels[i].g = (color >> 8) &  MASK ;
+        image->pixels[i].b = (color) & MASK ;
+    }
+    image->width = width;
+    image->height = height;
+    image->hdr = NULL;
+    return result;
+}
+
+image_format image_format_from_file(const char * file){
+    const char * extension = strrchr(file, '.');
+    if (extension && !strcmp(extension, ".png")) return ImageFormatPNG;
+    if (extension && !strcmp(extension, ".pfm")) return ImageFormatPFM;
+    return ImageFormatPPM;
+}
+
+bool parse_image_format(const char * name, image_format * format){
+    if (!strcmp(name, "ppm")) *format = ImageFormatPPM;
+    else if (!strcmp(name, "ppm-ascii")) *format = ImageFormatPPMAscii;
+    else if (!strcmp(name, "png")) *format = ImageFormatPNG;
+    else if (!strcmp(name, "pfm")) *format = ImageFormatPFM;
+    else return false;
+    return true;
+}
+
+s32 write_image(const char * file, image_t * image) {
+    image_writer_t writer = {};
+    s32 result = image_writer_open(&writer, file, image, image_format_from_file(file));
+    if (result == 0) {
+        result = image_writer_write_rows(&writer, 0, image->height);
+    }
+    if (image_writer_close(&writer) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+// the image as a file of the format would hold it, in a malloc'ed buffer the caller frees
+s32 encode_image(image_t * image, image_format format, u8 ** data, u64 * size){
+    char * buffer = NULL;
+    size_t buffer_size = 0;
+    *data = NULL;
+    *size = 0;
+    if (format == ImageFormatPFM && !image->hdr) return -1;
+
+    FILE * fp = open_memstream(&buffer, &buffer_size);
+    if (!fp) return -1;
+
+    image_writer_t writer = {};
+    s32 result = image_writer_open_stream(&writer, fp, image, format);
+    if (result == 0) {
+        result = image_writer_write_rows(&writer, 0, image->height);
+        // a memory stream ends where its position is left, pfm rows are written bottom up
+        if (result == 0 && format == ImageFormatPFM) {
+            s64 end = writer.data_offset + (s64) sizeof(r32) * 3 * image->width * image->height;
+            if (fseek(fp, end, SEEK_SET) != 0) result = -1;
+        }
+    }
+    if (image_writer_close(&writer) != 0) {
+        result = -1;
+    }
+    if (result != 0) {
+        free(buffer);
+        return -1;
+    }
+    *data = (u8 *) buffer;
+    *size = buffer_size;
+    return 0;
+}
+
+// @note: png encoder
+// rows are filtered (none/sub/up/paeth, picked per row by the smallest sum of absolute
+// values) and compressed into fixed huffman deflate blocks with a hash chain lz77 match
+// finder, one block per batch of rows. each batch goes out as its own IDAT chunk
+
+static u32 crc_table[256];
+
+u32 crc32_update(u32 crc, const u8 * data, s64 size){
+    if (crc_table[1] == 0) {
+        for(u32 n = 0 ; n < 256 ; n++){
+            u32 c = n;
+            for(s32 k = 0 ; k < 8 ; k++){
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            crc_table[n] = c;
+        }
+    }
+    crc = ~crc;
+    for(s64 i = 0 ; i < size ; i++){
+        crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+u32 adler32_update(u32 adler, const u8 * data, s64 size){
+    u32 a = adler & 0xffff, b = adler >> 16;
+    while(size > 0){
+        // 5552 is the most bytes that can be summed before b can overflow
+        s64 block = size < 5552 ? size : 5552;
+        for(s64 i = 0 ; i < block ; i++){
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += block;
+        size -= block;
+    }
+    return (b << 16) | a;
+}
+
+struct byte_buffer_t {
+    u8 * data;
+    s64 size, capacity;
+};
+
+inline void buffer_reserve(byte_buffer_t * buffer, s64 extra){
+    if (buffer->size + extra <= buffer->capacity) return;
+    s64 capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+    while (capacity < buffer->size + extra) capacity *= 2;
+    buffer->data = (u8 *) realloc(buffer->data, capacity);
+    buffer->capacity = capacity;
+}
+
+inline void buffer_push(byte_buffer_t * buffer, u8 byte){
+    buffer_reserve(buffer, 1);
+    buffer->data[buffer->size++] = byte;
+}
+
+inline void put_u32_be(u8 * out, u32 value){
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+s32 write_png_chunk(FILE * fp, const char * type, const u8 * data, u32 size){
+    u8 header[8];
+    put_u32_be(header, size);
+    memcpy(header + 4, type, 4);
+
+    u32 crc = crc32_update(0, header + 4, 4);
+    crc = crc32_update(crc, data, size);
+    u8 footer[4];
+    put_u32_be(footer, crc);
+
+    if (fwrite(header, 1, 8, fp) != 8) return -1;
+    if (size > 0 && fwrite(data, 1, size, fp) != size) return -1;
+    if (fwrite(footer, 1, 4, fp) != 4) return -1;
+    return 0;
+}
+
+// deflate writes bits least significant first, huffman codes most significant first
+inline void put_bits(image_writer_t * writer, byte_buffer_t * out, u32 value, s32 count){
+    writer->bit_buffer |= (u64)value << writer->bit_count;
+    writer->bit_count += count;
+    while (writer->bit_count >= 8) {
+        buffer_push(out, (u8) writer->bit_buffer);
+        writer->bit_buffer >>= 8;
+        writer->bit_count -= 8;
+    }
+}
+
+inline void put_huffman(image_writer_t * writer, byte_buffer_t * out, u32 code, s32 length){
+    u32 reversed = 0;
+    for(s32 i = 0 ; i < length ; i++){
+        reversed |= ((code >> i) & 1) << (length - 1 - i);
+    }
+    put_bits(writer, out, reversed, length);
+}
+
+inline void put_literal_length(image_writer_t * writer, byte_buffer_t * out, s32 symbol){
+    if (symbol < 144) put_huffman(writer, out, 0x30 + symbol, 8);
+    else if (symbol < 256) put_huffman(writer, out, 0x190 + symbol - 144, 9);
+    else if (symbol < 280) put_huffman(writer, out, symbol - 256, 7);
+    else put_huffman(writer, out, 0xC0 + symbol - 280, 8);
+}
+
+static const u16 DEFLATE_LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const u8 DEFLATE_LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const u16 DEFLATE_DISTANCE_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const u8 DEFLATE_DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+void put_match(image_writer_t * writer, byte_buffer_t * out, s32 length, s32 distance){
+    s32 code = 28;
+    while (DEFLATE_LENGTH_BASE[code] > length) code--;
+    put_literal_length(writer, out, 257 + code);
+    put_bits(writer, out, length - DEFLATE_LENGTH_BASE[code], DEFLATE_LENGTH_EXTRA[code]);
+
+    code = 29;
+    while (DEFLATE_DISTANCE_BASE[code] > distance) code--;
+    put_huffman(writer, out, code, 5);
+    put_bits(writer, out, distance - DEFLATE_DISTANCE_BASE[code], DEFLATE_DISTANCE_EXTRA[code]);
+}
+
+const s32 DEFLATE_WINDOW = 32768;
+const s32 DEFLATE_HASH_BITS = 15;
+const s32 DEFLATE_MAX_CHAIN = 32;
+
+// compresses data[start, size) as one fixed huffman block, data[0, start) is the window
+void deflate_block(image_writer_t * writer, byte_buffer_t * out, const u8 * data, s32 start, s32 size){
+    s32 * head = (s32 *) malloc(sizeof(s32) * (1 << DEFLATE_HASH_BITS));
+    s32 * chain = (s32 *) malloc(sizeof(s32) * (size > 0 ? size : 1));
+    for(s32 i = 0 ; i < (1 << DEFLATE_HASH_BITS) ; i++) head[i] = -1;
+
+    #define DEFLATE_HASH(p) ((((u32)data[p] << 16) ^ ((u32)data[(p) + 1] << 8) ^ data[(p) + 2]) * 2654435761u >> (32 - DEFLATE_HASH_BITS))
+
+    for(s32 i = 0 ; i + 2 < start ; i++){
+        u32 h = DEFLATE_HASH(i);
+        chain[i] = head[h];
+        head[h] = i;
+    }
+
+    put_bits(writer, out, 0, 1);  // not the final block
+    put_bits(writer, out, 1, 2);  // fixed huffman codes
+
+    s32 i = start;
+    while (i < size) {
+        s32 best_length = 0, best_distance = 0;
+
+        if (i + 2 < size) {
+            u32 h = DEFLATE_HASH(i);
+            s32 candidate = head[h];
+            s32 max_length = size - i < 258 ? size - i : 258;
+            for(s32 tries = 0 ; candidate >= 0 && i - candidate <= DEFLATE_WINDOW && tries < DEFLATE_MAX_CHAIN ; tries++){
+                s32 length = 0;
+                while (length < max_length && data[candidate + length] == data[i + length]) length++;
+                if (length > best_length) {
+                    best_length = length;
+                    best_distance = i - candidate;
+                    if (length == max_length) break;
+                }
+                candidate = chain[candidate];
+            }
+        }
+
+        s32 advance = 1;
+        if (best_length >= 3) {
+            put_match(writer, out, best_length, best_distance);
+            advance = best_length;
+        } else {
+            put_literal_length(writer, out, data[i]);
+        }
+
+        for(s32 k = 0 ; k < advance ; k++, i++){
+            if (i + 2 < size) {
+                u32 h = DEFLATE_HASH(i);
+                chain[i] = head[h];
+                head[h] = i;
+            }
+        }
+    }
+
+    #undef DEFLATE_HASH
+
+    put_literal_length(writer, out, 256);
+
+    free(head);
+    free(chain);
+}
+
+inline u8 paeth(u8 a, u8 b, u8 c){
+    s32 p = (s32)a + b - c;
+    s32 pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    if (pb <= pc) return b;
+    return c;
+}
+
+// writes the filter type byte and the filtered row to out
+void filter_png_row(const u8 * row, const u8 * previous, s32 size, u8 * out){
+    const s32 BPP = 3;
+    u8 * candidates[4];
+    u8 types[4] = {0, 1, 2, 4};
+    u8 * scratch = (u8 *) malloc(4 * size);
+    u64 best_score = ~0ull;
+    s32 best = 0;
+
+    for(s32 f = 0 ; f < 4 ; f++){
+        candidates[f] = scratch + f * size;
+        u64 score = 0;
+        for(s32 i = 0 ; i < size ; i++){
+            u8 left = i >= BPP ? row[i - BPP] : 0;
+            u8 up = previous[i];
+            u8 upleft = i >= BPP ? previous[i - BPP] : 0;
+            u8 value = row[i];
+            if (types[f] == 1) value -= left;
+            else if (types[f] == 2) value -= up;
+            else if (types[f] == 4) value -= paeth(left, up, upleft);
+            candidates[f][i] = value;
+            score += (s8) value < 0 ? -(s32)(s8) value : value;
+        }
+        if (score < best_score) {
+            best_score = score;
+            best = f;
+        }
+    }
+
+    out[0] = types[best];
+    memcpy(out + 1, candidates[best], size);
+    free(scratch);
+}
+
+// zlib header ahead of the first deflate block: 32k window, no preset dictionary
+inline void png_start_stream(image_writer_t * writer, byte_buffer_t * out){
+    if (writer->zlib_started) return;
+    buffer_push(out, 0x78);
+    buffer_push(out, 0x01);
+    writer->zlib_started = true;
+}
+
+s32 write_png_rows(image_writer_t * writer, s32 y0, s32 y1){
+    image_t * image = writer->image;
+    s32 row_size = image->width * 3;
+    s32 filtered_size = row_size + 1;
+
+    // window followed by the new rows, so matches can reach back into earlier batches
+    s32 data_size = writer->window_size + filtered_size * (y1 - y0);
+    u8 * data = (u8 *) malloc(data_size);
+    memcpy(data, writer->window, writer->window_size);
+
+    for(s32 y = y0 ; y < y1 ; y++){
+        const u8 * row = (const u8 *) &image->pixels[(s64)y * image->width];
+        filter_png_row(row, writer->previous_row, row_size, data + writer->window_size + (y - y0) * filtered_size);
+        memcpy(writer->previous_row, row, row_size);
+    }
+
+    s32 start = writer->window_size;
+    writer->adler = adler32_update(writer->adler, data + start, data_size - start);
+
+    byte_buffer_t out = {};
+    png_start_stream(writer, &out);
+    deflate_block(writer, &out, data, start, data_size);
+
+    s32 keep = data_size < DEFLATE_WINDOW ? data_size : DEFLATE_WINDOW;
+    memcpy(writer->window, data + data_size - keep, keep);
+    writer->window_size = keep;
+    free(data);
+
+    s32 result = write_png_chunk(writer->fp, "IDAT", out.data, (u32) out.size);
+    free(out.data);
+    return result;
+}
+
+s32 image_writer_open(image_writer_t * writer, const char * file, image_t * image, image_format format){
+    *writer = {};
+
+    if (format == ImageFormatPFM && !image->hdr) {
+        fprintf(stderr, "%s: no float data to write\n", file);
+        return -1;
+    }
+
+    FILE * fp = fopen(file, format == ImageFormatPPMAscii ? "w" : "wb");
+    if (!fp) {
+        fprintf(stderr, "%s: could not open for writing\n", file);
+        return -1;
+    }
+    return image_writer_open_stream(writer, fp, image, format);
+}
+
+// a writer over an open stream, which image_writer_close closes. pfm needs it seekable
+s32 image_writer_open_stream(image_writer_t * writer, FILE * fp, image_t * image, image_format format){
+    *writer = {};
+    writer->image = image;
+    writer->format = format;
+    writer->fp = fp;
+
+    s32 result = 0;
+    switch(format){
+        case ImageFormatPPMAscii: {
+            fprintf(writer->fp, "P3\n%d %d\n255\n", image->width, image->height);
+        } break;
+        case ImageFormatPPM: {
+            fprintf(writer->fp, "P6\n%d %d\n255\n", image->width, image->height);
+        } break;
+        case ImageFormatPFM: {
+            // negative scale marks little endian, rows are stored bottom to top
+            fprintf(writer->fp, "PF\n%d %d\n-1.0\n", image->width, image->height);
+            writer->data_offset = ftell(writer->fp);
+        } break;
+        case ImageFormatPNG: {
+            static const u8 signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+            fwrite(signature, 1, 8, writer->fp);
+
+            u8 header[13] = {};
+            put_u32_be(header, image->width);
+            put_u32_be(header + 4, image->height);
+            header[8] = 8;   // bits per channel
+            header[9] = 2;   // rgb
+            result = write_png_chunk(writer->fp, "IHDR", header, 13);
+
+            writer->adler = 1;
+            writer->window = (u8 *) malloc(DEFLATE_WINDOW);
+            writer->previous_row = (u8 *) calloc(image->width * 3, 1);
+        } break;
+    }
+
+    return result;
+}
+
+s32 image_writer_write_rows(image_writer_t * writer, s32 y0, s32 y1){
+    image_t * image = writer->image;
+    if (!writer->fp || y1 <= y0) return 0;
+
+    s32 result = 0;
+    switch(writer->format){
+        case ImageFormatPPMAscii: {
+            for(s64 i = (s64)y0 * image->width ; i < (s64)y1 * image->width ; i++){
+                fprintf(writer->fp, "%u %u %u\n", image->pixels[i].r, image->pixels[i].g, image->pixels[i].b);
+            }
+        } break;
+        case ImageFormatPPM: {
+            // pixel_t is three packed bytes, so the rows go out in one write
+            u64 size = sizeof(pixel_t) * image->width * (y1 - y0);
+            if (fwrite(&image->pixels[(s64)y0 * image->width], 1, size, writer->fp) != size) result = -1;
+        } break;
+        case ImageFormatPFM: {
+            s64 row_size = sizeof(r32) * 3 * image->width;
+            for(s32 y = y0 ; y < y1 ; y++){
+                fseek(writer->fp, writer->data_offset + row_size * (image->height - 1 - y), SEEK_SET);
+                if (fwrite(&image->hdr[(s64)y * image->width * 3], 1, row_size, writer->fp) != (u64) row_size) result = -1;
+            }
+        } break;
+        case ImageFormatPNG: {
+            result = write_png_rows(writer, y0, y1);
+        } break;
+    }
+
+    return result;
+}
+
+s32 image_writer_close(image_writer_t * writer){
+    s32 result = 0;
+    if (writer->fp) {
+        if (writer->format == ImageFormatPNG) {
+            // empty final block, then the adler32 of everything that was compressed
+            byte_buffer_t out = {};
+            png_start_stream(writer, &out);
+            put_bits(writer, &out, 1, 1);
+            put_bits(writer, &out, 1, 2);
+            put_literal_length(writer, &out, 256);
+            if (writer->bit_count > 0) put_bits(writer, &out, 0, 8 - writer->bit_count);
+
+            buffer_reserve(&out, 4);
+            put_u32_be(out.data + out.size, writer->adler);
+            out.size += 4;
+
+            result = write_png_chunk(writer->fp, "IDAT", out.data, (u32) out.size);
+            if (result == 0) result = write_png_chunk(writer->fp, "IEND", NULL, 0);
+            free(out.data);
+        }
+        if (fclose(writer->fp) != 0) result = -1;
+    }
+    free(writer->window);
+    free(writer->previous_row);
+    writer->fp = NULL;
+    writer->window = NULL;
+    writer->previous_row = NULL;
+    return result;
+}
+
+void * image_writer_thread(void * arg){
+    image_writer_t * writer = (image_writer_t *) arg;
+    s32 written = 0;
+    s32 result = 0;
+
+    pthread_mutex_lock(&writer->lock);
+    while(true){
+        while (writer->rows_ready == written && !writer->finished) {
+            pthread_cond_wait(&writer->cond, &writer->lock);
+        }
+        s32 ready = writer->rows_ready;
+        if (ready == written && writer->finished) break;
+
+        // rows below ready are final, nobody touches them while we write unlocked
+        pthread_mutex_unlock(&writer->lock);
+        if (result == 0) result = image_writer_write_rows(writer, written, ready);
+        written = ready;
+        pthread_mutex_lock(&writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return (void *)(intptr_t) result;
+}
+
+void image_writer_start_stream(image_writer_t * writer, s32 tiles_per_row){
+    writer->streaming = true;
+    writer->pending_tiles = (s32 *) malloc(sizeof(s32) * writer->image->height);
+    for(s32 y = 0 ; y < writer->image->height ; y++){
+        writer->pending_tiles[y] = tiles_per_row;
+    }
+    writer->rows_ready = 0;
+    writer->finished = false;
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    pthread_create(&writer->thread, NULL, image_writer_thread, writer);
+}
+
+void image_writer_tile_done(image_writer_t * writer, s32 y0, s32 y1){
+    if (!writer || !writer->streaming) return;
+
+    pthread_mutex_lock(&writer->lock);
+    for(s32 y = y0 ; y < y1 ; y++){
+        writer->pending_tiles[y]--;
+    }
+    s32 ready = writer->rows_ready;
+    while (ready < writer->image->height && writer->pending_tiles[ready] == 0) ready++;
+    if (ready != writer->rows_ready) {
+        writer->rows_ready = ready;
+        pthread_cond_signal(&writer->cond);
+    }
+    pthread_mutex_unlock(&writer->lock);
+}
+
+s32 image_writer_finish_stream(image_writer_t * writer){
+    pthread_mutex_lock(&writer->lock);
+    writer->finished = true;
+    pthread_cond_signal(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+
+    void * thread_result = NULL;
+    pthread_join(writer->thread, &thread_result);
+    s32 result = (s32)(intptr_t) thread_result;
+
+    // anything the workers never reported (an aborted render) goes out now
+    if (writer->rows_ready < writer->image->height && result == 0) {
+        result = image_writer_write_rows(writer, writer->rows_ready, writer->image->height);
+    }
+
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->cond);
+    free(writer->pending_tiles);
+    writer->pending_tiles = NULL;
+    writer->streaming = false;
+    return result;
+}
+
+// @note: scene files
+
+s32 load_scene(scene_t * scene, const char * file, accel_type accel){
+    char magic[8] = {};
+    FILE * fp = fopen(file, "rb");
+    if (!fp) {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    size_t read = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+
+    if (read == sizeof(magic) && !memcmp(magic, SCENE_FILE_MAGIC, sizeof(magic))) {
+        return load_scene_binary(scene, file, accel);
+    }
+    return load_scene_text(scene, file, accel);
+}
+
+static bool scene_section_valid(const scene_file_header_t * header, u64 offset, u64 size){
+    return offset % SCENE_FILE_ALIGN == 0 && offset >= sizeof(scene_file_header_t) && offset <= header->file_size && size <= header->file_size - offset;
+}
+
+static bool material_valid(const material_t & mat){
+    return mat.type == Lambertian || mat.type == Metallic || mat.type == Dielectric || mat.type == Emissive;
+}
+
+s32 load_scene_binary(scene_t * scene, const char * file, accel_type accel){
+    *scene = {};
+
+    s32 fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (u64)st.st_size < sizeof(scene_file_header_t)) {
+        fprintf(stderr, "%s: not a scene file\n", file);
+        close(fd);
+        return -1;
+    }
+
+    // private writable mapping so the arrays can be touched up in place without
+    // ever reaching the file
+    u64 mapping_size = st.st_size;
+    void * mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    return load_scene_mapping(scene, mapping, mapping_size, accel, file);
+}
+
+// the scene in a mapped scene file image, which the scene takes over. name is only used
+// in error messages
+s32 load_scene_mapping(scene_t * scene, void * mapping, u64 mapping_size, accel_type accel, const char * name){
+    *scene = {};
+    u8 * base = (u8 *) mapping;
+    const scene_file_header_t * header = (const scene_file_header_t *) base;
+
+    const char * error = NULL;
+    u64 capacity = header->sphere_capacity;
+    if (memcmp(header->magic, SCENE_FILE_MAGIC, sizeof(header->magic))) error = "bad magic";
+    else if (header->version != SCENE_FILE_VERSION) error = "unsupported version";
+    else if (header->file_size != mapping_size) error = "truncated";
+    else if (header->real_size != sizeof(real)) error = header->real_size == sizeof(r32) ? "single precision scene, rebuild with -DRT_FLOAT" : "double precision scene, rebuild without -DRT_FLOAT";
+    else if (header->material_size != sizeof(material_t) || header->node_size != sizeof(bvh_node_t)) error = "incompatible layout";
+    else if (header->sphere_count < 0 || header->material_count < 0 || header->node_count < 0) error = "bad counts";
+    else if (header->sphere_capacity != (header->sphere_count + SPHERE_SOA_PADDING - 1) / SPHERE_SOA_PADDING * SPHERE_SOA_PADDING) error = "bad sphere padding";
+    else if (header->sphere_count > 0 && header->material_count == 0) error = "no materials";
+    else if (!scene_section_valid(header, header->center_x_offset, capacity * sizeof(real)) ||
+             !scene_section_valid(header, header->center_y_offset, capacity * sizeof(real)) ||
+             !scene_section_valid(header, header->center_z_offset, capacity * sizeof(real)) ||
+             !scene_section_valid(header, header->radius_offset, capacity * sizeof(real)) ||
+             !scene_section_valid(header, header->material_index_offset, capacity * sizeof(u32)) ||
+             !scene_section_valid(header, header->materials_offset, (u64)header->material_count * sizeof(material_t)) ||
+             !scene_section_valid(header, header->camera_offset, sizeof(camera_desc_t)) ||
+             ((header->flags & SceneFileHasBVH) && !scene_section_valid(header, header->nodes_offset, (u64)header->node_count * sizeof(bvh_node_t)))) {
+        error = "section out of bounds";
+    }
+
+    if (!error) {
+        scene->spheres.center_x = (real *)(base + header->center_x_offset);
+        scene->spheres.center_y = (real *)(base + header->center_y_offset);
+        scene->spheres.center_z = (real *)(base + header->center_z_offset);
+        scene->spheres.radius = (real *)(base + header->radius_offset);
+        scene->spheres.count = header->sphere_count;
+        scene->spheres.capacity = header->sphere_capacity;
+        scene->material_index = (u32 *)(base + header->material_index_offset);
+        scene->materials = (material_t *)(base + header->materials_offset);
+        scene->material_count = header->material_count;
+        scene->camera = *(const camera_desc_t *)(base + header->camera_offset);
+
+        for(s32 i = 0 ; i < header->sphere_count && !error ; i++){
+            if (scene->material_index[i] >= (u32)header->material_count) error = "material index out of range";
+        }
+        for(s32 i = 0 ; i < header->material_count && !error ; i++){
+            if (!material_valid(scene->materials[i])) error = "unknown material type";
+        }
+    }
+
+    if (!error && (header->flags & SceneFileHasBVH) && accel == AccelBVH) {
+        const bvh_node_t * nodes = (const bvh_node_t *)(base + header->nodes_offset);
+        for(s32 i = 0 ; i < header->node_count && !error ; i++){
+            if (nodes[i].count == 0 ? 
+                (nodes[i].offset <= i + 1 || nodes[i].offset >= header->node_count || i + 1 >= header->node_count) : 
+                (nodes[i].offset < 0 || nodes[i].offset + nodes[i].count > header->sphere_count)) {
+                error = "bad bvh node";
+            }
+        }
+        if (!error) {
+            scene->accel = AccelBVH;
+            scene->bvh.nodes = (bvh_node_t *)(base + header->nodes_offset);
+            scene->bvh.node_count = header->node_count;
+            scene->bvh.index_count = header->sphere_count;
+        }
+    }
+
+    if (error) {
+        fprintf(stderr, "%s: %s\n", name, error);
+        munmap(mapping, mapping_size);
+        *scene = {};
+        return -1;
+    }
+
+    if (accel != AccelNone && scene->accel != accel) {
+        // no stored hierarchy or a compact one asked for, build it from a copy and drop the mapping
+        s32 count = header->sphere_count;
+        sphere_desc_t * spheres = (sphere_desc_t *) malloc(sizeof(sphere_desc_t) * (count > 0 ? count : 1));
+        for(s32 i = 0 ; i < count ; i++){
+            spheres[i].center = point3(scene->spheres.center_x[i], scene->spheres.center_y[i], scene->spheres.center_z[i]);
+            spheres[i].radius = scene->spheres.radius[i];
+            spheres[i].material = scene->material_index[i];
+        }
+
+        scene_t built = {};
+        built.camera = scene->camera;
+        build_scene(&built, spheres, count, scene->materials, scene->material_count, accel);
+        free(spheres);
+        munmap(mapping, mapping_size);
+        *scene = built;
+        return 0;
+    }
+
+    scene->mapping = mapping;
+    scene->mapping_size = mapping_size;
+    build_light_list(scene);
+    return 0;
 }
 
-vec3 operator - (const vec3 & a, const vec3 & b){
-    vec3 result = {
-        a.x - b.x,
-        a.y - b.y,
-        a.z - b.z,
-    };
-    return result;
+// the "key values..." pairs of a camera line, keys that are not given keep their value.
+// returns an error message or NULL
+const char * parse_camera_keys(const char * rest, camera_desc_t * camera){
+    char key[32];
+    s32 consumed = 0;
+    while (sscanf(rest, " %31s%n", key, &consumed) == 1) {
+        rest += consumed;
+        s32 values = !strcmp(key, "lookfrom") || !strcmp(key, "lookat") || !strcmp(key, "up") ? 3 : 1;
+        r64 v[3] = {};
+        s32 read = values == 3 ? 
+            sscanf(rest, "%lf %lf %lf%n", &v[0], &v[1], &v[2], &consumed) : 
+            sscanf(rest, "%lf%n", &v[0], &consumed);
+        if (read != values) return "bad camera value";
+        rest += consumed;
+
+        if (!strcmp(key, "lookfrom")) camera->lookfrom = point3(v[0], v[1], v[2]);
+        else if (!strcmp(key, "lookat")) camera->look_at = point3(v[0], v[1], v[2]);
+        else if (!strcmp(key, "up")) camera->up = vec3(v[0], v[1], v[2]);
+        else if (!strcmp(key, "vfov")) camera->vfov = v[0];
+        else if (!strcmp(key, "aperture")) camera->defocus_angle = v[0];
+        else if (!strcmp(key, "focus")) camera->focus_dist = v[0];
+        else if (!strcmp(key, "aspect")) camera->aspect_ratio = v[0];
+        else return "unknown camera key";
+    }
+    return NULL;
 }
 
-vec3 operator + (const vec3 & a, const vec3 & b) {
-    vec3 result = {
-        a.x + b.x,
-        a.y + b.y,
-        a.z + b.z,
-    };
-    return result;
+struct scene_text_material_t {
+    char name[64];
+    material_t mat;
+};
+
+struct scene_text_mesh_t {
+    char file[4096];     // resolved against the scene file's directory
+    s32 material;        // into the file's materials
+    point3 offset;
+    r64 scale;
+    s32 line_number;
+};
+
+// the index of mat in the scene's deduplicated table, which holds every declared material
+u32 scene_material_index(const scene_t * scene, const material_t & mat){
+    material_t key = canonical_material(mat);
+    u32 material = 0;
+    while (memcmp(&scene->materials[material], &key, sizeof(material_t))) material++;
+    return material;
 }
 
-vec3 operator * (const vec3  & a, r64 scale){
-    vec3 result = {
-        a.x * scale,
-        a.y * scale,
-        a.z * scale,
-    };
+struct scene_text_grid_t {
+    point3 origin;
+    r64 cell;
+    s32 nx, nz;
+    u32 seed;
+};
+
+// objects loading objects, as deep as OBJECT_MAX_DEPTH
+thread_local s32 object_depth = 0;
+
+s32 load_scene_text(scene_t * scene, const char * file, accel_type accel){
+    *scene = {};
+
+    FILE * fp = fopen(file, "r");
+    if (!fp) {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    camera_desc_t camera = default_camera_desc();
+
+    s32 sphere_count = 0, sphere_capacity = 1024;
+    sphere_desc_t * spheres = (sphere_desc_t *) malloc(sizeof(sphere_desc_t) * sphere_capacity);
+    s32 material_count = 0, material_capacity = 16;
+    scene_text_material_t * materials = (scene_text_material_t *) malloc(sizeof(scene_text_material_t) * material_capacity);
+    s32 mesh_count = 0;
+    scene_text_mesh_t * meshes = NULL;
+    s32 grid_count = 0;
+    scene_text_grid_t * grids = NULL;
+    s32 object_count = 0;
+    object_t * objects = NULL;
+    s32 instance_count = 0, instance_capacity = 0;
+    instance_t * instances = NULL;
+
+    char line[1024];
+    s32 line_number = 0;
+    const char * error = NULL;
+    while (!error && fgets(line, sizeof(line), fp)) {
+        line_number++;
+        char * comment = strchr(line, '#');
+        if (comment) *comment = 0;
+
+        char keyword[32];
+        s32 used = 0;
+        if (sscanf(line, " %31s%n", keyword, &used) != 1) continue;
+        const char * rest = line + used;
+
+        if (!strcmp(keyword, "sphere")) {
+            sphere_desc_t sphere = {};
+            char name[64];
+            r64 v[4];
+            if (sscanf(rest, "%lf %lf %lf %lf %63s", &v[0], &v[1], &v[2], &v[3], name) != 5) {
+                error = "expected: sphere x y z radius material";
+                break;
+            }
+            sphere.center = point3(v[0], v[1], v[2]);
+            sphere.radius = v[3];
+            // spheres tend to reuse the material declared last, look from the back
+            s32 m = material_count - 1;
+            while (m >= 0 && strcmp(materials[m].name, name)) m--;
+            if (m < 0) {
+                error = "undeclared material";
+                break;
+            }
+            sphere.material = m;
+
+            if (sphere_count == sphere_capacity) {
+                sphere_capacity *= 2;
+                spheres = (sphere_desc_t *) realloc(spheres, sizeof(sphere_desc_t) * sphere_capacity);
+            }
+            spheres[sphere_count++] = sphere;
+        }
+        else if (!strcmp(keyword, "material")) {
+            scene_text_material_t entry = {};
+            char type[32];
+            s32 consumed = 0;
+            if (sscanf(rest, "%63s %31s%n", entry.name, type, &consumed) != 2) {
+                error = "expected: material name type ...";
+                break;
+            }
+            rest += consumed;
+
+            material_t & mat = entry.mat;
+            r64 v[4] = {1.0, 1.0, 1.0, 1.0};
+            if (!strcmp(type, "lambertian")) {
+                mat.type = Lambertian;
+                if (sscanf(rest, "%lf %lf %lf", &v[0], &v[1], &v[2]) != 3) error = "expected: lambertian r g b";
+                mat.lambertian.albedo = color3(v[0], v[1], v[2]);
+            }
+            else if (!strcmp(type, "metallic")) {
+                mat.type = Metallic;
+                if (sscanf(rest, "%lf %lf %lf %lf", &v[0], &v[1], &v[2], &v[3]) != 4) error = "expected: metallic r g b fuzz";
+                mat.metallic.albedo = color3(v[0], v[1], v[2]);
+                mat.metallic.fuzziness = v[3];
+            }
+            else if (!strcmp(type, "dielectric")) {
+                mat.type = Dielectric;
+                s32 read = sscanf(rest, "%lf %lf %lf %lf", &v[3], &v[0], &v[1], &v[2]);
+                if (read != 1 && read != 4) error = "expected: dielectric ior [r g b]";
+                mat.dielectric.refractive = v[3];
+                mat.dielectric.albedo = color3(v[0], v[1], v[2]);
+            }
+            else if (!strcmp(type, "emissive")) {
+                mat.type = Emissive;
+                if (sscanf(rest, "%lf %lf %lf", &v[0], &v[1], &v[2]) != 3) error = "expected: emissive r g b";
+                mat.emissive.radiance = color3(v[0], v[1], v[2]);
+            }
+            else {
+                error = "unknown material type";
+            }
+            if (error) break;
+
+            if (material_count == material_capacity) {
+                material_capacity *= 2;
+                materials = (scene_text_material_t *) realloc(materials, sizeof(scene_text_material_t) * material_capacity);
+            }
+            materials[material_count++] = entry;
+        }
+        else if (!strcmp(keyword, "camera")) {
+            error = parse_camera_keys(rest, &camera);
+        }
+        else if (!strcmp(keyword, "mesh")) {
+            // loaded once the materials are final, the lines are few
+            scene_text_mesh_t entry = {};
+            char path[2048], name[64];
+            r64 v[4] = {0.0, 0.0, 0.0, 1.0};
+            s32 read = sscanf(rest, "%2047s %63s %lf %lf %lf %lf", path, name, &v[0], &v[1], &v[2], &v[3]);
+            if (read != 2 && read != 5 && read != 6) {
+                error = "expected: mesh file material [x y z [scale]]";
+                break;
+            }
+            s32 m = material_count - 1;
+            while (m >= 0 && strcmp(materials[m].name, name)) m--;
+            if (m < 0) {
+                error = "undeclared material";
+                break;
+            }
+            const char * slash = strrchr(file, '/');
+            if (path[0] == '/' || !slash) snprintf(entry.file, sizeof(entry.file), "%s", path);
+            else snprintf(entry.file, sizeof(entry.file), "%.*s/%s", (s32)(slash - file), file, path);
+            entry.material = m;
+            entry.offset = point3(v[0], v[1], v[2]);
+            entry.scale = v[3];
+            entry.line_number = line_number;
+
+            meshes = (scene_text_mesh_t *) realloc(meshes, sizeof(scene_text_mesh_t) * (mesh_count + 1));
+            meshes[mesh_count++] = entry;
+        }
+        else if (!strcmp(keyword, "grid")) {
+            scene_text_grid_t entry = {};
+            r64 v[4] = {0.0, 0.0, 0.0, 1.0};
+            s32 read = sscanf(rest, "%lf %lf %lf %d %d %lf %u", &v[0], &v[1], &v[2], &entry.nx, &entry.nz, &v[3], &entry.seed);
+            if (read != 5 && read != 6 && read != 7) {
+                error = "expected: grid x y z nx nz [cell [seed]]";
+                break;
+            }
+            if (entry.nx < 1 || entry.nz < 1 || !(v[3] > 0.0)) {
+                error = "grid counts and cell must be positive";
+                break;
+            }
+            entry.origin = point3(v[0], v[1], v[2]);
+            entry.cell = v[3];
+
+            grids = (scene_text_grid_t *) realloc(grids, sizeof(scene_text_grid_t) * (grid_count + 1));
+            grids[grid_count++] = entry;
+        }
+        else if (!strcmp(keyword, "object")) {
+            object_t entry = {};
+            char path[2048];
+            if (sscanf(rest, "%63s %2047s", entry.name, path) != 2) {
+                error = "expected: object name file";
+                break;
+            }
+            if (object_depth >= OBJECT_MAX_DEPTH) {
+                error = "objects nest too deep";
+                break;
+            }
+            const char * slash = strrchr(file, '/');
+            char resolved[4096];
+            if (path[0] == '/' || !slash) snprintf(resolved, sizeof(resolved), "%s", path);
+            else snprintf(resolved, sizeof(resolved), "%.*s/%s", (s32)(slash - file), file, path);
+            entry.file = realpath(resolved, NULL);
+            if (!entry.file) entry.file = strdup(resolved);
+
+            entry.scene = (scene_t *) calloc(1, sizeof(scene_t));
+            object_depth++;
+            s32 loaded = load_scene(entry.scene, entry.file, accel);
+            object_depth--;
+            if (loaded != 0) {
+                free(entry.scene);
+                free(entry.file);
+                error = "object failed to load";
+                break;
+            }
+
+            objects = (object_t *) realloc(objects, sizeof(object_t) * (object_count + 1));
+            objects[object_count++] = entry;
+        }
+        else if (!strcmp(keyword, "instance")) {
+            char name[64];
+            r64 v[5] = {0.0, 0.0, 0.0, 1.0, 0.0};
+            s32 read = sscanf(rest, "%63s %lf %lf %lf %lf %lf", name, &v[0], &v[1], &v[2], &v[3], &v[4]);
+            if (read != 4 && read != 5 && read != 6) {
+                error = "expected: instance object x y z [scale [yaw]]";
+                break;
+            }
+            if (!(v[3] > 0.0)) {
+                error = "instance scale must be positive";
+                break;
+            }
+            s32 o = object_count - 1;
+            while (o >= 0 && strcmp(objects[o].name, name)) o--;
+            if (o < 0) {
+                error = "undeclared object";
+                break;
+            }
+
+            if (instance_count == instance_capacity) {
+                instance_capacity = instance_capacity > 0 ? instance_capacity * 2 : 64;
+                instances = (instance_t *) realloc(instances, sizeof(instance_t) * instance_capacity);
+            }
+            instances[instance_count++] = create_instance(o, point3(v[0], v[1], v[2]), v[3], v[4]);
+        }
+        else {
+            error = "unknown keyword";
+        }
+    }
+    fclose(fp);
+
+    if (!error && camera.aspect_ratio <= 0.0) error = "aspect must be positive";
+    if (error) {
+        fprintf(stderr, "%s:%d: %s\n", file, line_number, error);
+        for(s32 o = 0 ; o < object_count ; o++){
+            destroy_scene(objects[o].scene);
+            free(objects[o].scene);
+            free(objects[o].file);
+        }
+        free(spheres);
+        free(materials);
+        free(meshes);
+        free(grids);
+        free(objects);
+        free(instances);
+        return -1;
+    }
+
+    // the grid palettes and the objects' materials go into the table with the file's own
+    s32 table_count = material_count + grid_count * GRID_PALETTE_SIZE;
+    for(s32 o = 0 ; o < object_count ; o++){
+        table_count += objects[o].scene->material_count;
+    }
+    material_t * table = (material_t *) malloc(sizeof(material_t) * (table_count > 0 ? table_count : 1));
+    s32 table_used = 0;
+    for(s32 i = 0 ; i < material_count ; i++){
+        table[table_used++] = materials[i].mat;
+    }
+    for(s32 g = 0 ; g < grid_count ; g++){
+        grid_palette(grids[g].seed, &table[table_used]);
+        table_used += GRID_PALETTE_SIZE;
+    }
+    for(s32 o = 0 ; o < object_count ; o++){
+        memcpy(&table[table_used], objects[o].scene->materials, sizeof(material_t) * objects[o].scene->material_count);
+        table_used += objects[o].scene->material_count;
+    }
+
+    scene->camera = camera;
+    build_scene(scene, spheres, sphere_count, table, table_count, accel);
+
+    if (grid_count > 0) scene->grids = (sphere_grid_t *) malloc(sizeof(sphere_grid_t) * grid_count);
+    for(s32 g = 0 ; g < grid_count ; g++){
+        sphere_grid_t * grid = &scene->grids[g];
+        create_sphere_grid(grid, grids[g].origin, grids[g].cell, grids[g].nx, grids[g].nz, grids[g].seed);
+        for(s32 k = 0 ; k < GRID_PALETTE_SIZE ; k++){
+            grid->palette[k] = scene_material_index(scene, table[material_count + g * GRID_PALETTE_SIZE + k]);
+        }
+        scene->grid_count++;
+        fprintf(stderr, "grid: %d x %d spheres from %d bytes\n", grid->nx, grid->nz, (s32) sizeof(sphere_grid_t));
+    }
+
+    scene->objects = objects;
+    scene->object_count = object_count;
+    for(s32 o = 0 ; o < object_count ; o++){
+        const scene_t * object = objects[o].scene;
+        objects[o].material_remap = (u32 *) malloc(sizeof(u32) * (object->material_count > 0 ? object->material_count : 1));
+        for(s32 m = 0 ; m < object->material_count ; m++){
+            objects[o].material_remap[m] = scene_material_index(scene, object->materials[m]);
+        }
+    }
+    scene->instances = instances;
+    scene->instance_count = instance_count;
+    if (instance_count > 0) {
+        build_instance_bvh(scene);
+        fprintf(stderr, "instances: %d of %d objects\n", scene->instance_count, object_count);
+    }
+
+    s32 result = 0;
+    if (mesh_count > 0) scene->meshes = (mesh_t *) calloc(mesh_count, sizeof(mesh_t));
+    for(s32 i = 0 ; i < mesh_count && result == 0 ; i++){
+        u32 material = scene_material_index(scene, materials[meshes[i].material].mat);
+        const char * mesh_error = load_mesh(&scene->meshes[i], meshes[i].file, meshes[i].offset, meshes[i].scale, material);
+        if (mesh_error) {
+            fprintf(stderr, "%s:%d: %s: %s\n", file, meshes[i].line_number, meshes[i].file, mesh_error);
+            result = -1;
+            break;
+        }
+        scene->mesh_count++;
+    }
+
+    free(spheres);
+    free(materials);
+    free(meshes);
+    free(grids);
+    free(table);
+    if (result != 0) destroy_scene(scene);
     return result;
 }
 
-vec3 operator * (const vec3 & b, const vec3 & a){
-    vec3 result = {
-        a.x * b.x,
-        a.y * b.y,
-        a.z * b.z,
-    };
-    return result;
+static u64 scene_file_section(u64 * cursor, u64 size){
+    u64 offset = (*cursor + SCENE_FILE_ALIGN - 1) / SCENE_FILE_ALIGN * SCENE_FILE_ALIGN;
+    *cursor = offset + size;
+    return offset;
 }
 
+static bool scene_file_write_at(FILE * fp, u64 offset, const void * data, u64 size){
+    return fseek(fp, (long)offset, SEEK_SET) == 0 && fwrite(data, 1, size, fp) == size;
+}
 
-vec3 operator * (const r64 & scale, vec3 a){
-    vec3 result = {
-        a.x * scale,
-        a.y * scale,
-        a.z * scale,
-    };
-    return result;
+// the binary scene file into fp, which has to be seekable
+bool write_scene_binary(const scene_t * scene, FILE * fp){
+    if (scene_has_shapes(scene)) {
+        fprintf(stderr, "binary scene files hold only spheres, save meshes, grids and instances as .txt\n");
+        return false;
+    }
+    if (scene->accel == AccelCompact) {
+        // files hold plain sphere arrays, of the spheres as they decode
+        sphere_desc_t * spheres = scene_sphere_descs(scene);
+        scene_t flat = {};
+        flat.camera = scene->camera;
+        build_scene(&flat, spheres, scene->spheres.count, scene->materials, scene->material_count, AccelNone);
+        bool ok = write_scene_binary(&flat, fp);
+        destroy_scene(&flat);
+        free(spheres);
+        return ok;
+    }
+
+    scene_file_header_t header = {};
+    memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic));
+    header.version = SCENE_FILE_VERSION;
+    header.flags = scene->accel == AccelBVH ? SceneFileHasBVH : 0;
+    header.sphere_count = scene->spheres.count;
+    header.sphere_capacity = scene->spheres.capacity;
+    header.material_count = scene->material_count;
+    header.node_count = scene->accel == AccelBVH ? scene->bvh.node_count : 0;
+    header.material_size = sizeof(material_t);
+    header.node_size = sizeof(bvh_node_t);
+    header.real_size = sizeof(real);
+
+    u64 capacity = scene->spheres.capacity;
+    u64 cursor = sizeof(header);
+    header.center_x_offset = scene_file_section(&cursor, capacity * sizeof(real));
+    header.center_y_offset = scene_file_section(&cursor, capacity * sizeof(real));
+    header.center_z_offset = scene_file_section(&cursor, capacity * sizeof(real));
+    header.radius_offset = scene_file_section(&cursor, capacity * sizeof(real));
+    header.material_index_offset = scene_file_section(&cursor, capacity * sizeof(u32));
+    header.materials_offset = scene_file_section(&cursor, (u64)scene->material_count * sizeof(material_t));
+    header.camera_offset = scene_file_section(&cursor, sizeof(camera_desc_t));
+    header.nodes_offset = scene_file_section(&cursor, (u64)header.node_count * sizeof(bvh_node_t));
+    header.file_size = cursor;
+
+    bool ok = 
+        scene_file_write_at(fp, 0, &header, sizeof(header)) && 
+        scene_file_write_at(fp, header.center_x_offset, scene->spheres.center_x, capacity * sizeof(real)) && 
+        scene_file_write_at(fp, header.center_y_offset, scene->spheres.center_y, capacity * sizeof(real)) && 
+        scene_file_write_at(fp, header.center_z_offset, scene->spheres.center_z, capacity * sizeof(real)) && 
+        scene_file_write_at(fp, header.radius_offset, scene->spheres.radius, capacity * sizeof(real)) && 
+        scene_file_write_at(fp, header.material_index_offset, scene->material_index, capacity * sizeof(u32)) && 
+        scene_file_write_at(fp, header.materials_offset, scene->materials, (u64)scene->material_count * sizeof(material_t)) && 
+        scene_file_write_at(fp, header.camera_offset, &scene->camera, sizeof(camera_desc_t)) && 
+        scene_file_write_at(fp, header.nodes_offset, scene->bvh.nodes, (u64)header.node_count * sizeof(bvh_node_t));
+
+    // pad to file_size in case the last section is empty
+    if (ok && fseek(fp, 0, SEEK_END) == 0 && (u64)ftell(fp) < header.file_size) {
+        ok = fseek(fp, (long)header.file_size - 1, SEEK_SET) == 0 && fputc(0, fp) != EOF;
+    }
+    return ok;
 }
 
-vec3 operator / (const vec3  & a, r64 scale){
-    vec3 result = {
-        a.x / scale,
-        a.y / scale,
-        a.z / scale,
-    };
-    return result;
+s32 save_scene_binary(const scene_t * scene, const char * file){
+    FILE * fp = fopen(file, "wb");
+    if (!fp) {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    bool ok = write_scene_binary(scene, fp);
+    if (fclose(fp) != 0) ok = false;
+
+    if (!ok) {
+        fprintf(stderr, "%s: write failed\n", file);
+        return -1;
+    }
+    return 0;
 }
 
-vec3 cross(const vec3 & a, const vec3 & b) {
-    vec3 result = {};
-    result.x = a.y * b.z - a.z * b.y;
-    result.y = a.z * b.x - a.x * b.z;
-    result.z = a.x * b.y - a.y * b.x;
-    return result;
+s32 save_scene_text(const scene_t * scene, const char * file){
+    FILE * fp = fopen(file, "w");
+    if (!fp) {
+        fprintf(stderr, "%s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    const camera_desc_t & c = scene->camera;
+    fprintf(fp, "camera lookfrom %.17g %.17g %.17g lookat %.17g %.17g %.17g up %.17g %.17g %.17g vfov %.17g aperture %.17g focus %.17g aspect %.17g\n", 
+        c.lookfrom.x, c.lookfrom.y, c.lookfrom.z, c.look_at.x, c.look_at.y, c.look_at.z, c.up.x, c.up.y, c.up.z, 
+        c.vfov, c.defocus_angle, c.focus_dist, c.aspect_ratio);
+
+    for(s32 i = 0 ; i < scene->material_count ; i++){
+        const material_t & mat = scene->materials[i];
+        switch(mat.type){
+            case Lambertian:
+                fprintf(fp, "material m%d lambertian %.17g %.17g %.17g\n", i, mat.lambertian.albedo.r, mat.lambertian.albedo.g, mat.lambertian.albedo.b);
+                break;
+            case Metallic:
+                fprintf(fp, "material m%d metallic %.17g %.17g %.17g %.17g\n", i, mat.metallic.albedo.r, mat.metallic.albedo.g, mat.metallic.albedo.b, mat.metallic.fuzziness);
+                break;
+            case Dielectric:
+                fprintf(fp, "material m%d dielectric %.17g %.17g %.17g %.17g\n", i, mat.dielectric.refractive, mat.dielectric.albedo.r, mat.dielectric.albedo.g, mat.dielectric.albedo.b);
+                break;
+            case Emissive:
+                fprintf(fp, "material m%d emissive %.17g %.17g %.17g\n", i, mat.emissive.radiance.r, mat.emissive.radiance.g, mat.emissive.radiance.b);
+                break;
+            default:
+                break;
+        }
+    }
+
+    for(s32 i = 0 ; i < scene->spheres.count ; i++){
+        point3 center = scene_sphere_center(scene, i);
+        fprintf(fp, "sphere %.17g %.17g %.17g %.17g m%u\n", 
+            center.x, center.y, center.z, scene_sphere_radius(scene, i), scene_sphere_material(scene, i));
+    }
+
+    for(s32 i = 0 ; i < scene->mesh_count ; i++){
+        const mesh_t & mesh = scene->meshes[i];
+        fprintf(fp, "mesh %s m%u %.17g %.17g %.17g %.17g\n", 
+            mesh.file, mesh.material, mesh.offset.x, mesh.offset.y, mesh.offset.z, mesh.scale);
+    }
+
+    // palettes come back from the seeds, the materials above already hold them
+    for(s32 i = 0 ; i < scene->grid_count ; i++){
+        const sphere_grid_t & grid = scene->grids[i];
+        fprintf(fp, "grid %.17g %.17g %.17g %d %d %.17g %u\n", 
+            grid.origin.x, grid.origin.y, grid.origin.z, grid.nx, grid.nz, grid.cell, grid.seed);
+    }
+
+    for(s32 i = 0 ; i < scene->object_count ; i++){
+        fprintf(fp, "object %s %s\n", scene->objects[i].name, scene->objects[i].file);
+    }
+    for(s32 i = 0 ; i < scene->instance_count ; i++){
+        const instance_t & instance = scene->instances[i];
+        fprintf(fp, "instance %s %.17g %.17g %.17g %.17g %.17g\n", scene->objects[instance.object].name, 
+            instance.offset.x, instance.offset.y, instance.offset.z, instance.scale, instance.yaw);
+    }
+
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "%s: write failed\n", file);
+        return -1;
+    }
+    return 0;
 }
 
-r64 lengthsq(const vec3 & v) {
-    return (v.x * v.x + v.y * v.y + v.z * v.z);
+// @note: mesh files
+// obj and binary ply meshes are read from a read-only mapping in two passes: the first
+// counts vertices and triangles, the second parses straight into arrays of exactly that
+// size, so a load allocates the mesh and nothing per vertex or face. polygons are split
+// into fans. from obj only v and f lines are read, from ply the x, y, z of the vertex
+// element and the vertex_indices list of the face element
+
+struct mapped_file_t {
+    const char * data;
+    u64 size;
+};
+
+static bool map_file(mapped_file_t * mapped, const char * file){
+    *mapped = {};
+    s32 fd = open(file, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        errno = st.st_size == 0 ? EINVAL : errno;
+        return false;
+    }
+    void * mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return false;
+
+    madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+    mapped->data = (const char *) mapping;
+    mapped->size = st.st_size;
+    return true;
 }
 
-r64 length(const vec3 & v){
-    return sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+static void unmap_file(mapped_file_t * mapped){
+    if (mapped->data) munmap((void *) mapped->data, mapped->size);
+    *mapped = {};
 }
 
-vec3 normalize(const vec3 & val){
-    if (length(val) == 0) {
-        return vec3(0.0, 0.0, 0.0);
+static inline bool mesh_space(char c){
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// a decimal number at *p, which moves past it. no locale and no terminator needed
+static bool parse_mesh_number(const char ** p, const char * end, r64 * value){
+    const char * s = *p;
+    while (s < end && mesh_space(*s)) s++;
+
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) negative = *s++ == '-';
+
+    u64 mantissa = 0;
+    s32 exponent = 0, digits = 0;
+    for(; s < end && *s >= '0' && *s <= '9' ; s++, digits++){
+        if (mantissa < 1000000000000000000ull) mantissa = mantissa * 10 + (*s - '0');
+        else exponent++;
     }
-    return val/ length(val);
+    if (s < end && *s == '.') {
+        for(s++ ; s < end && *s >= '0' && *s <= '9' ; s++, digits++){
+            if (mantissa < 1000000000000000000ull) {
+                mantissa = mantissa * 10 + (*s - '0');
+                exponent--;
+            }
+        }
+    }
+    if (digits == 0) return false;
+
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        const char * e = s + 1;
+        bool e_negative = false;
+        if (e < end && (*e == '-' || *e == '+')) e_negative = *e++ == '-';
+        s32 e_value = 0;
+        if (e < end && *e >= '0' && *e <= '9') {
+            for(; e < end && *e >= '0' && *e <= '9' ; e++) {
+                if (e_value < 10000) e_value = e_value * 10 + (*e - '0');
+            }
+            exponent += e_negative ? -e_value : e_value;
+            s = e;
+        }
+    }
+
+    static const r64 powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    r64 result = (r64) mantissa;
+    if (exponent >= 0) result = exponent <= 22 ? result * powers[exponent] : result * pow(10.0, exponent);
+    else result = exponent >= -22 ? result / powers[-exponent] : result * pow(10.0, exponent);
+
+    *value = negative ? -result : result;
+    *p = s;
+    return true;
 }
 
+static bool parse_mesh_integer(const char ** p, const char * end, s64 * value){
+    const char * s = *p;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) negative = *s++ == '-';
+    if (s == end || *s < '0' || *s > '9') return false;
 
-r64 dot(const vec3 & a, const vec3 & b) {
-    return (a.x * b.x + a.y * b.y + a.z * b.z);
+    s64 result = 0;
+    for(; s < end && *s >= '0' && *s <= '9' ; s++){
+        if (result < ((s64)1 << 40)) result = result * 10 + (*s - '0');
+    }
+    *value = negative ? -result : result;
+    *p = s;
+    return true;
 }
 
+// the vertex of an obj face corner "v", "v/t", "v//n" or "v/t/n", negative counts back
+// from the vertices read so far. *p moves past the corner
+static bool parse_obj_corner(const char ** p, const char * end, s64 vertices_so_far, s64 vertex_count, u32 * index){
+    s64 v = 0;
+    if (!parse_mesh_integer(p, end, &v) || v == 0) return false;
+    while (*p < end && !mesh_space(**p) && **p != '\n') (*p)++;
+
+    s64 resolved = v > 0 ? v - 1 : vertices_so_far + v;
+    if (resolved < 0 || resolved >= vertex_count) return false;
+    *index = (u32) resolved;
+    return true;
+}
 
-s32 create_image(image_t * image, s32 width, s32 height, u32 color){
-    const u64 MASK = 255;
-    s32 result = 0;
-    image->pixels = (pixel_t *) malloc(sizeof(pixel_t) * width * height);
-    for(s64 i = 0 ; i < width * height ; i++) {
-        image->pixels[i].r = (color >> 16) & MASK ;
-        image->pixels[i].g = (color >> 8) &  MASK ;
-        image->pixels[i].b = (color) & MASK ;
+static const char * load_obj(mesh_t * mesh, const mapped_file_t * mapped){
+    const char * begin = mapped->data;
+    const char * end = mapped->data + mapped->size;
+
+    s64 vertex_count = 0, triangle_count = 0;
+    for(const char * line = begin ; line < end ; ){
+        const char * next = (const char *) memchr(line, '\n', end - line);
+        next = next ? next + 1 : end;
+        // a comment runs to the end of the line, also after a face or vertex
+        const char * stop = (const char *) memchr(line, '#', next - line);
+        if (!stop) stop = next;
+
+        const char * s = line;
+        while (s < stop && mesh_space(*s)) s++;
+        if (stop - s > 2 && s[0] == 'v' && mesh_space(s[1])) {
+            vertex_count++;
+        }
+        else if (stop - s > 2 && s[0] == 'f' && mesh_space(s[1])) {
+            s32 corners = 0;
+            for(s++ ; s < stop ; ){
+                while (s < stop && (mesh_space(*s) || *s == '\n')) s++;
+                if (s == stop) break;
+                corners++;
+                while (s < stop && !mesh_space(*s) && *s != '\n') s++;
+            }
+            if (corners >= 3) triangle_count += corners - 2;
+        }
+        line = next;
     }
-    image->width = width;
-    image->height = height;
-    return result;
+    if (vertex_count > INT32_MAX || triangle_count > INT32_MAX / 3) return "too many vertices or faces";
+    if (triangle_count == 0) return "no faces";
+
+    mesh->vertex_count = (s32) vertex_count;
+    mesh->triangle_count = (s32) triangle_count;
+    mesh->positions = (r32 *) malloc(sizeof(r32) * 3 * vertex_count);
+    mesh->triangles = (u32 *) malloc(sizeof(u32) * 3 * triangle_count);
+
+    s64 vertex = 0, triangle = 0;
+    for(const char * line = begin ; line < end ; ){
+        const char * next = (const char *) memchr(line, '\n', end - line);
+        next = next ? next + 1 : end;
+        const char * stop = (const char *) memchr(line, '#', next - line);
+        if (!stop) stop = next;
+
+        const char * s = line;
+        while (s < stop && mesh_space(*s)) s++;
+        if (stop - s > 2 && s[0] == 'v' && mesh_space(s[1])) {
+            s++;
+            r64 v[3];
+            for(s32 k = 0 ; k < 3 ; k++){
+                if (!parse_mesh_number(&s, stop, &v[k])) return "bad vertex";
+                mesh->positions[3 * vertex + k] = (r32) v[k];
+            }
+            vertex++;
+        }
+        else if (stop - s > 2 && s[0] == 'f' && mesh_space(s[1])) {
+            s++;
+            u32 first = 0, previous = 0;
+            for(s32 corner = 0 ; ; corner++){
+                while (s < stop && mesh_space(*s)) s++;
+                if (s == stop || *s == '\n') break;
+                u32 index = 0;
+                // indices can only point at vertices that were read before the face
+                if (!parse_obj_corner(&s, stop, vertex, vertex, &index)) return "bad face index";
+                if (corner == 0) first = index;
+                else if (corner >= 2) {
+                    u32 * tri = &mesh->triangles[3 * triangle++];
+                    tri[0] = first;
+                    tri[1] = previous;
+                    tri[2] = index;
+                }
+                previous = index;
+            }
+        }
+        line = next;
+    }
+    return NULL;
 }
 
-s32 write_image(const char * file, image_t * image) {
-    s32 result = 0;
-    FILE * fp = fopen(file, "w");
-    if (!fp) {
-        result = -1;
-        goto return_image_write_result;
+enum ply_type {
+    PlyNone, PlyInt8, PlyUInt8, PlyInt16, PlyUInt16, PlyInt32, PlyUInt32, PlyFloat32, PlyFloat64,
+};
+
+static const s32 PLY_TYPE_SIZE[] = {0, 1, 1, 2, 2, 4, 4, 4, 8};
+
+static ply_type parse_ply_type(const char * name){
+    if (!strcmp(name, "char") || !strcmp(name, "int8")) return PlyInt8;
+    if (!strcmp(name, "uchar") || !strcmp(name, "uint8")) return PlyUInt8;
+    if (!strcmp(name, "short") || !strcmp(name, "int16")) return PlyInt16;
+    if (!strcmp(name, "ushort") || !strcmp(name, "uint16")) return PlyUInt16;
+    if (!strcmp(name, "int") || !strcmp(name, "int32")) return PlyInt32;
+    if (!strcmp(name, "uint") || !strcmp(name, "uint32")) return PlyUInt32;
+    if (!strcmp(name, "float") || !strcmp(name, "float32")) return PlyFloat32;
+    if (!strcmp(name, "double") || !strcmp(name, "float64")) return PlyFloat64;
+    return PlyNone;
+}
+
+static r64 read_ply_value(const u8 * p, ply_type type, bool swap){
+    u8 bytes[8];
+    s32 size = PLY_TYPE_SIZE[type];
+    for(s32 i = 0 ; i < size ; i++) bytes[i] = p[swap ? size - 1 - i : i];
+    switch(type){
+        case PlyInt8: { s8 v; memcpy(&v, bytes, 1); return v; }
+        case PlyUInt8: return bytes[0];
+        case PlyInt16: { s16 v; memcpy(&v, bytes, 2); return v; }
+        case PlyUInt16: { u16 v; memcpy(&v, bytes, 2); return v; }
+        case PlyInt32: { s32 v; memcpy(&v, bytes, 4); return v; }
+        case PlyUInt32: { u32 v; memcpy(&v, bytes, 4); return v; }
+        case PlyFloat32: { r32 v; memcpy(&v, bytes, 4); return v; }
+        case PlyFloat64: { r64 v; memcpy(&v, bytes, 8); return v; }
+        default: return 0.0;
+    }
+}
+
+const s32 PLY_MAX_PROPERTIES = 32;
+const s32 PLY_MAX_ELEMENTS = 8;
+
+struct ply_element_t {
+    char name[32];
+    s64 count;
+    s32 property_count;
+    ply_type types[PLY_MAX_PROPERTIES];        // value type, or index type of a list
+    ply_type list_counts[PLY_MAX_PROPERTIES];  // PlyNone for a plain property
+    char names[PLY_MAX_PROPERTIES][32];
+};
+
+// bytes of property k of an item, p pointing at the property
+static s64 ply_property_size(const ply_element_t * element, s32 k, const u8 * p, bool swap){
+    if (element->list_counts[k] == PlyNone) return PLY_TYPE_SIZE[element->types[k]];
+    s64 n = (s64) read_ply_value(p, element->list_counts[k], swap);
+    return PLY_TYPE_SIZE[element->list_counts[k]] + n * PLY_TYPE_SIZE[element->types[k]];
+}
+
+// bytes of one item of the element at p, -1 when it runs past end
+static s64 ply_item_size(const ply_element_t * element, const u8 * p, const u8 * end, bool swap){
+    s64 size = 0;
+    for(s32 k = 0 ; k < element->property_count ; k++){
+        if (element->list_counts[k] == PlyNone) {
+            size += PLY_TYPE_SIZE[element->types[k]];
+            continue;
+        }
+        if (p + size + PLY_TYPE_SIZE[element->list_counts[k]] > end) return -1;
+        s64 n = (s64) read_ply_value(p + size, element->list_counts[k], swap);
+        if (n < 0) return -1;
+        size += PLY_TYPE_SIZE[element->list_counts[k]] + n * PLY_TYPE_SIZE[element->types[k]];
     }
-    fprintf(fp, "P3\n%d %d\n255\n", image->width, image->height);
-    for(s64 i = 0 ; i < image->width * image->height; i++){
-        fprintf(fp, "%u %u %u\n", image->pixels[i].r, image->pixels[i].g, image->pixels[i].b);
+    return p + size <= end ? size : -1;
+}
+
+static const char * load_ply(mesh_t * mesh, const mapped_file_t * mapped){
+    const char * end = mapped->data + mapped->size;
+    const char * header_end = NULL;
+    for(const char * s = mapped->data ; s + 10 <= end && !header_end ; ){
+        const char * next = (const char *) memchr(s, '\n', end - s);
+        if (!next) break;
+        if (!strncmp(s, "end_header", 10)) header_end = next + 1;
+        s = next + 1;
     }
-    fclose(fp);
+    if (!header_end) return "no end_header";
+
+    bool swap = false, format = false;
+    ply_element_t elements[PLY_MAX_ELEMENTS];
+    s32 element_count = 0;
+    for(const char * s = mapped->data ; s < header_end ; ){
+        const char * next = (const char *) memchr(s, '\n', header_end - s) + 1;
+        char line[256] = {};
+        memcpy(line, s, minimum((s64)(next - s), (s64) sizeof(line) - 1));
+        s = next;
+
+        char word[3][32] = {};
+        s32 words = sscanf(line, "%31s %31s %31s", word[0], word[1], word[2]);
+        if (words < 1) continue;
+        if (!strcmp(word[0], "format")) {
+            if (!strcmp(word[1], "binary_little_endian")) swap = false;
+            else if (!strcmp(word[1], "binary_big_endian")) swap = true;
+            else return "only binary ply is read";
+            format = true;
+        }
+        else if (!strcmp(word[0], "element")) {
+            if (element_count == PLY_MAX_ELEMENTS) return "too many elements";
+            ply_element_t * element = &elements[element_count++];
+            *element = {};
+            long long count = -1;
+            if (sscanf(line, "element %31s %lld", element->name, &count) != 2 || count < 0) return "bad element";
+            element->count = count;
+        }
+        else if (!strcmp(word[0], "property")) {
+            if (element_count == 0) return "property before element";
+            ply_element_t * element = &elements[element_count - 1];
+            if (element->property_count == PLY_MAX_PROPERTIES) return "too many properties";
+            s32 k = element->property_count++;
+            if (!strcmp(word[1], "list")) {
+                char index_type[32], name[32];
+                if (sscanf(line, "property list %*s %31s %31s", index_type, name) != 2) return "bad list property";
+                element->list_counts[k] = parse_ply_type(word[2]);
+                element->types[k] = parse_ply_type(index_type);
+                memcpy(element->names[k], name, sizeof(name));
+                if (element->list_counts[k] == PlyNone || element->types[k] == PlyNone) return "unknown property type";
+            }
+            else {
+                element->list_counts[k] = PlyNone;
+                element->types[k] = parse_ply_type(word[1]);
+                memcpy(element->names[k], word[2], sizeof(word[2]));
+                if (element->types[k] == PlyNone) return "unknown property type";
+            }
+        }
+    }
+    if (!format) return "no format";
+
+    const u8 * data = (const u8 *) header_end;
+    const u8 * data_end = (const u8 *) end;
+    const ply_element_t * vertices = NULL;
+    const ply_element_t * faces = NULL;
+    const u8 * vertex_data = NULL;
+    const u8 * face_data = NULL;
+    s32 position[3] = {-1, -1, -1};
+    s32 indices = -1;
+
+    // first pass: where every element starts, and the triangles of the faces
+    s64 triangle_count = 0;
+    const u8 * p = data;
+    for(s32 e = 0 ; e < element_count ; e++){
+        const ply_element_t * element = &elements[e];
+        bool fixed = true;
+        for(s32 k = 0 ; k < element->property_count ; k++) fixed = fixed && element->list_counts[k] == PlyNone;
+
+        if (!strcmp(element->name, "vertex")) {
+            vertices = element;
+            vertex_data = p;
+            for(s32 k = 0 ; k < element->property_count ; k++){
+                for(s32 axis = 0 ; axis < 3 ; axis++){
+                    if (element->list_counts[k] == PlyNone && element->names[k][0] == "xyz"[axis] && element->names[k][1] == 0) position[axis] = k;
+                }
+            }
+            if (!fixed) return "vertex element with a list";
+        }
+        if (!strcmp(element->name, "face")) {
+            faces = element;
+            face_data = p;
+            for(s32 k = 0 ; k < element->property_count ; k++){
+                if (element->list_counts[k] != PlyNone && 
+                    (!strcmp(element->names[k], "vertex_indices") || !strcmp(element->names[k], "vertex_index"))) indices = k;
+            }
+        }
 
-return_image_write_result:
-    return result;
+        if (fixed) {
+            s64 item = ply_item_size(element, p, data_end, swap);
+            if (item < 0 || item * element->count > data_end - p) return "truncated";
+            p += item * element->count;
+            continue;
+        }
+        for(s64 i = 0 ; i < element->count ; i++){
+            s64 item = ply_item_size(element, p, data_end, swap);
+            if (item < 0) return "truncated";
+            if (element == faces && indices >= 0) {
+                // the list's count sits after the plain properties before it
+                const u8 * q = p;
+                for(s32 k = 0 ; k < indices ; k++) q += ply_property_size(element, k, q, swap);
+                s64 n = (s64) read_ply_value(q, element->list_counts[indices], swap);
+                if (n >= 3) triangle_count += n - 2;
+            }
+            p += item;
+        }
+    }
+    if (!vertices || position[0] < 0 || position[1] < 0 || position[2] < 0) return "no vertex x, y, z";
+    if (!faces || indices < 0) return "no face vertex_indices";
+    if (vertices->count > INT32_MAX || triangle_count > INT32_MAX / 3) return "too many vertices or faces";
+    if (triangle_count == 0) return "no faces";
+
+    mesh->vertex_count = (s32) vertices->count;
+    mesh->triangle_count = (s32) triangle_count;
+    mesh->positions = (r32 *) malloc(sizeof(r32) * 3 * vertices->count);
+    mesh->triangles = (u32 *) malloc(sizeof(u32) * 3 * triangle_count);
+
+    // second pass: positions, then the fans of the faces
+    s64 stride = ply_item_size(vertices, vertex_data, data_end, swap);
+    s64 offsets[3] = {};
+    for(s32 axis = 0 ; axis < 3 ; axis++){
+        for(s32 k = 0 ; k < position[axis] ; k++) offsets[axis] += PLY_TYPE_SIZE[vertices->types[k]];
+    }
+    for(s64 v = 0 ; v < vertices->count ; v++){
+        const u8 * item = vertex_data + v * stride;
+        for(s32 axis = 0 ; axis < 3 ; axis++){
+            mesh->positions[3 * v + axis] = (r32) read_ply_value(item + offsets[axis], vertices->types[position[axis]], swap);
+        }
+    }
+
+    s64 triangle = 0;
+    p = face_data;
+    for(s64 f = 0 ; f < faces->count ; f++){
+        const u8 * q = p;
+        for(s32 k = 0 ; k < indices ; k++) q += ply_property_size(faces, k, q, swap);
+        s64 n = (s64) read_ply_value(q, faces->list_counts[indices], swap);
+        q += PLY_TYPE_SIZE[faces->list_counts[indices]];
+
+        s32 size = PLY_TYPE_SIZE[faces->types[indices]];
+        for(s64 c = 2 ; c < n ; c++){
+            s64 corner[3] = {
+                (s64) read_ply_value(q, faces->types[indices], swap), 
+                (s64) read_ply_value(q + (c - 1) * size, faces->types[indices], swap), 
+                (s64) read_ply_value(q + c * size, faces->types[indices], swap)};
+            u32 * tri = &mesh->triangles[3 * triangle++];
+            for(s32 k = 0 ; k < 3 ; k++){
+                if (corner[k] < 0 || corner[k] >= vertices->count) return "bad face index";
+                tri[k] = (u32) corner[k];
+            }
+        }
+        p += ply_item_size(faces, p, data_end, swap);
+    }
+    return NULL;
+}
+
+// the mesh in an obj or binary ply file, moved by offset after scaling. NULL on success
+// or what went wrong
+const char * load_mesh(mesh_t * mesh, const char * file, const point3 & offset, r64 scale, u32 material){
+    *mesh = {};
+    mapped_file_t mapped;
+    if (!map_file(&mapped, file)) return strerror(errno);
+
+    r64 start = get_time_seconds();
+    bool ply = mapped.size >= 4 && !memcmp(mapped.data, "ply\n", 4);
+    const char * error = ply ? load_ply(mesh, &mapped) : load_obj(mesh, &mapped);
+    unmap_file(&mapped);
+    if (error) {
+        destroy_mesh(mesh);
+        return error;
+    }
+    r64 parsed = get_time_seconds();
+
+    for(s64 i = 0 ; i < 3 * (s64) mesh->vertex_count ; i++){
+        mesh->positions[i] = (r32)(mesh->positions[i] * scale + offset.data[i % 3]);
+    }
+    build_mesh_bvh(mesh);
+
+    mesh->material = material;
+    mesh->offset = offset;
+    mesh->scale = scale;
+    char * absolute = realpath(file, NULL);
+    mesh->file = absolute ? absolute : strdup(file);
+
+    u64 bytes = (u64) mesh->vertex_count * 3 * sizeof(r32) + (u64) mesh->triangle_count * 3 * sizeof(u32) + 
+        (u64) mesh->bvh.node_count * sizeof(bvh_node_t);
+    fprintf(stderr, "mesh: %s, %d triangles, %d vertices, parsed in %.2f s, bvh in %.2f s, %.1f MB\n", 
+        file, mesh->triangle_count, mesh->vertex_count, parsed - start, get_time_seconds() - parsed, bytes / (1024.0 * 1024.0));
+    return NULL;
 }